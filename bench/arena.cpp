@@ -0,0 +1,122 @@
+#include "arena.hpp"
+#include "kompute.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Many small storage buffers as GL buffers of their own against ranges of a BufferArena:
+// allocation churn, then one submission that fills every buffer. Each buffer is read back and
+// checked (a word out of place fails), and the arena reports how fragmented the churn left it.
+
+static const std::string src = R"(
+#version 430 core
+layout (local_size_x = LOCAL_SIZE_X) in;
+layout(binding = 0) writeonly buffer Out { uint OutData[]; };
+uniform uint value;
+void main() {
+    KOMPUTE_GUARD();
+    OutData[gl_GlobalInvocationID.x] = value + gl_GlobalInvocationID.x;
+}
+)";
+
+using Clock = std::chrono::steady_clock;
+
+int main(int argc, char** argv) {
+    Kompute k(argc > 1 ? argv[1] : "/dev/dri/renderD128");
+    int count = argc > 2 ? std::stoi(argv[2]) : 2000;
+    int rounds = argc > 3 ? std::stoi(argv[3]) : 20;
+
+    // Sizes of a few hundred bytes to a few hundred kilobytes
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> words(16, 64 << 10);
+    std::vector<size_t> sizes(count);
+    for (auto& size : sizes) {
+        size = size_t(words(rng)) * sizeof(uint32_t);
+    }
+
+    KomputeKernel kernel(src, Defines{ { "LOCAL_SIZE_X", "256" } });
+    ReadbackPool readbacks;
+    bool ok = true;
+
+    BufferArena arena;
+    for (bool use_arena : { false, true }) {
+        const char* name = use_arena ? "arena" : "own buffers";
+        std::vector<std::shared_ptr<Buff>> buffers(count);
+
+        for (int i = 0; i < count; i++) {
+            buffers[i] = make_storage(use_arena ? &arena : nullptr, sizes[i]);
+        }
+        // Then half of them are replaced every round
+        glFinish();
+        auto tp = Clock::now();
+        for (int round = 0; round < rounds; round++) {
+            for (int i = round % 2; i < count; i += 2) {
+                buffers[i].reset();
+                buffers[i] = make_storage(use_arena ? &arena : nullptr, sizes[i]);
+            }
+        }
+        glFinish();
+        double churn = std::chrono::duration<double, std::micro>(Clock::now() - tp).count();
+
+        // Parameters are baked into the list, so each buffer gets its own block
+        std::vector<std::unique_ptr<ParamBlock>> blocks;
+        CommandList list;
+        for (int i = 0; i < count; i++) {
+            auto& block = *blocks.emplace_back(std::make_unique<ParamBlock>(kernel));
+            block.set(block.param<uint32_t>("value"), uint32_t(i) << 20);
+            const std::array<std::shared_ptr<Buff>, 1> bound = { buffers[i] };
+            list.dispatch_threads(kernel, block, bound, int(sizes[i] / 4));
+        }
+        glFinish();
+        tp = Clock::now();
+        k.submit(list);
+        glFinish();
+        double submit = std::chrono::duration<double, std::milli>(Clock::now() - tp).count();
+
+        size_t wrong = 0;
+        std::vector<uint32_t> host;
+        for (int i = 0; i < count; i++) {
+            host.resize(sizes[i] / 4);
+            readbacks.read(*buffers[i], std::as_writable_bytes(std::span(host))).wait();
+            for (size_t j = 0; j < host.size(); j++) {
+                wrong += host[j] != (uint32_t(i) << 20) + uint32_t(j);
+            }
+        }
+
+        std::cout << name << ": " << churn / (rounds * count / 2) << " us per allocation, "
+                  << submit << " ms to fill " << count << " buffers, " << wrong
+                  << " words wrong" << std::endl;
+        ok &= wrong == 0;
+        if (use_arena) {
+            auto s = arena.stats();
+            std::cout << "  " << s.allocations << " allocations, " << s.allocated / 1024
+                      << " KiB of " << s.reserved / 1024 << " KiB in " << s.blocks
+                      << " GL buffers, " << s.free_ranges << " free ranges, fragmentation "
+                      << s.fragmentation() << std::endl;
+        }
+    }
+
+    // Per-frame temporaries: bump allocation, rewound every frame. The first frame reserves.
+    glFinish();
+    auto tp = Clock::now();
+    for (int round = 0; round <= rounds; round++) {
+        if (round == 1) {
+            tp = Clock::now();
+        }
+        for (int i = 0; i < count; i++) {
+            arena.scratch(sizes[i]);
+        }
+        arena.reset_scratch();
+    }
+    double scratch = std::chrono::duration<double, std::micro>(Clock::now() - tp).count();
+    std::cout << "scratch: " << scratch / (rounds * count) << " us per allocation, "
+              << arena.stats().scratch_capacity / 1024 << " KiB reserved" << std::endl;
+
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+#include "components.hpp"
+#include "kompute.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Bounding boxes of a motion mask: reading the float mask back and running cv::findContours +
+// cv::boundingRect on the CPU, against labelling on the GPU and reading back only the boxes.
+// Masks are random rectangles, rings (to exercise nesting) and speckle; every iteration checks
+// that both paths find the same set of boxes.
+
+using Clock = std::chrono::steady_clock;
+using Rect = std::tuple<int, int, int, int>;
+
+static double time_ms(const std::function<void()>& f) {
+    auto tp = Clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(Clock::now() - tp).count();
+}
+
+static cv::Mat random_mask(int width, int height, std::mt19937& rng) {
+    cv::Mat mask = cv::Mat::zeros(height, width, CV_32FC1);
+    std::uniform_int_distribution<int> x(0, width - 1);
+    std::uniform_int_distribution<int> y(0, height - 1);
+    std::uniform_int_distribution<int> size(2, std::max(3, width / 10));
+    for (int i = 0; i < 40; i++) {
+        cv::Rect r(x(rng), y(rng), size(rng), size(rng));
+        if (i % 4 == 0) {
+            cv::rectangle(mask, r, cv::Scalar(255), 2);
+        } else {
+            cv::rectangle(mask, r, cv::Scalar(170), cv::FILLED);
+        }
+    }
+    for (int i = 0; i < width * height / 500; i++) {
+        mask.at<float>(y(rng), x(rng)) = 85;
+    }
+    return mask;
+}
+
+int main(int argc, char** argv) {
+    Kompute k(argc > 1 ? argv[1] : "/dev/dri/renderD128");
+    int width = argc > 2 ? std::stoi(argv[2]) : 1920;
+    int height = argc > 3 ? std::stoi(argv[3]) : 1080;
+    int iters = argc > 4 ? std::stoi(argv[4]) : 20;
+
+    std::mt19937 rng(1);
+    Components components(width, height, 4096);
+    BoxList boxes(4096);
+    ReadbackPool pool;
+    auto mask = std::make_shared<StorageBuff<float>>();
+    CommandList list;
+    components.record(list, mask);
+
+    std::cout << width << "x" << height << ", " << iters << " iterations" << std::endl;
+
+    int mismatches = 0;
+    double cpu_ms = 0;
+    double gpu_ms = 0;
+    for (int i = 0; i < iters; i++) {
+        cv::Mat m = random_mask(width, height, rng);
+        mask->set_data(std::span<const float>(m.ptr<float>(), m.total()));
+        glFinish();
+
+        std::vector<Rect> expected;
+        cv::Mat host(height, width, CV_32FC1);
+        cpu_ms += time_ms([&] {
+            mask->get_data(pool, std::span<float>(host.ptr<float>(), host.total())).wait();
+            cv::Mat binary;
+            host.convertTo(binary, CV_8UC1);
+            std::vector<std::vector<cv::Point>> contours;
+            cv::findContours(binary, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+            expected.clear();
+            for (const auto& contour : contours) {
+                cv::Rect r = cv::boundingRect(contour);
+                expected.emplace_back(r.x, r.y, r.width, r.height);
+            }
+        });
+
+        gpu_ms += time_ms([&] {
+            k.submit(list);
+            pool.read(components.result(), boxes.bytes()).wait();
+        });
+
+        std::vector<Rect> found;
+        for (const Box& b : boxes.boxes()) {
+            found.emplace_back(b.x, b.y, b.width, b.height);
+        }
+        std::sort(expected.begin(), expected.end());
+        std::sort(found.begin(), found.end());
+        if (found != expected || boxes.found() > boxes.capacity()) {
+            mismatches++;
+        }
+    }
+
+    std::cout << "readback + findContours: " << cpu_ms / iters << " ms, "
+              << size_t(width) * height * sizeof(float) / 1e6 << " MB read back" << std::endl;
+    std::cout << "Components: " << gpu_ms / iters << " ms, " << boxes.bytes().size() / 1e3
+              << " kB read back" << std::endl;
+    std::cout << "mismatching frames: " << mismatches << "/" << iters << std::endl;
+
+    return mismatches == 0 ? 0 : 1;
+}
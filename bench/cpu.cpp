@@ -0,0 +1,118 @@
+#include "cpu.hpp"
+#include "kompute.hpp"
+#include "motion.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Motion mask throughput of the CPU backend, scalar and SIMD, on 1..N threads, against
+// MotionDetector on the GPU when there is one. Every CPU mask is compared with the first
+// configuration's, and with the GPU's; more than a few differing pixels fails.
+
+using Clock = std::chrono::steady_clock;
+
+int main(int argc, char** argv) {
+    std::string device = argc > 1 ? argv[1] : "/dev/dri/renderD128";
+    int width = argc > 2 ? std::stoi(argv[2]) : 1920;
+    int height = argc > 3 ? std::stoi(argv[3]) : 1080;
+    int frames = argc > 4 ? std::stoi(argv[4]) : 20;
+    const size_t pixels = size_t(width) * height;
+
+    // A still background with a noisy band that moves every frame
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> noise(0.0f, 1.0f);
+    auto fill = [&](std::span<float> dst, int i) {
+        for (size_t p = 0; p < pixels; p++) {
+            int x = int(p % width);
+            int y = int(p / width);
+            bool band = (x + i * 16) % width < width / 8;
+            for (int c = 0; c < 3; c++) {
+                dst[p * 3 + c] = band ? noise(rng) : float((x / 32 + y / 32) % 4) / 4.0f;
+            }
+        }
+    };
+    std::vector<std::vector<float>> inputs(frames, std::vector<float>(pixels * 3));
+    for (int i = 0; i < frames; i++) {
+        fill(inputs[i], i);
+    }
+
+    std::cout << width << "x" << height << ", " << frames << " frames" << std::endl;
+
+    // Masks of the last frame, to compare. Pixels whose difference sits right at the threshold
+    // may round the other way on another ISA or the GPU (FMA contraction, summation order), so
+    // allow one in 10^4.
+    const size_t tolerance = pixels / 10000;
+    std::vector<float> reference;
+    bool ok = true;
+    auto report = [&](const std::string& name, double ms, const std::vector<float>& mask) {
+        size_t diff = 0;
+        if (reference.empty()) {
+            reference = mask;
+        }
+        for (size_t p = 0; p < pixels; p++) {
+            diff += mask[p] != reference[p];
+        }
+        std::cout << name << ": " << ms << " ms/frame, " << 1000.0 / ms << " fps, " << diff
+                  << " pixels differ" << std::endl;
+        ok &= diff <= tolerance;
+    };
+
+    const size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (CpuIsa isa : { CpuIsa::Scalar, detect_isa() }) {
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            ThreadPool pool(threads);
+            CpuMotionDetector detector(width, height, pool, isa);
+            std::vector<float> mask(pixels);
+            auto tp = Clock::now();
+            for (int i = 0; i < frames; i++) {
+                std::memcpy(detector.frame().data(), inputs[i].data(), pixels * 3 * sizeof(float));
+                detector.submit(std::span<float>(mask));
+            }
+            double ms = std::chrono::duration<double, std::milli>(Clock::now() - tp).count();
+            report(
+                std::string("CPU ") + to_string(isa) + ", " + std::to_string(threads) + " threads",
+                ms / frames, mask
+            );
+        }
+        if (isa == CpuIsa::Scalar && detect_isa() == CpuIsa::Scalar) {
+            break;
+        }
+    }
+
+    std::optional<Kompute> k;
+    try {
+        k.emplace(device);
+    } catch (const std::runtime_error& e) {
+        std::cout << "GPU: skipped (" << e.what() << ")" << std::endl;
+        std::cout << (ok ? "OK" : "FAILED") << std::endl;
+        return ok ? 0 : 1;
+    }
+    MotionDetector detector(*k, width, height);
+    std::vector<float> mask(pixels);
+    Readback pending;
+    auto tp = Clock::now();
+    for (int i = 0; i < frames; i++) {
+        std::memcpy(detector.frame().data(), inputs[i].data(), pixels * 3 * sizeof(float));
+        if (pending.valid()) {
+            pending.wait();
+        }
+        pending = detector.submit(std::span<float>(mask));
+    }
+    if (pending.valid()) {
+        pending.wait();
+    }
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - tp).count();
+    report("GPU", ms / frames, mask);
+
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+#include "idx.hpp"
+#include "lenet.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <unistd.h>
+}
+
+// Loading a synthetic MNIST-sized dataset: reading the whole file against mapping it, then an
+// epoch of shuffled batches through the prefetcher, then saving a model and mapping it back.
+
+using Clock = std::chrono::steady_clock;
+
+static double since(Clock::time_point tp) {
+    return std::chrono::duration<double>(Clock::now() - tp).count();
+}
+
+static void write_idx(
+    const std::filesystem::path& path, const std::vector<uint32_t>& dims,
+    const std::vector<uint8_t>& data
+) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    const char magic[] = { 0, 0, 0x08, char(dims.size()) };
+    file.write(magic, sizeof(magic));
+    for (uint32_t d : dims) {
+        const char be[] = { char(d >> 24), char(d >> 16), char(d >> 8), char(d) };
+        file.write(be, sizeof(be));
+    }
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::stoul(argv[1]) : 60000;
+    size_t batch_size = argc > 2 ? std::stoul(argv[2]) : 64;
+
+    auto dir = std::filesystem::temp_directory_path() /
+               ("kompute-dataset-" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir);
+    std::mt19937 rng(1);
+    std::vector<uint8_t> pixels(count * LeNet::input_pixels);
+    std::vector<uint8_t> labels(count);
+    std::ranges::generate(pixels, [&] { return uint8_t(rng()); });
+    std::ranges::generate(labels, [&] { return uint8_t(rng() % LeNet::classes); });
+    write_idx(dir / "images", { uint32_t(count), 28, 28 }, pixels);
+    write_idx(dir / "labels", { uint32_t(count) }, labels);
+    std::cout << count << " images, " << (pixels.size() >> 20) << " MiB" << std::endl;
+
+    bool ok = true;
+
+    // Reading copies every byte before the first can be used
+    auto tp = Clock::now();
+    {
+        FILE* fp = fopen((dir / "images").c_str(), "rb");
+        std::vector<uint8_t> data(std::filesystem::file_size(dir / "images"));
+        ok &= fread(data.data(), 1, data.size(), fp) == data.size();
+        fclose(fp);
+    }
+    std::cout << "fread: " << since(tp) * 1e3 << " ms" << std::endl;
+
+    tp = Clock::now();
+    IdxFile images(dir / "images");
+    IdxFile label_file(dir / "labels");
+    std::cout << "mmap and validate: " << since(tp) * 1e3 << " ms" << std::endl;
+    ok &= std::ranges::equal(images.data(), pixels);
+    ok &= std::ranges::equal(label_file.data(), labels);
+
+    // Consumes the batches without work of its own, so this is the producer's throughput
+    {
+        BatchPrefetcher batches(images, label_file, batch_size, 2);
+        tp = Clock::now();
+        size_t seen = 0;
+        for (size_t i = 0; i < batches.batches_per_epoch(); i++) {
+            auto& batch = batches.next();
+            seen += batch.count;
+            ok &= batch.epoch == 0;
+        }
+        double seconds = since(tp);
+        ok &= seen == count;
+        std::cout << "Shuffled epoch in batches of " << batch_size << ": " << seconds * 1e3
+                  << " ms, " << count / seconds << " images/s" << std::endl;
+    }
+
+    LeNet net;
+    net.randomize(3);
+    tp = Clock::now();
+    net.save(dir / "model");
+    std::cout << "Model save: " << since(tp) * 1e3 << " ms" << std::endl;
+    tp = Clock::now();
+    LeNet loaded(dir / "model");
+    std::cout << "Model load: " << since(tp) * 1e3 << " ms, "
+              << loaded.parameters().size_bytes() << " bytes" << std::endl;
+    ok &= std::ranges::equal(loaded.parameters(), net.parameters());
+
+    // The mapping is private: changes stay in memory
+    loaded.fc2.biases[0] = 1.0f;
+    ok &= LeNet(dir / "model").fc2.biases[0] == 0.0f;
+
+    std::filesystem::remove_all(dir);
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
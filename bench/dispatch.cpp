@@ -0,0 +1,139 @@
+#include "kompute.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Measures CPU submit cost of a dispatch: uniform upload, binding and glDispatchCompute.
+// The kernel does no work so the numbers are dominated by the submit path. The last case shows
+// what an active Profiler adds; a trace spanning more than a second must keep its timestamps to the
+// nanosecond.
+
+static const std::string src = R"(
+#version 430 core
+layout (local_size_x = 1) in;
+layout(binding = 0) buffer Out { float OutData[]; };
+uniform ivec3 dims;
+uniform float thresh;
+uniform vec2 weights;
+void main() {
+    OutData[0] = float(dims.x + dims.y + dims.z) * thresh * weights.x * weights.y;
+}
+)";
+
+// The submit path as it was before kernels reflected their uniforms: a string lookup per
+// uniform and per dispatch.
+static void dispatch_by_name(
+    KomputeKernel& kernel, const std::vector<Uniform>& uniforms,
+    const std::vector<std::shared_ptr<Buff>>& buffers
+) {
+    int idx = 0;
+    for (auto& buffer : buffers) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, idx++, buffer->ssbo);
+    }
+    glUseProgram(kernel.program);
+    for (auto& uniform : uniforms) {
+        GLint location = glGetUniformLocation(kernel.program, uniform.name.c_str());
+        if (std::holds_alternative<float>(uniform.val)) {
+            glUniform1f(location, std::get<float>(uniform.val));
+        } else if (std::holds_alternative<std::vector<float>>(uniform.val)) {
+            auto& val = std::get<std::vector<float>>(uniform.val);
+            glUniform2f(location, val[0], val[1]);
+        } else if (std::holds_alternative<std::vector<int>>(uniform.val)) {
+            auto& val = std::get<std::vector<int>>(uniform.val);
+            glUniform3i(location, val[0], val[1], val[2]);
+        }
+    }
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+template <typename F>
+static void run(const char* name, int iters, F&& f) {
+    glFinish();
+    auto tp = std::chrono::steady_clock::now();
+    for (int i = 0; i < iters; i++) {
+        f(i);
+    }
+    auto submit = std::chrono::steady_clock::now();
+    glFinish();
+    auto done = std::chrono::steady_clock::now();
+    auto ns = [](auto d) { return std::chrono::duration<double, std::nano>(d).count(); };
+    std::cout << name << ": " << ns(submit - tp) / iters << " ns/dispatch submit, "
+              << ns(done - tp) / iters << " ns/dispatch total" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    Kompute k(argc > 1 ? argv[1] : "/dev/dri/renderD128");
+    int iters = argc > 2 ? std::stoi(argv[2]) : 100000;
+
+    KomputeKernel kernel(src);
+    auto out = std::make_shared<StorageBuff<float>>();
+    out->set_size(sizeof(float));
+    const std::vector<std::shared_ptr<Buff>> buffers = { out };
+
+    run("by name (baseline)", iters, [&](int i) {
+        dispatch_by_name(
+            kernel,
+            {
+                { "dims", std::vector<int>{ 1920, 1080, i } },
+                { "thresh", 0.2f },
+                { "weights", std::vector<float>{ 0.5f, 0.5f } },
+            },
+            buffers
+        );
+    });
+
+    run("Uniform list", iters, [&](int i) {
+        k.dispatch(
+            kernel,
+            {
+                { "dims", std::vector<int>{ 1920, 1080, i } },
+                { "thresh", 0.2f },
+                { "weights", std::vector<float>{ 0.5f, 0.5f } },
+            },
+            buffers, 1
+        );
+    });
+
+    ParamBlock params(kernel);
+    auto dims = params.param<ivec3>("dims");
+    auto thresh = params.param<float>("thresh");
+    auto weights = params.param<vec2>("weights");
+    params.set(thresh, 0.2f);
+    params.set(weights, { 0.5f, 0.5f });
+
+    run("ParamBlock", iters, [&](int i) {
+        params.set(dims, { 1920, 1080, i });
+        k.dispatch(kernel, params, buffers, 1);
+    });
+
+    // Same again with a CPU span and a GPU span per dispatch
+    Profiler profiler;
+    profiler.start();
+    run("ParamBlock, profiled", iters, [&](int i) {
+        params.set(dims, { 1920, 1080, i });
+        k.dispatch(kernel, params, buffers, 1);
+    });
+    profiler.stop();
+    std::cout << profiler.recorded() << " events recorded" << std::endl;
+
+    // Two spans 1.5 s apart; the second one's start and duration are written exactly
+    Profiler trace(2);
+    TraceEvent event{ .kind = TraceKind::Submit, .start_ns = 1000000000000, .duration_ns = 1 };
+    std::strcpy(event.name, "first");
+    trace.record(event);
+    event.start_ns += 1500000001;
+    event.duration_ns = 2000000003;
+    std::strcpy(event.name, "second");
+    trace.record(event);
+    std::ostringstream json;
+    trace.write_chrome_trace(json);
+    const bool ok = json.str().find("\"ts\":1500000.001,\"dur\":2000000.003") != std::string::npos;
+
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,215 @@
+#include "arena.hpp"
+#include "graph.hpp"
+#include "kompute.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A motion-style chain as a KernelGraph: blur, edges, diff against the previous frame's edges,
+// threshold and dilate, plus a node nothing reads. Runs with and without aliasing, compares the
+// masks and reports the schedule and the memory each needs.
+
+static const std::string header = R"(
+#version 430 core
+layout (local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y) in;
+uniform ivec2 dims;
+float at(int x, int y);
+float tap(int x, int y) {
+    return at(clamp(x, 0, dims.x - 1), clamp(y, 0, dims.y - 1));
+}
+)";
+
+// 3x3 box blur, gradient magnitude and 3x3 max read one image; diff reads two
+static const std::string blur_src = header + R"(
+layout(binding = 0) readonly buffer In { float src[]; };
+layout(binding = 1) writeonly buffer Out { float dst[]; };
+float at(int x, int y) { return src[y * dims.x + x]; }
+void main() {
+    KOMPUTE_GUARD();
+    ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+    float sum = 0.0;
+    for (int dy = -1; dy <= 1; dy++)
+        for (int dx = -1; dx <= 1; dx++)
+            sum += tap(p.x + dx, p.y + dy);
+    dst[p.y * dims.x + p.x] = sum / 9.0;
+}
+)";
+
+static const std::string edges_src = header + R"(
+layout(binding = 0) readonly buffer In { float src[]; };
+layout(binding = 1) writeonly buffer Out { float dst[]; };
+float at(int x, int y) { return src[y * dims.x + x]; }
+void main() {
+    KOMPUTE_GUARD();
+    ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+    float gx = tap(p.x + 1, p.y) - tap(p.x - 1, p.y);
+    float gy = tap(p.x, p.y + 1) - tap(p.x, p.y - 1);
+    dst[p.y * dims.x + p.x] = sqrt(gx * gx + gy * gy);
+}
+)";
+
+static const std::string diff_src = header + R"(
+layout(binding = 0) readonly buffer A { float a[]; };
+layout(binding = 1) readonly buffer B { float b[]; };
+layout(binding = 2) writeonly buffer Out { float dst[]; };
+float at(int x, int y) { return 0.0; }
+void main() {
+    KOMPUTE_GUARD();
+    uint i = gl_GlobalInvocationID.y * uint(dims.x) + gl_GlobalInvocationID.x;
+    dst[i] = abs(a[i] - b[i]);
+}
+)";
+
+static const std::string copy_src = header + R"(
+layout(binding = 0) readonly buffer In { float src[]; };
+layout(binding = 1) writeonly buffer Out { float dst[]; };
+float at(int x, int y) { return 0.0; }
+void main() {
+    KOMPUTE_GUARD();
+    uint i = gl_GlobalInvocationID.y * uint(dims.x) + gl_GlobalInvocationID.x;
+    dst[i] = src[i];
+}
+)";
+
+static const std::string threshold_src = header + R"(
+layout(binding = 0) readonly buffer In { float src[]; };
+layout(binding = 1) writeonly buffer Out { float dst[]; };
+uniform float thresh;
+float at(int x, int y) { return 0.0; }
+void main() {
+    KOMPUTE_GUARD();
+    uint i = gl_GlobalInvocationID.y * uint(dims.x) + gl_GlobalInvocationID.x;
+    dst[i] = src[i] > thresh ? 1.0 : 0.0;
+}
+)";
+
+static const std::string dilate_src = header + R"(
+layout(binding = 0) readonly buffer In { float src[]; };
+layout(binding = 1) writeonly buffer Out { float dst[]; };
+float at(int x, int y) { return src[y * dims.x + x]; }
+void main() {
+    KOMPUTE_GUARD();
+    ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+    float m = 0.0;
+    for (int dy = -1; dy <= 1; dy++)
+        for (int dx = -1; dx <= 1; dx++)
+            m = max(m, tap(p.x + dx, p.y + dy));
+    dst[p.y * dims.x + p.x] = m * 255.0;
+}
+)";
+
+using Clock = std::chrono::steady_clock;
+
+int main(int argc, char** argv) {
+    Kompute k(argc > 1 ? argv[1] : "/dev/dri/renderD128");
+    int width = argc > 2 ? std::stoi(argv[2]) : 1280;
+    int height = argc > 3 ? std::stoi(argv[3]) : 720;
+    int frames = argc > 4 ? std::stoi(argv[4]) : 20;
+    const size_t pixels = size_t(width) * height;
+    const size_t bytes = pixels * sizeof(float);
+    const uvec3 image = { uint32_t(width), uint32_t(height), 1 };
+
+    const Defines local = { { "LOCAL_SIZE_X", "16" }, { "LOCAL_SIZE_Y", "16" } };
+    struct Op {
+        KomputeKernel kernel;
+        ParamBlock params;
+
+        Op(const std::string& name, const std::string& src, const Defines& defines, ivec2 dims)
+            : kernel(src, defines), params(kernel) {
+            kernel.name = name;
+            params.set(params.param<ivec2>("dims"), dims);
+        }
+    };
+    const ivec2 dims = { width, height };
+    Op blur("blur", blur_src, local, dims);
+    Op edges("edges", edges_src, local, dims);
+    Op diff("diff", diff_src, local, dims);
+    Op keep("keep", copy_src, local, dims);
+    Op threshold("threshold", threshold_src, local, dims);
+    Op dilate("dilate", dilate_src, local, dims);
+    threshold.params.set(threshold.params.param<float>("thresh"), 0.05f);
+
+    // A bright square that moves every frame
+    std::vector<float> host(pixels);
+    auto fill = [&](int i) {
+        std::fill(host.begin(), host.end(), 0.1f);
+        int x0 = (i * 16) % (width / 2);
+        for (int y = height / 4; y < height / 2; y++) {
+            std::fill_n(&host[size_t(y) * width + x0], width / 8, 0.9f);
+        }
+    };
+
+    BufferArena arena;
+    ReadbackPool readbacks;
+    std::vector<float> masks[2];
+    for (bool alias : { false, true }) {
+        auto frame = std::make_shared<StorageBuff<float>>();
+        frame->set_size(bytes);
+        auto previous = std::make_shared<StorageBuff<float>>();
+        previous->set_data(std::vector<float>(pixels, 0.0f));
+        auto mask = std::make_shared<StorageBuff<float>>();
+        mask->set_size(bytes);
+
+        // Declared out of order on purpose: keep overwrites what diff reads
+        KernelGraph g;
+        auto in = g.external("frame", frame);
+        auto prev = g.external("previous edges", previous);
+        auto out = g.external("mask", mask);
+        auto blurred = g.transient("blurred", bytes);
+        auto edge = g.transient("edges", bytes);
+        auto changed = g.transient("diff", bytes);
+        auto binary = g.transient("binary", bytes);
+        auto unused = g.transient("unused", bytes);
+        g.node("blur", blur.kernel, blur.params, { in, blurred }, image);
+        g.node("unused", blur.kernel, blur.params, { in, unused }, image);
+        g.node("edges", edges.kernel, edges.params, { blurred, edge }, image);
+        g.node("diff", diff.kernel, diff.params, { edge, prev, changed }, image);
+        g.node("keep", keep.kernel, keep.params, { edge, prev }, image);
+        g.node("threshold", threshold.kernel, threshold.params, { changed, binary }, image);
+        g.node("dilate", dilate.kernel, dilate.params, { binary, out }, image);
+        g.compile(&arena, alias);
+
+        auto& mem = g.memory();
+        std::cout << (alias ? "aliased" : "unaliased") << ": " << mem.transient_buffers
+                  << " transient buffers, " << mem.unaliased_bytes / double(1 << 20)
+                  << " MiB unaliased, " << mem.aliased_bytes / double(1 << 20) << " MiB in "
+                  << mem.slots << " slots, " << mem.peak_live_bytes / double(1 << 20)
+                  << " MiB peak live" << std::endl;
+        std::cout << "  schedule:";
+        for (auto& level : g.schedule()) {
+            std::cout << " [";
+            for (size_t i = 0; i < level.size(); i++) {
+                std::cout << (i ? " " : "") << level[i];
+            }
+            std::cout << "]";
+        }
+        std::cout << ", " << g.barriers() << " barriers" << std::endl;
+
+        auto tp = Clock::now();
+        for (int i = 0; i < frames; i++) {
+            fill(i);
+            frame->set_data(host);
+            g.run(k);
+        }
+        masks[alias].resize(pixels);
+        readbacks.read(*mask, std::as_writable_bytes(std::span(masks[alias]))).wait();
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - tp).count();
+        size_t on = std::count(masks[alias].begin(), masks[alias].end(), 255.0f);
+        std::cout << "  " << ms / frames << " ms/frame, " << on << " mask pixels set"
+                  << std::endl;
+    }
+
+    size_t diff_pixels = 0;
+    for (size_t p = 0; p < pixels; p++) {
+        diff_pixels += masks[0][p] != masks[1][p];
+    }
+    std::cout << diff_pixels << " pixels differ between the two" << std::endl;
+
+    // Aliasing a buffer that is still live corrupts the mask
+    return diff_pixels == 0 ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+#include "kompute.hpp"
+#include "lenet.hpp"
+#include "lenet_gpu.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// LeNet inference on the GPU across batch sizes, in images per second including the upload and
+// the readback of the scores. Every batch is checked against the CPU reference.
+
+using Clock = std::chrono::steady_clock;
+
+int main(int argc, char** argv) {
+    Kompute k(argc > 1 ? argv[1] : "/dev/dri/renderD128");
+    size_t largest = argc > 2 ? std::stoul(argv[2]) : 4096;
+    size_t chunk = argc > 3 ? std::stoul(argv[3]) : 256;
+
+    LeNet net;
+    net.randomize(1);
+    LeNetInference engine(net, chunk);
+
+    // Random strokes on a dark background, roughly like digits
+    std::mt19937 rng(2);
+    std::vector<float> images(largest * LeNet::input_pixels, 0.0f);
+    std::uniform_int_distribution<int> pos(4, 23);
+    for (size_t i = 0; i < largest; i++) {
+        float* image = &images[i * LeNet::input_pixels];
+        for (int stroke = 0; stroke < 60; stroke++) {
+            image[pos(rng) * LeNet::input_size + pos(rng)] = 1.0f;
+        }
+    }
+
+    // CPU reference speed, on a few images
+    const size_t reference = std::min<size_t>(largest, 256);
+    std::vector<float> expected(largest * LeNet::classes);
+    auto tp = Clock::now();
+    infer(net, std::span(images).first(reference * LeNet::input_pixels), expected);
+    double cpu = std::chrono::duration<double>(Clock::now() - tp).count();
+    std::cout << "CPU reference: " << reference / cpu << " images/s" << std::endl;
+    infer(
+        net, std::span(images).subspan(reference * LeNet::input_pixels),
+        std::span(expected).subspan(reference * LeNet::classes)
+    );
+
+    size_t failures = 0;
+    std::vector<float> scores(largest * LeNet::classes);
+    for (size_t batch = 1; batch <= largest; batch *= 4) {
+        auto in = std::span(images).first(batch * LeNet::input_pixels);
+        auto out = std::span(scores).first(batch * LeNet::classes);
+        engine.run(k, in, out);
+
+        float max_diff = 0;
+        size_t disagree = 0;
+        for (size_t i = 0; i < batch; i++) {
+            auto got = out.subspan(i * LeNet::classes, LeNet::classes);
+            auto want = std::span(expected).subspan(i * LeNet::classes, LeNet::classes);
+            for (int c = 0; c < LeNet::classes; c++) {
+                max_diff = std::max(max_diff, std::abs(got[c] - want[c]));
+            }
+            disagree += predict(got) != predict(want);
+        }
+        failures += max_diff > 1e-3f;
+
+        const int iterations = int(std::max<size_t>(1, 4096 / batch));
+        tp = Clock::now();
+        for (int i = 0; i < iterations; i++) {
+            engine.run(k, in, out);
+        }
+        double s = std::chrono::duration<double>(Clock::now() - tp).count();
+        std::cout << "batch " << batch << ": " << batch * iterations / s
+                  << " images/s, max score difference " << max_diff << ", " << disagree
+                  << " predictions differ" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
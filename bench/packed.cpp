@@ -0,0 +1,322 @@
+#include "kompute.hpp"
+#include "motion.hpp"
+#include "packed.hpp"
+
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Packed buffer elements: the error of the host conversions, the GLSL accessors against them,
+// then MotionDetector with 8-bit input, packed features and a byte mask against the all-float
+// pipeline: bytes per pixel, time per frame and the pixels whose mask differs.
+
+using Clock = std::chrono::steady_clock;
+
+static uint32_t bits(float v) {
+    return std::bit_cast<uint32_t>(v);
+}
+
+static uint32_t bits(uint8_t v) {
+    return v;
+}
+
+static uint32_t bits(Half v) {
+    return v.bits;
+}
+
+static uint32_t bits(BFloat16 v) {
+    return v.bits;
+}
+
+// Largest absolute and relative error of a round trip through T
+template <typename T>
+static std::pair<double, double> round_trip(std::span<const float> values) {
+    std::vector<T> packed(values.size());
+    std::vector<float> back(values.size());
+    pack(values, std::span(packed));
+    unpack(std::span<const T>(packed), std::span(back));
+    double max_abs = 0;
+    double max_rel = 0;
+    for (size_t i = 0; i < values.size(); i++) {
+        const double err = std::abs(double(back[i]) - values[i]);
+        max_abs = std::max(max_abs, err);
+        max_rel = std::max(max_rel, err / std::abs(values[i]));
+    }
+    return { max_abs, max_rel };
+}
+
+static const char* accessors_src = R"(#version 430 core
+
+layout (local_size_x = LOCAL_SIZE_X, local_size_y = 1, local_size_z = 1) in;
+
+layout(binding = 0) readonly buffer Packed {
+    P_ELEM PackedData[];
+};
+
+layout(binding = 1) writeonly buffer Loaded {
+    float LoadedData[];
+};
+
+layout(binding = 2) writeonly buffer Stored {
+    P_ELEM StoredData[];
+};
+
+layout(binding = 3) readonly buffer Floats {
+    float FloatData[];
+};
+
+layout(binding = 4) writeonly buffer Rounded {
+    P_ELEM RoundedData[];
+};
+
+// Four elements per invocation
+void main() {
+    KOMPUTE_GUARD();
+    const uint idx = gl_GlobalInvocationID.x;
+
+    for (uint j = 0u; j < 4u; j++) {
+        LoadedData[4u * idx + j] = P_LOAD(PackedData, 4u * idx + j);
+    }
+    P_STORE4(StoredData, idx, P_LOAD4(PackedData, idx));
+    const uint i = 4u * idx;
+    vec4 v = vec4(FloatData[i], FloatData[i + 1u], FloatData[i + 2u], FloatData[i + 3u]);
+    P_STORE4(RoundedData, idx, v);
+}
+)";
+
+// Loads must give exactly the host's conversion, and storing what was loaded the same bits;
+// storing arbitrary floats may round differently, but by one unit at most.
+template <typename T>
+static bool check_accessors(Kompute& k, std::span<const float> values) {
+    const Packing packing = PackingOf<T>::value;
+    const size_t n = values.size();
+    std::vector<T> host(n);
+    if constexpr (std::is_same_v<T, float>) {
+        host.assign(values.begin(), values.end());
+    } else {
+        pack(values, std::span(host));
+    }
+
+    auto packed = std::make_shared<StorageBuff<T>>();
+    packed->set_data(std::span<const T>(host));
+    auto loaded = std::make_shared<StorageBuff<float>>();
+    loaded->set_size(n * sizeof(float));
+    auto stored = std::make_shared<StorageBuff<T>>();
+    stored->set_size(packed_size(packing, n));
+    auto floats = std::make_shared<StorageBuff<float>>();
+    floats->set_data(values);
+    auto rounded = std::make_shared<StorageBuff<T>>();
+    rounded->set_size(packed_size(packing, n));
+
+    Defines defines = packed_accessors("P", packing);
+    defines.push_back({ "LOCAL_SIZE_X", "64" });
+    KomputeKernel kernel(std::string(accessors_src), defines);
+    ParamBlock params(kernel);
+    const std::array<std::shared_ptr<Buff>, 5> buffers = {
+        packed, loaded, stored, floats, rounded,
+    };
+    k.dispatch_threads(kernel, params, buffers, int(n / 4));
+
+    auto gpu_loaded = loaded->get_data();
+    auto gpu_stored = stored->get_data();
+    auto gpu_rounded = rounded->get_data();
+    size_t load_errors = 0;
+    size_t store_errors = 0;
+    size_t off_by_one = 0;
+    size_t rounding_errors = 0;
+    for (size_t i = 0; i < n; i++) {
+        float expected = 0;
+        if constexpr (std::is_same_v<T, float>) {
+            expected = host[i];
+        } else {
+            unpack(std::span<const T>(&host[i], 1), std::span(&expected, 1));
+        }
+        load_errors += bits(gpu_loaded[i]) != bits(expected);
+        store_errors += bits(gpu_stored[i]) != bits(host[i]);
+        const uint32_t a = bits(gpu_rounded[i]);
+        const uint32_t b = bits(host[i]);
+        off_by_one += a != b;
+        rounding_errors += (a > b ? a - b : b - a) > 1;
+    }
+    std::cout << to_string(packing) << " accessors: " << load_errors << " load, " << store_errors
+              << " store errors; " << off_by_one << " of " << n
+              << " stores rounded differently from the host, " << rounding_errors
+              << " by more than one unit" << std::endl;
+    return load_errors == 0 && store_errors == 0 && rounding_errors == 0;
+}
+
+int main(int argc, char** argv) {
+    Kompute k(argc > 1 ? argv[1] : "/dev/dri/renderD128");
+    int width = argc > 2 ? std::stoi(argv[2]) : 1280;
+    int height = argc > 3 ? std::stoi(argv[3]) : 720;
+    int frames = argc > 4 ? std::stoi(argv[4]) : 20;
+    const size_t pixels = size_t(width) * height;
+    bool ok = true;
+
+    // Host conversions: pixel values in [0, 1], and magnitudes from 1e-3 to 1e3 of either sign
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::uniform_real_distribution<float> exponent(-3.0f, 3.0f);
+    std::vector<float> pixel_values(1 << 20);
+    std::vector<float> wide_values(1 << 20);
+    for (size_t i = 0; i < pixel_values.size(); i++) {
+        pixel_values[i] = std::max(unit(rng), 1e-6f);
+        wide_values[i] = std::pow(10.0f, exponent(rng)) * (rng() % 2 ? 1.0f : -1.0f);
+    }
+    auto [unorm_abs, unorm_rel] = round_trip<uint8_t>(pixel_values);
+    auto [half_abs, half_rel] = round_trip<Half>(wide_values);
+    auto [bf16_abs, bf16_rel] = round_trip<BFloat16>(wide_values);
+    std::cout << "unorm8: max error " << unorm_abs << " on [0, 1]" << std::endl;
+    std::cout << "fp16: max relative error " << half_rel << std::endl;
+    std::cout << "bf16: max relative error " << bf16_rel << std::endl;
+    ok &= unorm_abs <= 0.5 / 255 + 1e-7;
+    ok &= half_rel <= std::ldexp(1.0, -11);
+    ok &= bf16_rel <= std::ldexp(1.0, -8);
+
+    // Rounding edges: the largest half, overflow, subnormals, ties to even, NaN
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    ok &= to_half(65504.0f).bits == 0x7bff && to_half(65520.0f).bits == 0x7c00;
+    ok &= to_half(1.0f).bits == 0x3c00 && to_float(Half{ 1 }) == std::ldexp(1.0f, -24);
+    ok &= to_half(std::ldexp(1.5f, -24)).bits == 2 && to_half(std::ldexp(2.5f, -24)).bits == 2;
+    ok &= to_bfloat16(1.0f + std::ldexp(1.0f, -8)).bits == 0x3f80;
+    ok &= std::isnan(to_float(to_half(nan))) && std::isnan(to_float(to_bfloat16(nan)));
+    ok &= to_unorm8(nan) == 0 && to_unorm8(-1.0f) == 0 && to_unorm8(2.0f) == 255;
+
+    // Buffers round up to whole words
+    {
+        StorageBuff<uint8_t> odd;
+        odd.set_data(std::span<const float>(pixel_values).first(3));
+        ok &= odd.size == 4 && odd.get_floats().size() == 4;
+    }
+
+    // Values around the rounding steps of every type, and some that are exact in all of them
+    std::vector<float> accessor_values(4096);
+    for (size_t i = 0; i < accessor_values.size(); i++) {
+        accessor_values[i] = i % 8 == 0 ? float(i % 256) / 255.0f : unit(rng);
+    }
+    ok &= check_accessors<float>(k, accessor_values);
+    ok &= check_accessors<uint8_t>(k, accessor_values);
+    ok &= check_accessors<Half>(k, accessor_values);
+    ok &= check_accessors<BFloat16>(k, accessor_values);
+
+    // A still background with a noisy band that moves every frame, as 8-bit BGR
+    std::vector<std::vector<uint8_t>> inputs(frames, std::vector<uint8_t>(pixels * 3));
+    for (int i = 0; i < frames; i++) {
+        for (size_t p = 0; p < pixels; p++) {
+            int x = int(p % width);
+            int y = int(p / width);
+            bool band = (x + i * 16) % width < width / 8;
+            for (int c = 0; c < 3; c++) {
+                inputs[i][p * 3 + c] = band ? uint8_t(rng()) : uint8_t((x / 32 + y / 32) % 4 * 64);
+            }
+        }
+    }
+    std::vector<std::vector<float>> float_inputs(frames, std::vector<float>(pixels * 3));
+    for (int i = 0; i < frames; i++) {
+        for (size_t j = 0; j < pixels * 3; j++) {
+            float_inputs[i][j] = unorm8_to_float(inputs[i][j]);
+        }
+    }
+
+    struct Config {
+        const char* name;
+        PixelFormat input;
+        MotionOptions options;
+    };
+    const Config configs[] = {
+        { "float32", PixelFormat::BGR, {} },
+        { "bgr8, float32 features, unorm8 mask", PixelFormat::BGR8,
+          { Packing::Float32, Packing::Unorm8 } },
+        { "bgr8, fp16 features, unorm8 mask", PixelFormat::BGR8,
+          { Packing::Half, Packing::Unorm8 } },
+        { "bgr8, bf16 features, unorm8 mask", PixelFormat::BGR8,
+          { Packing::BFloat16, Packing::Unorm8 } },
+    };
+
+    std::cout << width << "x" << height << ", " << frames << " frames" << std::endl;
+    // Every frame's mask of the all-float pipeline
+    std::vector<std::vector<uint8_t>> reference;
+    double reference_ms = 0;
+    for (const Config& config : configs) {
+        MotionDetector detector(
+            k, width, height, config.input, nullptr, nullptr, nullptr, ".", config.options
+        );
+        const bool bytes_in = config.input == PixelFormat::BGR8;
+        const bool bytes_out = config.options.mask == Packing::Unorm8;
+        std::vector<float> float_mask(pixels);
+        std::vector<uint8_t> byte_mask(pixels);
+        auto upload = [&](int i) {
+            if (bytes_in) {
+                std::memcpy(detector.frame_bgr8().data(), inputs[i].data(), pixels * 3);
+            } else {
+                std::memcpy(detector.frame().data(), float_inputs[i].data(), pixels * 3 * 4);
+            }
+        };
+        auto submit = [&] {
+            return bytes_out ? detector.submit(std::span(byte_mask))
+                             : detector.submit(std::span(float_mask));
+        };
+
+        // Timed with one readback in flight, as in main.cpp
+        Readback pending;
+        auto tp = Clock::now();
+        for (int i = 0; i < frames; i++) {
+            upload(i);
+            if (pending.valid()) {
+                pending.wait();
+            }
+            pending = submit();
+        }
+        if (pending.valid()) {
+            pending.wait();
+        }
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - tp).count() / frames;
+
+        // Then every mask against the reference's; the timed frames gave each a history
+        size_t differ = 0;
+        for (int i = 0; i < frames; i++) {
+            upload(i);
+            submit().wait();
+            std::vector<uint8_t> mask(pixels);
+            for (size_t p = 0; p < pixels; p++) {
+                mask[p] = bytes_out ? byte_mask[p] : uint8_t(float_mask[p]);
+            }
+            if (reference.size() < size_t(frames)) {
+                reference.push_back(std::move(mask));
+            } else {
+                for (size_t p = 0; p < pixels; p++) {
+                    differ += mask[p] != reference[i][p];
+                }
+            }
+        }
+        if (reference_ms == 0) {
+            reference_ms = ms;
+        }
+
+        // Per pixel: the upload, written and read by the feature pass, the history, written once
+        // and read twice, and the mask, written and read back
+        const double upload_bytes = double(detector.upload_size()) / pixels;
+        const double history_bytes = 4.0 * element_bytes(config.options.features);
+        const double mask_bytes = double(element_bytes(config.options.mask));
+        const double traffic = 2 * upload_bytes + 3 * history_bytes + 2 * mask_bytes;
+        const double mismatch = double(differ) / (pixels * frames);
+        std::cout << config.name << ": " << upload_bytes << " B/px upload, " << history_bytes
+                  << " B/px per history buffer, " << mask_bytes << " B/px mask, " << traffic
+                  << " B/px moved per frame; " << ms << " ms/frame (" << reference_ms / ms
+                  << "x); " << differ << " mask pixels differ (" << mismatch * 100 << "%)"
+                  << std::endl;
+        // fp16 and bf16 only flip pixels whose difference is within rounding of the threshold
+        ok &= mismatch <= (config.options.features == Packing::Float32 ? 1e-5 : 1e-2);
+    }
+
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,185 @@
+#include "kompute.hpp"
+#include "primitives.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Reduce, scan, histogram and compaction across input sizes: every result is checked against
+// the CPU, then each primitive is timed and reported as input bandwidth.
+
+using Clock = std::chrono::steady_clock;
+
+template <typename T>
+static std::shared_ptr<StorageBuff<T>> upload(const std::vector<T>& data) {
+    auto buffer = std::make_shared<StorageBuff<T>>();
+    buffer->set_data(data);
+    return buffer;
+}
+
+template <typename F>
+static double gbps(size_t bytes, int iterations, F&& f) {
+    f();
+    glFinish();
+    auto tp = Clock::now();
+    for (int i = 0; i < iterations; i++) {
+        f();
+    }
+    glFinish();
+    double s = std::chrono::duration<double>(Clock::now() - tp).count();
+    return bytes * double(iterations) / s / 1e9;
+}
+
+int main(int argc, char** argv) {
+    Kompute k(argc > 1 ? argv[1] : "/dev/dri/renderD128");
+    size_t largest = argc > 2 ? std::stoul(argv[2]) : size_t(1) << 22;
+    int iterations = argc > 3 ? std::stoi(argv[3]) : 10;
+    std::cout << (has_subgroup_arithmetic() ? "subgroup" : "shared memory") << " path"
+              << std::endl;
+
+    std::vector<size_t> sizes = { 1, 1000, 2048, 2049, 100000, 1 << 20, 1920 * 1080, 1 << 22 };
+    sizes.erase(
+        std::remove_if(sizes.begin(), sizes.end(), [&](size_t n) { return n > largest; }),
+        sizes.end()
+    );
+    if (sizes.empty() || sizes.back() != largest) {
+        sizes.push_back(largest);
+    }
+
+    Reduce<float> sum(largest);
+    Reduce<float> maximum(largest, ReduceOp::Max);
+    Reduce<int32_t> minimum(largest, ReduceOp::Min);
+    Reduce<uint32_t> count(largest);
+    Scan<uint32_t> exclusive(largest);
+    Scan<uint32_t> inclusive(largest, true);
+    Scan<float> running_max(largest, true, ReduceOp::Max);
+    Histogram<float> histogram(256, 0.0f, 1.0f);
+    Compact<float> compact(largest);
+    ReadbackPool readbacks;
+
+    std::mt19937 rng(1);
+    size_t failures = 0;
+    auto check = [&](bool ok, const char* what, size_t n) {
+        if (!ok) {
+            std::cout << "  " << what << " wrong for " << n << " elements" << std::endl;
+            failures++;
+        }
+    };
+
+    for (size_t n : sizes) {
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::uniform_int_distribution<int32_t> small(-1000, 1000);
+        std::uniform_int_distribution<uint32_t> digit(0, 15);
+        std::vector<float> floats(n);
+        std::vector<int32_t> ints(n);
+        std::vector<uint32_t> uints(n);
+        for (size_t i = 0; i < n; i++) {
+            floats[i] = unit(rng);
+            ints[i] = small(rng);
+            uints[i] = digit(rng);
+        }
+        auto fbuf = upload(floats);
+        auto ibuf = upload(ints);
+        auto ubuf = upload(uints);
+        auto scanned = std::make_shared<StorageBuff<uint32_t>>();
+        scanned->set_size(n * sizeof(uint32_t));
+        auto fscanned = std::make_shared<StorageBuff<float>>();
+        fscanned->set_size(n * sizeof(float));
+
+        // Reductions: float sums differ from a sequential sum only by rounding
+        double expected_sum = 0;
+        for (float f : floats) {
+            expected_sum += f;
+        }
+        check(std::abs(sum.run(k, fbuf, n) - expected_sum) <= 1e-5 * n, "float sum", n);
+        check(
+            maximum.run(k, fbuf, n) == *std::max_element(floats.begin(), floats.end()),
+            "float max", n
+        );
+        check(
+            minimum.run(k, ibuf, n) == *std::min_element(ints.begin(), ints.end()), "int min", n
+        );
+        uint32_t expected_count = 0;
+        for (uint32_t u : uints) {
+            expected_count += u;
+        }
+        check(count.run(k, ubuf, n) == expected_count, "uint sum", n);
+
+        // Scans
+        std::vector<uint32_t> host(n);
+        std::vector<uint32_t> expected(n);
+        exclusive.run(k, ubuf, scanned, n);
+        readbacks.read(*scanned, std::as_writable_bytes(std::span(host))).wait();
+        uint32_t run = 0;
+        for (size_t i = 0; i < n; i++) {
+            expected[i] = run;
+            run += uints[i];
+        }
+        check(host == expected, "exclusive scan", n);
+        inclusive.run(k, ubuf, scanned, n);
+        readbacks.read(*scanned, std::as_writable_bytes(std::span(host))).wait();
+        for (size_t i = 0; i < n; i++) {
+            expected[i] += uints[i];
+        }
+        check(host == expected, "inclusive scan", n);
+        std::vector<float> fhost(n);
+        std::vector<float> fexpected(n);
+        running_max.run(k, fbuf, fscanned, n);
+        readbacks.read(*fscanned, std::as_writable_bytes(std::span(fhost))).wait();
+        float m = floats[0];
+        for (size_t i = 0; i < n; i++) {
+            m = std::max(m, floats[i]);
+            fexpected[i] = m;
+        }
+        check(fhost == fexpected, "running max", n);
+
+        // Histogram, binned the way the kernel does
+        std::vector<uint32_t> bins(256);
+        for (float f : floats) {
+            float x = (f - 0.0f) * (256.0f / 1.0f);
+            if (x >= 0.0f && x < 256.0f) {
+                bins[uint32_t(x)]++;
+            }
+        }
+        check(histogram.run(k, fbuf, n) == bins, "histogram", n);
+
+        // Compaction
+        auto kept = compact.run(k, fbuf, n, 0.5f);
+        std::vector<float> values;
+        std::vector<uint32_t> indices;
+        for (size_t i = 0; i < n; i++) {
+            if (floats[i] > 0.5f) {
+                values.push_back(floats[i]);
+                indices.push_back(uint32_t(i));
+            }
+        }
+        check(kept.values == values && kept.indices == indices, "compaction", n);
+
+        // Throughput, by bytes of input
+        const size_t bytes = n * sizeof(float);
+        CommandList list;
+        auto timed = [&](auto&& record) {
+            return gbps(bytes, iterations, [&] {
+                list.clear();
+                record(list);
+                k.submit(list);
+            });
+        };
+        double reduce_rate = timed([&](CommandList& l) { sum.record(l, fbuf, n); });
+        double scan_rate = timed([&](CommandList& l) { exclusive.record(l, ubuf, scanned, n); });
+        double histogram_rate = timed([&](CommandList& l) { histogram.record(l, fbuf, n); });
+        double compact_rate = timed([&](CommandList& l) { compact.record(l, fbuf, n, 0.5f); });
+        std::cout << n << " elements: reduce " << reduce_rate << " GB/s, scan " << scan_rate
+                  << " GB/s, histogram " << histogram_rate << " GB/s, compact " << compact_rate
+                  << " GB/s" << std::endl;
+    }
+
+    std::cout << failures << " checks failed" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,49 @@
+#include "kompute.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+// Kernel startup cost with and without the program binary cache. Mesa only hands out program
+// binaries while its own shader cache is enabled, so there the source-compile figure already
+// benefits from the driver cache once it is warm.
+
+using Clock = std::chrono::steady_clock;
+
+static double ms(Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+int main(int argc, char** argv) {
+    Kompute k(argc > 1 ? argv[1] : "/dev/dri/renderD128");
+    std::filesystem::path kernel = argc > 2 ? argv[2] : "kernel.glsl";
+    int iters = argc > 3 ? std::stoi(argv[3]) : 20;
+
+    auto dir = std::filesystem::temp_directory_path() / "kompute_bench_cache";
+    std::filesystem::remove_all(dir);
+    ProgramCache cache(dir);
+
+    auto tp = Clock::now();
+    for (int i = 0; i < iters; i++) {
+        KomputeKernel kern(kernel);
+    }
+    std::cout << "source compile: " << ms(Clock::now() - tp) / iters << " ms/kernel" << std::endl;
+
+    tp = Clock::now();
+    { KomputeKernel kern(kernel, &cache); }
+    std::cout << "cache miss + store: " << ms(Clock::now() - tp) << " ms" << std::endl;
+
+    tp = Clock::now();
+    for (int i = 0; i < iters; i++) {
+        KomputeKernel kern(kernel, &cache);
+    }
+    std::cout << "cache hit: " << ms(Clock::now() - tp) / iters << " ms/kernel" << std::endl;
+
+    auto& stats = cache.stats();
+    std::cout << "hits " << stats.hits << ", misses " << stats.misses << ", rejected "
+              << stats.rejected << ", stores " << stats.stores << std::endl;
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
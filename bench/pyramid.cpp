@@ -0,0 +1,187 @@
+#include "kompute.hpp"
+#include "motion.hpp"
+#include "packed.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Coarse-to-fine motion detection against the full-resolution path, on a still textured
+// background with blobs of several sizes moving across it: time per frame, tiles refined at full
+// resolution, the moving pixels of the full-resolution mask that are found, and how well the
+// boxes match (the mean over full-resolution boxes of the best intersection over union).
+
+using Clock = std::chrono::steady_clock;
+
+static double iou(const Box& a, const Box& b) {
+    const int x0 = std::max(a.x, b.x);
+    const int y0 = std::max(a.y, b.y);
+    const int x1 = std::min(a.x + a.width, b.x + b.width);
+    const int y1 = std::min(a.y + a.height, b.y + b.height);
+    if (x1 <= x0 || y1 <= y0) {
+        return 0;
+    }
+    const double overlap = double(x1 - x0) * (y1 - y0);
+    return overlap / (double(a.width) * a.height + double(b.width) * b.height - overlap);
+}
+
+int main(int argc, char** argv) {
+    Kompute k(argc > 1 ? argv[1] : "/dev/dri/renderD128");
+    int width = argc > 2 ? std::stoi(argv[2]) : 1920;
+    int height = argc > 3 ? std::stoi(argv[3]) : 1080;
+    int frames = argc > 4 ? std::stoi(argv[4]) : 20;
+    const size_t pixels = size_t(width) * height;
+    const int tiles_x = (width + MotionDetector::tile_size - 1) / MotionDetector::tile_size;
+    const int tiles_y = (height + MotionDetector::tile_size - 1) / MotionDetector::tile_size;
+    const size_t tiles = size_t(tiles_x) * tiles_y;
+    bool ok = true;
+
+    std::mt19937 rng(1);
+    std::vector<uint8_t> background(pixels * 3);
+    for (size_t p = 0; p < pixels; p++) {
+        int x = int(p % width);
+        int y = int(p / width);
+        for (int c = 0; c < 3; c++) {
+            background[p * 3 + c] = uint8_t((x / 32 + y / 32 + c) % 4 * 32 + rng() % 16);
+        }
+    }
+    // Blobs as fractions of the frame height, moving right by a number of pixels per frame
+    struct Blob {
+        double x, y, size;
+        int speed;
+        uint8_t colour;
+    };
+    const Blob blobs[] = {
+        { 0.05, 0.1, 0.3, 12, 250 },
+        { 0.3, 0.5, 0.15, 8, 200 },
+        { 0.6, 0.2, 0.05, 6, 230 },
+        { 0.1, 0.8, 0.01, 4, 255 },
+    };
+    std::vector<std::vector<uint8_t>> inputs(frames, background);
+    for (int i = 0; i < frames; i++) {
+        for (const Blob& blob : blobs) {
+            const int side = std::max(int(blob.size * height), 2);
+            const int x0 = int(blob.x * width) + i * blob.speed;
+            const int y0 = int(blob.y * height);
+            for (int y = y0; y < std::min(y0 + side, height); y++) {
+                for (int x = x0; x < std::min(x0 + side, width); x++) {
+                    for (int c = 0; c < 3; c++) {
+                        inputs[i][(size_t(y) * width + x) * 3 + c] = blob.colour;
+                    }
+                }
+            }
+        }
+    }
+
+    struct Config {
+        int level;
+        int margin;
+    };
+    const Config configs[] = {
+        { 0, 0 }, { 1, 16 }, { 2, 16 }, { 3, 16 }, { 2, 0 }, { 2, 32 },
+    };
+
+    std::cout << width << "x" << height << ", " << frames << " frames, " << tiles << " tiles"
+              << std::endl;
+    // Every frame's mask and boxes at full resolution
+    std::vector<uint8_t> reference;
+    std::vector<std::vector<Box>> reference_boxes;
+    double full_ms = 0;
+    for (const Config& config : configs) {
+        MotionOptions options{
+            .mask = Packing::Unorm8,
+            .pyramid_level = config.level,
+            .refine_margin = config.margin,
+        };
+        MotionDetector detector(
+            k, width, height, PixelFormat::BGR8, nullptr, nullptr, nullptr, ".", options
+        );
+        auto upload = [&](int i) {
+            std::memcpy(detector.frame_bgr8().data(), inputs[i].data(), pixels * 3);
+        };
+
+        // Timed with one readback of boxes in flight, as in main.cpp
+        BoxList boxes;
+        Readback pending;
+        auto tp = Clock::now();
+        for (int i = 0; i < frames; i++) {
+            upload(i);
+            if (pending.valid()) {
+                pending.wait();
+            }
+            pending = detector.submit(boxes);
+        }
+        if (pending.valid()) {
+            pending.wait();
+        }
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - tp).count() / frames;
+        if (config.level == 0) {
+            full_ms = ms;
+        }
+
+        // Then every frame again for its mask and tile count, and again for its boxes; the
+        // timed frames gave the first one a history
+        std::vector<uint8_t> mask(pixels);
+        ReadbackPool counts;
+        uint32_t count = 0;
+        size_t tiles_run = 0;
+        size_t moving = 0;
+        size_t found = 0;
+        size_t spurious = 0;
+        for (int i = 0; i < frames; i++) {
+            upload(i);
+            detector.submit(std::span(mask)).wait();
+            if (config.level == 0) {
+                reference.insert(reference.end(), mask.begin(), mask.end());
+                continue;
+            }
+            counts.read(detector.tiles(), std::as_writable_bytes(std::span(&count, 1))).wait();
+            tiles_run += count;
+            for (size_t p = 0; p < pixels; p++) {
+                const bool expected = reference[i * pixels + p] != 0;
+                moving += expected;
+                found += expected && mask[p] != 0;
+                spurious += !expected && mask[p] != 0;
+            }
+        }
+        double box_iou = 0;
+        size_t box_count = 0;
+        for (int i = 0; i < frames; i++) {
+            upload(i);
+            detector.submit(boxes).wait();
+            std::vector<Box> found_boxes(boxes.boxes().begin(), boxes.boxes().end());
+            if (config.level == 0) {
+                reference_boxes.push_back(found_boxes);
+                continue;
+            }
+            for (const Box& expected : reference_boxes[i]) {
+                double best = 0;
+                for (const Box& box : found_boxes) {
+                    best = std::max(best, iou(expected, box));
+                }
+                box_iou += best;
+                box_count++;
+            }
+        }
+
+        if (config.level == 0) {
+            std::cout << "full resolution: " << ms << " ms/frame" << std::endl;
+            continue;
+        }
+        std::cout << "level " << config.level << ", margin " << config.margin << ": " << ms
+                  << " ms/frame (" << full_ms / ms << "x), " << double(tiles_run) / frames
+                  << " of " << tiles << " tiles refined, " << double(found) / moving * 100
+                  << "% of moving pixels found, " << spurious << " spurious, box IoU "
+                  << box_iou / std::max(box_count, size_t(1)) << std::endl;
+        // Inside the refined tiles the mask is the full-resolution one
+        ok &= spurious == 0;
+    }
+
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
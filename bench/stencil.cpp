@@ -0,0 +1,100 @@
+#include "kompute.hpp"
+#include "stencil.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <string>
+
+// Throughput of the tiled stencils against OpenCV on the CPU, and the largest absolute
+// difference between the two, on random 3-channel float images. Fails when a filter is further
+// off than its tolerance.
+
+using Clock = std::chrono::steady_clock;
+
+static double time_ms(int iters, const std::function<void()>& f) {
+    f();
+    auto tp = Clock::now();
+    for (int i = 0; i < iters; i++) {
+        f();
+    }
+    return std::chrono::duration<double, std::milli>(Clock::now() - tp).count() / iters;
+}
+
+int main(int argc, char** argv) {
+    Kompute k(argc > 1 ? argv[1] : "/dev/dri/renderD128");
+    int iters = argc > 2 ? std::stoi(argv[2]) : 10;
+    bool ok = true;
+
+    const float sigma = 1.0f;
+    cv::Mat gauss1d = cv::getGaussianKernel(5, sigma, CV_32F);
+    cv::Mat gauss2d = gauss1d * gauss1d.t();
+    std::vector<float> gauss_weights(gauss2d.begin<float>(), gauss2d.end<float>());
+
+    struct Filter {
+        std::string name;
+        Stencil stencil;
+        std::function<void(const cv::Mat&, cv::Mat&)> reference;
+        // Largest absolute error allowed: float rounding of a different summation order
+        double tolerance = 1e-4;
+    };
+    std::vector<Filter> filters;
+    filters.push_back({ "gaussian 5x5 (separable)", Stencil::gaussian(2, sigma, 3),
+                        [&](const cv::Mat& src, cv::Mat& dst) {
+                            cv::GaussianBlur(
+                                src, dst, cv::Size(5, 5), sigma, sigma, cv::BORDER_REPLICATE
+                            );
+                        } });
+    filters.push_back({ "gaussian 5x5 (2D)", Stencil::convolution(5, gauss_weights, 3),
+                        [&](const cv::Mat& src, cv::Mat& dst) {
+                            cv::filter2D(
+                                src, dst, -1, gauss2d, cv::Point(-1, -1), 0, cv::BORDER_REPLICATE
+                            );
+                        } });
+    filters.push_back({ "box 7x7", Stencil::box(3, 3), [](const cv::Mat& src, cv::Mat& dst) {
+                           cv::blur(src, dst, cv::Size(7, 7), cv::Point(-1, -1),
+                                    cv::BORDER_REPLICATE);
+                       } });
+    filters.push_back({ "sobel magnitude", Stencil::sobel(1), [](const cv::Mat& src, cv::Mat& dst) {
+                           cv::Mat gx, gy;
+                           cv::Sobel(src, gx, CV_32F, 1, 0, 3, 1, 0, cv::BORDER_REPLICATE);
+                           cv::Sobel(src, gy, CV_32F, 0, 1, 3, 1, 0, cv::BORDER_REPLICATE);
+                           cv::magnitude(gx, gy, dst);
+                       } });
+
+    const std::pair<int, int> sizes[] = { { 640, 480 }, { 1920, 1080 }, { 3840, 2160 } };
+    for (auto [width, height] : sizes) {
+        for (auto& f : filters) {
+            cv::Mat src(height, width, f.stencil.channels() == 3 ? CV_32FC3 : CV_32FC1);
+            cv::randu(src, 0.0f, 1.0f);
+            cv::Mat expected;
+            cv::Mat result(height, width, f.stencil.out_channels() == 3 ? CV_32FC3 : CV_32FC1);
+
+            auto in = std::make_shared<StorageBuff<float>>();
+            auto out = std::make_shared<StorageBuff<float>>();
+            in->set_data({ src.ptr<float>(), src.total() * src.channels() });
+            out->set_size(result.total() * result.channels() * sizeof(float));
+
+            double gpu = time_ms(iters, [&] {
+                f.stencil.run(k, in, out, width, height);
+                glFinish();
+            });
+            double cpu = time_ms(iters, [&] { f.reference(src, expected); });
+
+            auto data = out->get_data();
+            std::memcpy(result.data, data.data(), data.size() * sizeof(float));
+            double err = cv::norm(result, expected, cv::NORM_INF);
+
+            std::cout << width << "x" << height << " " << f.name << ": gpu " << gpu << " ms ("
+                      << width * height / gpu / 1e3 << " Mpx/s), opencv " << cpu
+                      << " ms, max abs error " << err << std::endl;
+            ok &= err <= f.tolerance;
+        }
+    }
+
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+#include "kompute.hpp"
+#include "motion.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Aggregate throughput of N motion detectors sharing one device: each stream submitting on its
+// own, against one batched submission per round holding a frame from every stream. Frames are
+// synthetic YUV420P, so this measures the GPU side only.
+
+using Clock = std::chrono::steady_clock;
+
+int main(int argc, char** argv) {
+    Kompute k(argc > 1 ? argv[1] : "/dev/dri/renderD128");
+    int width = argc > 2 ? std::stoi(argv[2]) : 640;
+    int height = argc > 3 ? std::stoi(argv[3]) : 480;
+    int frames = argc > 4 ? std::stoi(argv[4]) : 50;
+    int max_streams = argc > 5 ? std::stoi(argv[5]) : 8;
+
+    std::vector<uint8_t> y(size_t(width) * height, 60);
+    std::vector<uint8_t> uv(size_t(width / 2) * (height / 2), 128);
+    const uint8_t* planes[3] = { y.data(), uv.data(), uv.data() };
+    const int linesize[3] = { width, width / 2, width / 2 };
+    auto next_frame = [&](int i) {
+        std::memset(y.data(), 60, y.size());
+        for (int row = height / 4; row < height / 2; row++) {
+            std::memset(&y[size_t(row) * width + (i * 8) % (width / 2)], 220, width / 8);
+        }
+    };
+
+    std::cout << width << "x" << height << " YUV420P, " << frames << " frames per stream"
+              << std::endl;
+
+    for (int n = 1; n <= max_streams; n *= 2) {
+        std::vector<std::unique_ptr<MotionDetector>> detectors;
+        std::vector<BoxList> boxes(n);
+        for (int s = 0; s < n; s++) {
+            detectors.push_back(
+                std::make_unique<MotionDetector>(k, width, height, PixelFormat::YUV420P)
+            );
+        }
+
+        auto run = [&](bool batched) {
+            std::vector<CommandList*> batch;
+            std::vector<Readback> pending(n);
+            glFinish();
+            auto start = Clock::now();
+            for (int i = 0; i < frames; i++) {
+                next_frame(i);
+                batch.clear();
+                for (int s = 0; s < n; s++) {
+                    if (pending[s].valid()) {
+                        pending[s].wait();
+                    }
+                    detectors[s]->frame(planes, linesize);
+                    if (batched) {
+                        detectors[s]->record(batch, boxes[s]);
+                    } else {
+                        pending[s] = detectors[s]->submit(boxes[s]);
+                    }
+                }
+                if (batched) {
+                    k.submit(batch);
+                    for (int s = 0; s < n; s++) {
+                        pending[s] = detectors[s]->read(boxes[s]);
+                    }
+                }
+            }
+            for (auto& p : pending) {
+                if (p.valid()) {
+                    p.wait();
+                }
+            }
+            double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            return double(n) * frames / seconds;
+        };
+
+        double separate = run(false);
+        double batched = run(true);
+        std::cout << n << " streams: " << separate << " fps separate, " << batched
+                  << " fps batched" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,300 @@
+#include "components.hpp"
+#include "kompute.hpp"
+#include "yuv.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Every stage of the motion pipeline on its own, swept over frame sizes, plus raw upload and
+// readback swept over buffer sizes. Results are written as JSON or CSV so runs can be compared
+// across versions:
+//
+//     bench_suite surfaceless json results.json
+//
+// Wall times bracket each iteration with glFinish, so they include the GPU work. Dispatches are
+// also timed on the GPU: `gpu_elapsed_ms` from GL_TIME_ELAPSED, `gpu_span_ms` between
+// GL_TIMESTAMPs around the commands. llvmpipe reports ~0 for the former, the latter works there.
+
+#ifndef KOMPUTE_VERSION
+#define KOMPUTE_VERSION "unknown"
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+static const double none = std::numeric_limits<double>::quiet_NaN();
+
+struct Result {
+    std::string bench;
+    std::string stage;
+    int width = 0;
+    int height = 0;
+    size_t bytes = 0;
+    int iterations = 0;
+    double wall_ms = 0;
+    double wall_min_ms = 0;
+    double gpu_elapsed_ms = none;
+    double gpu_span_ms = none;
+};
+
+// Times one warm-up and `iters` runs of `f`; with `gpu`, GPU timers wrap the commands it issues.
+static Result measure(int iters, bool gpu, const std::function<void()>& f) {
+    f();
+    glFinish();
+
+    Result r;
+    r.iterations = iters;
+    r.wall_min_ms = std::numeric_limits<double>::max();
+    std::vector<GpuTimer> timers(gpu ? iters : 0);
+    for (int i = 0; i < iters; i++) {
+        auto tp = Clock::now();
+        if (gpu) {
+            timers[i].begin();
+        }
+        f();
+        if (gpu) {
+            timers[i].end();
+        }
+        glFinish();
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - tp).count();
+        r.wall_ms += ms / iters;
+        r.wall_min_ms = std::min(r.wall_min_ms, ms);
+    }
+    if (gpu) {
+        r.gpu_elapsed_ms = 0;
+        r.gpu_span_ms = 0;
+        for (auto& timer : timers) {
+            r.gpu_elapsed_ms += timer.elapsed_ms() / iters;
+            r.gpu_span_ms += timer.span_ms() / iters;
+        }
+    }
+    GL_CHECK_ERROR();
+    return r;
+}
+
+static std::string json_number(double v) {
+    return std::isnan(v) ? "null" : std::to_string(v);
+}
+
+static void write_json(std::ostream& os, const std::string& renderer, std::span<Result> results) {
+    os << "{\n  \"version\": \"" << KOMPUTE_VERSION << "\",\n  \"renderer\": \"" << renderer
+       << "\",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        os << (i ? ",\n" : "\n") << "    { \"bench\": \"" << r.bench << "\", \"stage\": \""
+           << r.stage << "\", \"width\": " << r.width << ", \"height\": " << r.height
+           << ", \"bytes\": " << r.bytes << ", \"iterations\": " << r.iterations
+           << ", \"wall_ms\": " << json_number(r.wall_ms)
+           << ", \"wall_min_ms\": " << json_number(r.wall_min_ms)
+           << ", \"gpu_elapsed_ms\": " << json_number(r.gpu_elapsed_ms)
+           << ", \"gpu_span_ms\": " << json_number(r.gpu_span_ms) << " }";
+    }
+    os << "\n  ]\n}\n";
+}
+
+static void write_csv(std::ostream& os, const std::string& renderer, std::span<Result> results) {
+    os << "version,renderer,bench,stage,width,height,bytes,iterations,wall_ms,wall_min_ms,"
+          "gpu_elapsed_ms,gpu_span_ms\n";
+    auto number = [](double v) { return std::isnan(v) ? std::string() : std::to_string(v); };
+    for (const Result& r : results) {
+        os << KOMPUTE_VERSION << ",\"" << renderer << "\"," << r.bench << "," << r.stage << ","
+           << r.width << "," << r.height << "," << r.bytes << "," << r.iterations << ","
+           << number(r.wall_ms) << "," << number(r.wall_min_ms) << ","
+           << number(r.gpu_elapsed_ms) << "," << number(r.gpu_span_ms) << "\n";
+    }
+}
+
+// Frame stages: BGR and YUV upload, YUV conversion, the two motion kernels, mask readback, and
+// the boxes of the mask on the CPU (readback + findContours) and on the GPU (Components)
+static void bench_frame(
+    Kompute& k, int width, int height, int iters, const std::filesystem::path& kernels,
+    std::vector<Result>& results
+) {
+    const size_t pixels = size_t(width) * height;
+    auto add = [&](const std::string& stage, size_t bytes, Result r) {
+        r.bench = "frame";
+        r.stage = stage;
+        r.width = width;
+        r.height = height;
+        r.bytes = bytes;
+        results.push_back(r);
+        std::cerr << width << "x" << height << " " << stage << ": " << r.wall_ms << " ms"
+                  << std::endl;
+    };
+
+    // A still background with a bright band that moves between the two frames
+    std::vector<float> frames[2];
+    for (int f = 0; f < 2; f++) {
+        frames[f].resize(pixels * 3);
+        for (size_t p = 0; p < pixels; p++) {
+            int x = int(p % width);
+            bool band = (x + f * width / 16) % width < width / 8;
+            std::fill_n(&frames[f][p * 3], 3, band ? 0.9f : float(x % 64) / 256.0f);
+        }
+    }
+    std::vector<uint8_t> luma(pixels, 60);
+    std::vector<uint8_t> chroma(size_t((width + 1) / 2) * ((height + 1) / 2), 128);
+    const uint8_t* planes[3] = { luma.data(), chroma.data(), chroma.data() };
+    const int linesize[3] = { width, (width + 1) / 2, (width + 1) / 2 };
+
+    // motion.glsl takes four pixels per invocation
+    const size_t padded = (pixels + 3) & ~size_t(3);
+    auto in = std::make_shared<RingBuff<float>>();
+    std::array<std::shared_ptr<StorageBuff<float>>, 2> history;
+    for (auto& h : history) {
+        h = std::make_shared<StorageBuff<float>>();
+        h->set_size(padded * 4 * sizeof(float));
+    }
+    auto mask = std::make_shared<StorageBuff<float>>();
+    mask->set_size(padded * sizeof(float));
+
+    int f = 0;
+    add("upload_bgr", pixels * 3 * sizeof(float), measure(iters, false, [&] {
+            in->set_data(frames[f++ % 2]);
+        }));
+
+    YuvConverter yuv(width, height, PixelFormat::YUV420P);
+    add("upload_yuv", yuv.frame_size(), measure(iters, false, [&] {
+            yuv.upload(planes, linesize);
+        }));
+    auto bgr = std::make_shared<StorageBuff<float>>();
+    bgr->set_size(pixels * 3 * sizeof(float));
+    CommandList convert;
+    yuv.record(convert, bgr);
+    add("yuv_convert", pixels * 3 * sizeof(float), measure(iters, true, [&] {
+            k.submit(convert);
+        }));
+
+    KomputeKernel features(
+        kernels / "features.glsl", Defines{ { "LOCAL_SIZE_X", "16" }, { "LOCAL_SIZE_Y", "16" } }
+    );
+    KomputeKernel motion(kernels / "motion.glsl", Defines{ { "LOCAL_SIZE_X", "256" } });
+    ParamBlock features_params(features);
+    features_params.set(features_params.param<ivec3>("dims"), { width, height, 3 });
+    ParamBlock motion_params(motion);
+    motion_params.set(motion_params.param<float>("thresh"), 0.2f);
+
+    // Features of both frames, so the motion pass has something to find
+    for (int i = 0; i < 2; i++) {
+        in->set_data(frames[i]);
+        const std::array<std::shared_ptr<Buff>, 2> buffers = { in, history[i] };
+        k.dispatch_threads(features, features_params, buffers, width, height);
+    }
+    const std::array<std::shared_ptr<Buff>, 2> feature_buffers = { in, history[0] };
+    add("features", pixels * 3 * sizeof(float), measure(iters, true, [&] {
+            k.dispatch_threads(features, features_params, feature_buffers, width, height);
+        }));
+    in->set_data(frames[0]);
+    k.dispatch_threads(features, features_params, feature_buffers, width, height);
+    const std::array<std::shared_ptr<Buff>, 3> motion_buffers = { history[1], history[0], mask };
+    add("motion", pixels * 4 * 2 * sizeof(float), measure(iters, true, [&] {
+            k.dispatch_threads(motion, motion_params, motion_buffers, int(padded / 4));
+        }));
+
+    ReadbackPool readbacks;
+    cv::Mat host(height, width, CV_32FC1);
+    std::span<float> host_span(host.ptr<float>(), pixels);
+    add("readback_mask", pixels * sizeof(float), measure(iters, false, [&] {
+            mask->get_data(readbacks, host_span).wait();
+        }));
+
+    add("contours_cpu", pixels * sizeof(float), measure(iters, false, [&] {
+            mask->get_data(readbacks, host_span).wait();
+            cv::Mat binary;
+            host.convertTo(binary, CV_8UC1);
+            std::vector<std::vector<cv::Point>> contours;
+            cv::findContours(binary, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+            for (const auto& contour : contours) {
+                cv::boundingRect(contour);
+            }
+        }));
+
+    Components components(width, height);
+    BoxList boxes;
+    CommandList label;
+    components.record(label, mask);
+    add("contours_gpu", boxes.bytes().size(), measure(iters, true, [&] {
+            k.submit(label);
+            readbacks.read(components.result(), boxes.bytes()).wait();
+        }));
+}
+
+// Raw transfers of `bytes`: into a persistently mapped ring, through glBufferData, and back
+// through a ReadbackPool
+static void bench_buffer(Kompute& k, size_t bytes, int iters, std::vector<Result>& results) {
+    auto add = [&](const std::string& stage, Result r) {
+        r.bench = "buffer";
+        r.stage = stage;
+        r.bytes = bytes;
+        results.push_back(r);
+        std::cerr << bytes << " B " << stage << ": " << r.wall_ms << " ms" << std::endl;
+    };
+
+    std::vector<std::byte> host(bytes, std::byte{ 1 });
+    auto ring = std::make_shared<RingBuff<std::byte>>();
+    add("upload_ring", measure(iters, false, [&] { ring->set_data(host); }));
+
+    auto storage = std::make_shared<StorageBuff<std::byte>>();
+    add("upload_buffer_data", measure(iters, false, [&] {
+            storage->set_data(host, GL_STREAM_DRAW);
+        }));
+
+    ReadbackPool readbacks;
+    add("readback", measure(iters, true, [&] { readbacks.read(*storage, host).wait(); }));
+}
+
+int main(int argc, char** argv) {
+    std::string device = argc > 1 ? argv[1] : "/dev/dri/renderD128";
+    std::string format = argc > 2 ? argv[2] : "json";
+    std::string path = argc > 3 ? argv[3] : "-";
+    int iters = argc > 4 ? std::stoi(argv[4]) : 10;
+    std::filesystem::path kernels = argc > 5 ? argv[5] : ".";
+    if (format != "json" && format != "csv") {
+        std::cerr << "usage: " << argv[0]
+                  << " [device] [json|csv] [output, - for stdout] [iterations] [kernel dir]"
+                  << std::endl;
+        return 1;
+    }
+
+    Kompute k(device);
+    std::string renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+
+    std::vector<Result> results;
+    for (auto [width, height] : { std::pair{ 320, 240 }, { 640, 480 }, { 1280, 720 },
+                                  { 1920, 1080 } }) {
+        bench_frame(k, width, height, iters, kernels, results);
+    }
+    for (size_t bytes = 64 << 10; bytes <= 64 << 20; bytes *= 4) {
+        bench_buffer(k, bytes, iters, results);
+    }
+
+    std::ofstream file;
+    if (path != "-") {
+        file.open(path);
+        if (!file) {
+            std::cerr << "Cannot open " << path << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& os = path != "-" ? file : std::cout;
+    if (format == "json") {
+        write_json(os, renderer, results);
+    } else {
+        write_csv(os, renderer, results);
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "kompute.hpp"
+#include "motion.hpp"
+#include "packed.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Dirty tiles on mostly static footage: a bit-identical textured background with a noisy square
+// sweeping across it, for a range of square sizes. MotionDetector runs over every pixel, then
+// only over the tiles that changed: time per frame, tiles the passes ran over, and the pixels
+// whose mask differs between the two.
+
+using Clock = std::chrono::steady_clock;
+
+int main(int argc, char** argv) {
+    Kompute k(argc > 1 ? argv[1] : "/dev/dri/renderD128");
+    int width = argc > 2 ? std::stoi(argv[2]) : 1280;
+    int height = argc > 3 ? std::stoi(argv[3]) : 720;
+    int frames = argc > 4 ? std::stoi(argv[4]) : 20;
+    const size_t pixels = size_t(width) * height;
+    const int tiles_x = (width + MotionDetector::tile_size - 1) / MotionDetector::tile_size;
+    const int tiles_y = (height + MotionDetector::tile_size - 1) / MotionDetector::tile_size;
+    const size_t tiles = size_t(tiles_x) * tiles_y;
+    bool ok = true;
+
+    std::mt19937 rng(1);
+    std::vector<uint8_t> background(pixels * 3);
+    for (size_t p = 0; p < pixels; p++) {
+        int x = int(p % width);
+        int y = int(p / width);
+        for (int c = 0; c < 3; c++) {
+            background[p * 3 + c] = uint8_t((x / 32 + y / 32 + c) % 4 * 64 + rng() % 16);
+        }
+    }
+
+    std::cout << width << "x" << height << ", " << frames << " frames, " << tiles << " tiles of "
+              << MotionDetector::tile_size << "x" << MotionDetector::tile_size << std::endl;
+    // Fraction of the frame the square covers
+    for (double area : { 0.0, 0.01, 0.1, 0.5, 1.0 }) {
+        const int side = std::min(int(std::sqrt(area * pixels)), std::min(width, height));
+        std::vector<std::vector<uint8_t>> inputs(frames, background);
+        for (int i = 0; i < frames; i++) {
+            const int x0 = side == 0 ? 0 : i * 8 % (width - side + 1);
+            const int y0 = (height - side) / 2;
+            for (int y = y0; y < y0 + side; y++) {
+                for (int x = x0; x < x0 + side; x++) {
+                    for (int c = 0; c < 3; c++) {
+                        inputs[i][(size_t(y) * width + x) * 3 + c] = uint8_t(rng());
+                    }
+                }
+            }
+        }
+
+        // Every frame's mask over all pixels
+        std::vector<uint8_t> reference;
+        double full_ms = 0;
+        for (bool dirty_tiles : { false, true }) {
+            MotionOptions options{ .mask = Packing::Unorm8, .dirty_tiles = dirty_tiles };
+            MotionDetector detector(
+                k, width, height, PixelFormat::BGR8, nullptr, nullptr, nullptr, ".", options
+            );
+            std::vector<uint8_t> mask(pixels);
+            auto upload = [&](int i) {
+                std::memcpy(detector.frame_bgr8().data(), inputs[i].data(), pixels * 3);
+            };
+
+            // Timed with one readback in flight, as in main.cpp
+            Readback pending;
+            auto tp = Clock::now();
+            for (int i = 0; i < frames; i++) {
+                upload(i);
+                if (pending.valid()) {
+                    pending.wait();
+                }
+                pending = detector.submit(std::span(mask));
+            }
+            if (pending.valid()) {
+                pending.wait();
+            }
+            double ms =
+                std::chrono::duration<double, std::milli>(Clock::now() - tp).count() / frames;
+
+            // Then every frame again, for its mask and tile count; the timed frames gave the
+            // first one a history
+            ReadbackPool counts;
+            uint32_t count = 0;
+            size_t tiles_run = 0;
+            size_t differ = 0;
+            for (int i = 0; i < frames; i++) {
+                upload(i);
+                detector.submit(std::span(mask)).wait();
+                if (!dirty_tiles) {
+                    reference.insert(reference.end(), mask.begin(), mask.end());
+                    continue;
+                }
+                counts.read(detector.tiles(), std::as_writable_bytes(std::span(&count, 1))).wait();
+                tiles_run += count;
+                for (size_t p = 0; p < pixels; p++) {
+                    differ += mask[p] != reference[i * pixels + p];
+                }
+            }
+            if (!dirty_tiles) {
+                full_ms = ms;
+            }
+            std::cout << "moving " << area * 100 << "%, " << (dirty_tiles ? "dirty" : "full")
+                      << " tiles: " << ms << " ms/frame (" << full_ms / ms << "x)";
+            if (dirty_tiles) {
+                std::cout << ", " << double(tiles_run) / frames << " of " << tiles
+                          << " tiles per frame, " << differ << " mask pixels differ";
+                ok &= differ == 0;
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
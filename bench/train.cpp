@@ -0,0 +1,119 @@
+#include "cpu.hpp"
+#include "lenet.hpp"
+#include "lenet_train.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Epoch time of LeNet training on the CPU, scalar and SIMD, on 1..N threads. The images are
+// synthetic: ten random stroke patterns, one per class, shifted and with noise, so the loss must
+// fall within the epoch. Every configuration starts from the same weights.
+
+using Clock = std::chrono::steady_clock;
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::stoul(argv[1]) : 60000;
+    size_t batch = argc > 2 ? std::stoul(argv[2]) : 64;
+    float learning_rate = argc > 3 ? std::stof(argv[3]) : 0.05f;
+
+    std::mt19937 rng(1);
+    std::vector<std::vector<float>> patterns(LeNet::classes);
+    std::uniform_int_distribution<int> pos(6, 21);
+    for (auto& pattern : patterns) {
+        pattern.assign(LeNet::input_pixels, 0.0f);
+        for (int stroke = 0; stroke < 40; stroke++) {
+            pattern[pos(rng) * LeNet::input_size + pos(rng)] = 1.0f;
+        }
+    }
+    std::vector<float> images(count * LeNet::input_pixels);
+    std::vector<uint8_t> labels(count);
+    std::uniform_int_distribution<int> shift(-2, 2);
+    std::uniform_real_distribution<float> noise(0.0f, 0.3f);
+    for (size_t i = 0; i < count; i++) {
+        labels[i] = uint8_t(rng() % LeNet::classes);
+        const int dx = shift(rng);
+        const int dy = shift(rng);
+        float* image = &images[i * LeNet::input_pixels];
+        for (int y = 0; y < LeNet::input_size; y++) {
+            for (int x = 0; x < LeNet::input_size; x++) {
+                const int sx = std::clamp(x + dx, 0, LeNet::input_size - 1);
+                const int sy = std::clamp(y + dy, 0, LeNet::input_size - 1);
+                const float v = patterns[labels[i]][sy * LeNet::input_size + sx];
+                image[y * LeNet::input_size + x] = std::min(1.0f, v + noise(rng));
+            }
+        }
+    }
+
+    LeNet initial;
+    initial.randomize(2);
+
+    // The trainer's predictions before its first update are the reference's
+    size_t expected_correct = 0;
+    {
+        const size_t first = std::min(batch, count);
+        std::vector<float> scores(first * LeNet::classes);
+        infer(initial, std::span(images).first(first * LeNet::input_pixels), scores);
+        for (size_t i = 0; i < first; i++) {
+            auto s = std::span(scores).subspan(i * LeNet::classes, LeNet::classes);
+            expected_correct += predict(s) == labels[i];
+        }
+    }
+
+    std::cout << count << " images in batches of " << batch << std::endl;
+    bool ok = true;
+    double scalar = 0;
+    const size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (CpuIsa isa : { CpuIsa::Scalar, detect_isa() }) {
+        double single = 0;
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            ThreadPool pool(threads);
+            LeNet net = initial;
+            LeNetTrainer trainer(net, pool, isa);
+            double first_loss = 0;
+            double last_loss = 0;
+            size_t correct = 0;
+            const size_t batches = (count + batch - 1) / batch;
+            auto tp = Clock::now();
+            for (size_t b = 0; b < batches; b++) {
+                const size_t n = std::min(batch, count - b * batch);
+                auto in = std::span(images).subspan(
+                    b * batch * LeNet::input_pixels, n * LeNet::input_pixels
+                );
+                auto in_labels = std::span(labels).subspan(b * batch, n);
+                float loss = trainer.step(in, in_labels, learning_rate);
+                if (b == 0) {
+                    first_loss = loss;
+                    ok &= trainer.correct() == expected_correct;
+                }
+                // The last tenth of the epoch
+                if (b >= batches - std::max<size_t>(batches / 10, 1)) {
+                    last_loss += loss * n;
+                    correct += trainer.correct();
+                }
+            }
+            double seconds = std::chrono::duration<double>(Clock::now() - tp).count();
+            if (single == 0) {
+                single = seconds;
+            }
+            if (scalar == 0) {
+                scalar = seconds;
+            }
+            const size_t tail = count - (batches - std::max<size_t>(batches / 10, 1)) * batch;
+            last_loss /= tail;
+            ok &= last_loss < first_loss;
+            std::cout << to_string(isa) << ", " << threads << " threads: epoch " << seconds
+                      << " s, " << count / seconds << " images/s, " << single / seconds
+                      << "x 1 thread, " << scalar / seconds << "x scalar; loss " << first_loss
+                      << " -> " << last_loss << ", " << 100.0 * correct / tail
+                      << "% right at the end" << std::endl;
+        }
+    }
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
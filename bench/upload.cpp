@@ -0,0 +1,85 @@
+#include "kompute.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Per-frame upload cost of a 3-channel float frame: glBufferData reallocation (StorageBuff),
+// persistent-mapped ring slots (RingBuff) and a plain memcpy as the floor. Each frame is consumed
+// by a small dispatch so the ring's fences are exercised.
+
+static const std::string src = R"(
+#version 430 core
+layout (local_size_x = 64) in;
+layout(binding = 0) readonly buffer In { float InData[]; };
+layout(binding = 1) buffer Out { float OutData[]; };
+void main() {
+    OutData[gl_GlobalInvocationID.x] = InData[gl_GlobalInvocationID.x * 1024u];
+}
+)";
+
+using Clock = std::chrono::steady_clock;
+
+static double ms(Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+int main(int argc, char** argv) {
+    Kompute k(argc > 1 ? argv[1] : "/dev/dri/renderD128");
+    int width = argc > 2 ? std::stoi(argv[2]) : 1920;
+    int height = argc > 3 ? std::stoi(argv[3]) : 1080;
+    int frames = argc > 4 ? std::stoi(argv[4]) : 100;
+
+    const size_t count = size_t(width) * height * 3;
+    const int groups = static_cast<int>(count / 1024 / 64);
+    std::vector<float> frame(count, 0.5f);
+    std::vector<float> host(count);
+
+    KomputeKernel kernel(src);
+    ParamBlock params(kernel);
+    auto out = std::make_shared<StorageBuff<float>>();
+    out->set_size(groups * 64 * sizeof(float));
+
+    std::cout << width << "x" << height << "x3 float, " << count * sizeof(float) / 1e6
+              << " MB/frame, " << frames << " frames" << std::endl;
+
+    auto run = [&](const char* name, std::shared_ptr<Buff> in, auto&& upload) {
+        const std::array<std::shared_ptr<Buff>, 2> buffers = { in, out };
+        Clock::duration spent{};
+        glFinish();
+        auto start = Clock::now();
+        for (int i = 0; i < frames; i++) {
+            frame[0] = float(i);
+            auto tp = Clock::now();
+            upload();
+            spent += Clock::now() - tp;
+            k.dispatch(kernel, params, buffers, groups);
+        }
+        glFinish();
+        std::cout << name << ": " << ms(spent) / frames << " ms/frame upload, "
+                  << ms(Clock::now() - start) / frames << " ms/frame total" << std::endl;
+    };
+
+    {
+        Clock::duration spent{};
+        for (int i = 0; i < frames; i++) {
+            auto tp = Clock::now();
+            std::memcpy(host.data(), frame.data(), count * sizeof(float));
+            spent += Clock::now() - tp;
+        }
+        std::cout << "memcpy: " << ms(spent) / frames << " ms/frame" << std::endl;
+    }
+
+    auto storage = std::make_shared<StorageBuff<float>>();
+    run("StorageBuff::set_data", storage, [&] { storage->set_data(frame, GL_STREAM_DRAW); });
+
+    for (size_t slots : { 1, 2, 3 }) {
+        auto ring = std::make_shared<RingBuff<float>>(slots);
+        auto name = "RingBuff<" + std::to_string(slots) + ">::set_data";
+        run(name.c_str(), ring, [&] { ring->set_data(frame); });
+    }
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "kompute.hpp"
+#include "yuv.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <opencv2/core.hpp>
+#include <random>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+// YUV420P ingestion: swscale to BGR24 plus a float conversion on the CPU (what main.cpp used to
+// do for every frame) against uploading the raw planes and converting on the GPU. Reports the
+// per-frame time, bytes handed to the GPU and the difference between the two outputs.
+
+using Clock = std::chrono::steady_clock;
+
+static double ms(Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+int main(int argc, char** argv) {
+    Kompute k(argc > 1 ? argv[1] : "/dev/dri/renderD128");
+    int width = argc > 2 ? std::stoi(argv[2]) : 1920;
+    int height = argc > 3 ? std::stoi(argv[3]) : 1080;
+    int frames = argc > 4 ? std::stoi(argv[4]) : 100;
+
+    const size_t pixels = size_t(width) * height;
+    const int chroma_width = (width + 1) / 2;
+    const int chroma_height = (height + 1) / 2;
+
+    // Smooth luma and chroma gradients with a little noise, like a decoded camera frame
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> noise(-4, 4);
+    std::vector<uint8_t> y(pixels);
+    std::vector<uint8_t> u(size_t(chroma_width) * chroma_height);
+    std::vector<uint8_t> v(u.size());
+    for (int row = 0; row < height; row++) {
+        for (int col = 0; col < width; col++) {
+            int level = 16 + (col + row) * 219 / (width + height) + noise(rng);
+            y[size_t(row) * width + col] = std::clamp(level, 16, 235);
+        }
+    }
+    for (int row = 0; row < chroma_height; row++) {
+        for (int col = 0; col < chroma_width; col++) {
+            u[size_t(row) * chroma_width + col] = 16 + col * 224 / chroma_width;
+            v[size_t(row) * chroma_width + col] = 16 + row * 224 / chroma_height;
+        }
+    }
+    const uint8_t* planes[3] = { y.data(), u.data(), v.data() };
+    const int linesize[3] = { width, chroma_width, chroma_width };
+
+    std::cout << width << "x" << height << " YUV420P, " << frames << " frames" << std::endl;
+
+    // CPU: swscale + convertTo, then the float upload the detector needs
+    cv::Mat bgr(height, width, CV_8UC3);
+    cv::Mat reference(height, width, CV_32FC3);
+    SwsContext* sws = sws_getContext(
+        width, height, AV_PIX_FMT_YUV420P, width, height, AV_PIX_FMT_BGR24, SWS_BILINEAR, nullptr,
+        nullptr, nullptr
+    );
+    if (!sws) {
+        throw std::runtime_error("Could not initialize the sws context");
+    }
+    RingBuff<float> upload;
+    {
+        uint8_t* dst[4] = { bgr.data, nullptr, nullptr, nullptr };
+        int dst_linesize[4] = { static_cast<int>(bgr.step[0]), 0, 0, 0 };
+        auto tp = Clock::now();
+        for (int i = 0; i < frames; i++) {
+            sws_scale(sws, planes, linesize, 0, height, dst, dst_linesize);
+            cv::Mat mapped(height, width, CV_32FC3, upload.next(pixels * 3).data());
+            bgr.convertTo(mapped, CV_32FC3, 1.0 / 255.0);
+        }
+        glFinish();
+        std::cout << "sws_scale + convertTo: " << ms(Clock::now() - tp) / frames << " ms/frame, "
+                  << pixels * 3 * sizeof(float) / 1e6 << " MB uploaded/frame" << std::endl;
+        bgr.convertTo(reference, CV_32FC3, 1.0 / 255.0);
+    }
+    sws_freeContext(sws);
+
+    // GPU: upload the planes, convert in a shader
+    YuvConverter converter(width, height, PixelFormat::YUV420P);
+    auto out = std::make_shared<StorageBuff<float>>();
+    out->set_size(pixels * 3 * sizeof(float));
+    CommandList list;
+    converter.record(list, out);
+    {
+        Clock::duration cpu{};
+        auto tp = Clock::now();
+        for (int i = 0; i < frames; i++) {
+            auto start = Clock::now();
+            converter.upload(planes, linesize);
+            cpu += Clock::now() - start;
+            k.submit(list);
+        }
+        glFinish();
+        std::cout << "YuvConverter: " << ms(Clock::now() - tp) / frames << " ms/frame ("
+                  << ms(cpu) / frames << " ms CPU), " << converter.frame_size() / 1e6
+                  << " MB uploaded/frame" << std::endl;
+    }
+
+    auto result = out->get_data();
+    const float* ref = reference.ptr<float>();
+    double max_diff = 0;
+    double sum_diff = 0;
+    for (size_t i = 0; i < result.size(); i++) {
+        double diff = std::abs(double(result[i]) - ref[i]);
+        max_diff = std::max(max_diff, diff);
+        sum_diff += diff;
+    }
+    // swscale rounds to 8 bits and sites chroma slightly differently, so expect a few levels; a
+    // wrong matrix, range or siting is off by far more
+    const double max_levels = max_diff * 255;
+    const double mean_levels = sum_diff / result.size() * 255;
+    std::cout << "difference vs swscale: max " << max_levels << ", mean " << mean_levels
+              << " (8-bit levels)" << std::endl;
+    const bool ok = max_levels <= 6 && mean_levels <= 1;
+
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
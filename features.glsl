@@ -0,0 +1,88 @@
+#version 430 core
+
+layout (local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y, local_size_z = 1) in;
+
+// Element types of the buffers, as accessors from packed.hpp; floats unless the host says otherwise
+#ifndef IN_ELEM
+#define IN_ELEM float
+#define IN_LOAD(b, i) (b)[i]
+#endif
+#ifndef FEAT_ELEM
+#define FEAT_ELEM vec4
+#define FEAT_STORE4(b, i, v) (b)[i] = (v)
+#endif
+
+layout(binding = 0) readonly buffer In {
+    IN_ELEM InData[];
+};
+
+// Per pixel: Gaussian-blurred colour in xyz, Sobel edge magnitude in w
+layout(binding = 1) writeonly buffer Features {
+    FEAT_ELEM FeatData[];
+};
+
+#ifdef TILE
+// Dirty-tile mode (tiles.glsl): a workgroup per listed tile
+layout(binding = 2) readonly buffer Tiles {
+    uint Args[3];
+    uint Tile[];
+};
+#endif
+
+uniform ivec3 dims;
+
+#define GET_VEC3(bff, uv) vec3(IN_LOAD(bff, (uv.y * dims.x + uv.x) * dims.z),\
+    IN_LOAD(bff, (uv.y * dims.x + uv.x) * dims.z + 1),\
+    IN_LOAD(bff, (uv.y * dims.x + uv.x) * dims.z + 2))
+
+const float gauss[9] = float[9](
+	1.0 / 16.0, 2.0 / 16.0, 1.0 / 16.0,
+	2.0 / 16.0, 4.0 / 16.0, 2.0 / 16.0,
+	1.0 / 16.0, 2.0 / 16.0, 1.0 / 16.0
+);
+
+const float sobelX[9] = float[9](
+	-1.0,  0.0,  1.0,
+	-2.0,  0.0,  2.0,
+	-1.0,  0.0,  1.0
+);
+
+const float sobelY[9] = float[9](
+	-1.0, -2.0, -1.0,
+	0.0,  0.0,  0.0,
+	1.0,  2.0,  1.0
+);
+
+const ivec2 offset[9] = ivec2[](
+	ivec2(-1,  1), ivec2( 0,  1), ivec2( 1,  1),
+	ivec2(-1,  0), ivec2( 0,  0), ivec2( 1,  0),
+	ivec2(-1, -1), ivec2( 0, -1), ivec2( 1, -1)
+);
+
+void main() {
+#ifdef TILE
+    const uint tile = Tile[gl_WorkGroupID.x];
+    const ivec2 Coord =
+        ivec2(tile % TILES_X, tile / TILES_X) * TILE + ivec2(gl_LocalInvocationID.xy);
+    if (any(greaterThanEqual(Coord, dims.xy))) {
+        return;
+    }
+#else
+    KOMPUTE_GUARD();
+    const ivec2 Coord = ivec2(gl_GlobalInvocationID.xy);
+#endif
+
+	vec3 blur = vec3(0.0);
+	vec2 grad = vec2(0.0);
+
+	// Both 3x3 stencils share the same neighbourhood, so read it once. Borders are clamped.
+	for (int i = 0; i < 9; i++) {
+		ivec2 coordOffset = clamp(Coord + offset[i], ivec2(0), dims.xy - 1);
+		vec3 c = GET_VEC3(InData, coordOffset);
+		blur += c * gauss[i];
+		float intensity = dot(c, vec3(0.299, 0.587, 0.114));  // Convert to grayscale
+		grad += vec2(sobelX[i], sobelY[i]) * intensity;
+	}
+
+	FEAT_STORE4(FeatData, Coord.y * dims.x + Coord.x, vec4(blur, length(grad)));
+}
@@ -1,6 +1,6 @@
 #version 430 core
 
-layout (local_size_x = 1, local_size_y = 1, local_size_z = 1) in;
+layout (local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y, local_size_z = 1) in;
 
 layout(binding = 0) readonly buffer In1 {
     float InData1[];
@@ -110,6 +110,7 @@ vec3 computeMotionMask(vec3 edge, vec3 blur, float edgeWeight, float blurWeight)
 
 
 void main() {
+    KOMPUTE_GUARD();
     const uvec2 Coord = gl_GlobalInvocationID.xy;
     /*
      * Start Shader Code
@@ -0,0 +1,83 @@
+#version 430 core
+
+layout (local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y, local_size_z = 1) in;
+
+// Element types of the buffers, as accessors from packed.hpp; floats unless the host says otherwise
+#ifndef FEAT_ELEM
+#define FEAT_ELEM vec4
+#define FEAT_LOAD4(b, i) (b)[i]
+#define FEAT_STORE4(b, i, v) (b)[i] = (v)
+#endif
+#ifndef MASK_ELEM
+#define MASK_ELEM vec4
+#define MASK_STORE4(b, i, v) (b)[i] = (v)
+#endif
+// Mask value of a pixel that moved in all three channels: 255 as a float, 1.0 for unorm8
+#ifndef MASK_MAX
+#define MASK_MAX 255.0
+#endif
+
+// Output of features.glsl for the current and the previous frame
+layout(binding = 0) readonly buffer Cur {
+    FEAT_ELEM CurFeat[];
+};
+
+#ifdef TILE
+// Tiled modes (tiles.glsl): a workgroup per listed tile, TILE / 4 x TILE invocations
+layout(binding = 3) readonly buffer Tiles {
+    uint Args[3];
+    uint Tile[];
+};
+#endif
+
+#if defined(TILE) && !defined(REFINE)
+// Dirty-tile mode keeps the previous features up to date only where a tile ran, so the current
+// ones replace them. Coarse-to-fine mode (REFINE) recomputes them from the previous frame.
+layout(binding = 1) buffer Prev {
+    FEAT_ELEM PrevFeat[];
+};
+#else
+layout(binding = 1) readonly buffer Prev {
+    FEAT_ELEM PrevFeat[];
+};
+#endif
+
+layout(binding = 2) writeonly buffer Out {
+    MASK_ELEM OutData[];
+};
+
+uniform float thresh;
+
+float moved(uint pixel) {
+    vec4 diff = abs(FEAT_LOAD4(CurFeat, pixel) - FEAT_LOAD4(PrevFeat, pixel));
+    vec3 outColor = max(vec3(diff.w), diff.xyz);
+    outColor = step(vec3(thresh), outColor);  // Keep pixels above the threshold
+
+    return (outColor.x + outColor.y + outColor.z) * MASK_MAX / 3.0;
+}
+
+// Four pixels per invocation, so that a packed mask is written in whole words. All buffers are
+// padded to a multiple of four pixels.
+void main() {
+#ifdef TILE
+    const uint tile = Tile[gl_WorkGroupID.x];
+    const uvec2 xy = uvec2(tile % TILES_X, tile / TILES_X) * TILE +
+                     uvec2(4u * gl_LocalInvocationID.x, gl_LocalInvocationID.y);
+    if (xy.x >= WIDTH || xy.y >= HEIGHT) {
+        return;
+    }
+    // Rows start on a whole word: WIDTH is a multiple of four
+    const uint idx = (xy.y * WIDTH + xy.x) / 4u;
+#else
+    KOMPUTE_GUARD();
+    const uint idx = gl_GlobalInvocationID.x;
+#endif
+
+    const uint p = 4u * idx;
+    MASK_STORE4(OutData, idx, vec4(moved(p), moved(p + 1u), moved(p + 2u), moved(p + 3u)));
+#if defined(TILE) && !defined(REFINE)
+    for (uint i = p; i < p + 4u; i++) {
+        FEAT_STORE4(PrevFeat, i, FEAT_LOAD4(CurFeat, i));
+    }
+#endif
+}
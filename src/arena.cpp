@@ -0,0 +1,174 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+static size_t storage_alignment() {
+    GLint alignment = 0;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    // Shaders address whole uints, whatever the driver allows
+    return std::max<size_t>(alignment, 4);
+}
+
+BufferArena::BufferArena(size_t block_size)
+    : block_size(block_size), alignment(storage_alignment()) {
+    if (block_size == 0) {
+        throw std::runtime_error("BufferArena needs a nonzero block size");
+    }
+}
+
+BufferArena::~BufferArena() {
+    for (auto& block : blocks) {
+        glDeleteBuffers(1, &block.ssbo);
+    }
+    for (auto& block : scratch_blocks) {
+        glDeleteBuffers(1, &block.ssbo);
+    }
+}
+
+GLuint BufferArena::create(size_t size) {
+    GLuint ssbo = 0;
+    glGenBuffers(1, &ssbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_DYNAMIC_STORAGE_BIT);
+    GL_CHECK_ERROR();
+    return ssbo;
+}
+
+size_t BufferArena::align(size_t size) const {
+    return (std::max<size_t>(size, 1) + alignment - 1) / alignment * alignment;
+}
+
+std::shared_ptr<Buff> BufferArena::allocate(size_t size) {
+    const size_t aligned = align(size);
+    // First fit, over the blocks in the order they were created
+    size_t index = blocks.size();
+    size_t offset = 0;
+    for (size_t i = 0; i < blocks.size() && index == blocks.size(); i++) {
+        for (auto [free_offset, free_size] : blocks[i].free) {
+            if (free_size >= aligned) {
+                index = i;
+                offset = free_offset;
+                break;
+            }
+        }
+    }
+    if (index == blocks.size()) {
+        Block block;
+        block.size = std::max(block_size, aligned);
+        block.ssbo = create(block.size);
+        block.free[0] = block.size;
+        blocks.push_back(std::move(block));
+    }
+
+    Block& block = blocks[index];
+    auto it = block.free.find(offset);
+    size_t rest = it->second - aligned;
+    block.free.erase(it);
+    if (rest > 0) {
+        block.free[offset + aligned] = rest;
+    }
+    block.allocations++;
+
+    auto buffer = std::shared_ptr<Buff>(new Buff, [this, index, offset, aligned](Buff* b) {
+        release(index, offset, aligned);
+        delete b;
+    });
+    buffer->ssbo = block.ssbo;
+    buffer->offset = offset;
+    buffer->size = size;
+    return buffer;
+}
+
+void BufferArena::release(size_t index, size_t offset, size_t size) {
+    Block& block = blocks[index];
+    block.allocations--;
+    auto next = block.free.lower_bound(offset);
+    // Merge with the free range after, then the one before
+    if (next != block.free.end() && next->first == offset + size) {
+        size += next->second;
+        next = block.free.erase(next);
+    }
+    if (next != block.free.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            prev->second += size;
+            return;
+        }
+    }
+    block.free.emplace_hint(next, offset, size);
+}
+
+std::shared_ptr<Buff> BufferArena::scratch(size_t size) {
+    const size_t aligned = align(size);
+    while (scratch_current < scratch_blocks.size() &&
+           scratch_blocks[scratch_current].size - scratch_blocks[scratch_current].used < aligned)
+    {
+        scratch_current++;
+    }
+    if (scratch_current == scratch_blocks.size()) {
+        ScratchBlock block;
+        block.size = std::max(block_size, aligned);
+        block.ssbo = create(block.size);
+        scratch_blocks.push_back(block);
+    }
+
+    ScratchBlock& block = scratch_blocks[scratch_current];
+    auto buffer = std::make_shared<Buff>();
+    buffer->ssbo = block.ssbo;
+    buffer->offset = block.used;
+    buffer->size = size;
+    block.used += aligned;
+    return buffer;
+}
+
+void BufferArena::reset_scratch() {
+    for (auto& block : scratch_blocks) {
+        block.used = 0;
+    }
+    scratch_current = 0;
+}
+
+void BufferArena::write(const Buff& dst, std::span<const std::byte> data) {
+    if (data.size() > dst.size) {
+        throw std::runtime_error("Write is larger than the buffer");
+    }
+    TraceScope trace(TraceKind::Upload, "arena", data.size());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, dst.ssbo);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, dst.offset, data.size(), data.data());
+    GL_CHECK_ERROR();
+}
+
+BufferArena::Stats BufferArena::stats() const {
+    Stats s;
+    for (auto& block : blocks) {
+        s.blocks++;
+        s.reserved += block.size;
+        s.allocations += block.allocations;
+        size_t free_bytes = 0;
+        for (auto [offset, size] : block.free) {
+            free_bytes += size;
+            s.free_ranges++;
+            s.largest_free = std::max(s.largest_free, size);
+        }
+        s.free_bytes += free_bytes;
+        s.allocated += block.size - free_bytes;
+    }
+    for (auto& block : scratch_blocks) {
+        s.blocks++;
+        s.reserved += block.size;
+        s.scratch_used += block.used;
+        s.scratch_capacity += block.size;
+    }
+    return s;
+}
+
+std::shared_ptr<Buff> make_storage(BufferArena* arena, size_t size) {
+    if (arena) {
+        return arena->allocate(size);
+    }
+    auto buffer = std::make_shared<StorageBuff<std::byte>>();
+    buffer->set_size(size);
+    return buffer;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "kompute.hpp"
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <span>
+#include <vector>
+
+// Sub-allocates storage buffers out of a few large GL buffers, so that many streams' worth of
+// intermediate buffers don't each cost a GL object and an allocation. Every range starts at a
+// multiple of GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT and is bound with glBindBufferRange.
+//
+// allocate() hands out long-lived ranges from per-block free lists (first fit; a released range
+// merges with its free neighbours) that go back when the last reference is dropped. scratch()
+// bump-allocates per-frame temporaries out of separate blocks and reset_scratch() rewinds them
+// all at once. GL runs commands in order, so rewinding is safe as soon as nothing will record
+// new work against the old scratch ranges.
+//
+// GL thread only. The arena must outlive everything allocated from it.
+class BufferArena {
+public:
+    struct Stats {
+        // GL buffers backing the arena and their total size, scratch included
+        size_t blocks = 0;
+        size_t reserved = 0;
+        // Live allocate() ranges and the bytes they take, alignment padding included
+        size_t allocations = 0;
+        size_t allocated = 0;
+        // Free space in the long-lived blocks
+        size_t free_bytes = 0;
+        size_t free_ranges = 0;
+        size_t largest_free = 0;
+        size_t scratch_used = 0;
+        size_t scratch_capacity = 0;
+
+        // 0 when the free space is one contiguous range, towards 1 the more it is split up
+        double fragmentation() const {
+            return free_bytes ? 1.0 - double(largest_free) / double(free_bytes) : 0.0;
+        }
+    };
+
+    // Blocks are `block_size` bytes; a larger request gets a block of its own.
+    explicit BufferArena(size_t block_size = 32 << 20);
+    ~BufferArena();
+    BufferArena(const BufferArena&) = delete;
+
+    // `size` bytes that live until the last reference is dropped
+    std::shared_ptr<Buff> allocate(size_t size);
+    // `size` bytes that live until the next reset_scratch()
+    std::shared_ptr<Buff> scratch(size_t size);
+    void reset_scratch();
+
+    // Uploads `data` to the start of `dst`, which must be large enough
+    static void write(const Buff& dst, std::span<const std::byte> data);
+
+    Stats stats() const;
+
+    const size_t block_size;
+    const size_t alignment;
+
+private:
+    struct Block {
+        GLuint ssbo = 0;
+        size_t size = 0;
+        // Free ranges by offset, never adjacent
+        std::map<size_t, size_t> free;
+        size_t allocations = 0;
+    };
+
+    struct ScratchBlock {
+        GLuint ssbo = 0;
+        size_t size = 0;
+        size_t used = 0;
+    };
+
+    std::vector<Block> blocks;
+    std::vector<ScratchBlock> scratch_blocks;
+    size_t scratch_current = 0;
+
+    GLuint create(size_t size);
+    size_t align(size_t size) const;
+    void release(size_t block, size_t offset, size_t size);
+};
+
+// A long-lived buffer of `size` bytes from `arena`, or a StorageBuff of its own without one
+std::shared_ptr<Buff> make_storage(BufferArena* arena, size_t size);
@@ -0,0 +1,210 @@
+#include "components.hpp"
+
+#include <stdexcept>
+#include <string>
+
+// Passes, each a separate dispatch:
+//   0 every pixel is its own root
+//   1 union each pixel with its earlier neighbours of the same class
+//   2 point every pixel straight at its root
+//   3 number the foreground roots and mark background touching the image border (the outside)
+//   4 reduce boxes; a component touching the outside is not nested in anything
+//   5 compact the outermost components' boxes
+static const char* components_src = R"(#version 430 core
+
+layout (local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y, local_size_z = 1) in;
+
+layout(binding = 0) readonly buffer Mask {
+    MASK_ELEM MaskData[];
+};
+
+// Each pixel points at a smaller or equal index; roots point at themselves
+layout(binding = 1) coherent buffer Labels {
+    uint Label[];
+};
+
+// Foreground root -> component id, background root -> 1 if it touches the outside
+layout(binding = 2) buffer Ids {
+    uint Id[];
+};
+
+// Per component: min x, min y, max x, max y
+layout(binding = 3) buffer Boxes {
+    uint BoxData[];
+};
+
+layout(binding = 4) buffer External {
+    uint ExternalData[];
+};
+
+// Outermost components, total components, then x, y, width, height per box
+layout(binding = 5) buffer Out {
+    uint OutData[];
+};
+
+bool foreground(int x, int y) {
+    return MASK_LOAD(MaskData, y * WIDTH + x) >= FOREGROUND;
+}
+
+uint find(uint x) {
+    uint p = Label[x];
+    while (p != x) {
+        x = p;
+        p = Label[x];
+    }
+    return x;
+}
+
+void unite(uint a, uint b) {
+    for (;;) {
+        a = find(a);
+        b = find(b);
+        if (a == b) {
+            return;
+        }
+        if (a > b) {
+            uint t = a;
+            a = b;
+            b = t;
+        }
+        uint old = atomicMin(Label[b], a);
+        if (old == b) {
+            return;
+        }
+        // b was linked elsewhere meanwhile; join that tree instead
+        b = old;
+    }
+}
+
+void main() {
+    KOMPUTE_GUARD();
+    const ivec2 Coord = ivec2(gl_GlobalInvocationID.xy);
+    const uint i = uint(Coord.y * WIDTH + Coord.x);
+
+#if PASS == 0
+    Label[i] = i;
+    Id[i] = 0u;
+    if (i == 0u) {
+        OutData[0] = 0u;
+        OutData[1] = 0u;
+    }
+#elif PASS == 1
+    bool fg = foreground(Coord.x, Coord.y);
+    if (Coord.x > 0 && foreground(Coord.x - 1, Coord.y) == fg) {
+        unite(i, i - 1u);
+    }
+    if (Coord.y > 0) {
+        if (foreground(Coord.x, Coord.y - 1) == fg) {
+            unite(i, i - uint(WIDTH));
+        }
+        if (fg && Coord.x > 0 && foreground(Coord.x - 1, Coord.y - 1)) {
+            unite(i, i - uint(WIDTH) - 1u);
+        }
+        if (fg && Coord.x < WIDTH - 1 && foreground(Coord.x + 1, Coord.y - 1)) {
+            unite(i, i - uint(WIDTH) + 1u);
+        }
+    }
+#elif PASS == 2
+    Label[i] = find(i);
+#elif PASS == 3
+    bool border = Coord.x == 0 || Coord.y == 0 || Coord.x == WIDTH - 1 || Coord.y == HEIGHT - 1;
+    if (foreground(Coord.x, Coord.y)) {
+        if (Label[i] == i) {
+            uint id = atomicAdd(OutData[1], 1u);
+            Id[i] = id;
+            BoxData[id * 4u] = 0xffffffffu;
+            BoxData[id * 4u + 1u] = 0xffffffffu;
+            BoxData[id * 4u + 2u] = 0u;
+            BoxData[id * 4u + 3u] = 0u;
+            ExternalData[id] = 0u;
+        }
+    } else if (border) {
+        Id[Label[i]] = 1u;
+    }
+#elif PASS == 4
+    if (!foreground(Coord.x, Coord.y)) {
+        return;
+    }
+    uint id = Id[Label[i]];
+    atomicMin(BoxData[id * 4u], uint(Coord.x));
+    atomicMin(BoxData[id * 4u + 1u], uint(Coord.y));
+    atomicMax(BoxData[id * 4u + 2u], uint(Coord.x));
+    atomicMax(BoxData[id * 4u + 3u], uint(Coord.y));
+
+    // Foreground separates 4-connected background, so a component borders the outside only if
+    // no other component encloses it
+    bool outside = Coord.x == 0 || Coord.y == 0 || Coord.x == WIDTH - 1 || Coord.y == HEIGHT - 1;
+    const ivec2 offsets[4] = ivec2[4](ivec2(-1, 0), ivec2(1, 0), ivec2(0, -1), ivec2(0, 1));
+    for (int n = 0; n < 4 && !outside; n++) {
+        ivec2 c = Coord + offsets[n];
+        if (!foreground(c.x, c.y) && Id[Label[c.y * WIDTH + c.x]] != 0u) {
+            outside = true;
+        }
+    }
+    if (outside) {
+        ExternalData[id] = 1u;
+    }
+#elif PASS == 5
+    uint id = i;
+    if (id >= OutData[1] || ExternalData[id] == 0u) {
+        return;
+    }
+    uint slot = atomicAdd(OutData[0], 1u);
+    if (slot < uint(CAPACITY)) {
+        uint o = 4u + slot * 4u;
+        OutData[o] = BoxData[id * 4u];
+        OutData[o + 1u] = BoxData[id * 4u + 1u];
+        OutData[o + 2u] = BoxData[id * 4u + 2u] - BoxData[id * 4u] + 1u;
+        OutData[o + 3u] = BoxData[id * 4u + 3u] - BoxData[id * 4u + 1u] + 1u;
+    }
+#endif
+}
+)";
+
+Components::Components(
+    int width, int height, size_t capacity, ProgramCache* cache, BufferArena* arena, Packing mask
+)
+    : width(width), height(height), capacity(capacity), mask(mask) {
+    if (width <= 0 || height <= 0) {
+        throw std::runtime_error("Components needs a non-empty frame");
+    }
+    const size_t pixels = size_t(width) * height;
+    // Separate 8-connected components are at least one pixel apart in both directions
+    max_components = size_t(width + 1) / 2 * ((height + 1) / 2);
+
+    for (int pass = 0; pass < int(passes.size()); pass++) {
+        const bool linear = pass == 5;
+        Defines defines = {
+            { "LOCAL_SIZE_X", linear ? "256" : "16" },
+            { "LOCAL_SIZE_Y", linear ? "1" : "16" },
+            { "PASS", std::to_string(pass) },
+            { "WIDTH", std::to_string(width) },
+            { "HEIGHT", std::to_string(height) },
+            { "CAPACITY", std::to_string(capacity) },
+            // Half a unit of the mask's 0..255 scale
+            { "FOREGROUND", mask == Packing::Unorm8 ? "(0.5 / 255.0)" : "0.5" },
+        };
+        const Defines accessors = packed_accessors("MASK", mask);
+        defines.insert(defines.end(), accessors.begin(), accessors.end());
+        passes[pass].kernel =
+            std::make_unique<KomputeKernel>(std::string(components_src), defines, cache);
+        passes[pass].kernel->name = "components_" + std::to_string(pass);
+        passes[pass].params = std::make_unique<ParamBlock>(*passes[pass].kernel);
+    }
+
+    labels = make_storage(arena, pixels * sizeof(uint32_t));
+    ids = make_storage(arena, pixels * sizeof(uint32_t));
+    boxes = make_storage(arena, max_components * 4 * sizeof(uint32_t));
+    external = make_storage(arena, max_components * sizeof(uint32_t));
+    out = make_storage(arena, (capacity + 1) * sizeof(Box));
+}
+
+void Components::record(CommandList& list, const std::shared_ptr<Buff>& mask) {
+    const std::array<std::shared_ptr<Buff>, 6> buffers = {
+        mask, labels, ids, boxes, external, out,
+    };
+    for (int pass = 0; pass < 5; pass++) {
+        list.dispatch_threads(*passes[pass].kernel, *passes[pass].params, buffers, width, height);
+    }
+    list.dispatch_threads(*passes[5].kernel, *passes[5].params, buffers, int(max_components));
+}
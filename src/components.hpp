@@ -0,0 +1,100 @@
+#pragma once
+
+#include "arena.hpp"
+#include "kompute.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+// Bounding box of a connected component in pixels, laid out like cv::Rect
+struct Box {
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+};
+
+// Host side of Components::result(): a readback destination holding up to `capacity` boxes.
+class BoxList {
+public:
+    explicit BoxList(size_t capacity = 256) : data(capacity + 1) {}
+
+    // The boxes that fit, in no particular order
+    std::span<const Box> boxes() const {
+        return { data.data() + 1, std::min(found(), capacity()) };
+    }
+
+    // Outermost components found, including any that did not fit
+    size_t found() const {
+        return size_t(data[0].x);
+    }
+
+    size_t capacity() const {
+        return data.size() - 1;
+    }
+
+    // Fills the list from boxes found on the host
+    void assign(std::span<const Box> found) {
+        data[0].x = int32_t(found.size());
+        std::copy_n(found.begin(), std::min(found.size(), capacity()), data.begin() + 1);
+    }
+
+    std::span<std::byte> bytes() {
+        return std::as_writable_bytes(std::span(data));
+    }
+
+private:
+    // data[0] holds the counters, the boxes follow
+    std::vector<Box> data;
+};
+
+// Connected-component labelling of a motion mask and per-component bounding boxes, entirely on
+// the GPU, so that only a few kilobytes of boxes are read back instead of the whole mask.
+//
+// Pixels >= 0.5 are foreground (what convertTo(CV_8U) turns nonzero), or nonzero bytes in a
+// mask packed as unorm8. Foreground is labelled
+// with 8-connectivity and background with 4-connectivity by a lock-free union-find; components
+// that sit inside a hole of another one are dropped. The boxes are thus the same set
+// cv::findContours(RETR_EXTERNAL) + cv::boundingRect produce.
+class Components {
+public:
+    // Intermediate buffers come from `arena` when given. `mask` is the element type of the masks
+    // given to record().
+    Components(
+        int width, int height, size_t capacity = 256, ProgramCache* cache = nullptr,
+        BufferArena* arena = nullptr, Packing mask = Packing::Float32
+    );
+    Components(const Components&) = delete;
+
+    // Records the labelling of `mask` (width * height elements) into result()
+    void record(CommandList& list, const std::shared_ptr<Buff>& mask);
+
+    // Counters followed by up to `capacity` boxes; read back into a BoxList of equal capacity
+    const Buff& result() const {
+        return *out;
+    }
+
+    const int width;
+    const int height;
+    const size_t capacity;
+    const Packing mask;
+
+private:
+    struct Pass {
+        std::unique_ptr<KomputeKernel> kernel;
+        std::unique_ptr<ParamBlock> params;
+    };
+
+    std::array<Pass, 6> passes;
+    // Upper bound on 8-connected foreground components
+    size_t max_components;
+    std::shared_ptr<Buff> labels;
+    std::shared_ptr<Buff> ids;
+    std::shared_ptr<Buff> boxes;
+    std::shared_ptr<Buff> external;
+    std::shared_ptr<Buff> out;
+};
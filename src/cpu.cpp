@@ -0,0 +1,385 @@
+#include "cpu.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <opencv2/imgproc.hpp>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KOMPUTE_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define KOMPUTE_NEON 1
+#endif
+
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 1; i < threads; i++) {
+        workers.emplace_back([this] {
+            uint64_t seen = 0;
+            std::unique_lock l(mtx);
+            for (;;) {
+                wake.wait(l, [&] { return stopping || (job && generation != seen); });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+                busy++;
+                l.unlock();
+                run_chunks();
+                l.lock();
+                if (--busy == 0) {
+                    idle.notify_all();
+                }
+            }
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard l(mtx);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::run_chunks() {
+    const size_t chunks = (job_size + job_grain - 1) / job_grain;
+    for (size_t c; (c = next_chunk.fetch_add(1, std::memory_order_relaxed)) < chunks;) {
+        (*job)(c * job_grain, std::min(job_size, (c + 1) * job_grain));
+    }
+}
+
+void ThreadPool::parallel_for(
+    size_t n, size_t grain, const std::function<void(size_t, size_t)>& fn
+) {
+    grain = std::max<size_t>(grain, 1);
+    if (workers.empty() || n <= grain) {
+        for (size_t begin = 0; begin < n; begin += grain) {
+            fn(begin, std::min(n, begin + grain));
+        }
+        return;
+    }
+
+    {
+        std::lock_guard l(mtx);
+        job = &fn;
+        job_size = n;
+        job_grain = grain;
+        next_chunk.store(0, std::memory_order_relaxed);
+        generation++;
+    }
+    wake.notify_all();
+    run_chunks();
+
+    // Workers only pick up the job under the lock while it is set, so once none is busy every
+    // chunk has finished
+    std::unique_lock l(mtx);
+    idle.wait(l, [&] { return busy == 0; });
+    job = nullptr;
+}
+
+const char* to_string(CpuIsa isa) {
+    switch (isa) {
+        case CpuIsa::Avx2:
+            return "AVX2";
+        case CpuIsa::Neon:
+            return "NEON";
+        default:
+            return "scalar";
+    }
+}
+
+CpuIsa detect_isa() {
+#if KOMPUTE_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return CpuIsa::Avx2;
+    }
+#elif KOMPUTE_NEON
+    return CpuIsa::Neon;
+#endif
+    return CpuIsa::Scalar;
+}
+
+namespace {
+
+// One row of the fused feature + motion pass. planes[p] points at the row's first pixel in
+// padded plane p, so [-1] and [width] are the replicated borders and the rows above and below
+// are `stride` floats away.
+struct Row {
+    const float* planes[4];
+    ptrdiff_t stride;
+    const float* prev[4];
+    float* cur[4];
+    float* out;
+    float thresh;
+};
+
+// Every kernel below does the same operations in the same order. Blur and Sobel are summed as
+// [1 2 1] (or [1 0 -1]) columns and then rows of the 3x3 neighbourhood.
+void features_row_scalar(const Row& r, int begin, int end) {
+    const ptrdiff_t s = r.stride;
+    for (int x = begin; x < end; x++) {
+        float blur[3];
+        for (int c = 0; c < 3; c++) {
+            const float* p = r.planes[c] + x;
+            float left = p[-1 - s] + 2.0f * p[-1] + p[-1 + s];
+            float mid = p[-s] + 2.0f * p[0] + p[s];
+            float right = p[1 - s] + 2.0f * p[1] + p[1 + s];
+            blur[c] = (left + 2.0f * mid + right) * (1.0f / 16.0f);
+        }
+        const float* g = r.planes[3] + x;
+        float gx = (g[1 - s] + 2.0f * g[1] + g[1 + s]) - (g[-1 - s] + 2.0f * g[-1] + g[-1 + s]);
+        float gy = (g[-1 - s] + 2.0f * g[-s] + g[1 - s]) - (g[-1 + s] + 2.0f * g[s] + g[1 + s]);
+        float edge = std::sqrt(gx * gx + gy * gy);
+
+        float edge_diff = std::fabs(edge - r.prev[3][x]);
+        float count = 0.0f;
+        for (int c = 0; c < 3; c++) {
+            float d = std::max(edge_diff, std::fabs(blur[c] - r.prev[c][x]));
+            count += d >= r.thresh ? 1.0f : 0.0f;
+            r.cur[c][x] = blur[c];
+        }
+        r.cur[3][x] = edge;
+        r.out[x] = count * 255.0f / 3.0f;
+    }
+}
+
+#if KOMPUTE_X86
+#define KOMPUTE_AVX2 __attribute__((target("avx2")))
+
+KOMPUTE_AVX2 inline __m256 column_sum(const float* p, ptrdiff_t s) {
+    __m256 v = _mm256_mul_ps(_mm256_set1_ps(2.0f), _mm256_loadu_ps(p));
+    return _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(p - s), v), _mm256_loadu_ps(p + s));
+}
+
+KOMPUTE_AVX2 inline __m256 row_sum(const float* p) {
+    __m256 v = _mm256_mul_ps(_mm256_set1_ps(2.0f), _mm256_loadu_ps(p));
+    return _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(p - 1), v), _mm256_loadu_ps(p + 1));
+}
+
+KOMPUTE_AVX2 inline __m256 abs_diff(__m256 a, __m256 b) {
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), _mm256_sub_ps(a, b));
+}
+
+// Returns the first column left for the scalar kernel
+KOMPUTE_AVX2 int features_row_avx2(const Row& r, int width) {
+    const ptrdiff_t s = r.stride;
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 thresh = _mm256_set1_ps(r.thresh);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256 blur[3];
+        for (int c = 0; c < 3; c++) {
+            const float* p = r.planes[c] + x;
+            __m256 sum = _mm256_add_ps(column_sum(p - 1, s), _mm256_mul_ps(two, column_sum(p, s)));
+            sum = _mm256_add_ps(sum, column_sum(p + 1, s));
+            blur[c] = _mm256_mul_ps(sum, _mm256_set1_ps(1.0f / 16.0f));
+        }
+        const float* g = r.planes[3] + x;
+        __m256 gx = _mm256_sub_ps(column_sum(g + 1, s), column_sum(g - 1, s));
+        __m256 gy = _mm256_sub_ps(row_sum(g - s), row_sum(g + s));
+        __m256 edge = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(gx, gx), _mm256_mul_ps(gy, gy)));
+
+        __m256 edge_diff = abs_diff(edge, _mm256_loadu_ps(r.prev[3] + x));
+        __m256 count = _mm256_setzero_ps();
+        for (int c = 0; c < 3; c++) {
+            __m256 d = _mm256_max_ps(edge_diff, abs_diff(blur[c], _mm256_loadu_ps(r.prev[c] + x)));
+            count = _mm256_add_ps(count, _mm256_and_ps(_mm256_cmp_ps(d, thresh, _CMP_GE_OQ), one));
+            _mm256_storeu_ps(r.cur[c] + x, blur[c]);
+        }
+        _mm256_storeu_ps(r.cur[3] + x, edge);
+        __m256 out = _mm256_mul_ps(count, _mm256_set1_ps(255.0f));
+        _mm256_storeu_ps(r.out + x, _mm256_div_ps(out, _mm256_set1_ps(3.0f)));
+    }
+    return x;
+}
+#endif
+
+#if KOMPUTE_NEON
+inline float32x4_t column_sum(const float* p, ptrdiff_t s) {
+    float32x4_t v = vmulq_n_f32(vld1q_f32(p), 2.0f);
+    return vaddq_f32(vaddq_f32(vld1q_f32(p - s), v), vld1q_f32(p + s));
+}
+
+inline float32x4_t row_sum(const float* p) {
+    float32x4_t v = vmulq_n_f32(vld1q_f32(p), 2.0f);
+    return vaddq_f32(vaddq_f32(vld1q_f32(p - 1), v), vld1q_f32(p + 1));
+}
+
+// Returns the first column left for the scalar kernel
+int features_row_neon(const Row& r, int width) {
+    const ptrdiff_t s = r.stride;
+    const uint32x4_t one = vreinterpretq_u32_f32(vdupq_n_f32(1.0f));
+    const float32x4_t thresh = vdupq_n_f32(r.thresh);
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        float32x4_t blur[3];
+        for (int c = 0; c < 3; c++) {
+            const float* p = r.planes[c] + x;
+            float32x4_t sum = vaddq_f32(column_sum(p - 1, s), vmulq_n_f32(column_sum(p, s), 2.0f));
+            sum = vaddq_f32(sum, column_sum(p + 1, s));
+            blur[c] = vmulq_n_f32(sum, 1.0f / 16.0f);
+        }
+        const float* g = r.planes[3] + x;
+        float32x4_t gx = vsubq_f32(column_sum(g + 1, s), column_sum(g - 1, s));
+        float32x4_t gy = vsubq_f32(row_sum(g - s), row_sum(g + s));
+        float32x4_t edge = vsqrtq_f32(vaddq_f32(vmulq_f32(gx, gx), vmulq_f32(gy, gy)));
+
+        float32x4_t edge_diff = vabdq_f32(edge, vld1q_f32(r.prev[3] + x));
+        float32x4_t count = vdupq_n_f32(0.0f);
+        for (int c = 0; c < 3; c++) {
+            float32x4_t d = vmaxq_f32(edge_diff, vabdq_f32(blur[c], vld1q_f32(r.prev[c] + x)));
+            uint32x4_t hit = vandq_u32(vcgeq_f32(d, thresh), one);
+            count = vaddq_f32(count, vreinterpretq_f32_u32(hit));
+            vst1q_f32(r.cur[c] + x, blur[c]);
+        }
+        vst1q_f32(r.cur[3] + x, edge);
+        vst1q_f32(r.out + x, vdivq_f32(vmulq_n_f32(count, 255.0f), vdupq_n_f32(3.0f)));
+    }
+    return x;
+}
+#endif
+
+}  // namespace
+
+CpuMotionDetector::CpuMotionDetector(int width, int height, ThreadPool& pool, CpuIsa isa)
+    : width(width), height(height), isa(isa), pool(pool) {
+    if (width <= 0 || height <= 0) {
+        throw std::runtime_error("CpuMotionDetector needs a non-empty frame");
+    }
+#if !KOMPUTE_X86
+    if (isa == CpuIsa::Avx2) {
+        throw std::runtime_error("AVX2 kernels are only built for x86");
+    }
+#else
+    if (isa == CpuIsa::Avx2 && !__builtin_cpu_supports("avx2")) {
+        throw std::runtime_error("This CPU does not support AVX2");
+    }
+#endif
+#if !KOMPUTE_NEON
+    if (isa == CpuIsa::Neon) {
+        throw std::runtime_error("NEON kernels are only built for AArch64");
+    }
+#endif
+
+    const size_t pixels = size_t(width) * height;
+    in.resize(pixels * 3);
+    for (auto& plane : planes) {
+        plane.resize(size_t(width + 2) * (height + 2));
+    }
+    for (auto& h : history) {
+        for (auto& plane : h) {
+            plane.resize(pixels);
+        }
+    }
+    mask.resize(pixels);
+}
+
+std::span<float> CpuMotionDetector::frame() {
+    return in;
+}
+
+void CpuMotionDetector::process(float* out) {
+    const size_t stride = size_t(width) + 2;
+    // A few chunks per thread to even out the load
+    const size_t grain = std::max<size_t>(1, height / (pool.size() * 4));
+
+    pool.parallel_for(height, grain, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; y++) {
+            const float* src = in.data() + y * width * 3;
+            float* dst[4];
+            for (int p = 0; p < 4; p++) {
+                dst[p] = planes[p].data() + (y + 1) * stride + 1;
+            }
+            for (int x = 0; x < width; x++) {
+                float b = src[x * 3];
+                float g = src[x * 3 + 1];
+                float r = src[x * 3 + 2];
+                dst[0][x] = b;
+                dst[1][x] = g;
+                dst[2][x] = r;
+                // Same weights and order as features.glsl
+                dst[3][x] = 0.299f * b + 0.587f * g + 0.114f * r;
+            }
+            for (int p = 0; p < 4; p++) {
+                dst[p][-1] = dst[p][0];
+                dst[p][width] = dst[p][width - 1];
+                if (y == 0) {
+                    std::memcpy(dst[p] - 1 - stride, dst[p] - 1, stride * sizeof(float));
+                }
+                if (y == size_t(height) - 1) {
+                    std::memcpy(dst[p] - 1 + stride, dst[p] - 1, stride * sizeof(float));
+                }
+            }
+        }
+    });
+
+    auto& cur = history[frames % 2];
+    auto& prev = history[1 - frames % 2];
+    pool.parallel_for(height, grain, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; y++) {
+            Row row;
+            for (int p = 0; p < 4; p++) {
+                row.planes[p] = planes[p].data() + (y + 1) * stride + 1;
+                row.prev[p] = prev[p].data() + y * width;
+                row.cur[p] = cur[p].data() + y * width;
+            }
+            row.stride = stride;
+            row.out = out + y * width;
+            row.thresh = threshold;
+
+            int x = 0;
+#if KOMPUTE_X86
+            if (isa == CpuIsa::Avx2) {
+                x = features_row_avx2(row, width);
+            }
+#elif KOMPUTE_NEON
+            if (isa == CpuIsa::Neon) {
+                x = features_row_neon(row, width);
+            }
+#endif
+            features_row_scalar(row, x, width);
+        }
+    });
+}
+
+bool CpuMotionDetector::submit(std::span<float> out) {
+    if (out.size() < mask.size()) {
+        throw std::runtime_error("Motion mask is smaller than the frame");
+    }
+    // The first frame only fills the history
+    process(frames == 0 ? mask.data() : out.data());
+    return frames++ > 0;
+}
+
+bool CpuMotionDetector::submit(BoxList& boxes) {
+    process(mask.data());
+    if (frames++ == 0) {
+        return false;
+    }
+
+    // What Components computes on the GPU
+    cv::Mat binary;
+    cv::Mat(height, width, CV_32FC1, mask.data()).convertTo(binary, CV_8UC1);
+    std::vector<std::vector<cv::Point>> contours;
+    cv::findContours(binary, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+    std::vector<Box> found;
+    found.reserve(contours.size());
+    for (const auto& contour : contours) {
+        cv::Rect r = cv::boundingRect(contour);
+        found.push_back({ r.x, r.y, r.width, r.height });
+    }
+    boxes.assign(found);
+    return true;
+}
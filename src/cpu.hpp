@@ -0,0 +1,98 @@
+#pragma once
+
+#include "components.hpp"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+// CPU backend: the motion mask of features.glsl + motion.glsl computed with SIMD row kernels on
+// a thread pool, for machines without a render node and as a baseline for the GPU path.
+
+// Fixed set of worker threads that split index ranges between them. The calling thread takes
+// part too, so a pool of size 1 runs everything inline.
+class ThreadPool {
+public:
+    // `threads` counts the caller; 0 uses every hardware thread.
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+
+    // Runs fn(begin, end) over [0, n) in chunks of at most `grain` and returns once all of them
+    // are done. Not reentrant.
+    void parallel_for(size_t n, size_t grain, const std::function<void(size_t, size_t)>& fn);
+
+    size_t size() const {
+        return workers.size() + 1;
+    }
+
+private:
+    void run_chunks();
+
+    std::vector<std::thread> workers;
+    std::mutex mtx;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    // The current job; set and cleared by parallel_for under mtx
+    const std::function<void(size_t, size_t)>* job = nullptr;
+    size_t job_size = 0;
+    size_t job_grain = 1;
+    std::atomic<size_t> next_chunk = 0;
+    size_t busy = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};
+
+// Instruction set the CPU kernels run with, picked at runtime.
+enum class CpuIsa { Scalar, Avx2, Neon };
+
+const char* to_string(CpuIsa isa);
+
+// The best one this machine supports
+CpuIsa detect_isa();
+
+// CPU counterpart of MotionDetector for BGR float frames: same blur, Sobel, diff and threshold,
+// same mask values and the same boxes. Frames are processed synchronously on the pool.
+class CpuMotionDetector {
+public:
+    CpuMotionDetector(int width, int height, ThreadPool& pool, CpuIsa isa = detect_isa());
+    CpuMotionDetector(const CpuMotionDetector&) = delete;
+
+    // Memory for the next frame, width * height * 3 floats in [0, 1].
+    std::span<float> frame();
+
+    // Processes the frame written through frame() and writes its motion mask (width * height
+    // floats, 0 or 255) into `mask`. The first frame has nothing to compare against: returns false
+    // and leaves `mask` alone.
+    bool submit(std::span<float> mask);
+    // Same, but stores the bounding boxes of the mask's outermost connected components.
+    bool submit(BoxList& boxes);
+
+    float threshold = 0.2f;
+
+    const int width;
+    const int height;
+    const CpuIsa isa;
+
+private:
+    // Splits the frame into planes with replicated borders, then runs the fused feature and
+    // motion pass, writing the mask to `out`
+    void process(float* out);
+
+    ThreadPool& pool;
+    std::vector<float> in;
+    // Blue, green, red and intensity, (width + 2) x (height + 2) each
+    std::array<std::vector<float>, 4> planes;
+    // Per frame parity: blurred blue, green, red and edge magnitude, planar
+    std::array<std::array<std::vector<float>, 4>, 2> history;
+    // Mask for the first frame and for box extraction
+    std::vector<float> mask;
+    size_t frames = 0;
+};
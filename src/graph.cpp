@@ -0,0 +1,258 @@
+#include "graph.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+GraphBuffer KernelGraph::transient(std::string name, size_t size) {
+    if (size == 0) {
+        throw std::runtime_error("Transient buffer " + name + " is empty");
+    }
+    Resource r;
+    r.name = std::move(name);
+    r.size = size;
+    r.transient = true;
+    resources.push_back(std::move(r));
+    return { resources.size() - 1 };
+}
+
+GraphBuffer KernelGraph::external(std::string name, std::shared_ptr<Buff> buffer) {
+    if (!buffer) {
+        throw std::runtime_error("External buffer " + name + " is null");
+    }
+    Resource r;
+    r.name = std::move(name);
+    r.size = buffer->size;
+    r.storage = std::move(buffer);
+    resources.push_back(std::move(r));
+    return { resources.size() - 1 };
+}
+
+static void add_unique(std::vector<size_t>& v, size_t x) {
+    if (x != SIZE_MAX && std::find(v.begin(), v.end(), x) == v.end()) {
+        v.push_back(x);
+    }
+}
+
+void KernelGraph::node(
+    std::string name, KomputeKernel& kernel, ParamBlock& params, std::vector<GraphBuffer> buffers,
+    uvec3 threads
+) {
+    if (buffers.size() < kernel.buffers.size()) {
+        throw std::runtime_error("Node " + name + " binds fewer buffers than its kernel uses");
+    }
+    const size_t index = nodes.size();
+    Node n;
+    n.kernel = &kernel;
+    n.params = &params;
+    n.threads = threads;
+    n.writes.resize(buffers.size());
+    for (size_t i = 0; i < buffers.size(); i++) {
+        if (buffers[i].id >= resources.size()) {
+            throw std::runtime_error("Node " + name + " binds an unknown buffer");
+        }
+        for (auto& b : kernel.buffers) {
+            if (b.binding == i) {
+                n.writes[i] = !b.readonly;
+            }
+        }
+    }
+
+    // Reads first, so a buffer both read and written through different bindings still
+    // depends on its previous writer
+    for (size_t i = 0; i < buffers.size(); i++) {
+        Resource& r = resources[buffers[i].id];
+        if (r.transient && r.writer == SIZE_MAX && !n.writes[i]) {
+            throw std::runtime_error(
+                "Node " + name + " reads " + r.name + " before anything writes it"
+            );
+        }
+        add_unique(n.deps, r.writer);
+        add_unique(n.inputs, r.writer);
+    }
+    for (size_t i = 0; i < buffers.size(); i++) {
+        Resource& r = resources[buffers[i].id];
+        if (n.writes[i]) {
+            for (size_t reader : r.readers) {
+                if (reader != index) {
+                    add_unique(n.deps, reader);
+                }
+            }
+            r.readers.clear();
+            r.writer = index;
+        } else {
+            add_unique(r.readers, index);
+        }
+    }
+
+    n.name = std::move(name);
+    n.buffers = std::move(buffers);
+    nodes.push_back(std::move(n));
+}
+
+void KernelGraph::compile(BufferArena* arena, bool alias) {
+    // Nodes only ever depend on earlier ones, so one backward pass finds everything that
+    // contributes to an external buffer
+    for (auto& n : nodes) {
+        n.live = false;
+    }
+    for (size_t i = nodes.size(); i-- > 0;) {
+        Node& n = nodes[i];
+        for (size_t b = 0; b < n.buffers.size(); b++) {
+            if (n.writes[b] && !resources[n.buffers[b].id].transient) {
+                n.live = true;
+            }
+        }
+        if (n.live) {
+            for (size_t input : n.inputs) {
+                nodes[input].live = true;
+            }
+        }
+    }
+
+    // As soon as possible: one level past the latest live dependency
+    levels.clear();
+    for (size_t i = 0; i < nodes.size(); i++) {
+        Node& n = nodes[i];
+        if (!n.live) {
+            continue;
+        }
+        n.level = 0;
+        for (size_t dep : n.deps) {
+            if (nodes[dep].live) {
+                n.level = std::max(n.level, nodes[dep].level + 1);
+            }
+        }
+        if (levels.size() <= n.level) {
+            levels.resize(n.level + 1);
+        }
+        levels[n.level].push_back(i);
+    }
+
+    for (auto& r : resources) {
+        r.first = SIZE_MAX;
+        r.last = 0;
+    }
+    for (size_t level = 0; level < levels.size(); level++) {
+        for (size_t i : levels[level]) {
+            for (auto b : nodes[i].buffers) {
+                Resource& r = resources[b.id];
+                r.first = std::min(r.first, level);
+                r.last = std::max(r.last, level);
+            }
+        }
+    }
+    assign_memory(arena, alias);
+
+    // Levels after the first start with a barrier: it orders every dependency, and the reuse
+    // of memory whose previous tenant was last touched in an earlier level
+    list.clear();
+    std::vector<std::shared_ptr<Buff>> bound;
+    for (size_t level = 0; level < levels.size(); level++) {
+        if (level > 0) {
+            list.barrier();
+        }
+        for (size_t i : levels[level]) {
+            Node& n = nodes[i];
+            bound.clear();
+            for (auto b : n.buffers) {
+                bound.push_back(resources[b.id].storage);
+            }
+            list.dispatch_threads(
+                *n.kernel, *n.params, bound, int(n.threads[0]), int(n.threads[1]),
+                int(n.threads[2])
+            );
+        }
+    }
+}
+
+void KernelGraph::assign_memory(BufferArena* arena, bool alias) {
+    std::vector<size_t> order;
+    for (size_t id = 0; id < resources.size(); id++) {
+        if (resources[id].transient) {
+            resources[id].storage.reset();
+            if (resources[id].first != SIZE_MAX) {
+                order.push_back(id);
+            }
+        }
+    }
+
+    report = {};
+    report.transient_buffers = order.size();
+    for (size_t level = 0; level < levels.size(); level++) {
+        size_t live = 0;
+        for (size_t id : order) {
+            if (resources[id].first <= level && level <= resources[id].last) {
+                live += resources[id].size;
+            }
+        }
+        report.peak_live_bytes = std::max(report.peak_live_bytes, live);
+    }
+
+    // Largest first, each into the first slot none of whose tenants is alive at the same time
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return resources[a].size > resources[b].size;
+    });
+    struct Slot {
+        size_t size;
+        std::vector<size_t> tenants;
+    };
+    std::vector<Slot> plan;
+    std::vector<size_t> slot_of(resources.size());
+    for (size_t id : order) {
+        const Resource& r = resources[id];
+        report.unaliased_bytes += r.size;
+        size_t s = alias ? 0 : plan.size();
+        for (; s < plan.size(); s++) {
+            bool disjoint = std::all_of(
+                plan[s].tenants.begin(), plan[s].tenants.end(),
+                [&](size_t t) {
+                    return resources[t].last < r.first || r.last < resources[t].first;
+                }
+            );
+            if (disjoint) {
+                break;
+            }
+        }
+        if (s == plan.size()) {
+            plan.push_back({ r.size, {} });
+        }
+        plan[s].tenants.push_back(id);
+        slot_of[id] = s;
+    }
+
+    slots.clear();
+    for (auto& slot : plan) {
+        slots.push_back(make_storage(arena, slot.size));
+        report.aliased_bytes += slot.size;
+    }
+    report.slots = slots.size();
+    for (size_t id : order) {
+        // A view of the slot's storage sized to this buffer
+        auto view = std::make_shared<Buff>(*slots[slot_of[id]]);
+        view->size = resources[id].size;
+        resources[id].storage = std::move(view);
+    }
+}
+
+void KernelGraph::run(Kompute& k) {
+    k.submit(list);
+}
+
+void KernelGraph::record(CommandList& out) const {
+    out.append(list);
+}
+
+const std::shared_ptr<Buff>& KernelGraph::buffer(GraphBuffer handle) const {
+    return resources.at(handle.id).storage;
+}
+
+std::vector<std::vector<std::string>> KernelGraph::schedule() const {
+    std::vector<std::vector<std::string>> names(levels.size());
+    for (size_t level = 0; level < levels.size(); level++) {
+        for (size_t i : levels[level]) {
+            names[level].push_back(nodes[i].name);
+        }
+    }
+    return names;
+}
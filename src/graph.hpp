@@ -0,0 +1,120 @@
+#pragma once
+
+#include "arena.hpp"
+#include "kompute.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+// Handle to a buffer declared in a KernelGraph
+struct GraphBuffer {
+    size_t id = SIZE_MAX;
+};
+
+// Multi-pass GPU work declared as a graph: nodes are kernels, edges the buffers they bind.
+//
+//     KernelGraph g;
+//     auto frame = g.external("frame", in);
+//     auto mask = g.external("mask", out);
+//     auto blurred = g.transient("blurred", bytes);
+//     auto edges = g.transient("edges", bytes);
+//     g.node("blur", blur, blur_params, { frame, blurred }, { w, h, 1 });
+//     g.node("edges", sobel, sobel_params, { blurred, edges }, { w, h, 1 });
+//     g.node("threshold", thresh, thresh_params, { edges, mask }, { w, h, 1 });
+//     g.compile(&arena);
+//     g.run(k);
+//
+// Nodes are declared in program order and a buffer binding counts as a write unless its SSBO
+// block is readonly. compile() derives the dependencies from that (read after write, write
+// after read, write after write), drops nodes nothing external depends on, and schedules the
+// rest in levels: every node runs as soon as its inputs are ready, each level is one barrier
+// after the previous one, and nodes within a level run back to back. Transient buffers only
+// live from the level that first touches them to the level that last does, so buffers whose
+// lifetimes don't overlap share storage.
+class KernelGraph {
+public:
+    struct MemoryReport {
+        size_t transient_buffers = 0;
+        // Bytes if every transient buffer had storage of its own
+        size_t unaliased_bytes = 0;
+        // Bytes allocated once buffers with disjoint lifetimes share storage
+        size_t aliased_bytes = 0;
+        size_t slots = 0;
+        // Most bytes live during any one level; no assignment can go below it
+        size_t peak_live_bytes = 0;
+    };
+
+    KernelGraph() = default;
+    KernelGraph(const KernelGraph&) = delete;
+
+    // A buffer the graph owns, only needed while the graph runs
+    GraphBuffer transient(std::string name, size_t size);
+    // A buffer owned by the caller, e.g. an input, an output or state kept across runs. Never
+    // aliased, and nodes writing one are never dropped.
+    GraphBuffer external(std::string name, std::shared_ptr<Buff> buffer);
+
+    // `buffers` in binding order; `threads` as for Kompute::dispatch_threads
+    void node(
+        std::string name, KomputeKernel& kernel, ParamBlock& params,
+        std::vector<GraphBuffer> buffers, uvec3 threads
+    );
+
+    // Schedules the nodes, assigns and allocates memory (from `arena` if given) and records
+    // the command list. With `alias` false every transient buffer gets storage of its own.
+    void compile(BufferArena* arena = nullptr, bool alias = true);
+    void run(Kompute& k);
+    // Appends the compiled commands to `list`, to batch them with other work
+    void record(CommandList& list) const;
+
+    // The storage behind a buffer once compiled; null for transients no node kept
+    const std::shared_ptr<Buff>& buffer(GraphBuffer handle) const;
+    const MemoryReport& memory() const {
+        return report;
+    }
+    // Names of the scheduled nodes, one level per entry
+    std::vector<std::vector<std::string>> schedule() const;
+    size_t barriers() const {
+        return levels.empty() ? 0 : levels.size() - 1;
+    }
+
+private:
+    struct Resource {
+        std::string name;
+        size_t size = 0;
+        bool transient = false;
+        std::shared_ptr<Buff> storage;
+        // While nodes are declared: the last node that wrote it and who read it since
+        size_t writer = SIZE_MAX;
+        std::vector<size_t> readers;
+        // First and last level that uses it, once compiled
+        size_t first = SIZE_MAX;
+        size_t last = 0;
+    };
+
+    struct Node {
+        std::string name;
+        KomputeKernel* kernel;
+        ParamBlock* params;
+        std::vector<GraphBuffer> buffers;
+        std::vector<bool> writes;
+        uvec3 threads;
+        // Nodes that must run first, and the subset whose output this one reads
+        std::vector<size_t> deps;
+        std::vector<size_t> inputs;
+        bool live = false;
+        size_t level = 0;
+    };
+
+    std::vector<Resource> resources;
+    std::vector<Node> nodes;
+    // Node indices per level
+    std::vector<std::vector<size_t>> levels;
+    std::vector<std::shared_ptr<Buff>> slots;
+    MemoryReport report;
+    CommandList list;
+
+    void assign_memory(BufferArena* arena, bool alias);
+};
@@ -0,0 +1,129 @@
+#include "idx.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#include <sys/mman.h>
+}
+
+static uint32_t read_be32(const std::byte* p) {
+    return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | uint32_t(p[3]);
+}
+
+IdxFile::IdxFile(const std::filesystem::path& path) : file(path) {
+    auto bytes = file.bytes();
+    auto fail = [&](const std::string& why) {
+        throw std::runtime_error(path.string() + ": " + why);
+    };
+    if (bytes.size() < 4 || bytes[0] != std::byte(0) || bytes[1] != std::byte(0)) {
+        fail("not an IDX file");
+    }
+    // Only unsigned bytes: the type MNIST uses
+    if (bytes[2] != std::byte(0x08)) {
+        fail("unsupported element type");
+    }
+    const size_t ndims = size_t(bytes[3]);
+    const size_t header = 4 + 4 * ndims;
+    if (ndims == 0 || bytes.size() < header) {
+        fail("truncated header");
+    }
+    for (size_t d = 0; d < ndims; d++) {
+        shape.push_back(read_be32(&bytes[4 + 4 * d]));
+        if (d > 0) {
+            stride *= shape.back();
+        }
+    }
+    if (bytes.size() - header != size_t(shape[0]) * stride) {
+        fail("size does not match the dimensions");
+    }
+    items = { reinterpret_cast<const uint8_t*>(bytes.data() + header), bytes.size() - header };
+}
+
+BatchPrefetcher::BatchPrefetcher(
+    const IdxFile& images, const IdxFile& labels, size_t batch_size, uint32_t seed, size_t depth
+)
+    : batch_size(batch_size), images(images), labels(labels), slots(std::max<size_t>(depth, 1)) {
+    if (batch_size == 0) {
+        throw std::runtime_error("Batches need at least one item");
+    }
+    if (labels.count() != images.count() || labels.item_size() != 1) {
+        throw std::runtime_error("Labels don't match the images");
+    }
+    if (images.count() == 0) {
+        throw std::runtime_error("No images to batch");
+    }
+    images.advise(MADV_RANDOM);
+    for (size_t i = 0; i < slots.size(); i++) {
+        slots[i].images.resize(batch_size * images.item_size());
+        slots[i].labels.resize(batch_size);
+        empty.push_back(i);
+    }
+    worker = std::thread([this, seed] { produce(seed); });
+}
+
+BatchPrefetcher::~BatchPrefetcher() {
+    {
+        std::lock_guard lock(mtx);
+        stopping = true;
+    }
+    freed.notify_all();
+    worker.join();
+}
+
+const BatchPrefetcher::Batch& BatchPrefetcher::next() {
+    std::unique_lock lock(mtx);
+    if (held != SIZE_MAX) {
+        empty.push_back(held);
+        freed.notify_one();
+    }
+    filled.wait(lock, [&] { return !ready.empty(); });
+    held = ready.front();
+    ready.erase(ready.begin());
+    return slots[held];
+}
+
+void BatchPrefetcher::produce(uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<uint32_t> order(images.count());
+    std::iota(order.begin(), order.end(), 0);
+    const size_t item_size = images.item_size();
+
+    for (size_t epoch = 0;; epoch++) {
+        std::shuffle(order.begin(), order.end(), rng);
+        for (size_t first = 0; first < order.size(); first += batch_size) {
+            size_t slot;
+            {
+                std::unique_lock lock(mtx);
+                freed.wait(lock, [&] { return stopping || !empty.empty(); });
+                if (stopping) {
+                    return;
+                }
+                slot = empty.back();
+                empty.pop_back();
+            }
+
+            // Filled outside the lock: the slot belongs to this thread until it is ready
+            Batch& batch = slots[slot];
+            batch.count = std::min(batch_size, order.size() - first);
+            batch.epoch = epoch;
+            for (size_t i = 0; i < batch.count; i++) {
+                auto pixels = images.item(order[first + i]);
+                std::transform(
+                    pixels.begin(), pixels.end(), &batch.images[i * item_size],
+                    [](uint8_t p) { return p / 255.0f; }
+                );
+                batch.labels[i] = labels.item(order[first + i])[0];
+            }
+
+            {
+                std::lock_guard lock(mtx);
+                ready.push_back(slot);
+            }
+            filled.notify_one();
+        }
+    }
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "mapped.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+// An IDX file (the MNIST format) of unsigned bytes, mapped rather than read: opening costs the
+// same whatever the size, and pages load as items are touched. The header is validated: magic,
+// element type, and a size that matches the dimensions exactly.
+class IdxFile {
+public:
+    explicit IdxFile(const std::filesystem::path& path);
+
+    // Dimensions, outermost first; the first counts the items
+    const std::vector<uint32_t>& dims() const {
+        return shape;
+    }
+
+    size_t count() const {
+        return shape[0];
+    }
+
+    // Bytes per item: the product of the inner dimensions
+    size_t item_size() const {
+        return stride;
+    }
+
+    std::span<const uint8_t> item(size_t i) const {
+        return items.subspan(i * stride, stride);
+    }
+
+    std::span<const uint8_t> data() const {
+        return items;
+    }
+
+    void advise(int advice) const {
+        file.advise(advice);
+    }
+
+private:
+    MappedFile file;
+    std::vector<uint32_t> shape;
+    size_t stride = 1;
+    std::span<const uint8_t> items;
+};
+
+// Shuffled mini-batches of an image and a label file, gathered by a background thread into
+// contiguous buffers while the caller works on earlier ones. Images become floats in [0, 1].
+// Every epoch visits each item once in a new order; its last batch may be short.
+//
+//     BatchPrefetcher batches(images, labels, 64, seed);
+//     for (size_t i = 0; i < batches.batches_per_epoch(); i++) {
+//         auto& batch = batches.next();
+//         train(batch.images, batch.labels);
+//     }
+class BatchPrefetcher {
+public:
+    struct Batch {
+        // count * item_size floats
+        std::vector<float> images;
+        std::vector<uint8_t> labels;
+        size_t count = 0;
+        size_t epoch = 0;
+    };
+
+    // Keeps up to `depth` batches ready
+    BatchPrefetcher(
+        const IdxFile& images, const IdxFile& labels, size_t batch_size, uint32_t seed,
+        size_t depth = 4
+    );
+    ~BatchPrefetcher();
+    BatchPrefetcher(const BatchPrefetcher&) = delete;
+
+    // The next batch, waiting if it isn't ready yet. Valid until the following call.
+    const Batch& next();
+
+    size_t batches_per_epoch() const {
+        return (images.count() + batch_size - 1) / batch_size;
+    }
+
+    const size_t batch_size;
+
+private:
+    void produce(uint32_t seed);
+
+    const IdxFile& images;
+    const IdxFile& labels;
+    std::vector<Batch> slots;
+    // Slot indices, in the order they were filled or handed back
+    std::vector<size_t> ready;
+    std::vector<size_t> empty;
+    size_t held = SIZE_MAX;
+    std::mutex mtx;
+    std::condition_variable filled;
+    std::condition_variable freed;
+    bool stopping = false;
+    std::thread worker;
+};
@@ -1,16 +1,24 @@
 #include "kompute.hpp"
 
+#include <algorithm>
+#include <cctype>
 #include <cstddef>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <regex>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 extern "C" {
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GL/gl.h>
 #include <GL/glew.h>
 #include <fcntl.h>
@@ -18,26 +26,189 @@ extern "C" {
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 }
 
-KomputeKernel::KomputeKernel(const std::string& src) {
-    shader = glCreateShader(GL_COMPUTE_SHADER);
-    auto csrc = src.c_str();
-    compile(&csrc);
+ProgramCache::ProgramCache(std::filesystem::path dir) : dir(std::move(dir)) {
+    std::filesystem::create_directories(this->dir);
+}
+
+namespace {
+
+struct CacheHeader {
+    char magic[4] = { 'K', 'P', 'B', 'C' };
+    uint32_t version = 1;
+    uint32_t format = 0;
+    uint32_t length = 0;
+};
+
+uint64_t fnv1a(std::string_view data, uint64_t hash = 0xcbf29ce484222325ull) {
+    for (unsigned char c : data) {
+        hash = (hash ^ c) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+}  // namespace
+
+std::filesystem::path ProgramCache::entry(const std::string& src) {
+    // Needs a current context, so it can't be done in the constructor
+    if (driver.empty()) {
+        for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+            auto str = reinterpret_cast<const char*>(glGetString(name));
+            driver += str ? str : "";
+            driver += '\n';
+        }
+    }
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long)fnv1a(src, fnv1a(driver)));
+    return dir / (std::string(key) + ".bin");
+}
+
+bool ProgramCache::load(GLuint program, const std::string& src) {
+    std::ifstream file(entry(src), std::ios::binary | std::ios::ate);
+    // An entry is the header and exactly `length` bytes of binary; the length is checked against
+    // the file before anything is allocated for it
+    const std::streamoff size = file ? std::streamoff(file.tellg()) : 0;
+    file.seekg(0);
+    CacheHeader header;
+    CacheHeader expected;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 ||
+        header.version != expected.version ||
+        size != std::streamoff(sizeof(header)) + std::streamoff(header.length))
+    {
+        counters.misses++;
+        return false;
+    }
+    std::vector<char> binary(header.length);
+    if (!file.read(binary.data(), binary.size())) {
+        counters.misses++;
+        return false;
+    }
+
+    glProgramBinary(program, header.format, binary.data(), header.length);
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    // Failing to load a binary is not a GL error, but clear anything the driver raised anyway
+    while (glGetError() != GL_NO_ERROR) {
+    }
+    if (status != GL_TRUE) {
+        counters.rejected++;
+        counters.misses++;
+        return false;
+    }
+    counters.hits++;
+    return true;
+}
+
+void ProgramCache::store(GLuint program, const std::string& src) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+    CacheHeader header;
+    std::vector<char> binary(length);
+    glGetProgramBinary(program, length, nullptr, &header.format, binary.data());
+    header.length = length;
+    GL_CHECK_ERROR();
+
+    // Write then rename, so concurrent processes never see a partial entry
+    auto path = entry(src);
+    auto tmp = path;
+    tmp += "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(binary.data(), binary.size());
+        if (!file) {
+            std::filesystem::remove(tmp);
+            return;
+        }
+    }
+    std::filesystem::rename(tmp, path);
+    counters.stores++;
 }
 
-KomputeKernel::KomputeKernel(const std::filesystem::path& path) {
+static const char* prelude = R"(#ifndef LOCAL_SIZE_X
+#define LOCAL_SIZE_X 1
+#endif
+#ifndef LOCAL_SIZE_Y
+#define LOCAL_SIZE_Y 1
+#endif
+#ifndef LOCAL_SIZE_Z
+#define LOCAL_SIZE_Z 1
+#endif
+uniform uvec3 kompute_threads;
+#define KOMPUTE_GUARD() \
+    if (any(greaterThanEqual(gl_GlobalInvocationID, kompute_threads))) return
+)";
+
+// Inserts the defines and the prelude after #version and any #extension lines right after it,
+// then restores the line numbering so compiler messages still point into the original source.
+static std::string preprocess(const std::string& src, const Defines& defines) {
+    std::string header;
+    for (auto& [name, value] : defines) {
+        header += "#define " + name + " " + value + "\n";
+    }
+    header += prelude;
+
+    auto version = src.find("#version");
+    if (version == std::string::npos) {
+        return header + "#line 1\n" + src;
+    }
+    auto eol = src.find('\n', version);
+    // #extension directives have to come before the prelude's declarations
+    while (eol != std::string::npos && src.compare(eol + 1, 10, "#extension") == 0) {
+        eol = src.find('\n', eol + 1);
+    }
+    if (eol == std::string::npos) {
+        return src + "\n" + header;
+    }
+    auto line = std::count(src.begin(), src.begin() + eol, '\n') + 2;
+    return src.substr(0, eol + 1) + header + "#line " + std::to_string(line) + "\n" +
+           src.substr(eol + 1);
+}
+
+static std::string read_source(const std::filesystem::path& path) {
     std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Cannot open " + path.string());
+    }
     std::stringstream ss;
     ss << file.rdbuf();
-    std::string src = ss.str();
-    auto csrc = src.c_str();
-    compile(&csrc);
+    return ss.str();
+}
+
+KomputeKernel::KomputeKernel(const std::string& src, ProgramCache* cache)
+    : KomputeKernel(src, Defines{}, cache) {}
+
+KomputeKernel::KomputeKernel(const std::filesystem::path& path, ProgramCache* cache)
+    : KomputeKernel(path, Defines{}, cache) {}
+
+KomputeKernel::KomputeKernel(const std::string& src, const Defines& defines, ProgramCache* cache) {
+    compile(preprocess(src, defines), cache);
 }
 
-void KomputeKernel::compile(const char** src) {
+KomputeKernel::KomputeKernel(
+    const std::filesystem::path& path, const Defines& defines, ProgramCache* cache
+)
+    : name(path.stem().string()) {
+    compile(preprocess(read_source(path), defines), cache);
+}
+
+void KomputeKernel::compile(const std::string& src, ProgramCache* cache) {
+    shader = 0;
+    program = glCreateProgram();
+    if (cache && cache->load(program, src)) {
+        reflect(src);
+        return;
+    }
+
     shader = glCreateShader(GL_COMPUTE_SHADER);
-    glShaderSource(shader, 1, src, nullptr);
+    auto csrc = src.c_str();
+    glShaderSource(shader, 1, &csrc, nullptr);
     glCompileShader(shader);
 
     GLint status;
@@ -49,7 +220,9 @@ void KomputeKernel::compile(const char** src) {
         throw std::runtime_error("Compute shader compilation failed");
     }
 
-    program = glCreateProgram();
+    if (cache) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
     glAttachShader(program, shader);
     glLinkProgram(program);
 
@@ -60,6 +233,263 @@ void KomputeKernel::compile(const char** src) {
         std::cerr << buffer << std::endl;
         throw std::runtime_error("Shader program linking failed");
     }
+
+    if (cache) {
+        cache->store(program, src);
+    }
+    reflect(src);
+}
+
+// Evaluates the #if conditions of the kernels here: integers, macros defined as integers,
+// defined(), !, comparisons, && and ||. Other macros are 0, as in C.
+struct Condition {
+    const std::map<std::string, std::string>& macros;
+    std::string_view text;
+    size_t pos = 0;
+
+    bool accept(std::string_view token) {
+        while (pos < text.size() && std::isspace(uint8_t(text[pos]))) {
+            pos++;
+        }
+        if (text.substr(pos, token.size()) != token) {
+            return false;
+        }
+        pos += token.size();
+        return true;
+    }
+
+    std::string word() {
+        accept("");
+        size_t start = pos;
+        while (pos < text.size() && (std::isalnum(uint8_t(text[pos])) || text[pos] == '_')) {
+            pos++;
+        }
+        return std::string(text.substr(start, pos - start));
+    }
+
+    static long long number(const std::string& s) {
+        char* end = nullptr;
+        long long value = std::strtoll(s.c_str(), &end, 0);
+        return end == s.c_str() ? 0 : value;
+    }
+
+    long long primary() {
+        if (accept("!")) {
+            return !primary();
+        }
+        if (accept("(")) {
+            long long value = any();
+            accept(")");
+            return value;
+        }
+        std::string name = word();
+        if (name == "defined") {
+            bool paren = accept("(");
+            name = word();
+            if (paren) {
+                accept(")");
+            }
+            return macros.contains(name);
+        }
+        if (name.empty()) {
+            // Anything unknown ends the expression
+            pos = text.size();
+            return 0;
+        }
+        if (std::isdigit(uint8_t(name[0]))) {
+            return number(name);
+        }
+        auto it = macros.find(name);
+        return it == macros.end() ? 0 : number(it->second);
+    }
+
+    long long relational() {
+        long long value = primary();
+        while (true) {
+            if (accept("<=")) {
+                value = value <= primary();
+            } else if (accept(">=")) {
+                value = value >= primary();
+            } else if (accept("<")) {
+                value = value < primary();
+            } else if (accept(">")) {
+                value = value > primary();
+            } else {
+                return value;
+            }
+        }
+    }
+
+    long long equality() {
+        long long value = relational();
+        while (true) {
+            if (accept("==")) {
+                value = value == relational();
+            } else if (accept("!=")) {
+                value = value != relational();
+            } else {
+                return value;
+            }
+        }
+    }
+
+    long long all() {
+        long long value = equality();
+        while (accept("&&")) {
+            long long rhs = equality();
+            value = value && rhs;
+        }
+        return value;
+    }
+
+    long long any() {
+        long long value = all();
+        while (accept("||")) {
+            long long rhs = all();
+            value = value || rhs;
+        }
+        return value;
+    }
+};
+
+// `src` with the lines of inactive #if, #ifdef and #ifndef branches blanked, following the
+// #defines and #undefs that come before them
+static std::string active_source(const std::string& src) {
+    std::map<std::string, std::string> macros;
+    struct Branch {
+        bool active;
+        // Whether this or an earlier branch of the same #if was taken
+        bool taken;
+    };
+    std::vector<Branch> branches;
+    std::string out;
+    std::istringstream lines(src);
+    for (std::string line; std::getline(lines, line);) {
+        std::istringstream words(line);
+        std::string directive, name, value, rest;
+        words >> directive;
+        std::getline(words, rest);
+        std::istringstream(rest) >> name >> value;
+        name = name.substr(0, name.find('('));
+        const bool active = branches.empty() || branches.back().active;
+        const bool outer = branches.size() < 2 || branches[branches.size() - 2].active;
+        if (directive == "#if" || directive == "#ifdef" || directive == "#ifndef") {
+            bool taken = directive == "#if"      ? Condition{ macros, rest }.any() != 0
+                         : directive == "#ifdef" ? macros.contains(name)
+                                                 : !macros.contains(name);
+            branches.push_back({ active && taken, taken });
+        } else if (directive == "#elif" && !branches.empty()) {
+            Branch& branch = branches.back();
+            bool taken = !branch.taken && Condition{ macros, rest }.any() != 0;
+            branch.active = outer && taken;
+            branch.taken |= taken;
+        } else if (directive == "#else" && !branches.empty()) {
+            Branch& branch = branches.back();
+            branch.active = outer && !branch.taken;
+            branch.taken = true;
+        } else if (directive == "#endif" && !branches.empty()) {
+            branches.pop_back();
+        } else if (active && directive == "#define") {
+            macros[name] = value;
+        } else if (active && directive == "#undef") {
+            macros.erase(name);
+        } else if (active) {
+            out += line;
+        }
+        out += '\n';
+    }
+    return out;
+}
+
+// GL does not report access qualifiers, so take them from the block's declaration in the
+// branches the compiler saw.
+static bool declared_readonly(const std::string& src, const std::string& block) {
+    std::regex re("\\breadonly\\b[^;{}]*\\bbuffer\\s+" + block + "\\b");
+    return std::regex_search(src, re);
+}
+
+void KomputeKernel::reflect(const std::string& src) {
+    std::string name;
+    GLint count = 0;
+    glGetProgramInterfaceiv(program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+    for (GLint i = 0; i < count; i++) {
+        const GLenum props[] = { GL_NAME_LENGTH, GL_TYPE, GL_LOCATION, GL_ARRAY_SIZE,
+                                 GL_BLOCK_INDEX };
+        GLint vals[5];
+        glGetProgramResourceiv(program, GL_UNIFORM, i, 5, props, 5, nullptr, vals);
+        // Members of uniform blocks have no location of their own.
+        if (vals[4] != -1) {
+            continue;
+        }
+        name.resize(vals[0]);
+        glGetProgramResourceName(program, GL_UNIFORM, i, vals[0], nullptr, name.data());
+        name.resize(vals[0] - 1);
+        // Arrays are reported as "name[0]"
+        if (name.ends_with("[0]")) {
+            name.resize(name.size() - 3);
+        }
+        uniforms.push_back({ name, vals[2], static_cast<GLenum>(vals[1]), vals[3] });
+    }
+
+    const std::string active = active_source(src);
+    glGetProgramInterfaceiv(program, GL_SHADER_STORAGE_BLOCK, GL_ACTIVE_RESOURCES, &count);
+    for (GLint i = 0; i < count; i++) {
+        const GLenum props[] = { GL_NAME_LENGTH, GL_BUFFER_BINDING };
+        GLint vals[2];
+        glGetProgramResourceiv(program, GL_SHADER_STORAGE_BLOCK, i, 2, props, 2, nullptr, vals);
+        name.resize(vals[0]);
+        glGetProgramResourceName(
+            program, GL_SHADER_STORAGE_BLOCK, i, vals[0], nullptr, name.data()
+        );
+        name.resize(vals[0] - 1);
+        buffers.push_back({ name, static_cast<GLuint>(vals[1]), declared_readonly(active, name) });
+    }
+
+    GLint size[3];
+    glGetProgramiv(program, GL_COMPUTE_WORK_GROUP_SIZE, size);
+    local_size = { uint32_t(size[0]), uint32_t(size[1]), uint32_t(size[2]) };
+    if (auto info = uniform("kompute_threads")) {
+        threads_location = info->location;
+    }
+    GL_CHECK_ERROR();
+}
+
+const UniformInfo* KomputeKernel::uniform(std::string_view name) const {
+    for (auto& u : uniforms) {
+        if (u.name == name) {
+            return &u;
+        }
+    }
+    return nullptr;
+}
+
+const BufferBinding* KomputeKernel::buffer(std::string_view name) const {
+    for (auto& b : buffers) {
+        if (b.name == name) {
+            return &b;
+        }
+    }
+    return nullptr;
+}
+
+void KomputeKernel::check_buffers(size_t count) const {
+    for (auto& b : buffers) {
+        if (b.binding >= count) {
+            throw std::runtime_error(
+                "Kernel " + name + " uses " + b.name + " at binding " + std::to_string(b.binding) +
+                " but only " + std::to_string(count) + " buffers were given"
+            );
+        }
+    }
+}
+
+const BufferBinding* KomputeKernel::binding(GLuint idx) const {
+    for (auto& b : buffers) {
+        if (b.binding == idx) {
+            return &b;
+        }
+    }
+    return nullptr;
 }
 
 KomputeKernel::~KomputeKernel() {
@@ -67,18 +497,339 @@ KomputeKernel::~KomputeKernel() {
     glDeleteProgram(program);
 }
 
-Kompute::Kompute(std::string dev) {
-    dvr_fd = open(dev.c_str(), O_RDWR | O_CLOEXEC);
-    if (dvr_fd < 0) {
-        throw std::runtime_error("Cannot open " + dev);
+void KomputeKernel::set_threads(uvec3 count) {
+    if (threads_location < 0 || threads == count) {
+        return;
+    }
+    glProgramUniform3ui(program, threads_location, count[0], count[1], count[2]);
+    threads = count;
+}
+
+void ParamBlock::apply() {
+    bool all = kernel.applied != this;
+    for (auto& slot : slots) {
+        if (!all && !slot.dirty) {
+            continue;
+        }
+        auto p = kernel.program;
+        auto f = reinterpret_cast<const GLfloat*>(storage.data() + slot.offset);
+        auto i = reinterpret_cast<const GLint*>(storage.data() + slot.offset);
+        auto u = reinterpret_cast<const GLuint*>(storage.data() + slot.offset);
+        switch (slot.type) {
+            case GL_FLOAT:
+                glProgramUniform1fv(p, slot.location, slot.count, f);
+                break;
+            case GL_FLOAT_VEC2:
+                glProgramUniform2fv(p, slot.location, slot.count, f);
+                break;
+            case GL_FLOAT_VEC3:
+                glProgramUniform3fv(p, slot.location, slot.count, f);
+                break;
+            case GL_FLOAT_VEC4:
+                glProgramUniform4fv(p, slot.location, slot.count, f);
+                break;
+            case GL_INT:
+                glProgramUniform1iv(p, slot.location, slot.count, i);
+                break;
+            case GL_INT_VEC2:
+                glProgramUniform2iv(p, slot.location, slot.count, i);
+                break;
+            case GL_INT_VEC3:
+                glProgramUniform3iv(p, slot.location, slot.count, i);
+                break;
+            case GL_INT_VEC4:
+                glProgramUniform4iv(p, slot.location, slot.count, i);
+                break;
+            case GL_UNSIGNED_INT:
+                glProgramUniform1uiv(p, slot.location, slot.count, u);
+                break;
+            case GL_UNSIGNED_INT_VEC2:
+                glProgramUniform2uiv(p, slot.location, slot.count, u);
+                break;
+            case GL_UNSIGNED_INT_VEC3:
+                glProgramUniform3uiv(p, slot.location, slot.count, u);
+                break;
+            case GL_UNSIGNED_INT_VEC4:
+                glProgramUniform4uiv(p, slot.location, slot.count, u);
+                break;
+            case GL_FLOAT_MAT4:
+                glProgramUniformMatrix4fv(p, slot.location, slot.count, GL_FALSE, f);
+                break;
+            default:
+                throw std::runtime_error("Unsupported uniform type");
+        }
+        slot.dirty = false;
+    }
+    kernel.applied = this;
+}
+
+Readback::Readback(Readback&& other) noexcept
+    : pool(std::exchange(other.pool, nullptr)), idx(other.idx), dst(other.dst) {}
+
+Readback& Readback::operator=(Readback&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool = std::exchange(other.pool, nullptr);
+        idx = other.idx;
+        dst = other.dst;
+    }
+    return *this;
+}
+
+Readback::~Readback() {
+    release();
+}
+
+bool Readback::ready() {
+    if (!pool) {
+        return true;
+    }
+    GLint status = GL_UNSIGNALED;
+    glGetSynciv(pool->staging[idx].fence, GL_SYNC_STATUS, 1, nullptr, &status);
+    return status == GL_SIGNALED;
+}
+
+void Readback::wait() {
+    if (!release()) {
+        throw std::runtime_error("glClientWaitSync failed");
+    }
+}
+
+bool Readback::release() noexcept {
+    if (!pool) {
+        return true;
     }
+    TraceScope trace(TraceKind::Wait, "readback", dst.size());
+    auto& s = pool->staging[idx];
+    GLenum res = GL_TIMEOUT_EXPIRED;
+    while (res == GL_TIMEOUT_EXPIRED) {
+        res = glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    }
+    glDeleteSync(s.fence);
+    s.fence = nullptr;
+    s.busy = false;
+    pool = nullptr;
+    if (res == GL_WAIT_FAILED) {
+        return false;
+    }
+    std::memcpy(dst.data(), s.ptr, dst.size());
+    return true;
+}
+
+ReadbackPool::~ReadbackPool() {
+    for (auto& s : staging) {
+        if (s.fence) {
+            glDeleteSync(s.fence);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, s.ssbo);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glDeleteBuffers(1, &s.ssbo);
+    }
+}
+
+size_t ReadbackPool::acquire(size_t size) {
+    size_t idx = staging.size();
+    for (size_t i = 0; i < staging.size(); i++) {
+        if (staging[i].busy) {
+            continue;
+        }
+        if (staging[i].capacity >= size) {
+            idx = i;
+            break;
+        }
+        // Too small, but can be regrown if nothing better turns up
+        if (idx == staging.size()) {
+            idx = i;
+        }
+    }
+    if (idx == staging.size()) {
+        staging.emplace_back();
+    }
+
+    auto& s = staging[idx];
+    if (s.capacity < size) {
+        if (s.ssbo) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, s.ssbo);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glDeleteBuffers(1, &s.ssbo);
+        }
+        const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &s.ssbo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, s.ssbo);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags | GL_CLIENT_STORAGE_BIT);
+        s.ptr = static_cast<std::byte*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+        s.capacity = size;
+        GL_CHECK_ERROR();
+    }
+    s.busy = true;
+    return idx;
+}
+
+Readback ReadbackPool::read(const Buff& src, std::span<std::byte> dst) {
+    // Make shader writes visible to the copy
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    return enqueue(src, dst);
+}
+
+Readback ReadbackPool::enqueue(const Buff& src, std::span<std::byte> dst) {
+    if (dst.size() > src.size) {
+        throw std::runtime_error("Readback is larger than the buffer");
+    }
+    size_t idx = acquire(dst.size());
+    auto& s = staging[idx];
+
+    GpuSpan trace(TraceKind::Readback, "readback", dst.size());
+    glBindBuffer(GL_COPY_READ_BUFFER, src.ssbo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, s.ssbo);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, src.offset, 0, dst.size());
+    // Make the copy visible to the mapping
+    glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+    s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Get the work to the GPU now rather than when someone first waits on it.
+    glFlush();
+    GL_CHECK_ERROR();
+    return { this, idx, dst };
+}
+
+StagingPool::StagingPool(size_t block_size, size_t count)
+    // The shaders reading these address whole uints
+    : block_size((block_size + 63) & ~size_t(63)), blocks(count) {
+    const GLbitfield flags =
+        GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    for (auto& block : blocks) {
+        glGenBuffers(1, &block.ssbo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, block.ssbo);
+        glBufferStorage(
+            GL_COPY_WRITE_BUFFER, this->block_size, nullptr, flags | GL_CLIENT_STORAGE_BIT
+        );
+        block.ptr = static_cast<std::byte*>(
+            glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, this->block_size, flags)
+        );
+        block.size = this->block_size;
+        GL_CHECK_ERROR();
+        free_blocks.push_back(&block);
+    }
+}
 
-    gbm = gbm_create_device(dvr_fd);
-    if (!gbm) {
-        throw std::runtime_error("Cannot create GBM device");
+StagingPool::~StagingPool() {
+    collect(true);
+    for (auto& block : blocks) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, block.ssbo);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glDeleteBuffers(1, &block.ssbo);
     }
+}
+
+StagingPool::Block* StagingPool::acquire() {
+    std::lock_guard l(mtx);
+    if (free_blocks.empty()) {
+        return nullptr;
+    }
+    Block* block = free_blocks.back();
+    free_blocks.pop_back();
+    return block;
+}
 
-    egl_display = eglGetDisplay(gbm);
+void StagingPool::release(Block* block) {
+    std::lock_guard l(mtx);
+    free_blocks.push_back(block);
+}
+
+StagingPool::Block* StagingPool::find(const void* ptr) {
+    auto p = static_cast<const std::byte*>(ptr);
+    for (auto& block : blocks) {
+        if (p >= block.ptr && p < block.ptr + block_size) {
+            return &block;
+        }
+    }
+    return nullptr;
+}
+
+void StagingPool::defer(std::function<void()> release) {
+    deferred.emplace_back(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), std::move(release));
+    glFlush();
+}
+
+void StagingPool::collect(bool wait) {
+    // Fences signal in submission order
+    size_t done = 0;
+    for (; done < deferred.size(); done++) {
+        GLenum res = glClientWaitSync(
+            deferred[done].first, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000 : 0
+        );
+        while (wait && res == GL_TIMEOUT_EXPIRED) {
+            res = glClientWaitSync(deferred[done].first, 0, 1000000000);
+        }
+        if (res == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+        glDeleteSync(deferred[done].first);
+        deferred[done].second();
+    }
+    deferred.erase(deferred.begin(), deferred.begin() + done);
+}
+
+GpuTimer::GpuTimer() {
+    glGenQueries(GLsizei(queries.size()), queries.data());
+}
+
+GpuTimer::~GpuTimer() {
+    glDeleteQueries(GLsizei(queries.size()), queries.data());
+}
+
+void GpuTimer::begin() {
+    glQueryCounter(queries[0], GL_TIMESTAMP);
+    glBeginQuery(GL_TIME_ELAPSED, queries[2]);
+}
+
+void GpuTimer::end() {
+    glEndQuery(GL_TIME_ELAPSED);
+    glQueryCounter(queries[1], GL_TIMESTAMP);
+}
+
+bool GpuTimer::ready() const {
+    GLuint available = 0;
+    glGetQueryObjectuiv(queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+    return available != 0;
+}
+
+double GpuTimer::elapsed_ms() const {
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v(queries[2], GL_QUERY_RESULT, &ns);
+    return ns / 1e6;
+}
+
+double GpuTimer::span_ms() const {
+    GLuint64 start = 0;
+    GLuint64 end = 0;
+    glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &end);
+    return (end - start) / 1e6;
+}
+
+Kompute::Kompute(std::string dev) {
+    if (dev == "surfaceless") {
+        auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+            eglGetProcAddress("eglGetPlatformDisplayEXT")
+        );
+        if (!get_platform_display) {
+            throw std::runtime_error("eglGetPlatformDisplayEXT is not available");
+        }
+        egl_display =
+            get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    } else {
+        dvr_fd = open(dev.c_str(), O_RDWR | O_CLOEXEC);
+        if (dvr_fd < 0) {
+            throw std::runtime_error("Cannot open " + dev);
+        }
+
+        gbm = gbm_create_device(dvr_fd);
+        if (!gbm) {
+            throw std::runtime_error("Cannot create GBM device");
+        }
+
+        egl_display = eglGetDisplay(gbm);
+    }
     if (egl_display == EGL_NO_DISPLAY) {
         throw std::runtime_error("Failed to get EGL display");
     }
@@ -88,11 +839,13 @@ Kompute::Kompute(std::string dev) {
     }
 
     EGLint configAttribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
-    if (!eglChooseConfig(egl_display, configAttribs, &egl_config, 1, &num_configs) ||
-        num_configs == 0)
-    {
+    if (!eglChooseConfig(egl_display, configAttribs, &egl_config, 1, &num_configs)) {
         throw std::runtime_error("Failed to choose EGL config");
     }
+    // Surfaceless displays expose no configs; compute needs none (EGL_KHR_no_config_context).
+    if (num_configs == 0) {
+        egl_config = EGL_NO_CONFIG_KHR;
+    }
 
     eglBindAPI(EGL_OPENGL_API);
     egl_context = eglCreateContext(egl_display, egl_config, EGL_NO_CONTEXT, NULL);
@@ -113,54 +866,56 @@ Kompute::Kompute(std::string dev) {
 Kompute::~Kompute() {
     eglDestroyContext(egl_display, egl_context);
     eglTerminate(egl_display);
-    gbm_device_destroy(gbm);
-    close(dvr_fd);
+    if (gbm) {
+        gbm_device_destroy(gbm);
+    }
+    if (dvr_fd >= 0) {
+        close(dvr_fd);
+    }
 };
 
+void Kompute::bind(KomputeKernel& kernel, std::span<const std::shared_ptr<Buff>> buffers) {
+    kernel.check_buffers(buffers.size());
+    for (GLuint idx = 0; idx < buffers.size(); idx++) {
+        buffers[idx]->bind(idx);
+    }
+    glUseProgram(kernel.program);
+}
+
 void Kompute::dispatch(
-    KomputeKernel& kernel, const std::vector<Uniform> uniforms,
-    const std::vector<std::shared_ptr<Buff>> buffers, int x, int y, int z
+    KomputeKernel& kernel, const std::vector<Uniform>& uniforms,
+    const std::vector<std::shared_ptr<Buff>>& buffers, int x, int y, int z
 ) {
     std::lock_guard l(mtx);
-    int idx = 0;
-    for (auto& buffer : buffers) {
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, idx++, buffer->ssbo);
-    }
-    glUseProgram(kernel.program);
+    TraceScope trace(TraceKind::Dispatch, kernel.name);
+    bind(kernel, buffers);
+    // Values set here bypass any ParamBlock, so the next one has to upload everything.
+    kernel.applied = nullptr;
+    kernel.set_threads({ x * kernel.local_size[0], y * kernel.local_size[1],
+                         z * kernel.local_size[2] });
 
     for (auto& uniform : uniforms) {
+        auto info = kernel.uniform(uniform.name);
+        // Unknown or optimised-out uniforms are ignored, as glUniform* does for location -1.
+        GLint location = info ? info->location : -1;
         if (std::holds_alternative<float>(uniform.val)) {
-            glUniform1f(
-                glGetUniformLocation(kernel.program, uniform.name.c_str()),
-                std::get<float>(uniform.val)
-            );
+            glUniform1f(location, std::get<float>(uniform.val));
         } else if (std::holds_alternative<int>(uniform.val)) {
-            glUniform1i(
-                glGetUniformLocation(kernel.program, uniform.name.c_str()),
-                std::get<int>(uniform.val)
-            );
+            glUniform1i(location, std::get<int>(uniform.val));
         } else if (std::holds_alternative<std::vector<float>>(uniform.val)) {
             auto& val = std::get<std::vector<float>>(uniform.val);
             switch (val.size()) {
                 case 1:
-                    glUniform1f(glGetUniformLocation(kernel.program, uniform.name.c_str()), val[0]);
+                    glUniform1f(location, val[0]);
                     break;
                 case 2:
-                    glUniform2f(
-                        glGetUniformLocation(kernel.program, uniform.name.c_str()), val[0], val[1]
-                    );
+                    glUniform2f(location, val[0], val[1]);
                     break;
                 case 3:
-                    glUniform3f(
-                        glGetUniformLocation(kernel.program, uniform.name.c_str()), val[0], val[1],
-                        val[2]
-                    );
+                    glUniform3f(location, val[0], val[1], val[2]);
                     break;
                 case 4:
-                    glUniform4f(
-                        glGetUniformLocation(kernel.program, uniform.name.c_str()), val[0], val[1],
-                        val[2], val[3]
-                    );
+                    glUniform4f(location, val[0], val[1], val[2], val[3]);
                     break;
                 default:
                     throw std::runtime_error("Unsupported uniform vector size");
@@ -169,24 +924,16 @@ void Kompute::dispatch(
             auto& val = std::get<std::vector<int>>(uniform.val);
             switch (val.size()) {
                 case 1:
-                    glUniform1i(glGetUniformLocation(kernel.program, uniform.name.c_str()), val[0]);
+                    glUniform1i(location, val[0]);
                     break;
                 case 2:
-                    glUniform2i(
-                        glGetUniformLocation(kernel.program, uniform.name.c_str()), val[0], val[1]
-                    );
+                    glUniform2i(location, val[0], val[1]);
                     break;
                 case 3:
-                    glUniform3i(
-                        glGetUniformLocation(kernel.program, uniform.name.c_str()), val[0], val[1],
-                        val[2]
-                    );
+                    glUniform3i(location, val[0], val[1], val[2]);
                     break;
                 case 4:
-                    glUniform4i(
-                        glGetUniformLocation(kernel.program, uniform.name.c_str()), val[0], val[1],
-                        val[2], val[3]
-                    );
+                    glUniform4i(location, val[0], val[1], val[2], val[3]);
                     break;
                 default:
                     throw std::runtime_error("Unsupported uniform vector size");
@@ -196,7 +943,261 @@ void Kompute::dispatch(
         }
     }
 
-    glDispatchCompute(x, y, z);
+    {
+        GpuSpan span(
+            TraceKind::Dispatch, kernel.name, 0, { uint32_t(x), uint32_t(y), uint32_t(z) }
+        );
+        glDispatchCompute(x, y, z);
+    }
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    GL_CHECK_ERROR();
+}
+
+static uvec3 groups_for(const KomputeKernel& kernel, int x, int y, int z) {
+    auto& local = kernel.local_size;
+    return { (x + local[0] - 1) / local[0], (y + local[1] - 1) / local[1],
+             (z + local[2] - 1) / local[2] };
+}
+
+void Kompute::run(
+    KomputeKernel& kernel, ParamBlock& params, std::span<const std::shared_ptr<Buff>> buffers,
+    uvec3 groups, uvec3 threads
+) {
+    if (&params.kernel != &kernel) {
+        throw std::runtime_error("Parameter block belongs to another kernel");
+    }
+    std::lock_guard l(mtx);
+    TraceScope trace(TraceKind::Dispatch, kernel.name, 0, groups);
+    bind(kernel, buffers);
+    params.apply();
+    kernel.set_threads(threads);
+
+    {
+        GpuSpan span(TraceKind::Dispatch, kernel.name, 0, groups);
+        glDispatchCompute(groups[0], groups[1], groups[2]);
+    }
     glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
     GL_CHECK_ERROR();
 }
+
+void Kompute::dispatch(
+    KomputeKernel& kernel, ParamBlock& params, std::span<const std::shared_ptr<Buff>> buffers,
+    int x, int y, int z
+) {
+    auto& local = kernel.local_size;
+    run(kernel, params, buffers, { uint32_t(x), uint32_t(y), uint32_t(z) },
+        { x * local[0], y * local[1], z * local[2] });
+}
+
+void Kompute::dispatch_threads(
+    KomputeKernel& kernel, ParamBlock& params, std::span<const std::shared_ptr<Buff>> buffers,
+    int x, int y, int z
+) {
+    run(kernel, params, buffers, groups_for(kernel, x, y, z),
+        { uint32_t(x), uint32_t(y), uint32_t(z) });
+}
+
+void CommandList::dispatch(
+    KomputeKernel& kernel, ParamBlock& params, std::span<const std::shared_ptr<Buff>> buffers,
+    int x, int y, int z
+) {
+    if (&params.kernel != &kernel) {
+        throw std::runtime_error("Parameter block belongs to another kernel");
+    }
+    kernel.check_buffers(buffers.size());
+    auto& local = kernel.local_size;
+    Dispatch cmd{ &kernel, &params, {}, x, y, z, { x * local[0], y * local[1], z * local[2] } };
+    cmd.buffers.reserve(buffers.size());
+    for (auto& buffer : buffers) {
+        cmd.buffers.push_back(buffer.get());
+    }
+    commands.push_back(std::move(cmd));
+}
+
+void CommandList::dispatch_threads(
+    KomputeKernel& kernel, ParamBlock& params, std::span<const std::shared_ptr<Buff>> buffers,
+    int x, int y, int z
+) {
+    auto groups = groups_for(kernel, x, y, z);
+    dispatch(kernel, params, buffers, groups[0], groups[1], groups[2]);
+    std::get<Dispatch>(commands.back()).threads = { uint32_t(x), uint32_t(y), uint32_t(z) };
+}
+
+void CommandList::dispatch_indirect(
+    KomputeKernel& kernel, ParamBlock& params, std::span<const std::shared_ptr<Buff>> buffers,
+    const Buff& args, size_t offset
+) {
+    dispatch(kernel, params, buffers, 0, 0, 0);
+    auto& cmd = std::get<Dispatch>(commands.back());
+    cmd.args = &args;
+    cmd.args_offset = offset;
+}
+
+void CommandList::copy(
+    const Buff& src, Buff& dst, size_t size, size_t src_offset, size_t dst_offset
+) {
+    commands.push_back(Copy{ &src, &dst, size, src_offset, dst_offset });
+}
+
+void CommandList::fill(Buff& dst, uint32_t value, size_t size, size_t offset) {
+    commands.push_back(Fill{ &dst, value, size, offset });
+}
+
+void CommandList::read(
+    ReadbackPool& pool, const Buff& src, std::span<std::byte> dst, Readback& handle
+) {
+    commands.push_back(Read{ &pool, &src, dst, &handle });
+}
+
+void CommandList::barrier(GLbitfield bits) {
+    commands.push_back(Barrier{ bits });
+}
+
+Kompute::Range Kompute::range_of(const Buff& buffer) {
+    // A bare Buff without a size stands for the whole GL buffer
+    if (buffer.size == 0) {
+        return { buffer.ssbo, 0, SIZE_MAX };
+    }
+    return { buffer.ssbo, buffer.offset, buffer.offset + buffer.size };
+}
+
+void Kompute::submit(CommandList& list) {
+    CommandList* lists[] = { &list };
+    submit(lists);
+}
+
+void Kompute::submit(std::span<CommandList* const> lists) {
+    std::lock_guard l(mtx);
+    TraceScope trace(TraceKind::Submit, "submit");
+    if (auto profiler = Profiler::active()) {
+        profiler->collect();
+    }
+
+    // Only shader writes are incoherent. Every range written by a dispatch needs a shader
+    // storage barrier before the next shader touches it, a buffer update barrier before a copy
+    // reads or writes it and a command barrier before an indirect dispatch reads it; each
+    // barrier covers every write issued before it.
+    shader_hazards.clear();
+    update_hazards.clear();
+    command_hazards.clear();
+    auto pending = [](const std::vector<Range>& v, const Range& r) {
+        return std::any_of(v.begin(), v.end(), [&](const Range& h) { return h.overlaps(r); });
+    };
+    auto sync_update = [&](std::initializer_list<Range> ranges) {
+        for (auto& r : ranges) {
+            if (pending(update_hazards, r)) {
+                glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+                update_hazards.clear();
+                return;
+            }
+        }
+    };
+
+    // Binding state is only trusted within one submit: deleted buffer names get reused.
+    GLuint program = 0;
+    bound.clear();
+
+    for (CommandList* list : lists) {
+        for (auto& command : list->commands) {
+            if (auto cmd = std::get_if<CommandList::Dispatch>(&command)) {
+                auto& kernel = *cmd->kernel;
+                for (auto buffer : cmd->buffers) {
+                    if (pending(shader_hazards, range_of(*buffer))) {
+                        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                        shader_hazards.clear();
+                        break;
+                    }
+                }
+                if (bound.size() < cmd->buffers.size()) {
+                    bound.resize(cmd->buffers.size());
+                }
+                for (GLuint idx = 0; idx < cmd->buffers.size(); idx++) {
+                    auto buffer = cmd->buffers[idx];
+                    auto range = range_of(*buffer);
+                    if (bound[idx] != range) {
+                        buffer->bind(idx);
+                        bound[idx] = range;
+                    }
+                    auto binding = kernel.binding(idx);
+                    if (binding && !binding->readonly) {
+                        if (!pending(shader_hazards, range)) {
+                            shader_hazards.push_back(range);
+                        }
+                        if (!pending(update_hazards, range)) {
+                            update_hazards.push_back(range);
+                        }
+                        if (!pending(command_hazards, range)) {
+                            command_hazards.push_back(range);
+                        }
+                    }
+                }
+                if (program != kernel.program) {
+                    glUseProgram(kernel.program);
+                    program = kernel.program;
+                }
+                cmd->params->apply();
+                kernel.set_threads(cmd->threads);
+                GpuSpan span(
+                    TraceKind::Dispatch, kernel.name, 0,
+                    { uint32_t(cmd->x), uint32_t(cmd->y), uint32_t(cmd->z) }
+                );
+                if (cmd->args) {
+                    size_t offset = cmd->args->offset + cmd->args_offset;
+                    if (pending(command_hazards, { cmd->args->ssbo, offset, offset + 12 })) {
+                        glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+                        command_hazards.clear();
+                    }
+                    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, cmd->args->ssbo);
+                    glDispatchComputeIndirect(GLintptr(offset));
+                } else {
+                    glDispatchCompute(cmd->x, cmd->y, cmd->z);
+                }
+            } else if (auto cmd = std::get_if<CommandList::Copy>(&command)) {
+                size_t size =
+                    cmd->size == SIZE_MAX ? cmd->src->size - cmd->src_offset : cmd->size;
+                size_t src_offset = cmd->src->offset + cmd->src_offset;
+                size_t dst_offset = cmd->dst->offset + cmd->dst_offset;
+                sync_update({ { cmd->src->ssbo, src_offset, src_offset + size },
+                              { cmd->dst->ssbo, dst_offset, dst_offset + size } });
+                GpuSpan span(TraceKind::Copy, "copy", size);
+                glBindBuffer(GL_COPY_READ_BUFFER, cmd->src->ssbo);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, cmd->dst->ssbo);
+                glCopyBufferSubData(
+                    GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, src_offset, dst_offset, size
+                );
+            } else if (auto cmd = std::get_if<CommandList::Fill>(&command)) {
+                size_t size = cmd->size == SIZE_MAX ? cmd->dst->size - cmd->offset : cmd->size;
+                size_t offset = cmd->dst->offset + cmd->offset;
+                sync_update({ { cmd->dst->ssbo, offset, offset + size } });
+                GpuSpan span(TraceKind::Copy, "fill", size);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, cmd->dst->ssbo);
+                glClearBufferSubData(
+                    GL_COPY_WRITE_BUFFER, GL_R32UI, offset, size, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                    &cmd->value
+                );
+            } else if (auto cmd = std::get_if<CommandList::Read>(&command)) {
+                sync_update({ range_of(*cmd->src) });
+                *cmd->handle = cmd->pool->enqueue(*cmd->src, cmd->dst);
+            } else if (auto cmd = std::get_if<CommandList::Barrier>(&command)) {
+                glMemoryBarrier(cmd->bits);
+                if (cmd->bits & GL_SHADER_STORAGE_BARRIER_BIT) {
+                    shader_hazards.clear();
+                }
+                if (cmd->bits & GL_BUFFER_UPDATE_BARRIER_BIT) {
+                    update_hazards.clear();
+                }
+                if (cmd->bits & GL_COMMAND_BARRIER_BIT) {
+                    command_hazards.clear();
+                }
+            }
+        }
+    }
+
+    // Leave results visible to whatever runs after the lists, like a single dispatch does.
+    if (!shader_hazards.empty()) {
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    } else if (!update_hazards.empty()) {
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    }
+    GL_CHECK_ERROR();
+}
\ No newline at end of file
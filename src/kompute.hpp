@@ -1,11 +1,23 @@
 #pragma once
 
+#include "packed.hpp"
+#include "profile.hpp"
+
+#include <array>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
+#include <functional>
 #include <memory>
 #include <mutex>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
 #include <vector>
 
 extern "C" {
@@ -23,8 +35,85 @@ extern "C" {
     } while (0)
 
 struct Buff {
-    GLuint ssbo;
+    GLuint ssbo = 0;
     size_t size = 0;
+    // Where the buffer starts in `ssbo`; nonzero for ranges sub-allocated from a BufferArena
+    size_t offset = 0;
+
+    // Binds just this buffer's range to shader storage binding `index`
+    void bind(GLuint index) const {
+        if (size > 0) {
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, index, ssbo, offset, size);
+        } else {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, ssbo);
+        }
+    }
+};
+
+class ReadbackPool;
+
+// Handle to an in-flight readback. The data lands in the destination given to
+// ReadbackPool::read() once wait() returns; an unwaited handle waits when destroyed.
+class Readback {
+public:
+    Readback() = default;
+    Readback(Readback&& other) noexcept;
+    Readback& operator=(Readback&& other) noexcept;
+    Readback(const Readback&) = delete;
+    ~Readback();
+
+    bool valid() const {
+        return pool != nullptr;
+    }
+
+    // Non-blocking: true once the GPU has finished the copy.
+    bool ready();
+    void wait();
+
+private:
+    friend class ReadbackPool;
+
+    Readback(ReadbackPool* pool, size_t idx, std::span<std::byte> dst)
+        : pool(pool), idx(idx), dst(dst) {}
+
+    // wait() without the exception, for the destructor and move assignment: frees the staging
+    // buffer either way and returns false if the wait failed, leaving dst as it was.
+    bool release() noexcept;
+
+    ReadbackPool* pool = nullptr;
+    size_t idx = 0;
+    std::span<std::byte> dst;
+};
+
+// Persistently mapped staging buffers for asynchronous readback. read() copies on the GPU into a
+// free staging buffer and fences it, so the CPU only blocks if it asks for the data before the
+// GPU got there. Staging buffers are reused; the pool only grows when every one is in flight.
+class ReadbackPool {
+public:
+    ReadbackPool() = default;
+    ~ReadbackPool();
+    ReadbackPool(const ReadbackPool&) = delete;
+
+    // Reads the first dst.size() bytes of src.
+    Readback read(const Buff& src, std::span<std::byte> dst);
+
+private:
+    friend class Readback;
+    friend class Kompute;
+
+    struct Staging {
+        GLuint ssbo = 0;
+        std::byte* ptr = nullptr;
+        size_t capacity = 0;
+        GLsync fence = nullptr;
+        bool busy = false;
+    };
+
+    std::vector<Staging> staging;
+
+    size_t acquire(size_t size);
+    // read() without the barrier, for callers that already track hazards.
+    Readback enqueue(const Buff& src, std::span<std::byte> dst);
 };
 
 template <typename T>
@@ -39,40 +128,335 @@ struct StorageBuff : public Buff {
 
     StorageBuff(const StorageBuff&) = delete;
 
+    // Packed element types (packed.hpp) are rounded up to whole 32-bit words, which shaders
+    // declare them as
     void set_data(const std::span<const T> data, int usage = GL_STATIC_COPY) {
-        this->size = data.size_bytes();
+        TraceScope trace(TraceKind::Upload, "set_data", data.size_bytes());
+        this->size = (data.size_bytes() + 3) & ~size_t(3);
+        this->usage = usage;
         glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, size, data.data(), usage);
+        if (size == data.size_bytes()) {
+            glBufferData(GL_SHADER_STORAGE_BUFFER, size, data.data(), usage);
+        } else {
+            glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, usage);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, data.size_bytes(), data.data());
+        }
         GL_CHECK_ERROR();
     }
 
+    // Packed element types: converts on the host
+    void set_data(std::span<const float> data, int usage = GL_STATIC_COPY)
+        requires(!std::is_same_v<T, float> && requires { PackingOf<T>::value; })
+    {
+        std::vector<T> packed(data.size());
+        pack(data, std::span(packed));
+        set_data(std::span<const T>(packed), usage);
+    }
+
+    // Reallocates only when the size or usage changes; the contents are undefined either way.
     void set_size(size_t size, int usage = GL_STATIC_COPY) {
+        if (this->size == size && this->usage == usage) {
+            return;
+        }
         this->size = size;
+        this->usage = usage;
         glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_STATIC_COPY);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, usage);
         GL_CHECK_ERROR();
     }
 
     std::vector<T> get_data() {
+        TraceScope trace(TraceKind::Readback, "get_data", size);
         std::vector<T> data(size / sizeof(T));
         glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
         glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data.data());
         GL_CHECK_ERROR();
         return data;
     }
+
+    // Packed element types: every element converted to float, word padding included
+    std::vector<float> get_floats()
+        requires(!std::is_same_v<T, float> && requires { PackingOf<T>::value; })
+    {
+        auto packed = get_data();
+        std::vector<float> data(packed.size());
+        unpack(std::span<const T>(packed), std::span(data));
+        return data;
+    }
+
+    // Asynchronous variant: reads into caller-owned memory without stalling or allocating.
+    Readback get_data(ReadbackPool& pool, std::span<T> dst) {
+        return pool.read(*this, std::as_writable_bytes(dst));
+    }
+
+private:
+    int usage = 0;
 };
 
+// Upload buffer backed by immutable, persistently mapped storage split into `slots` copies.
+// Each next() fences the slot the GPU was just given, moves on to the oldest one and waits for
+// its fence, so the CPU writes straight into memory the driver never reallocates or copies.
+template <typename T>
+struct RingBuff : public Buff {
+    explicit RingBuff(size_t slots = 3) : ring(slots) {
+        if (slots == 0) {
+            throw std::runtime_error("RingBuff needs at least one slot");
+        }
+    }
+
+    ~RingBuff() {
+        release();
+    }
+
+    RingBuff(const RingBuff&) = delete;
+
+    // Makes the next slot current with room for `count` elements and returns its mapping.
+    // Storage is only reallocated when `count` outgrows the current capacity.
+    std::span<T> next(size_t count) {
+        if (count > capacity) {
+            reserve(count);
+        } else if (ring[current].ssbo) {
+            ring[current].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            current = (current + 1) % ring.size();
+            wait(ring[current]);
+        }
+        ssbo = ring[current].ssbo;
+        size = count * sizeof(T);
+        return { ring[current].ptr, count };
+    }
+
+    void set_data(const std::span<const T> data) {
+        TraceScope trace(TraceKind::Upload, "ring", data.size_bytes());
+        auto dst = next(data.size());
+        std::memcpy(dst.data(), data.data(), data.size_bytes());
+    }
+
+    void reserve(size_t count) {
+        release();
+        capacity = count;
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        for (auto& slot : ring) {
+            glGenBuffers(1, &slot.ssbo);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot.ssbo);
+            glBufferStorage(GL_SHADER_STORAGE_BUFFER, count * sizeof(T), nullptr, flags);
+            slot.ptr = static_cast<T*>(
+                glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(T), flags)
+            );
+            GL_CHECK_ERROR();
+        }
+        current = 0;
+    }
+
+    size_t slots() const {
+        return ring.size();
+    }
+
+private:
+    struct Slot {
+        GLuint ssbo = 0;
+        T* ptr = nullptr;
+        GLsync fence = nullptr;
+    };
+
+    std::vector<Slot> ring;
+    size_t current = 0;
+    size_t capacity = 0;
+
+    static void wait(Slot& slot) {
+        if (!slot.fence) {
+            return;
+        }
+        GLenum res = GL_TIMEOUT_EXPIRED;
+        while (res == GL_TIMEOUT_EXPIRED) {
+            res = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        }
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+        if (res == GL_WAIT_FAILED) {
+            throw std::runtime_error("glClientWaitSync failed");
+        }
+    }
+
+    void release() {
+        for (auto& slot : ring) {
+            wait(slot);
+            if (slot.ssbo) {
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot.ssbo);
+                glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+                glDeleteBuffers(1, &slot.ssbo);
+            }
+            slot = {};
+        }
+        capacity = 0;
+        ssbo = 0;
+        size = 0;
+    }
+};
+
+// Fixed set of persistently mapped buffers that any thread can fill (a decoder's frame
+// allocator, say) and shaders read in place, so what the CPU wrote is the upload. The memory is
+// mapped for reading too and asks for client storage, since writers like decoders also read
+// back what they wrote. A block must stay acquired until the GPU is done with it; defer() and
+// collect() track that from the GL thread.
+class StagingPool {
+public:
+    struct Block : Buff {
+        std::byte* ptr = nullptr;
+    };
+
+    StagingPool(size_t block_size, size_t count);
+    ~StagingPool();
+    StagingPool(const StagingPool&) = delete;
+
+    // Thread-safe; nullptr when every block is in use.
+    Block* acquire();
+    void release(Block* block);
+    // The block whose memory holds `ptr`, if any.
+    Block* find(const void* ptr);
+
+    // GL thread: runs `release` once the GPU has finished everything submitted so far.
+    void defer(std::function<void()> release);
+    // GL thread: runs the deferred releases that are due; with `wait`, all of them.
+    void collect(bool wait = false);
+
+    const size_t block_size;
+
+private:
+    std::vector<Block> blocks;
+    std::vector<Block*> free_blocks;
+    std::mutex mtx;
+    std::vector<std::pair<GLsync, std::function<void()>>> deferred;
+};
+
+// GPU-side timing of the commands issued between begin() and end(): a GL_TIME_ELAPSED query,
+// and GL_TIMESTAMP marks on either side. Results are read after the fact, so timing a frame
+// doesn't stall it. Software drivers such as llvmpipe run compute work as it is issued and
+// report almost nothing elapsed; their timestamps still bracket the work.
+class GpuTimer {
+public:
+    GpuTimer();
+    ~GpuTimer();
+    GpuTimer(const GpuTimer&) = delete;
+
+    void begin();
+    void end();
+
+    // Whether the results are in; the getters below block until they are.
+    bool ready() const;
+    double elapsed_ms() const;
+    double span_ms() const;
+
+private:
+    // Start timestamp, end timestamp, elapsed
+    std::array<GLuint, 3> queries = {};
+};
+
+// GLSL-shaped value types used for uniforms and dispatch sizes.
+using vec2 = std::array<float, 2>;
+using vec3 = std::array<float, 3>;
+using vec4 = std::array<float, 4>;
+using ivec2 = std::array<int32_t, 2>;
+using ivec3 = std::array<int32_t, 3>;
+using ivec4 = std::array<int32_t, 4>;
+using uvec2 = std::array<uint32_t, 2>;
+using uvec3 = std::array<uint32_t, 3>;
+using uvec4 = std::array<uint32_t, 4>;
+using mat4 = std::array<float, 16>;
+
+struct UniformInfo {
+    std::string name;
+    GLint location;
+    GLenum type;
+    GLint count;
+};
+
+struct BufferBinding {
+    std::string name;
+    GLuint binding;
+    bool readonly;
+};
+
+struct ParamBlock;
+
+// Preprocessor definitions injected after a kernel's #version line.
+using Defines = std::vector<std::pair<std::string, std::string>>;
+
+// On-disk cache of linked program binaries, keyed by a hash of the source and the driver's
+// vendor, renderer and version strings. Entries the driver refuses to load are recompiled from
+// source and overwritten.
+class ProgramCache {
+public:
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        // Entries found on disk that the driver rejected
+        size_t rejected = 0;
+        size_t stores = 0;
+    };
+
+    explicit ProgramCache(std::filesystem::path dir);
+    ProgramCache(const ProgramCache&) = delete;
+
+    const Stats& stats() const {
+        return counters;
+    }
+
+private:
+    friend struct KomputeKernel;
+
+    std::filesystem::path dir;
+    std::string driver;
+    Stats counters;
+
+    std::filesystem::path entry(const std::string& src);
+    bool load(GLuint program, const std::string& src);
+    void store(GLuint program, const std::string& src);
+};
+
+// Every kernel is compiled with a small prelude after its #version line:
+//  - LOCAL_SIZE_X/Y/Z default to 1 unless given as defines, so one source can be compiled with
+//    different workgroup sizes via `layout(local_size_x = LOCAL_SIZE_X, ...) in;`
+//  - KOMPUTE_GUARD() returns from invocations outside the requested thread count, which every
+//    dispatch sets (groups * local size, or the exact count for dispatch_threads).
 struct KomputeKernel {
+    // Shows up in traces; the file stem for kernels loaded from a path
+    std::string name = "kernel";
     unsigned int shader;
     GLuint program;
+    // Reflected once at link time so dispatch never queries the program by name.
+    std::vector<UniformInfo> uniforms;
+    std::vector<BufferBinding> buffers;
+    uvec3 local_size;
 
-    KomputeKernel(const std::string& src);
-    KomputeKernel(const std::filesystem::path& path);
+    KomputeKernel(const std::string& src, ProgramCache* cache = nullptr);
+    KomputeKernel(const std::filesystem::path& path, ProgramCache* cache = nullptr);
+    KomputeKernel(const std::string& src, const Defines& defines, ProgramCache* cache = nullptr);
+    KomputeKernel(
+        const std::filesystem::path& path, const Defines& defines, ProgramCache* cache = nullptr
+    );
     ~KomputeKernel();
     KomputeKernel(const KomputeKernel&) = delete;
 
+    const UniformInfo* uniform(std::string_view name) const;
+    const BufferBinding* buffer(std::string_view name) const;
+
 private:
-    void compile(const char** src);
+    friend struct ParamBlock;
+    friend class Kompute;
+    friend class CommandList;
+    // Block whose values currently live in the program's default uniform block.
+    const ParamBlock* applied = nullptr;
+    GLint threads_location = -1;
+    uvec3 threads = { 0, 0, 0 };
+
+    void compile(const std::string& src, ProgramCache* cache);
+    void reflect(const std::string& src);
+
+    const BufferBinding* binding(GLuint idx) const;
+    // Buffers are given in binding order: buffers[i] goes to `layout(binding = i)`. Throws unless
+    // every block the kernel uses has one among `count`.
+    void check_buffers(size_t count) const;
+    void set_threads(uvec3 count);
 };
 
 struct Uniform {
@@ -80,6 +464,229 @@ struct Uniform {
     std::variant<float, int, std::vector<float>, std::vector<int>> val;
 };
 
+template <typename T>
+struct UniformType;
+
+template <>
+struct UniformType<float> {
+    static constexpr GLenum value = GL_FLOAT;
+};
+
+template <>
+struct UniformType<vec2> {
+    static constexpr GLenum value = GL_FLOAT_VEC2;
+};
+
+template <>
+struct UniformType<vec3> {
+    static constexpr GLenum value = GL_FLOAT_VEC3;
+};
+
+template <>
+struct UniformType<vec4> {
+    static constexpr GLenum value = GL_FLOAT_VEC4;
+};
+
+template <>
+struct UniformType<int32_t> {
+    static constexpr GLenum value = GL_INT;
+};
+
+template <>
+struct UniformType<ivec2> {
+    static constexpr GLenum value = GL_INT_VEC2;
+};
+
+template <>
+struct UniformType<ivec3> {
+    static constexpr GLenum value = GL_INT_VEC3;
+};
+
+template <>
+struct UniformType<ivec4> {
+    static constexpr GLenum value = GL_INT_VEC4;
+};
+
+template <>
+struct UniformType<uint32_t> {
+    static constexpr GLenum value = GL_UNSIGNED_INT;
+};
+
+template <>
+struct UniformType<uvec2> {
+    static constexpr GLenum value = GL_UNSIGNED_INT_VEC2;
+};
+
+template <>
+struct UniformType<uvec3> {
+    static constexpr GLenum value = GL_UNSIGNED_INT_VEC3;
+};
+
+template <>
+struct UniformType<uvec4> {
+    static constexpr GLenum value = GL_UNSIGNED_INT_VEC4;
+};
+
+template <>
+struct UniformType<mat4> {
+    static constexpr GLenum value = GL_FLOAT_MAT4;
+};
+
+// Typed handle into a ParamBlock, resolved once by name.
+template <typename T>
+struct Param {
+    size_t slot = SIZE_MAX;
+};
+
+// Uniform values for one kernel. Names are resolved when a Param is created; set() only copies
+// into preallocated storage and dispatch uploads just the slots that changed.
+struct ParamBlock {
+    explicit ParamBlock(KomputeKernel& kernel) : kernel(kernel) {}
+
+    ParamBlock(const ParamBlock&) = delete;
+
+    template <typename T>
+    Param<T> param(std::string_view name) {
+        auto info = kernel.uniform(name);
+        if (!info) {
+            throw std::runtime_error("Unknown uniform " + std::string(name));
+        }
+        if (info->type != UniformType<T>::value) {
+            throw std::runtime_error("Type mismatch for uniform " + std::string(name));
+        }
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i].location == info->location) {
+                return { i };
+            }
+        }
+        slots.push_back({ info->location, info->type, info->count, storage.size() });
+        storage.resize(storage.size() + sizeof(T) * info->count);
+        return { slots.size() - 1 };
+    }
+
+    template <typename T>
+    void set(Param<T> p, const std::type_identity_t<T>& val) {
+        set(p, std::span<const T>(&val, 1));
+    }
+
+    template <typename T>
+    void set(Param<T> p, std::span<const std::type_identity_t<T>> vals) {
+        auto& slot = slots.at(p.slot);
+        if (vals.size() > static_cast<size_t>(slot.count)) {
+            throw std::runtime_error("Too many values for uniform array");
+        }
+        auto dst = storage.data() + slot.offset;
+        if (!slot.dirty && std::memcmp(dst, vals.data(), vals.size_bytes()) == 0) {
+            return;
+        }
+        std::memcpy(dst, vals.data(), vals.size_bytes());
+        slot.dirty = true;
+    }
+
+    // Uploads changed values, or everything if another block touched the program since.
+    void apply();
+
+private:
+    struct Slot {
+        GLint location;
+        GLenum type;
+        GLint count;
+        size_t offset;
+        bool dirty = false;
+    };
+
+    KomputeKernel& kernel;
+    std::vector<Slot> slots;
+    std::vector<std::byte> storage;
+
+    friend class Kompute;
+    friend class CommandList;
+};
+
+// A recorded sequence of dispatches, copies and readbacks. Buffers are referenced, not owned,
+// and their current GL names are resolved at submit time, so a list can be recorded once and
+// submitted every frame. Submit binds only what changed and places barriers only in front of
+// commands that touch a buffer an earlier dispatch wrote (readonly SSBO blocks count as reads).
+// Dispatches take their buffers in binding order, as Kompute::dispatch does.
+class CommandList {
+public:
+    void dispatch(
+        KomputeKernel& kernel, ParamBlock& params, std::span<const std::shared_ptr<Buff>> buffers,
+        int x, int y = 1, int z = 1
+    );
+    void dispatch_threads(
+        KomputeKernel& kernel, ParamBlock& params, std::span<const std::shared_ptr<Buff>> buffers,
+        int x, int y = 1, int z = 1
+    );
+    // Takes the group counts from three uint32 at `offset` bytes into `args`, which an earlier
+    // dispatch may write. The kernel gets no thread count, so KOMPUTE_GUARD() can't be used.
+    void dispatch_indirect(
+        KomputeKernel& kernel, ParamBlock& params, std::span<const std::shared_ptr<Buff>> buffers,
+        const Buff& args, size_t offset = 0
+    );
+    void copy(
+        const Buff& src, Buff& dst, size_t size = SIZE_MAX, size_t src_offset = 0,
+        size_t dst_offset = 0
+    );
+    // Sets every 32-bit word of the range to `value`; offset and size are multiples of 4
+    void fill(Buff& dst, uint32_t value = 0, size_t size = SIZE_MAX, size_t offset = 0);
+    // `handle` is assigned when the list is submitted.
+    void read(ReadbackPool& pool, const Buff& src, std::span<std::byte> dst, Readback& handle);
+    // An explicit glMemoryBarrier, for hazards submit can't see such as reusing memory that
+    // earlier commands read
+    void barrier(GLbitfield bits = GL_SHADER_STORAGE_BARRIER_BIT);
+    // Appends a copy of `other`'s commands
+    void append(const CommandList& other) {
+        commands.insert(commands.end(), other.commands.begin(), other.commands.end());
+    }
+
+    void clear() {
+        commands.clear();
+    }
+
+private:
+    friend class Kompute;
+
+    struct Dispatch {
+        KomputeKernel* kernel;
+        ParamBlock* params;
+        std::vector<Buff*> buffers;
+        int x, y, z;
+        uvec3 threads;
+        // Indirect dispatches read x, y and z from here
+        const Buff* args = nullptr;
+        size_t args_offset = 0;
+    };
+
+    struct Copy {
+        const Buff* src;
+        Buff* dst;
+        size_t size;
+        size_t src_offset;
+        size_t dst_offset;
+    };
+
+    struct Fill {
+        Buff* dst;
+        uint32_t value;
+        size_t size;
+        size_t offset;
+    };
+
+    struct Read {
+        ReadbackPool* pool;
+        const Buff* src;
+        std::span<std::byte> dst;
+        Readback* handle;
+    };
+
+    struct Barrier {
+        GLbitfield bits;
+    };
+
+    std::vector<std::variant<Dispatch, Copy, Fill, Read, Barrier>> commands;
+};
+
 class Kompute {
     std::mutex mtx;
     int dvr_fd = -1;
@@ -88,12 +695,58 @@ class Kompute {
     EGLContext egl_context = EGL_NO_CONTEXT;
     EGLConfig egl_config;
     EGLint num_configs;
+    // Bytes [begin, end) of a GL buffer. Buffers sub-allocated from one arena share a GL
+    // buffer, so bindings and hazards are tracked by range rather than by name.
+    struct Range {
+        GLuint ssbo = 0;
+        size_t begin = 0;
+        size_t end = 0;
+
+        bool operator==(const Range&) const = default;
+
+        bool overlaps(const Range& other) const {
+            return ssbo == other.ssbo && begin < other.end && other.begin < end;
+        }
+    };
+
+    // Scratch state for submit, kept to avoid reallocating every time
+    std::vector<Range> bound;
+    std::vector<Range> shader_hazards;
+    std::vector<Range> update_hazards;
+    std::vector<Range> command_hazards;
+
+    static Range range_of(const Buff& buffer);
+
+    void bind(KomputeKernel& kernel, std::span<const std::shared_ptr<Buff>> buffers);
+    void run(
+        KomputeKernel& kernel, ParamBlock& params, std::span<const std::shared_ptr<Buff>> buffers,
+        uvec3 groups, uvec3 threads
+    );
 
 public:
+    // `dev` is a DRM render node, or "surfaceless" to run on EGL_MESA_platform_surfaceless
+    // (e.g. Mesa llvmpipe on machines without /dev/dri).
     Kompute(std::string dev);
+    // Every form of dispatch binds buffers[i] to `layout(binding = i)`; unused bindings may be
+    // given any buffer.
+    void dispatch(
+        KomputeKernel& kernel, const std::vector<Uniform>& uniforms,
+        const std::vector<std::shared_ptr<Buff>>& buffers, int x, int y = 1, int z = 1
+    );
     void dispatch(
-        KomputeKernel& kernel, const std::vector<Uniform> uniforms,
-        const std::vector<std::shared_ptr<Buff>> buffers, int x, int y = 1, int z = 1
+        KomputeKernel& kernel, ParamBlock& params,
+        std::span<const std::shared_ptr<Buff>> buffers, int x, int y = 1, int z = 1
     );
+    // Dispatches enough groups to cover x*y*z invocations; kernels drop the overhang with
+    // KOMPUTE_GUARD().
+    void dispatch_threads(
+        KomputeKernel& kernel, ParamBlock& params,
+        std::span<const std::shared_ptr<Buff>> buffers, int x, int y = 1, int z = 1
+    );
+    // Runs a recorded list under a single lock.
+    void submit(CommandList& list);
+    // Runs several lists back to back as one submission: one lock, bindings reused across
+    // lists, and barriers only where a later list touches what an earlier one wrote.
+    void submit(std::span<CommandList* const> lists);
     ~Kompute();
-};
\ No newline at end of file
+};
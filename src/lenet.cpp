@@ -0,0 +1,272 @@
+#include "lenet.hpp"
+#include "mapped.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+extern "C" {
+#include <unistd.h>
+}
+
+// Parameter arrays start on 64-byte boundaries: a cache line, and whole vectors for SIMD
+static constexpr size_t alignment = 64 / sizeof(float);
+// The parameters follow the header at a page boundary, so they can be used in place when mapped
+static constexpr size_t header_size = 4096;
+
+struct ModelHeader {
+    char magic[8] = { 'L', 'E', 'N', 'E', 'T', '-', '5', '\0' };
+    uint32_t version = 1;
+    uint32_t header_size = ::header_size;
+    // Tells a file written on a machine of the other endianness
+    uint32_t byte_order = 0x01020304;
+    uint32_t alignment = ::alignment;
+    uint64_t parameters = 0;
+    // Input channels, output channels, kernel size, stride and padding of conv1..3, then input
+    // and output channels of fc1..2
+    int32_t conv[3][5] = {};
+    int32_t fc[2][2] = {};
+    // Pads to the alignment of `parameters`, so memcmp sees no indeterminate bytes
+    uint32_t reserved = 0;
+};
+
+static_assert(sizeof(ModelHeader) <= header_size);
+static_assert(std::has_unique_object_representations_v<ModelHeader>);
+
+static ModelHeader make_header(const LeNet& net) {
+    ModelHeader header;
+    header.parameters = net.parameters().size();
+    const Conv2D* convs[] = { &net.conv1, &net.conv2, &net.conv3 };
+    for (int i = 0; i < 3; i++) {
+        const Conv2D& c = *convs[i];
+        int32_t shape[] = { c.input_channels, c.output_channels, c.kernel_size, c.stride,
+                            c.padding };
+        std::copy(std::begin(shape), std::end(shape), header.conv[i]);
+    }
+    const FullyConnected* fcs[] = { &net.fc1, &net.fc2 };
+    for (int i = 0; i < 2; i++) {
+        header.fc[i][0] = fcs[i]->input_channels;
+        header.fc[i][1] = fcs[i]->output_channels;
+    }
+    return header;
+}
+
+static Conv2D make_conv(int input_channels, int output_channels, int kernel_size, int padding) {
+    return { input_channels, output_channels, kernel_size, 1, padding, {}, {} };
+}
+
+static FullyConnected make_fc(int input_channels, int output_channels) {
+    return { input_channels, output_channels, {}, {} };
+}
+
+static std::shared_ptr<float> allocate(size_t floats) {
+    // bind() rounds every array up, so the size is a multiple of the alignment
+    const size_t bytes = floats * sizeof(float);
+    auto* p = static_cast<float*>(std::aligned_alloc(alignment * sizeof(float), bytes));
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    std::memset(p, 0, bytes);
+    return std::shared_ptr<float>(p, std::free);
+}
+
+LeNet::LeNet()
+    : conv1(make_conv(1, 6, 5, 2)), sub1{ 2, 2, 0 }, conv2(make_conv(6, 16, 5, 0)),
+      sub2{ 2, 2, 0 }, conv3(make_conv(16, 120, 5, 0)), fc1(make_fc(120, 84)),
+      fc2(make_fc(84, classes)) {
+    floats = bind(nullptr);
+    storage = allocate(floats);
+    bind(storage.get());
+}
+
+LeNet::LeNet(const std::filesystem::path& path) : LeNet() {
+    auto file = std::make_shared<MappedFile>(path, true);
+    auto bytes = file->writable_bytes();
+    ModelHeader header = make_header(*this);
+    if (bytes.size() < header_size || std::memcmp(bytes.data(), &header, sizeof(header)) != 0) {
+        throw std::runtime_error(path.string() + ": not a model of this network");
+    }
+    if (bytes.size() != header_size + floats * sizeof(float)) {
+        throw std::runtime_error(path.string() + ": size does not match the header");
+    }
+    // Shares ownership of the mapping; the zeroed memory of LeNet() is released
+    storage = std::shared_ptr<float>(file, reinterpret_cast<float*>(&bytes[header_size]));
+    bind(storage.get());
+}
+
+LeNet::LeNet(const LeNet& other) : LeNet() {
+    std::ranges::copy(other.parameters(), parameters().begin());
+}
+
+LeNet& LeNet::operator=(const LeNet& other) {
+    if (this != &other) {
+        std::ranges::copy(other.parameters(), parameters().begin());
+    }
+    return *this;
+}
+
+size_t LeNet::bind(float* base) {
+    size_t offset = 0;
+    auto take = [&](std::span<float>& array, size_t size) {
+        if (base) {
+            array = { base + offset, size };
+        }
+        offset += (size + alignment - 1) / alignment * alignment;
+    };
+    for (Conv2D* conv : { &conv1, &conv2, &conv3 }) {
+        take(conv->weights, size_t(conv->output_channels) * conv->fan_in());
+        take(conv->biases, conv->output_channels);
+    }
+    for (FullyConnected* fc : { &fc1, &fc2 }) {
+        take(fc->weights, size_t(fc->output_channels) * fc->input_channels);
+        take(fc->biases, fc->output_channels);
+    }
+    return offset;
+}
+
+void LeNet::save(const std::filesystem::path& path) const {
+    std::vector<char> header(header_size);
+    ModelHeader fields = make_header(*this);
+    std::memcpy(header.data(), &fields, sizeof(fields));
+
+    // Write then rename, so a mapped model is never seen half-written
+    auto tmp = path;
+    tmp += "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        file.write(header.data(), header.size());
+        auto values = std::as_bytes(parameters());
+        file.write(reinterpret_cast<const char*>(values.data()), values.size());
+        if (!file) {
+            file.close();
+            std::filesystem::remove(tmp);
+            throw std::runtime_error("Cannot write " + path.string());
+        }
+    }
+    std::filesystem::rename(tmp, path);
+}
+
+static void fill(std::span<float> weights, int fan_in, std::mt19937& rng) {
+    const float limit = std::sqrt(6.0f / fan_in);
+    std::uniform_real_distribution<float> dist(-limit, limit);
+    for (float& w : weights) {
+        w = dist(rng);
+    }
+}
+
+void LeNet::randomize(uint32_t seed) {
+    std::mt19937 rng(seed);
+    for (Conv2D* conv : { &conv1, &conv2, &conv3 }) {
+        fill(conv->weights, conv->fan_in(), rng);
+        std::fill(conv->biases.begin(), conv->biases.end(), 0.0f);
+    }
+    for (FullyConnected* fc : { &fc1, &fc2 }) {
+        fill(fc->weights, fc->input_channels, rng);
+        std::fill(fc->biases.begin(), fc->biases.end(), 0.0f);
+    }
+}
+
+// One image, channels-first: in is input_channels planes of size x size
+static std::vector<float> conv_forward(const Conv2D& conv, const std::vector<float>& in, int size) {
+    const int out_size = conv.output_size(size);
+    const int k = conv.kernel_size;
+    std::vector<float> out(size_t(conv.output_channels) * out_size * out_size);
+    for (int o = 0; o < conv.output_channels; o++) {
+        const float* w = &conv.weights[size_t(o) * conv.fan_in()];
+        for (int oy = 0; oy < out_size; oy++) {
+            for (int ox = 0; ox < out_size; ox++) {
+                float sum = conv.biases[o];
+                for (int c = 0; c < conv.input_channels; c++) {
+                    for (int ky = 0; ky < k; ky++) {
+                        int y = oy * conv.stride - conv.padding + ky;
+                        for (int kx = 0; kx < k; kx++) {
+                            int x = ox * conv.stride - conv.padding + kx;
+                            if (y >= 0 && y < size && x >= 0 && x < size) {
+                                sum += w[(c * k + ky) * k + kx] *
+                                       in[(size_t(c) * size + y) * size + x];
+                            }
+                        }
+                    }
+                }
+                out[(size_t(o) * out_size + oy) * out_size + ox] = std::max(sum, 0.0f);
+            }
+        }
+    }
+    return out;
+}
+
+// Averages over the part of each window inside the input
+static std::vector<float> pool_forward(
+    const SubSampl& pool, const std::vector<float>& in, int channels, int size
+) {
+    const int out_size = pool.output_size(size);
+    std::vector<float> out(size_t(channels) * out_size * out_size);
+    for (int c = 0; c < channels; c++) {
+        for (int oy = 0; oy < out_size; oy++) {
+            for (int ox = 0; ox < out_size; ox++) {
+                float sum = 0.0f;
+                int n = 0;
+                for (int py = 0; py < pool.pooling_size; py++) {
+                    int y = oy * pool.stride - pool.padding + py;
+                    for (int px = 0; px < pool.pooling_size; px++) {
+                        int x = ox * pool.stride - pool.padding + px;
+                        if (y >= 0 && y < size && x >= 0 && x < size) {
+                            sum += in[(size_t(c) * size + y) * size + x];
+                            n++;
+                        }
+                    }
+                }
+                out[(size_t(c) * out_size + oy) * out_size + ox] = n ? sum / n : 0.0f;
+            }
+        }
+    }
+    return out;
+}
+
+static void fc_forward(
+    const FullyConnected& fc, const float* in, float* out, bool relu
+) {
+    for (int o = 0; o < fc.output_channels; o++) {
+        float sum = fc.biases[o];
+        const float* w = &fc.weights[size_t(o) * fc.input_channels];
+        for (int i = 0; i < fc.input_channels; i++) {
+            sum += w[i] * in[i];
+        }
+        out[o] = relu ? std::max(sum, 0.0f) : sum;
+    }
+}
+
+void infer(const LeNet& net, std::span<const float> images, std::span<float> scores) {
+    const size_t count = images.size() / LeNet::input_pixels;
+    if (scores.size() < count * LeNet::classes) {
+        throw std::runtime_error("Not enough room for the scores");
+    }
+    for (size_t i = 0; i < count; i++) {
+        auto image = images.subspan(i * LeNet::input_pixels, LeNet::input_pixels);
+        std::vector<float> x(image.begin(), image.end());
+        int size = LeNet::input_size;
+        x = conv_forward(net.conv1, x, size);
+        size = net.conv1.output_size(size);
+        x = pool_forward(net.sub1, x, net.conv1.output_channels, size);
+        size = net.sub1.output_size(size);
+        x = conv_forward(net.conv2, x, size);
+        size = net.conv2.output_size(size);
+        x = pool_forward(net.sub2, x, net.conv2.output_channels, size);
+        size = net.sub2.output_size(size);
+        x = conv_forward(net.conv3, x, size);
+
+        std::vector<float> hidden(net.fc1.output_channels);
+        fc_forward(net.fc1, x.data(), hidden.data(), true);
+        fc_forward(net.fc2, hidden.data(), &scores[i * LeNet::classes], false);
+    }
+}
+
+int predict(std::span<const float> scores) {
+    return int(std::max_element(scores.begin(), scores.end()) - scores.begin());
+}
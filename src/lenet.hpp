@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+
+// LeNet-5 for 28x28 MNIST digits: conv 5x5 (padded to 32x32 like the original) -> 2x2 average
+// pool -> conv 5x5 -> pool -> conv 5x5 down to 1x1 -> fully connected 120 -> 84 -> 10. ReLU
+// follows every layer but the last, whose outputs are the class scores.
+//
+// Weights are stored flat and row-major: a convolution's as output_channels rows of
+// input_channels * kernel_size * kernel_size, a fully connected layer's as output_channels rows
+// of input_channels. Both are thus the left-hand matrix of the GEMM that computes the layer.
+// Layers only view their weights: all of them live in one block, LeNet::parameters(), with every
+// array starting on a 64-byte boundary.
+
+struct Conv2D {
+    int input_channels;
+    int output_channels;
+    int kernel_size;
+    int stride;
+    int padding;
+    std::span<float> weights;
+    std::span<float> biases;
+
+    int output_size(int input_size) const {
+        return (input_size + 2 * padding - kernel_size) / stride + 1;
+    }
+
+    // Elements per output channel's row of weights
+    int fan_in() const {
+        return input_channels * kernel_size * kernel_size;
+    }
+};
+
+struct SubSampl {
+    int pooling_size;
+    int stride;
+    int padding;
+
+    int output_size(int input_size) const {
+        return (input_size + 2 * padding - pooling_size) / stride + 1;
+    }
+};
+
+struct FullyConnected {
+    int input_channels;
+    int output_channels;
+    std::span<float> weights;
+    std::span<float> biases;
+};
+
+struct LeNet {
+    static constexpr int input_size = 28;
+    static constexpr int input_pixels = input_size * input_size;
+    static constexpr int classes = 10;
+
+    Conv2D conv1;
+    SubSampl sub1;
+    Conv2D conv2;
+    SubSampl sub2;
+    Conv2D conv3;
+    FullyConnected fc1;
+    FullyConnected fc2;
+
+    // Every layer with zero weights, in memory of its own
+    LeNet();
+    // Maps a model written by save(): the header is compared, not parsed, and the weights are
+    // used where they lie in the file. The mapping is private, so changing the weights never
+    // writes to the file.
+    explicit LeNet(const std::filesystem::path& path);
+    // Copies have memory of their own
+    LeNet(const LeNet& other);
+    LeNet& operator=(const LeNet& other);
+    LeNet(LeNet&&) = default;
+    LeNet& operator=(LeNet&&) = default;
+
+    // Uniform weights scaled by fan-in (He initialisation), zero biases
+    void randomize(uint32_t seed);
+
+    std::span<float> parameters() {
+        return { storage.get(), floats };
+    }
+
+    std::span<const float> parameters() const {
+        return { storage.get(), floats };
+    }
+
+    // A 4 KiB header describing the layers, then parameters() as they are in memory
+    void save(const std::filesystem::path& path) const;
+
+private:
+    // Aligned heap memory, or a mapped model file
+    std::shared_ptr<float> storage;
+    size_t floats = 0;
+
+    // Points every layer into `base`; returns the floats the layers take
+    size_t bind(float* base);
+};
+
+// CPU reference: scores for images.size() / LeNet::input_pixels images of 28x28 floats, 10
+// per image
+void infer(const LeNet& net, std::span<const float> images, std::span<float> scores);
+
+// Index of the highest of `scores`
+int predict(std::span<const float> scores);
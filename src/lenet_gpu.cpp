@@ -0,0 +1,332 @@
+#include "lenet_gpu.hpp"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <string>
+
+// Thread (x, y) writes element y of column x: column order is image, output row, output column
+// and row order input channel, kernel row, kernel column, matching the weights.
+static const char* im2col_src = R"(#version 430 core
+layout (local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y) in;
+
+layout(binding = 0) readonly buffer In { float src[]; };
+layout(binding = 1) writeonly buffer Columns { float col[]; };
+
+// Channels, size of the square input and images in the input buffer
+uniform ivec3 input_shape;
+// Kernel size, stride, padding and size of the square output
+uniform ivec4 conv;
+// First image of the chunk, and columns in the chunk
+uniform ivec2 range;
+
+void main() {
+    KOMPUTE_GUARD();
+    int n = int(gl_GlobalInvocationID.x);
+    int r = int(gl_GlobalInvocationID.y);
+    int k = conv.x;
+    int out_size = conv.w;
+    int ox = n % out_size;
+    int oy = (n / out_size) % out_size;
+    int image = range.x + n / (out_size * out_size);
+    int kx = r % k;
+    int ky = (r / k) % k;
+    int c = r / (k * k);
+    int y = oy * conv.y - conv.z + ky;
+    int x = ox * conv.y - conv.z + kx;
+    int size = input_shape.y;
+    float v = 0.0;
+    if (y >= 0 && y < size && x >= 0 && x < size) {
+        v = src[((c * input_shape.z + image) * size + y) * size + x];
+    }
+    col[r * range.y + n] = v;
+}
+)";
+
+// C = A * B + bias for row-major A (M x K) and B (K x N). Each workgroup computes a TM x TN tile
+// of C, staging TM x TK of A and TK x TN of B in shared memory per step; each invocation keeps
+// TN / 16 accumulators along a row. TM is 8 or 16, so layers with few outputs waste less.
+static const char* gemm_src = R"(#version 430 core
+layout (local_size_x = 16, local_size_y = TM) in;
+
+#define TN 64
+#define TK 16
+#define PER_THREAD (TN / 16)
+
+layout(binding = 0) readonly buffer Weights { float a[]; };
+layout(binding = 1) readonly buffer Biases { float bias[]; };
+layout(binding = 2) readonly buffer In { float b[]; };
+layout(binding = 3) writeonly buffer Out { float c[]; };
+
+uniform ivec3 mnk;
+// ReLU, and whether to write C transposed (N x M) starting at row `first`
+uniform ivec3 epilogue;
+
+shared float as[TM][TK];
+shared float bs[TK][TN];
+
+void main() {
+    int tx = int(gl_LocalInvocationID.x);
+    int ty = int(gl_LocalInvocationID.y);
+    int M = mnk.x;
+    int N = mnk.y;
+    int K = mnk.z;
+    int row = int(gl_WorkGroupID.y) * TM + ty;
+    int col = int(gl_WorkGroupID.x) * TN + tx;
+
+    float acc[PER_THREAD];
+    for (int j = 0; j < PER_THREAD; j++) {
+        acc[j] = 0.0;
+    }
+    for (int k0 = 0; k0 < K; k0 += TK) {
+        as[ty][tx] = row < M && k0 + tx < K ? a[row * K + k0 + tx] : 0.0;
+        for (int i = int(gl_LocalInvocationIndex); i < TK * TN; i += 16 * TM) {
+            int k = k0 + i / TN;
+            int n = int(gl_WorkGroupID.x) * TN + i % TN;
+            bs[i / TN][i % TN] = k < K && n < N ? b[k * N + n] : 0.0;
+        }
+        barrier();
+        for (int k = 0; k < TK; k++) {
+            float w = as[ty][k];
+            for (int j = 0; j < PER_THREAD; j++) {
+                acc[j] += w * bs[k][tx + 16 * j];
+            }
+        }
+        barrier();
+    }
+
+    if (row >= M) {
+        return;
+    }
+    for (int j = 0; j < PER_THREAD; j++) {
+        int n = col + 16 * j;
+        if (n < N) {
+            float v = acc[j] + bias[row];
+            if (epilogue.x != 0) {
+                v = max(v, 0.0);
+            }
+            if (epilogue.y != 0) {
+                c[(epilogue.z + n) * M + row] = v;
+            } else {
+                c[row * N + n] = v;
+            }
+        }
+    }
+}
+)";
+
+// Average over the part of each window inside the input, one output per invocation
+static const char* pool_src = R"(#version 430 core
+layout (local_size_x = LOCAL_SIZE_X) in;
+
+layout(binding = 0) readonly buffer In { float src[]; };
+layout(binding = 1) writeonly buffer Out { float dst[]; };
+
+// Size of the square input and output
+uniform ivec2 sizes;
+// Window size, stride and padding
+uniform ivec3 window;
+
+void main() {
+    KOMPUTE_GUARD();
+    int i = int(gl_GlobalInvocationID.x);
+    int out_size = sizes.y;
+    int ox = i % out_size;
+    int oy = (i / out_size) % out_size;
+    int plane = i / (out_size * out_size);
+    float sum = 0.0;
+    int n = 0;
+    for (int py = 0; py < window.x; py++) {
+        int y = oy * window.y - window.z + py;
+        for (int px = 0; px < window.x; px++) {
+            int x = ox * window.y - window.z + px;
+            if (y >= 0 && y < sizes.x && x >= 0 && x < sizes.x) {
+                sum += src[(plane * sizes.x + y) * sizes.x + x];
+                n++;
+            }
+        }
+    }
+    dst[i] = n > 0 ? sum / float(n) : 0.0;
+}
+)";
+
+static constexpr int gemm_tile_rows[2] = { 8, 16 };
+static constexpr int gemm_tile_n = 64;
+
+LeNetInference::LeNetInference(
+    const LeNet& net, size_t chunk, ProgramCache* cache, BufferArena* arena
+)
+    : chunk(chunk), pools{ net.sub1, net.sub2 }, arena(arena) {
+    if (chunk == 0) {
+        throw std::runtime_error("LeNetInference needs a nonzero chunk");
+    }
+    im2col = std::make_unique<KomputeKernel>(
+        std::string(im2col_src), Defines{ { "LOCAL_SIZE_X", "64" }, { "LOCAL_SIZE_Y", "4" } }, cache
+    );
+    im2col->name = "im2col";
+    for (int i = 0; i < 2; i++) {
+        gemms[i] = std::make_unique<KomputeKernel>(
+            std::string(gemm_src), Defines{ { "TM", std::to_string(gemm_tile_rows[i]) } }, cache
+        );
+        gemms[i]->name = "gemm";
+    }
+    pool = std::make_unique<KomputeKernel>(
+        std::string(pool_src), Defines{ { "LOCAL_SIZE_X", "256" } }, cache
+    );
+    pool->name = "pool";
+
+    for (const Conv2D* conv : { &net.conv1, &net.conv2, &net.conv3 }) {
+        Layer layer{ conv->output_channels, conv->fan_in(), conv->input_channels,
+                     conv->kernel_size,     conv->stride,   conv->padding };
+        layers.push_back(std::move(layer));
+    }
+    for (const FullyConnected* fc : { &net.fc1, &net.fc2 }) {
+        layers.push_back({ fc->output_channels, fc->input_channels });
+    }
+    for (auto& layer : layers) {
+        layer.weights = make_storage(arena, size_t(layer.rows) * layer.depth * sizeof(float));
+        layer.biases = make_storage(arena, size_t(layer.rows) * sizeof(float));
+    }
+    upload(net);
+
+    // Per image: the largest im2col matrix, convolution output and pooling output. fc1 writes
+    // into the pooling buffer.
+    size_t column_floats = 0;
+    size_t conv_floats = 0;
+    size_t pool_floats = net.fc1.output_channels;
+    int size = LeNet::input_size;
+    for (int i = 0; i < 3; i++) {
+        const Layer& layer = layers[i];
+        int out = (size + 2 * layer.padding - layer.kernel_size) / layer.stride + 1;
+        column_floats = std::max(column_floats, size_t(layer.depth) * out * out);
+        conv_floats = std::max(conv_floats, size_t(layer.rows) * out * out);
+        size = out;
+        if (i < 2) {
+            size = pools[i].output_size(size);
+            pool_floats = std::max(pool_floats, size_t(layer.rows) * size * size);
+        }
+    }
+    if (size != 1 || layers[2].rows != layers[3].depth) {
+        throw std::runtime_error("The last convolution has to reduce each image to a vector");
+    }
+    columns = make_storage(arena, column_floats * chunk * sizeof(float));
+    ping = make_storage(arena, conv_floats * chunk * sizeof(float));
+    pong = make_storage(arena, pool_floats * chunk * sizeof(float));
+    input = std::make_shared<StorageBuff<float>>();
+}
+
+void LeNetInference::upload(const LeNet& net) {
+    const std::span<const float> weights[] = { net.conv1.weights, net.conv2.weights,
+                                               net.conv3.weights, net.fc1.weights,
+                                               net.fc2.weights };
+    const std::span<const float> biases[] = { net.conv1.biases, net.conv2.biases, net.conv3.biases,
+                                              net.fc1.biases, net.fc2.biases };
+    for (size_t i = 0; i < layers.size(); i++) {
+        if (weights[i].size_bytes() != layers[i].weights->size) {
+            throw std::runtime_error("Net does not match the engine's layers");
+        }
+        BufferArena::write(*layers[i].weights, std::as_bytes(weights[i]));
+        BufferArena::write(*layers[i].biases, std::as_bytes(biases[i]));
+    }
+}
+
+void LeNetInference::record(
+    CommandList& list, const std::shared_ptr<Buff>& images, const std::shared_ptr<Buff>& scores,
+    size_t count
+) {
+    for (size_t first = 0, index = 0; first < count; first += chunk, index++) {
+        if (index > 0) {
+            // The chunks share the intermediate buffers
+            list.barrier();
+        }
+        record_chunk(list, images, scores, first, std::min(chunk, count - first), count, index);
+    }
+}
+
+void LeNetInference::record_chunk(
+    CommandList& list, const std::shared_ptr<Buff>& images, const std::shared_ptr<Buff>& scores,
+    size_t first, size_t count, size_t total, size_t index
+) {
+    if (params.size() <= index) {
+        params.resize(index + 1);
+    }
+    auto& blocks = params[index];
+    size_t step = 0;
+    auto next = [&](KomputeKernel& kernel) -> ParamBlock& {
+        if (blocks.size() <= step) {
+            blocks.push_back(std::make_unique<ParamBlock>(kernel));
+        }
+        return *blocks[step++];
+    };
+
+    const int n = int(count);
+    auto unfold = [&](const Layer& layer, const std::shared_ptr<Buff>& in, int size, int images_in,
+                      int first_image) {
+        int out = (size + 2 * layer.padding - layer.kernel_size) / layer.stride + 1;
+        auto& p = next(*im2col);
+        p.set(p.param<ivec3>("input_shape"), { layer.input_channels, size, images_in });
+        p.set(
+            p.param<ivec4>("conv"), { layer.kernel_size, layer.stride, layer.padding, out }
+        );
+        p.set(p.param<ivec2>("range"), { first_image, n * out * out });
+        const std::array<std::shared_ptr<Buff>, 2> buffers = { in, columns };
+        list.dispatch_threads(*im2col, p, buffers, n * out * out, layer.depth);
+        return out;
+    };
+    auto multiply = [&](const Layer& layer, const std::shared_ptr<Buff>& in,
+                        const std::shared_ptr<Buff>& out, int width, bool relu, bool last) {
+        const int tile = layer.rows <= gemm_tile_rows[0] ? 0 : 1;
+        auto& p = next(*gemms[tile]);
+        p.set(p.param<ivec3>("mnk"), { layer.rows, width, layer.depth });
+        p.set(p.param<ivec3>("epilogue"), { relu, last, last ? int(first) : 0 });
+        const std::array<std::shared_ptr<Buff>, 4> buffers = { layer.weights, layer.biases, in,
+                                                               out };
+        list.dispatch(
+            *gemms[tile], p, buffers, (width + gemm_tile_n - 1) / gemm_tile_n,
+            (layer.rows + gemm_tile_rows[tile] - 1) / gemm_tile_rows[tile]
+        );
+    };
+    auto subsample = [&](const SubSampl& window, int channels, int size) {
+        int out = window.output_size(size);
+        auto& p = next(*pool);
+        p.set(p.param<ivec2>("sizes"), { size, out });
+        p.set(p.param<ivec3>("window"), { window.pooling_size, window.stride, window.padding });
+        const std::array<std::shared_ptr<Buff>, 2> buffers = { ping, pong };
+        list.dispatch_threads(*pool, p, buffers, channels * n * out * out);
+        return out;
+    };
+
+    // Convolutions write ping and pooling pong, so every layer reads what the previous wrote
+    int size = LeNet::input_size;
+    size = unfold(layers[0], images, size, int(total), int(first));
+    multiply(layers[0], columns, ping, n * size * size, true, false);
+    size = subsample(pools[0], layers[0].rows, size);
+    size = unfold(layers[1], pong, size, n, 0);
+    multiply(layers[1], columns, ping, n * size * size, true, false);
+    size = subsample(pools[1], layers[1].rows, size);
+    unfold(layers[2], pong, size, n, 0);
+    multiply(layers[2], columns, ping, n, true, false);
+    multiply(layers[3], ping, pong, n, true, false);
+    multiply(layers[4], pong, scores, n, false, true);
+}
+
+void LeNetInference::run(Kompute& k, std::span<const float> images, std::span<float> scores) {
+    const size_t count = images.size() / LeNet::input_pixels;
+    if (scores.size() < count * LeNet::classes) {
+        throw std::runtime_error("Not enough room for the scores");
+    }
+    if (count == 0) {
+        return;
+    }
+    input->set_data(images.first(count * LeNet::input_pixels));
+    if (output_capacity < count) {
+        output = make_storage(arena, count * LeNet::classes * sizeof(float));
+        output_capacity = count;
+    }
+    list.clear();
+    record(list, input, output, count);
+    k.submit(list);
+    readbacks
+        .read(*output, std::as_writable_bytes(scores.first(count * LeNet::classes)))
+        .wait();
+}
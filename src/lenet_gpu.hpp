@@ -0,0 +1,87 @@
+#pragma once
+
+#include "arena.hpp"
+#include "kompute.hpp"
+#include "lenet.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <vector>
+
+// Batched LeNet inference on the GPU. Every layer is one GEMM of its weights against its input
+// matrix, in a tiled shared-memory kernel: convolutions get that matrix from im2col, pooling
+// runs between them. Activations are kept channels-first across the batch (C x N x H x W), which
+// is the layout both the GEMM writes and im2col reads, so no layer needs a transpose; only the
+// final scores are written image by image.
+//
+//     LeNetInference engine(net);
+//     engine.run(k, images, scores);
+//
+// Batches run in chunks of `chunk` images through one set of intermediate buffers, so memory
+// stays bounded however large the batch: the im2col matrix of the first layer alone takes 78 KiB
+// per image.
+class LeNetInference {
+public:
+    explicit LeNetInference(
+        const LeNet& net, size_t chunk = 256, ProgramCache* cache = nullptr,
+        BufferArena* arena = nullptr
+    );
+    LeNetInference(const LeNetInference&) = delete;
+
+    // Uploads the weights again, e.g. after training changed them
+    void upload(const LeNet& net);
+
+    // Records the scores of `count` images: `images` holds count * 28 * 28 floats, `scores`
+    // receives count * 10
+    void record(
+        CommandList& list, const std::shared_ptr<Buff>& images,
+        const std::shared_ptr<Buff>& scores, size_t count
+    );
+
+    // Uploads images.size() / 784 images, runs them and reads the scores back
+    void run(Kompute& k, std::span<const float> images, std::span<float> scores);
+
+    const size_t chunk;
+
+private:
+    // A layer as the GEMM sees it: `rows` outputs, each a dot product of `depth` inputs. The
+    // convolution geometry is unused for fully connected layers.
+    struct Layer {
+        int rows;
+        int depth;
+        int input_channels = 0;
+        int kernel_size = 0;
+        int stride = 1;
+        int padding = 0;
+        std::shared_ptr<Buff> weights;
+        std::shared_ptr<Buff> biases;
+    };
+
+    std::unique_ptr<KomputeKernel> im2col;
+    // Tiles of 8 and 16 rows
+    std::unique_ptr<KomputeKernel> gemms[2];
+    std::unique_ptr<KomputeKernel> pool;
+    // conv1, conv2, conv3, fc1, fc2
+    std::vector<Layer> layers;
+    SubSampl pools[2];
+
+    // Parameters of every dispatch, per chunk; created the first time a chunk is recorded
+    std::vector<std::vector<std::unique_ptr<ParamBlock>>> params;
+    std::shared_ptr<Buff> columns;
+    std::shared_ptr<Buff> ping;
+    std::shared_ptr<Buff> pong;
+
+    std::shared_ptr<StorageBuff<float>> input;
+    std::shared_ptr<Buff> output;
+    size_t output_capacity = 0;
+    BufferArena* arena;
+    CommandList list;
+    ReadbackPool readbacks;
+
+    void record_chunk(
+        CommandList& list, const std::shared_ptr<Buff>& images,
+        const std::shared_ptr<Buff>& scores, size_t first, size_t count, size_t total,
+        size_t index
+    );
+};
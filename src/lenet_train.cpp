@@ -0,0 +1,740 @@
+#include "lenet_train.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KOMPUTE_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define KOMPUTE_NEON 1
+#endif
+
+namespace {
+
+// Row-major C += op(A) * B. Element (i, k) of op(A) is a[i * a_row + k * a_col], so the same
+// kernel multiplies by the weights (a_row = depth, a_col = 1) or by their transpose.
+struct Gemm {
+    const float* a;
+    ptrdiff_t a_row;
+    ptrdiff_t a_col;
+    const float* b;
+    size_t ldb;
+    float* c;
+    size_t ldc;
+};
+
+// Blocks of B small enough to stay in L2 while every row of A passes over them
+constexpr size_t block_cols = 256;
+constexpr size_t block_depth = 128;
+
+void gemm_scalar(const Gemm& g, size_t i0, size_t i1, size_t j0, size_t j1, size_t k0, size_t k1) {
+    for (size_t i = i0; i < i1; i++) {
+        float* c = g.c + i * g.ldc;
+        for (size_t k = k0; k < k1; k++) {
+            const float a = g.a[i * g.a_row + k * g.a_col];
+            const float* b = g.b + k * g.ldb;
+            for (size_t j = j0; j < j1; j++) {
+                c[j] += a * b[j];
+            }
+        }
+    }
+}
+
+// Row-major C[i][k] += sum over n of A[i][n] * B[k][n]: the weight gradient, output gradients
+// against the im2col matrix
+struct GemmNT {
+    const float* a;
+    size_t lda;
+    const float* b;
+    size_t ldb;
+    float* c;
+    size_t ldc;
+};
+
+void gemm_nt_scalar(const GemmNT& g, size_t i, size_t k0, size_t k1, size_t n0, size_t n1) {
+    const float* a = g.a + i * g.lda;
+    for (size_t k = k0; k < k1; k++) {
+        const float* b = g.b + k * g.ldb;
+        float sum = 0.0f;
+        for (size_t n = n0; n < n1; n++) {
+            sum += a[n] * b[n];
+        }
+        g.c[i * g.ldc + k] += sum;
+    }
+}
+
+#if KOMPUTE_X86
+#define KOMPUTE_AVX2 __attribute__((target("avx2,fma")))
+
+// R rows by 16 columns of C held in registers across the whole depth
+template <int R>
+KOMPUTE_AVX2 void gemm_tile_avx2(const Gemm& g, size_t i, size_t j, size_t k0, size_t k1) {
+    __m256 acc[R][2];
+#pragma GCC unroll 8
+    for (int r = 0; r < R; r++) {
+        acc[r][0] = _mm256_loadu_ps(g.c + (i + r) * g.ldc + j);
+        acc[r][1] = _mm256_loadu_ps(g.c + (i + r) * g.ldc + j + 8);
+    }
+    for (size_t k = k0; k < k1; k++) {
+        const float* b = g.b + k * g.ldb + j;
+        const __m256 b0 = _mm256_loadu_ps(b);
+        const __m256 b1 = _mm256_loadu_ps(b + 8);
+#pragma GCC unroll 8
+        for (int r = 0; r < R; r++) {
+            const __m256 a = _mm256_set1_ps(g.a[(i + r) * g.a_row + k * g.a_col]);
+            acc[r][0] = _mm256_fmadd_ps(a, b0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_ps(a, b1, acc[r][1]);
+        }
+    }
+#pragma GCC unroll 8
+    for (int r = 0; r < R; r++) {
+        _mm256_storeu_ps(g.c + (i + r) * g.ldc + j, acc[r][0]);
+        _mm256_storeu_ps(g.c + (i + r) * g.ldc + j + 8, acc[r][1]);
+    }
+}
+
+// Returns the first column left for the scalar kernel
+KOMPUTE_AVX2 size_t
+gemm_avx2(const Gemm& g, size_t i0, size_t i1, size_t j0, size_t j1, size_t k0, size_t k1) {
+    size_t j = j0;
+    for (; j + 16 <= j1; j += 16) {
+        size_t i = i0;
+        for (; i + 4 <= i1; i += 4) {
+            gemm_tile_avx2<4>(g, i, j, k0, k1);
+        }
+        switch (i1 - i) {
+            case 3:
+                gemm_tile_avx2<3>(g, i, j, k0, k1);
+                break;
+            case 2:
+                gemm_tile_avx2<2>(g, i, j, k0, k1);
+                break;
+            case 1:
+                gemm_tile_avx2<1>(g, i, j, k0, k1);
+                break;
+        }
+    }
+    return j;
+}
+
+KOMPUTE_AVX2 inline float hsum(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehdup_ps(s)));
+}
+
+// R rows of A against S rows of B; returns the first n left for the scalar kernel
+template <int R, int S>
+KOMPUTE_AVX2 size_t gemm_nt_tile_avx2(const GemmNT& g, size_t i, size_t k, size_t n0, size_t n1) {
+    __m256 acc[R][S];
+#pragma GCC unroll 8
+    for (int r = 0; r < R; r++) {
+#pragma GCC unroll 8
+        for (int s = 0; s < S; s++) {
+            acc[r][s] = _mm256_setzero_ps();
+        }
+    }
+    size_t n = n0;
+    for (; n + 8 <= n1; n += 8) {
+        __m256 b[S];
+#pragma GCC unroll 8
+        for (int s = 0; s < S; s++) {
+            b[s] = _mm256_loadu_ps(g.b + (k + s) * g.ldb + n);
+        }
+#pragma GCC unroll 8
+        for (int r = 0; r < R; r++) {
+            const __m256 a = _mm256_loadu_ps(g.a + (i + r) * g.lda + n);
+#pragma GCC unroll 8
+            for (int s = 0; s < S; s++) {
+                acc[r][s] = _mm256_fmadd_ps(a, b[s], acc[r][s]);
+            }
+        }
+    }
+#pragma GCC unroll 8
+    for (int r = 0; r < R; r++) {
+#pragma GCC unroll 8
+        for (int s = 0; s < S; s++) {
+            g.c[(i + r) * g.ldc + k + s] += hsum(acc[r][s]);
+        }
+    }
+    return n;
+}
+
+template <int R>
+KOMPUTE_AVX2 void gemm_nt_rows_avx2(const GemmNT& g, size_t i, size_t k1, size_t n0, size_t n1) {
+    size_t k = 0;
+    size_t n = n0;
+    for (; k + 4 <= k1; k += 4) {
+        n = gemm_nt_tile_avx2<R, 4>(g, i, k, n0, n1);
+    }
+    for (; k < k1; k++) {
+        n = gemm_nt_tile_avx2<R, 1>(g, i, k, n0, n1);
+    }
+    for (int r = 0; r < R; r++) {
+        gemm_nt_scalar(g, i + r, 0, k1, n, n1);
+    }
+}
+
+KOMPUTE_AVX2 void gemm_nt_avx2(const GemmNT& g, size_t rows, size_t depth, size_t n0, size_t n1) {
+    size_t i = 0;
+    for (; i + 2 <= rows; i += 2) {
+        gemm_nt_rows_avx2<2>(g, i, depth, n0, n1);
+    }
+    if (i < rows) {
+        gemm_nt_rows_avx2<1>(g, i, depth, n0, n1);
+    }
+}
+#endif
+
+#if KOMPUTE_NEON
+template <int R>
+void gemm_tile_neon(const Gemm& g, size_t i, size_t j, size_t k0, size_t k1) {
+    float32x4_t acc[R][2];
+#pragma GCC unroll 8
+    for (int r = 0; r < R; r++) {
+        acc[r][0] = vld1q_f32(g.c + (i + r) * g.ldc + j);
+        acc[r][1] = vld1q_f32(g.c + (i + r) * g.ldc + j + 4);
+    }
+    for (size_t k = k0; k < k1; k++) {
+        const float* b = g.b + k * g.ldb + j;
+        const float32x4_t b0 = vld1q_f32(b);
+        const float32x4_t b1 = vld1q_f32(b + 4);
+#pragma GCC unroll 8
+        for (int r = 0; r < R; r++) {
+            const float a = g.a[(i + r) * g.a_row + k * g.a_col];
+            acc[r][0] = vfmaq_n_f32(acc[r][0], b0, a);
+            acc[r][1] = vfmaq_n_f32(acc[r][1], b1, a);
+        }
+    }
+#pragma GCC unroll 8
+    for (int r = 0; r < R; r++) {
+        vst1q_f32(g.c + (i + r) * g.ldc + j, acc[r][0]);
+        vst1q_f32(g.c + (i + r) * g.ldc + j + 4, acc[r][1]);
+    }
+}
+
+// Returns the first column left for the scalar kernel
+size_t gemm_neon(const Gemm& g, size_t i0, size_t i1, size_t j0, size_t j1, size_t k0, size_t k1) {
+    size_t j = j0;
+    for (; j + 8 <= j1; j += 8) {
+        size_t i = i0;
+        for (; i + 4 <= i1; i += 4) {
+            gemm_tile_neon<4>(g, i, j, k0, k1);
+        }
+        for (; i < i1; i++) {
+            gemm_tile_neon<1>(g, i, j, k0, k1);
+        }
+    }
+    return j;
+}
+
+template <int R, int S>
+size_t gemm_nt_tile_neon(const GemmNT& g, size_t i, size_t k, size_t n0, size_t n1) {
+    float32x4_t acc[R][S];
+#pragma GCC unroll 8
+    for (int r = 0; r < R; r++) {
+#pragma GCC unroll 8
+        for (int s = 0; s < S; s++) {
+            acc[r][s] = vdupq_n_f32(0.0f);
+        }
+    }
+    size_t n = n0;
+    for (; n + 4 <= n1; n += 4) {
+        float32x4_t b[S];
+#pragma GCC unroll 8
+        for (int s = 0; s < S; s++) {
+            b[s] = vld1q_f32(g.b + (k + s) * g.ldb + n);
+        }
+#pragma GCC unroll 8
+        for (int r = 0; r < R; r++) {
+            const float32x4_t a = vld1q_f32(g.a + (i + r) * g.lda + n);
+#pragma GCC unroll 8
+            for (int s = 0; s < S; s++) {
+                acc[r][s] = vfmaq_f32(acc[r][s], a, b[s]);
+            }
+        }
+    }
+#pragma GCC unroll 8
+    for (int r = 0; r < R; r++) {
+#pragma GCC unroll 8
+        for (int s = 0; s < S; s++) {
+            g.c[(i + r) * g.ldc + k + s] += vaddvq_f32(acc[r][s]);
+        }
+    }
+    return n;
+}
+
+template <int R>
+void gemm_nt_rows_neon(const GemmNT& g, size_t i, size_t k1, size_t n0, size_t n1) {
+    size_t k = 0;
+    size_t n = n0;
+    for (; k + 4 <= k1; k += 4) {
+        n = gemm_nt_tile_neon<R, 4>(g, i, k, n0, n1);
+    }
+    for (; k < k1; k++) {
+        n = gemm_nt_tile_neon<R, 1>(g, i, k, n0, n1);
+    }
+    for (int r = 0; r < R; r++) {
+        gemm_nt_scalar(g, i + r, 0, k1, n, n1);
+    }
+}
+
+void gemm_nt_neon(const GemmNT& g, size_t rows, size_t depth, size_t n0, size_t n1) {
+    size_t i = 0;
+    for (; i + 2 <= rows; i += 2) {
+        gemm_nt_rows_neon<2>(g, i, depth, n0, n1);
+    }
+    if (i < rows) {
+        gemm_nt_rows_neon<1>(g, i, depth, n0, n1);
+    }
+}
+#endif
+
+// C (rows x cols) += op(A) (rows x depth) * B (depth x cols), in blocks of B
+void gemm(CpuIsa isa, const Gemm& g, size_t rows, size_t cols, size_t depth) {
+    for (size_t j0 = 0; j0 < cols; j0 += block_cols) {
+        const size_t j1 = std::min(cols, j0 + block_cols);
+        for (size_t k0 = 0; k0 < depth; k0 += block_depth) {
+            const size_t k1 = std::min(depth, k0 + block_depth);
+            size_t j = j0;
+#if KOMPUTE_X86
+            if (isa == CpuIsa::Avx2) {
+                j = gemm_avx2(g, 0, rows, j0, j1, k0, k1);
+            }
+#elif KOMPUTE_NEON
+            if (isa == CpuIsa::Neon) {
+                j = gemm_neon(g, 0, rows, j0, j1, k0, k1);
+            }
+#endif
+            gemm_scalar(g, 0, rows, j, j1, k0, k1);
+        }
+    }
+}
+
+// C (rows x depth) += A (rows x cols) * B (depth x cols) transposed, in blocks of columns
+void gemm_nt(CpuIsa isa, const GemmNT& g, size_t rows, size_t depth, size_t cols) {
+    for (size_t n0 = 0; n0 < cols; n0 += block_cols) {
+        const size_t n1 = std::min(cols, n0 + block_cols);
+#if KOMPUTE_X86
+        if (isa == CpuIsa::Avx2) {
+            gemm_nt_avx2(g, rows, depth, n0, n1);
+            continue;
+        }
+#elif KOMPUTE_NEON
+        if (isa == CpuIsa::Neon) {
+            gemm_nt_neon(g, rows, depth, n0, n1);
+            continue;
+        }
+#endif
+        for (size_t i = 0; i < rows; i++) {
+            gemm_nt_scalar(g, i, 0, depth, n0, n1);
+        }
+    }
+}
+
+// Outputs [begin, end) of a row whose input at kernel offset `offset` lies inside the input
+struct Span {
+    int begin;
+    int end;
+};
+
+Span inside(int offset, int stride, int padding, int size, int out_size) {
+    auto first_at = [&](int x) {
+        // First output whose input is at or past x
+        return std::clamp((x + padding - offset + stride - 1) / stride, 0, out_size);
+    };
+    return { padding > offset ? first_at(0) : 0, first_at(size) };
+}
+
+// Channels-first over `count` images of size x size: column order image, output row, output
+// column; row order input channel, kernel row, kernel column, like the weights
+void im2col(const Conv2D& conv, const float* in, int size, size_t count, float* columns) {
+    const int k = conv.kernel_size;
+    const int stride = conv.stride;
+    const int out_size = conv.output_size(size);
+    const size_t cols = count * out_size * out_size;
+    for (int c = 0; c < conv.input_channels; c++) {
+        for (int ky = 0; ky < k; ky++) {
+            const Span ys = inside(ky, stride, conv.padding, size, out_size);
+            for (int kx = 0; kx < k; kx++) {
+                const Span xs = inside(kx, stride, conv.padding, size, out_size);
+                float* dst = columns + ((size_t(c) * k + ky) * k + kx) * cols;
+                for (size_t n = 0; n < count; n++) {
+                    const float* plane = in + (c * count + n) * size * size;
+                    for (int oy = 0; oy < out_size; oy++, dst += out_size) {
+                        if (oy < ys.begin || oy >= ys.end) {
+                            std::fill_n(dst, out_size, 0.0f);
+                            continue;
+                        }
+                        const float* row = plane + (oy * stride - conv.padding + ky) * size +
+                                           kx - conv.padding;
+                        std::fill_n(dst, xs.begin, 0.0f);
+                        for (int ox = xs.begin; ox < xs.end; ox++) {
+                            dst[ox] = row[ox * stride];
+                        }
+                        std::fill(dst + xs.end, dst + out_size, 0.0f);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Adds the columns' gradients back onto the pixels they were taken from; `in` must be zeroed
+void col2im(const Conv2D& conv, const float* columns, int size, size_t count, float* in) {
+    const int k = conv.kernel_size;
+    const int stride = conv.stride;
+    const int out_size = conv.output_size(size);
+    const size_t cols = count * out_size * out_size;
+    for (int c = 0; c < conv.input_channels; c++) {
+        for (int ky = 0; ky < k; ky++) {
+            const Span ys = inside(ky, stride, conv.padding, size, out_size);
+            for (int kx = 0; kx < k; kx++) {
+                const Span xs = inside(kx, stride, conv.padding, size, out_size);
+                const float* src = columns + ((size_t(c) * k + ky) * k + kx) * cols;
+                for (size_t n = 0; n < count; n++) {
+                    float* plane = in + (c * count + n) * size * size;
+                    for (int oy = ys.begin; oy < ys.end; oy++) {
+                        const float* from = src + (n * out_size + oy) * out_size;
+                        float* row = plane + (oy * stride - conv.padding + ky) * size + kx -
+                                     conv.padding;
+                        for (int ox = xs.begin; ox < xs.end; ox++) {
+                            row[ox * stride] += from[ox];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Calls fn(output, first row, first column, last row, last column) for every pooling window,
+// clipped to the input
+template <typename F>
+void windows(const SubSampl& pool, int size, F&& fn) {
+    const int out_size = pool.output_size(size);
+    for (int oy = 0; oy < out_size; oy++) {
+        for (int ox = 0; ox < out_size; ox++) {
+            const int y0 = oy * pool.stride - pool.padding;
+            const int x0 = ox * pool.stride - pool.padding;
+            const int y1 = std::min(y0 + pool.pooling_size, size);
+            const int x1 = std::min(x0 + pool.pooling_size, size);
+            fn(oy * out_size + ox, std::max(y0, 0), std::max(x0, 0), y1, x1);
+        }
+    }
+}
+
+// Average of the ReLU of `in` over the part of each window inside the input, like infer(). The
+// convolutions before pooling keep their outputs before the ReLU, which saves a pass over them.
+void pool_forward(const SubSampl& pool, const float* in, float* out, size_t planes, int size) {
+    const int out_size = pool.output_size(size);
+    for (size_t p = 0; p < planes; p++) {
+        const float* src = in + p * size * size;
+        float* dst = out + p * out_size * out_size;
+        windows(pool, size, [&](int o, int y0, int x0, int y1, int x1) {
+            float sum = 0.0f;
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    sum += std::max(src[y * size + x], 0.0f);
+                }
+            }
+            const int n = (y1 - y0) * (x1 - x0);
+            dst[o] = n > 0 ? sum / n : 0.0f;
+        });
+    }
+}
+
+// Spreads the gradients of pool_forward's outputs over their windows, through the ReLU of `in`;
+// grad_in must be zeroed
+void pool_backward(
+    const SubSampl& pool, const float* in, const float* grad_out, float* grad_in, size_t planes,
+    int size
+) {
+    const int out_size = pool.output_size(size);
+    for (size_t p = 0; p < planes; p++) {
+        const float* src = in + p * size * size;
+        const float* from = grad_out + p * out_size * out_size;
+        float* dst = grad_in + p * size * size;
+        windows(pool, size, [&](int o, int y0, int x0, int y1, int x1) {
+            const float g = from[o] / std::max((y1 - y0) * (x1 - x0), 1);
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    dst[y * size + x] += src[y * size + x] > 0.0f ? g : 0.0f;
+                }
+            }
+        });
+    }
+}
+
+// A layer as its GEMM sees it: `rows` outputs, each a dot product of `depth` inputs
+struct Dense {
+    std::span<float> weights;
+    std::span<float> biases;
+    size_t rows;
+    size_t depth;
+};
+
+Dense dense(const Conv2D& conv) {
+    return { conv.weights, conv.biases, size_t(conv.output_channels), size_t(conv.fan_in()) };
+}
+
+Dense dense(const FullyConnected& fc) {
+    return { fc.weights, fc.biases, size_t(fc.output_channels), size_t(fc.input_channels) };
+}
+
+// Rows of `out` start at the bias, so the GEMM adds onto it
+void fill_biases(std::span<const float> biases, float* out, size_t cols) {
+    for (size_t o = 0; o < biases.size(); o++) {
+        std::fill_n(out + o * cols, cols, biases[o]);
+    }
+}
+
+void relu(float* x, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        x[i] = x[i] > 0.0f ? x[i] : 0.0f;
+    }
+}
+
+// Gradients through the ReLU that produced `out`: zero wherever it clamped
+void relu_backward(const float* out, float* grad, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        grad[i] = out[i] > 0.0f ? grad[i] : 0.0f;
+    }
+}
+
+void bias_backward(const float* grad, std::span<float> biases, size_t cols) {
+    for (size_t o = 0; o < biases.size(); o++) {
+        float sum = 0.0f;
+        for (size_t j = 0; j < cols; j++) {
+            sum += grad[o * cols + j];
+        }
+        biases[o] += sum;
+    }
+}
+
+}  // namespace
+
+// Gradients and scratch of one shard. Every buffer is channels-first across a micro-batch.
+struct LeNetTrainer::Shard {
+    // Same layout as the net, so the reduction runs over parameters() as a whole
+    LeNet gradients;
+    // out1 and out2 are kept before their ReLU, which pooling applies
+    std::vector<float> columns1, out1, pooled1, columns2, out2, pooled2, columns3, out3, out4;
+    std::vector<float> scores;
+    // Gradients of the activations; columns and outputs of a layer take turns in two buffers
+    std::vector<float> grad_columns, grad_out, grad_pooled;
+    double loss = 0;
+    size_t correct = 0;
+};
+
+LeNetTrainer::LeNetTrainer(LeNet& net, ThreadPool& pool, CpuIsa isa)
+    : net(net), isa(isa), pool(pool) {
+#if !KOMPUTE_X86
+    if (isa == CpuIsa::Avx2) {
+        throw std::runtime_error("AVX2 kernels are only built for x86");
+    }
+#else
+    if (isa == CpuIsa::Avx2 &&
+        (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("fma"))) {
+        throw std::runtime_error("This CPU does not support AVX2 and FMA");
+    }
+#endif
+#if !KOMPUTE_NEON
+    if (isa == CpuIsa::Neon) {
+        throw std::runtime_error("NEON kernels are only built for AArch64");
+    }
+#endif
+
+    const size_t n = micro_batch;
+    const int size1 = net.conv1.output_size(LeNet::input_size);
+    const int pooled1 = net.sub1.output_size(size1);
+    const int size2 = net.conv2.output_size(pooled1);
+    const int pooled2 = net.sub2.output_size(size2);
+    const int size3 = net.conv3.output_size(pooled2);
+    if (size3 != 1 || net.fc1.input_channels != net.conv3.output_channels) {
+        throw std::runtime_error("conv3 must reduce to one value per channel for fc1");
+    }
+    for (size_t i = 0; i < pool.size(); i++) {
+        auto shard = std::make_unique<Shard>();
+        shard->columns1.resize(net.conv1.fan_in() * n * size1 * size1);
+        shard->out1.resize(net.conv1.output_channels * n * size1 * size1);
+        shard->pooled1.resize(net.conv1.output_channels * n * pooled1 * pooled1);
+        shard->columns2.resize(net.conv2.fan_in() * n * size2 * size2);
+        shard->out2.resize(net.conv2.output_channels * n * size2 * size2);
+        shard->pooled2.resize(net.conv2.output_channels * n * pooled2 * pooled2);
+        shard->columns3.resize(net.conv3.fan_in() * n);
+        shard->out3.resize(net.conv3.output_channels * n);
+        shard->out4.resize(net.fc1.output_channels * n);
+        shard->scores.resize(LeNet::classes * n);
+        shard->grad_columns.resize(std::max(shard->columns2.size(), shard->columns3.size()));
+        shard->grad_out.resize(std::max(
+            { shard->out1.size(), shard->out2.size(), shard->out3.size(), shard->out4.size(),
+              shard->scores.size() }
+        ));
+        shard->grad_pooled.resize(std::max(shard->pooled1.size(), shard->pooled2.size()));
+        shards.push_back(std::move(shard));
+    }
+}
+
+LeNetTrainer::~LeNetTrainer() = default;
+
+float LeNetTrainer::step(
+    std::span<const float> images, std::span<const uint8_t> labels, float learning_rate
+) {
+    const size_t count = images.size() / LeNet::input_pixels;
+    if (labels.size() < count) {
+        throw std::runtime_error("Every image needs a label");
+    }
+    if (count == 0) {
+        return 0.0f;
+    }
+
+    // out = weights * columns + biases
+    auto forward = [&](const Dense& layer, const float* columns, float* out, size_t cols) {
+        const Gemm g{ layer.weights.data(), ptrdiff_t(layer.depth), 1, columns, cols, out, cols };
+        fill_biases(layer.biases, out, cols);
+        gemm(isa, g, layer.rows, cols, layer.depth);
+    };
+    // From the gradients of `out`: those of the weights and biases into `grads`, and unless
+    // grad_columns is null those of the columns, the transposed weights times grad_out
+    auto backward = [&](const Dense& layer, const Dense& grads, const float* columns,
+                        const float* grad_out, float* grad_columns, size_t cols) {
+        const GemmNT g{ grad_out, cols, columns, cols, grads.weights.data(), layer.depth };
+        gemm_nt(isa, g, layer.rows, layer.depth, cols);
+        bias_backward(grad_out, grads.biases, cols);
+        if (grad_columns) {
+            const Gemm t{
+                layer.weights.data(), 1, ptrdiff_t(layer.depth), grad_out, cols, grad_columns, cols
+            };
+            std::fill_n(grad_columns, layer.depth * cols, 0.0f);
+            gemm(isa, t, layer.depth, cols, layer.rows);
+        }
+    };
+
+    // Gradients are of the mean loss over the whole batch, so the shards' simply add up
+    const float scale = 1.0f / count;
+    const size_t per_shard = (count + shards.size() - 1) / shards.size();
+    pool.parallel_for(shards.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t s = begin; s < end; s++) {
+            Shard& sh = *shards[s];
+            LeNet& g = sh.gradients;
+            std::ranges::fill(g.parameters(), 0.0f);
+            sh.loss = 0;
+            sh.correct = 0;
+            const size_t first = std::min(count, s * per_shard);
+            const size_t last = std::min(count, first + per_shard);
+            for (size_t m = first; m < last; m += micro_batch) {
+                const size_t n = std::min(micro_batch, last - m);
+                const float* x = images.data() + m * LeNet::input_pixels;
+                int size = LeNet::input_size;
+
+                // conv1 -> sub1 -> conv2 -> sub2 -> conv3 -> fc1 -> fc2
+                const int size1 = net.conv1.output_size(size);
+                const size_t cols1 = n * size1 * size1;
+                im2col(net.conv1, x, size, n, sh.columns1.data());
+                forward(dense(net.conv1), sh.columns1.data(), sh.out1.data(), cols1);
+                const size_t planes1 = net.conv1.output_channels * n;
+                pool_forward(net.sub1, sh.out1.data(), sh.pooled1.data(), planes1, size1);
+
+                const int pooled1 = net.sub1.output_size(size1);
+                const int size2 = net.conv2.output_size(pooled1);
+                const size_t cols2 = n * size2 * size2;
+                im2col(net.conv2, sh.pooled1.data(), pooled1, n, sh.columns2.data());
+                forward(dense(net.conv2), sh.columns2.data(), sh.out2.data(), cols2);
+                const size_t planes2 = net.conv2.output_channels * n;
+                pool_forward(net.sub2, sh.out2.data(), sh.pooled2.data(), planes2, size2);
+
+                const int pooled2 = net.sub2.output_size(size2);
+                im2col(net.conv3, sh.pooled2.data(), pooled2, n, sh.columns3.data());
+                forward(dense(net.conv3), sh.columns3.data(), sh.out3.data(), n);
+                relu(sh.out3.data(), net.conv3.output_channels * n);
+
+                // One value per channel and image: the layout fully connected layers take
+                forward(dense(net.fc1), sh.out3.data(), sh.out4.data(), n);
+                relu(sh.out4.data(), net.fc1.output_channels * n);
+                forward(dense(net.fc2), sh.out4.data(), sh.scores.data(), n);
+
+                // Softmax cross-entropy; its gradient is the probabilities less the label's 1
+                float* grad = sh.grad_out.data();
+                for (size_t i = 0; i < n; i++) {
+                    float top = sh.scores[i];
+                    int best = 0;
+                    for (int c = 1; c < LeNet::classes; c++) {
+                        if (sh.scores[c * n + i] > top) {
+                            top = sh.scores[c * n + i];
+                            best = c;
+                        }
+                    }
+                    float sum = 0.0f;
+                    for (int c = 0; c < LeNet::classes; c++) {
+                        grad[c * n + i] = std::exp(sh.scores[c * n + i] - top);
+                        sum += grad[c * n + i];
+                    }
+                    const int label = labels[m + i];
+                    sh.loss += std::log(sum) - (sh.scores[label * n + i] - top);
+                    sh.correct += best == label;
+                    for (int c = 0; c < LeNet::classes; c++) {
+                        grad[c * n + i] = (grad[c * n + i] / sum - (c == label)) * scale;
+                    }
+                }
+
+                // fc2 and fc1 write their input gradients straight into grad_columns
+                float* grad_in = sh.grad_columns.data();
+                backward(dense(net.fc2), dense(g.fc2), sh.out4.data(), grad, grad_in, n);
+                relu_backward(sh.out4.data(), grad_in, net.fc1.output_channels * n);
+                std::copy_n(grad_in, net.fc1.output_channels * n, grad);
+                backward(dense(net.fc1), dense(g.fc1), sh.out3.data(), grad, grad_in, n);
+                relu_backward(sh.out3.data(), grad_in, net.conv3.output_channels * n);
+                std::copy_n(grad_in, net.conv3.output_channels * n, grad);
+
+                float* grad_pooled = sh.grad_pooled.data();
+                backward(dense(net.conv3), dense(g.conv3), sh.columns3.data(), grad, grad_in, n);
+                std::fill_n(grad_pooled, planes2 * pooled2 * pooled2, 0.0f);
+                col2im(net.conv3, grad_in, pooled2, n, grad_pooled);
+                std::fill_n(grad, planes2 * size2 * size2, 0.0f);
+                pool_backward(net.sub2, sh.out2.data(), grad_pooled, grad, planes2, size2);
+
+                backward(
+                    dense(net.conv2), dense(g.conv2), sh.columns2.data(), grad, grad_in, cols2
+                );
+                std::fill_n(grad_pooled, planes1 * pooled1 * pooled1, 0.0f);
+                col2im(net.conv2, grad_in, pooled1, n, grad_pooled);
+                std::fill_n(grad, planes1 * size1 * size1, 0.0f);
+                pool_backward(net.sub1, sh.out1.data(), grad_pooled, grad, planes1, size1);
+
+                // The input needs no gradient
+                backward(
+                    dense(net.conv1), dense(g.conv1), sh.columns1.data(), grad, nullptr, cols1
+                );
+            }
+        }
+    });
+
+    // Reduction: sum the shards' gradients and step, in slices of the parameters
+    auto params = net.parameters();
+    std::vector<const float*> gradients;
+    for (auto& shard : shards) {
+        gradients.push_back(shard->gradients.parameters().data());
+    }
+    pool.parallel_for(params.size(), 4096, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            float sum = 0.0f;
+            for (const float* g : gradients) {
+                sum += g[i];
+            }
+            params[i] -= learning_rate * sum;
+        }
+    });
+
+    double loss = 0;
+    last_correct = 0;
+    for (auto& shard : shards) {
+        loss += shard->loss;
+        last_correct += shard->correct;
+    }
+    return float(loss / count);
+}
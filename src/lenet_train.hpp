@@ -0,0 +1,47 @@
+#pragma once
+
+#include "cpu.hpp"
+#include "lenet.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+// Mini-batch SGD for LeNet on the CPU. Each batch is split into one shard per pool thread; a
+// shard runs forward and backward on its images into gradients of its own, and a reduction then
+// sums the shards' gradients into the update. Every layer is a GEMM, convolutions through
+// im2col, with activations kept channels-first across a micro-batch (C x N x H x W) as on the GPU.
+//
+//     ThreadPool pool;
+//     LeNetTrainer trainer(net, pool);
+//     float loss = trainer.step(images, labels, 0.05f);
+class LeNetTrainer {
+public:
+    LeNetTrainer(LeNet& net, ThreadPool& pool, CpuIsa isa = detect_isa());
+    ~LeNetTrainer();
+    LeNetTrainer(const LeNetTrainer&) = delete;
+
+    // One update from images.size() / 784 images with a label each; returns their mean
+    // cross-entropy loss before the update
+    float step(std::span<const float> images, std::span<const uint8_t> labels, float learning_rate);
+
+    // Images of the last step the net classified right before the update
+    size_t correct() const {
+        return last_correct;
+    }
+
+    // Images a shard runs through the layers at once
+    static constexpr size_t micro_batch = 16;
+
+    LeNet& net;
+    const CpuIsa isa;
+
+private:
+    struct Shard;
+
+    ThreadPool& pool;
+    std::vector<std::unique_ptr<Shard>> shards;
+    size_t last_correct = 0;
+};
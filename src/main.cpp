@@ -1,16 +1,31 @@
+#include "arena.hpp"
+#include "cpu.hpp"
 #include "kompute.hpp"
+#include "motion.hpp"
+#include "pipeline.hpp"
+#include "tuner.hpp"
+#include "yuv.hpp"
 
 #include <opencv2/core/hal/interface.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/opencv.hpp>
+#include <optional>
 #include <span>
 #include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 
 extern "C" {
@@ -20,13 +35,14 @@ extern "C" {
 #include <libavcodec/codec_par.h>
 #include <libavcodec/packet.h>
 #include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
 }
 
-// Convert AVFrame (YUV) to OpenCV Mat (BGR)
-cv::Mat avframe_to_cvmat(AVFrame* frame, SwsContext* sws_ctx) {
+// Convert AVFrame (YUV) to OpenCV Mat (BGR), reusing bgr_image's memory when it fits
+void avframe_to_cvmat(AVFrame* frame, SwsContext* sws_ctx, cv::Mat& bgr_image) {
     int width = frame->width;
     int height = frame->height;
-    cv::Mat bgr_image(cv::Size(width, height), CV_8UC3);  // 8-bit unsigned, 3 channels (BGR)
+    bgr_image.create(cv::Size(width, height), CV_8UC3);  // 8-bit unsigned, 3 channels (BGR)
 
     // Define the destination buffer and linesize for BGR image
     uint8_t* dest[4] = { bgr_image.data, nullptr, nullptr, nullptr };
@@ -36,15 +52,183 @@ cv::Mat avframe_to_cvmat(AVFrame* frame, SwsContext* sws_ctx) {
     sws_scale(sws_ctx,
               frame->data, frame->linesize, 0, height,  // Source: YUV planes
               dest, dest_linesize);                     // Destination: BGR
+}
 
-    bgr_image.convertTo(bgr_image, CV_32FC3, 1.0 / 255.0);
-    return bgr_image;
+// Formats the detector converts on the GPU; anything else goes through swscale to 8-bit BGR
+PixelFormat gpu_format(int format) {
+    switch (format) {
+    case AV_PIX_FMT_YUV420P:
+        return PixelFormat::YUV420P;
+    case AV_PIX_FMT_YUVJ420P:
+        return PixelFormat::YUVJ420P;
+    case AV_PIX_FMT_NV12:
+        return PixelFormat::NV12;
+    default:
+        return PixelFormat::BGR8;
+    }
 }
 
-int main() {
+// One frame's worth of buffers. A fixed set of slots circulates through the stages and back,
+// so nothing is allocated per frame.
+struct FrameSlot {
+    // Decoded planes; unreferenced as soon as they are uploaded
+    AVFrame* frame = av_frame_alloc();
+    // 8-bit BGR to draw on
+    cv::Mat bgr;
+    // Float BGR for the CPU detector
+    cv::Mat upload;
+    BoxList boxes;
+    std::chrono::steady_clock::time_point decoded;
+    struct Stream* stream;
+};
+
+// Draw the bounding boxes of the moving regions
+void show_result(const BoxList& boxes, const cv::Mat& img, const std::string& window) {
+    if (boxes.found() > boxes.capacity()) {
+        std::cout << "Dropped " << boxes.found() - boxes.capacity() << " boxes" << std::endl;
+    }
+    cv::Mat outputImage = img.clone();
+    for (const Box& box : boxes.boxes()) {
+        cv::Rect boundingBox(box.x, box.y, box.width, box.height);
+        cv::rectangle(outputImage, boundingBox, cv::Scalar(0, 255, 0), 2); // Draw bounding box in green
+    }
+
+    // Show the result
+    cv::imshow(window, outputImage);
+    cv::waitKey(1);
+}
+
+using Clock = std::chrono::steady_clock;
+
+// One input and everything that is per input: its decoder, frame slots, the queues between its
+// decode and conversion threads and the GPU thread, and its detector's GPU state (history
+// buffers, parameters).
+struct Stream {
+    explicit Stream(std::string source, size_t index)
+        : source(std::move(source)), window("Bounding Boxes " + std::to_string(index)),
+          slots(8), free_slots(slots.size()), decoded(2), converted(2) {
+        for (auto& slot : slots) {
+            slot.stream = this;
+            free_slots.push(&slot);
+        }
+    }
+
+    ~Stream() {
+        for (auto& slot : slots) {
+            av_frame_free(&slot.frame);
+        }
+        avcodec_free_context(&codec_ctx);
+        avformat_close_input(&fmt_ctx);
+    }
+
+    const std::string source;
+    const std::string window;
+    AVFormatContext* fmt_ctx = nullptr;
+    AVCodecContext* codec_ctx = nullptr;
+    int video_stream_index = -1;
+
+    std::vector<FrameSlot> slots;
+    SpscQueue<FrameSlot*> free_slots;
+    SpscQueue<FrameSlot*> decoded;
+    SpscQueue<FrameSlot*> converted;
+    StageStats decode_stats{ "decode" };
+    StageStats convert_stats{ "convert" };
+    StageStats display_stats{ "display" };
+    StageStats latency_stats{ "decoded to displayed" };
+    std::thread decoder;
+    std::thread converter;
+
+    // Decoded frames go straight into this once the GPU thread has created it
+    std::atomic<StagingPool*> staging = nullptr;
+    // Largest frame the decoder asked for, so the GPU thread can size the pool
+    std::atomic<size_t> frame_bytes = 0;
+
+    // GPU thread only
+    std::unique_ptr<StagingPool> staging_pool;
+    // Keep zero-copy frames referenced until the GPU is done reading them
+    std::vector<AVFrame*> spare_frames;
+    size_t uploads = 0;
+    size_t zero_copy = 0;
+    size_t copied_bytes = 0;
+    std::optional<MotionDetector> detector;
+    // Instead of `detector` on the CPU backend
+    std::optional<CpuMotionDetector> cpu_detector;
+    Readback pending;
+    FrameSlot* pending_slot = nullptr;
+    bool finished = false;
+};
+
+// Blocks per stream's staging pool: enough for the decoder's reference frames and frame threads
+// plus every frame in flight through the pipeline.
+constexpr size_t staging_blocks = 40;
+
+void release_staging_buffer(void* opaque, uint8_t* data) {
+    auto pool = static_cast<StagingPool*>(opaque);
+    pool->release(pool->find(data));
+}
+
+// Decoder frame allocator. Once the GPU thread has set up the stream's staging pool, frames are
+// decoded straight into it and the detector reads the planes in place. Anything else (formats
+// the GPU can't convert, a pool that is missing, full or too small) gets FFmpeg's default
+// buffers and is copied on upload.
+int get_staging_buffer(AVCodecContext* ctx, AVFrame* frame, int flags) {
+    Stream& stream = *static_cast<Stream*>(ctx->opaque);
+    auto format = static_cast<AVPixelFormat>(frame->format);
+    if (gpu_format(format) == PixelFormat::BGR8) {
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+    }
+
+    // Same padding and alignment as the default allocator
+    int width = frame->width;
+    int height = frame->height;
+    int align[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(ctx, &width, &height, align);
+    int linesize[4];
+    if (av_image_fill_linesizes(linesize, format, width) < 0) {
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+    }
+    ptrdiff_t linesizes[4];
+    for (int i = 0; i < 4; i++) {
+        linesize[i] = (linesize[i] + 63) & ~63;
+        linesizes[i] = linesize[i];
+    }
+    size_t sizes[4];
+    if (av_image_fill_plane_sizes(sizes, format, height, linesizes) < 0) {
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+    }
+    size_t total = AV_INPUT_BUFFER_PADDING_SIZE;
+    for (size_t size : sizes) {
+        total += size;
+    }
+    if (total > stream.frame_bytes.load(std::memory_order_relaxed)) {
+        stream.frame_bytes.store(total, std::memory_order_relaxed);
+    }
+
+    StagingPool* pool = stream.staging.load(std::memory_order_acquire);
+    StagingPool::Block* block = pool && total <= pool->block_size ? pool->acquire() : nullptr;
+    if (!block) {
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+    }
+    auto base = reinterpret_cast<uint8_t*>(block->ptr);
+    frame->buf[0] = av_buffer_create(base, total, release_staging_buffer, pool, 0);
+    if (!frame->buf[0]) {
+        pool->release(block);
+        return AVERROR(ENOMEM);
+    }
+    for (int i = 0; i < 4 && sizes[i]; i++) {
+        frame->data[i] = base;
+        frame->linesize[i] = linesize[i];
+        base += sizes[i];
+    }
+    frame->extended_data = frame->data;
+    return 0;
+}
+
+void open_input(Stream& stream) {
     // read RTCP using ffmpeg
-        const char* rtsp_url = "test0.mp4";
-    AVFormatContext* fmt_ctx = avformat_alloc_context();
+    const char* rtsp_url = stream.source.c_str();
+    AVFormatContext*& fmt_ctx = stream.fmt_ctx;
+    fmt_ctx = avformat_alloc_context();
     if (avformat_open_input(&fmt_ctx, rtsp_url, 0, 0) < 0) {
         fprintf(stderr, "can't open %s\n", rtsp_url);
         exit(1);
@@ -55,15 +239,16 @@ int main() {
         exit(1);
     }
 
-    int video_stream_index = -1;
+    int& video_stream_index = stream.video_stream_index;
+    video_stream_index = -1;
     AVCodecParameters* codecpar = nullptr;
 
     // Find the video stream
     for (int i = 0; i < fmt_ctx->nb_streams; i++) {
-        AVStream* stream = fmt_ctx->streams[i];
-        if (stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+        AVStream* av_stream = fmt_ctx->streams[i];
+        if (av_stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
             video_stream_index = i;
-            codecpar = stream->codecpar;
+            codecpar = av_stream->codecpar;
             break;
         }
     }
@@ -80,7 +265,8 @@ int main() {
         exit(1);
     }
 
-    AVCodecContext* codec_ctx = avcodec_alloc_context3(codec);
+    AVCodecContext*& codec_ctx = stream.codec_ctx;
+    codec_ctx = avcodec_alloc_context3(codec);
     if (!codec_ctx) {
         fprintf(stderr, "failed to allocate codec context\n");
         exit(1);
@@ -92,116 +278,422 @@ int main() {
         exit(1);
     }
 
+    // Decode on several frames at once, into staging memory where possible
+    codec_ctx->thread_count = 0;
+    codec_ctx->thread_type = FF_THREAD_FRAME;
+    if (codec->capabilities & AV_CODEC_CAP_DR1) {
+        codec_ctx->opaque = &stream;
+        codec_ctx->get_buffer2 = get_staging_buffer;
+    }
+
     // Open the codec
     if (avcodec_open2(codec_ctx, codec, nullptr) < 0) {
         fprintf(stderr, "failed to open codec\n");
         exit(1);
     }
+}
 
-
+// Demux + decode into free slots
+void decode(Stream& stream) {
     AVPacket* packet = av_packet_alloc();
-    AVFrame* frame = av_frame_alloc();
+    FrameSlot* slot = nullptr;
+    Clock::time_point start;
+    // Hands on every frame the decoder has ready
+    auto receive = [&] {
+        for (;;) {
+            if (!slot) {
+                slot = *stream.free_slots.pop();
+                start = Clock::now();
+            }
+            if (avcodec_receive_frame(stream.codec_ctx, slot->frame) < 0) {
+                return;
+            }
+            slot->decoded = Clock::now();
+            stream.decode_stats.record(slot->decoded - start);
+            stream.decoded.push(slot);
+            slot = nullptr;
+        }
+    };
+    while (av_read_frame(stream.fmt_ctx, packet) >= 0) {
+        if (packet->stream_index == stream.video_stream_index) {
+            // Send the packet to the decoder
+            if (avcodec_send_packet(stream.codec_ctx, packet) < 0) {
+                fprintf(stderr, "error sending packet to decoder\n");
+                av_packet_unref(packet);
+                continue;
+            }
+            receive();
+        }
 
-    cv::Mat img;
-    cv::Mat old_img;
+        av_packet_unref(packet); // Clean up the packet for the next iteration
+    }
+    av_packet_free(&packet);
 
-    Kompute k("/dev/dri/renderD128");
+    // Drain the frames still in flight, several with frame threading
+    if (avcodec_send_packet(stream.codec_ctx, nullptr) >= 0) {
+        receive();
+    }
+    stream.decoded.close();
+}
 
-    KomputeKernel kernel(std::filesystem::path("kernel.glsl"));
+// Colour conversion, as far as the GPU doesn't do it (`gpu_yuv`: the GPU takes YUV planes and
+// 8-bit BGR as they are, and swscale only makes the colour preview). With `gray_preview`, YUV
+// frames the GPU converts are previewed from their luma instead, which saves the swscale pass.
+// Rings `gpu` for every frame it hands on.
+void convert(Stream& stream, Doorbell& gpu, bool gpu_yuv, bool gray_preview) {
+    // Only needed for formats the detector can't convert itself
+    SwsContext* sws_ctx = nullptr;
+    while (auto next = stream.decoded.pop()) {
+        FrameSlot* slot = *next;
+        auto start = Clock::now();
+        AVFrame* frame = slot->frame;
+        if (gpu_yuv && gray_preview && gpu_format(frame->format) != PixelFormat::BGR8) {
+            // The detector converts the planes itself; luma is enough to draw the boxes on
+            cv::Mat luma(frame->height, frame->width, CV_8UC1, frame->data[0], frame->linesize[0]);
+            cv::cvtColor(luma, slot->bgr, cv::COLOR_GRAY2BGR);
+        } else {
+            // Reused until the input format changes
+            sws_ctx = sws_getCachedContext(
+                sws_ctx, frame->width, frame->height, (AVPixelFormat)frame->format, frame->width,
+                frame->height, AV_PIX_FMT_BGR24, SWS_BILINEAR, nullptr, nullptr, nullptr
+            );
+            if (!sws_ctx) {
+                fprintf(stderr, "Error: Could not initialize the sws context.\n");
+                exit(1);
+            }
+            avframe_to_cvmat(frame, sws_ctx, slot->bgr);
+            if (!gpu_yuv) {
+                slot->bgr.convertTo(slot->upload, CV_32FC3, 1.0 / 255.0);
+            }
+        }
+        stream.convert_stats.record_since(start);
+        stream.converted.push(slot);
+        gpu.ring();
+    }
+    sws_freeContext(sws_ctx);
+    stream.converted.close();
+    gpu.ring();
+}
 
-    auto in1 = std::make_shared<StorageBuff<float>>();
-    auto in2 = std::make_shared<StorageBuff<float>>();
-    auto out = std::make_shared<StorageBuff<float>>();
+int main(int argc, char** argv) {
+    // Every argument is an input; all of them share one GPU. With --cpu, or without a render
+    // node, detection runs on the CPU backend instead. --dirty-tiles skips the static parts of
+    // frames, and --pyramid-level=N [--refine-margin=PIXELS] detects coarse to fine, on frames
+    // whose width allows it (MotionOptions). --gray-preview shows YUV input in grayscale and skips
+    // the swscale pass that the colour preview costs.
+    const std::string device = "/dev/dri/renderD128";
+    bool use_cpu = !std::filesystem::exists(device);
+    bool dirty_tiles = false;
+    bool gray_preview = false;
+    int pyramid_level = 0;
+    int refine_margin = MotionOptions{}.refine_margin;
+    std::vector<std::string> sources;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--cpu") {
+            use_cpu = true;
+        } else if (arg == "--dirty-tiles") {
+            dirty_tiles = true;
+        } else if (arg == "--gray-preview") {
+            gray_preview = true;
+        } else if (arg.starts_with("--pyramid-level=")) {
+            pyramid_level = std::stoi(arg.substr(arg.find('=') + 1));
+        } else if (arg.starts_with("--refine-margin=")) {
+            refine_margin = std::stoi(arg.substr(arg.find('=') + 1));
+        } else {
+            sources.push_back(argv[i]);
+        }
+    }
+    if (sources.empty()) {
+        sources.push_back("test0.mp4");
+    }
 
+    // Stages, each on its own thread: per stream, demux + decode and colour conversion; for all
+    // streams together, GPU upload + submit + readback (or CPU detection); and drawing on this
+    // thread (HighGUI wants the main thread). Bounded queues between them keep every stage busy
+    // while holding back whichever one runs ahead.
+    std::vector<std::unique_ptr<Stream>> streams;
+    for (size_t i = 0; i < sources.size(); i++) {
+        streams.push_back(std::make_unique<Stream>(sources[i], i));
+        open_input(*streams.back());
+    }
+    SpscQueue<FrameSlot*> done(2 * streams.size());
+    Doorbell gpu_ready;
+
+    StageStats gpu_stats("detect batch");
+    size_t batched_frames = 0;
+
+    // Takes at most one frame per stream, starting from a different stream each time, so a
+    // stream with frames piling up can't crowd out the others. Counts finished streams off
+    // `open`.
+    size_t first = 0;
+    auto take_round = [&](std::vector<std::pair<Stream*, FrameSlot*>>& ready, size_t& open) {
+        ready.clear();
+        for (size_t n = 0; n < streams.size(); n++) {
+            Stream& stream = *streams[(first + n) % streams.size()];
+            if (stream.finished) {
+                continue;
+            }
+            if (auto next = stream.converted.try_pop()) {
+                ready.emplace_back(&stream, *next);
+            } else if (stream.converted.drained()) {
+                stream.finished = true;
+                open--;
+            }
+        }
+        first = (first + 1) % streams.size();
+    };
+
+    auto start = Clock::now();
+    for (auto& stream : streams) {
+        stream->decoder = std::thread(decode, std::ref(*stream));
+        stream->converter = std::thread(
+            convert, std::ref(*stream), std::ref(gpu_ready), !use_cpu, gray_preview
+        );
+    }
 
+    auto gpu_stage = [&] {
+        // The GL context lives on this thread
+        Kompute k(device);
+        ProgramCache cache(".kompute_cache");
+        // Shared, so streams of the same size share their tuned kernels too
+        KernelTuner tuner("kernel.tune", &cache);
+        // Every stream's intermediate buffers, in a few large GL buffers
+        BufferArena arena;
+        // KOMPUTE_TRACE=<file> writes a Chrome trace of everything this stage did
+        const char* trace = std::getenv("KOMPUTE_TRACE");
+        std::optional<Profiler> profiler;
+        if (trace) {
+            profiler.emplace();
+            profiler->start();
+        }
 
-    while (av_read_frame(fmt_ctx, packet) >= 0) {
-        if (packet->stream_index == video_stream_index) {
-            // Send the packet to the decoder
-            if (avcodec_send_packet(codec_ctx, packet) < 0) {
-                fprintf(stderr, "error sending packet to decoder\n");
+        std::vector<std::pair<Stream*, FrameSlot*>> ready;
+        std::vector<std::pair<Stream*, AVFrame*>> held;
+        std::vector<CommandList*> batch;
+        size_t open = streams.size();
+        while (open > 0) {
+            // One batch holds a frame from every stream that has one
+            uint32_t rings = gpu_ready.count();
+            for (auto& stream : streams) {
+                if (stream->staging_pool) {
+                    stream->staging_pool->collect();
+                }
+            }
+            take_round(ready, open);
+            if (ready.empty()) {
+                if (open > 0) {
+                    gpu_ready.wait(rings);
+                }
                 continue;
             }
 
-            // Receive all available frames from the decoder
-            while (avcodec_receive_frame(codec_ctx, frame) >= 0) {
-                // Process the decoded frame (e.g., display or save it)
-                printf("Decoded frame, resolution: %dx%d\n", frame->width, frame->height);
-
-                SwsContext* sws_ctx = sws_getContext(
-                    frame->width, frame->height, (AVPixelFormat)frame->format,  // Source format (YUV)
-                    frame->width, frame->height, AV_PIX_FMT_BGR24,              // Destination format (BGR)
-                    SWS_BILINEAR, nullptr, nullptr, nullptr);
-                
-                if (!sws_ctx) {
-                    fprintf(stderr, "Error: Could not initialize the sws context.\n");
-                    return -1;
+            auto tp = Clock::now();
+            batch.clear();
+            held.clear();
+            for (auto [stream, slot] : ready) {
+                AVFrame* frame = slot->frame;
+                auto& detector = stream->detector;
+                if (!detector) {
+                    // Only boxes are read back, so the mask can be bytes
+                    detector.emplace(
+                        k, frame->width, frame->height, gpu_format(frame->format), &tuner, &cache,
+                        &arena, ".",
+                        MotionOptions{
+                            .mask = Packing::Unorm8,
+                            .dirty_tiles = dirty_tiles && frame->width % 4 == 0,
+                            .pyramid_level = frame->width % 4 == 0 ? pyramid_level : 0,
+                            .refine_margin = refine_margin,
+                        }
+                    );
+                    // Only once the decoder has shown us its frame layout
+                    size_t frame_bytes = stream->frame_bytes.load(std::memory_order_relaxed);
+                    if (detector->input != PixelFormat::BGR8 && frame_bytes > 0) {
+                        auto& pool = stream->staging_pool;
+                        pool = std::make_unique<StagingPool>(frame_bytes, staging_blocks);
+                        stream->staging.store(pool.get(), std::memory_order_release);
+                    }
                 }
 
-                old_img = img;
-                img = avframe_to_cvmat(frame, sws_ctx);
-                if (old_img.empty() || img.empty()) {
-                    continue;
+                StagingPool::Block* block = nullptr;
+                if (stream->staging_pool) {
+                    block = stream->staging_pool->find(frame->data[0]);
+                }
+                stream->uploads++;
+                if (block) {
+                    // Decoded in place: nothing to copy
+                    auto base = reinterpret_cast<const uint8_t*>(block->ptr);
+                    detector->frame(*block, base, frame->data, frame->linesize);
+                    stream->zero_copy++;
+                } else if (detector->input != PixelFormat::BGR8) {
+                    detector->frame(frame->data, frame->linesize);
+                    stream->copied_bytes += detector->upload_size();
+                } else {
+                    auto dst = detector->frame_bgr8();
+                    std::memcpy(dst.data(), slot->bgr.data, dst.size_bytes());
+                    stream->copied_bytes += dst.size_bytes();
                 }
 
-                in1->set_data({ img.ptr<float>(), img.total() * img.channels() }, GL_STATIC_READ);
-                in2->set_data({ old_img.ptr<float>(), old_img.total() * old_img.channels() }, GL_STATIC_READ);
-                out->set_size(img.total() * sizeof(float), GL_STATIC_DRAW);
-
-                std::vector<int> dims = { img.cols, img.rows, img.channels() };
-
-                // calc kernel time
-                k.dispatch(
-                    kernel,
-                    {
-                        { "dims", dims },
-                    },
-                    { in1, in2, out }, img.cols, img.rows
-                );
-                
-                auto tp = std::chrono::system_clock::now();
-                auto res = out->get_data();
-                
-                auto now = std::chrono::system_clock::now();
-                std::cout << "Kernel time: " << (std::chrono::duration_cast<std::chrono::milliseconds>(now - tp)).count() << " ms" << std::endl;
-                tp = now;
-                
-                cv::Mat res_img(img.rows, img.cols, CV_32FC1, res.data());
-                // Convert the image to grayscale
-                res_img.convertTo(res_img, CV_8UC1);
-
-                // Find contours in the binary mask
-                std::vector<std::vector<cv::Point>> contours;
-                std::vector<cv::Vec4i> hierarchy;
-                cv::findContours(res_img, contours, hierarchy, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
-
-                // Draw bounding boxes around the detected contours
-                cv::Mat outputImage = img.clone();
-                for (const auto& contour : contours) {
-                    cv::Rect boundingBox = cv::boundingRect(contour);
-                    cv::rectangle(outputImage, boundingBox, cv::Scalar(0, 255, 0), 2); // Draw bounding box in green
+                if (block) {
+                    // The GPU reads the decoder's buffer: keep it until the batch is done
+                    AVFrame* ref = stream->spare_frames.empty() ? av_frame_alloc()
+                                                                : stream->spare_frames.back();
+                    if (!stream->spare_frames.empty()) {
+                        stream->spare_frames.pop_back();
+                    }
+                    av_frame_move_ref(ref, frame);
+                    held.emplace_back(stream, ref);
+                } else {
+                    // Hand the decoder its buffer back
+                    av_frame_unref(frame);
                 }
+                detector->record(batch, slot->boxes);
+            }
+            k.submit(batch);
+            for (auto [stream, ref] : held) {
+                stream->staging_pool->defer([stream, ref] {
+                    av_frame_unref(ref);
+                    stream->spare_frames.push_back(ref);
+                });
+            }
 
-                now = std::chrono::system_clock::now();
-                std::cout << "Find contours time: " << (std::chrono::duration_cast<std::chrono::milliseconds>(now - tp)).count() << " ms" << std::endl;
-                // Show the result
-                cv::imshow("Bounding Boxes", outputImage);
-                cv::waitKey(1);
+            // Each frame's boxes come back while the next batch is converted and uploaded
+            for (auto [stream, slot] : ready) {
+                Readback readback = stream->detector->read(slot->boxes);
+                if (stream->pending.valid()) {
+                    stream->pending.wait();
+                }
+                if (stream->pending_slot) {
+                    done.push(stream->pending_slot);
+                }
+                stream->pending = std::move(readback);
+                stream->pending_slot = slot;
+            }
+            gpu_stats.record_since(tp);
+            batched_frames += ready.size();
+        }
 
+        auto usage = arena.stats();
+        std::cout << "GPU buffers: " << usage.allocated / double(1 << 20) << " MiB in "
+                  << usage.allocations << " allocations, " << usage.blocks << " GL buffers of "
+                  << usage.reserved / double(1 << 20) << " MiB, fragmentation "
+                  << usage.fragmentation() << std::endl;
+        for (auto& stream : streams) {
+            if (stream->pending.valid()) {
+                stream->pending.wait();
+            }
+            if (stream->pending_slot) {
+                done.push(stream->pending_slot);
+            }
+            // GL objects go before the context does. The decoder is done but still holds
+            // reference frames in staging memory; drop them while it is still mapped.
+            stream->pending = {};
+            stream->detector.reset();
+            if (stream->staging_pool) {
+                stream->staging_pool->collect(true);
+                stream->staging.store(nullptr);
+                avcodec_free_context(&stream->codec_ctx);
+                stream->staging_pool.reset();
             }
+            for (AVFrame* frame : stream->spare_frames) {
+                av_frame_free(&frame);
+            }
+        }
+        if (profiler) {
+            profiler->stop();
+            profiler->save(trace);
+            std::cout << "Trace of " << profiler->recorded() << " events written to " << trace
+                      << std::endl;
         }
+        done.close();
+    };
+
+    // Same rounds on the CPU backend, where each frame is done by the time its detector returns
+    auto cpu_stage = [&] {
+        ThreadPool pool;
+        std::cout << "Detecting on the CPU: " << to_string(detect_isa()) << ", " << pool.size()
+                  << " threads" << std::endl;
+
+        std::vector<std::pair<Stream*, FrameSlot*>> ready;
+        size_t open = streams.size();
+        while (open > 0) {
+            uint32_t rings = gpu_ready.count();
+            take_round(ready, open);
+            if (ready.empty()) {
+                if (open > 0) {
+                    gpu_ready.wait(rings);
+                }
+                continue;
+            }
 
-        av_packet_unref(packet); // Clean up the packet for the next iteration
+            auto tp = Clock::now();
+            for (auto [stream, slot] : ready) {
+                AVFrame* frame = slot->frame;
+                auto& detector = stream->cpu_detector;
+                if (!detector) {
+                    detector.emplace(frame->width, frame->height, pool);
+                }
+                auto dst = detector->frame();
+                std::memcpy(dst.data(), slot->upload.ptr<float>(), dst.size_bytes());
+                stream->uploads++;
+                stream->copied_bytes += dst.size_bytes();
+                av_frame_unref(frame);
+                detector->submit(slot->boxes);
+                done.push(slot);
+            }
+            gpu_stats.record_since(tp);
+            batched_frames += ready.size();
+        }
+        for (auto& stream : streams) {
+            stream->cpu_detector.reset();
+        }
+        done.close();
+    };
+
+    std::thread submitter;
+    if (use_cpu) {
+        submitter = std::thread(cpu_stage);
+    } else {
+        submitter = std::thread(gpu_stage);
     }
 
-    // Clean up
-    av_frame_free(&frame);
-    av_packet_free(&packet);
-    avcodec_free_context(&codec_ctx);
-    avformat_close_input(&fmt_ctx);
+    size_t displayed = 0;
+    while (auto next = done.pop()) {
+        FrameSlot* slot = *next;
+        Stream& stream = *slot->stream;
+        auto tp = Clock::now();
+        show_result(slot->boxes, slot->bgr, stream.window);
+        stream.display_stats.record_since(tp);
+        stream.latency_stats.record_since(slot->decoded);
+        stream.free_slots.push(slot);
+        displayed++;
+    }
 
-    av_packet_free(&packet);
-    avformat_close_input(&fmt_ctx);
+    for (auto& stream : streams) {
+        stream->decoder.join();
+        stream->converter.join();
+    }
+    submitter.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for (auto& stream : streams) {
+        std::cout << stream->source << ":" << std::endl;
+        std::cout << "  " << stream->decode_stats << std::endl;
+        std::cout << "    decoded queue: " << stream->decoded << std::endl;
+        std::cout << "  " << stream->convert_stats << std::endl;
+        std::cout << "    converted queue: " << stream->converted << std::endl;
+        std::cout << "  " << stream->display_stats << std::endl;
+        std::cout << "  " << stream->latency_stats << std::endl;
+        std::cout << "  uploads: " << stream->uploads << " frames, " << stream->zero_copy
+                  << " decoded in place, "
+                  << double(stream->copied_bytes) / std::max<size_t>(stream->uploads, 1)
+                  << " bytes copied per frame" << std::endl;
+    }
+    double per_batch = double(batched_frames) / std::max<uint64_t>(gpu_stats.count(), 1);
+    std::cout << gpu_stats << ", " << per_batch << " frames per batch" << std::endl;
+    std::cout << "  done queue: " << done << std::endl;
+    std::cout << displayed << " frames from " << streams.size() << " streams in " << seconds
+              << " s, " << displayed / seconds << " fps" << std::endl;
 
     return 0;
 }
@@ -0,0 +1,62 @@
+#include "mapped.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+MappedFile::MappedFile(const std::filesystem::path& path, bool writable) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path.string());
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Cannot stat " + path.string());
+    }
+    size = size_t(st.st_size);
+    if (size > 0) {
+        int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        void* p = mmap(nullptr, size, prot, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Cannot map " + path.string());
+        }
+        data = static_cast<std::byte*>(p);
+    }
+    // The mapping keeps the file alive
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data) {
+        munmap(data, size);
+    }
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data(std::exchange(other.data, nullptr)), size(std::exchange(other.size, 0)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        if (data) {
+            munmap(data, size);
+        }
+        data = std::exchange(other.data, nullptr);
+        size = std::exchange(other.size, 0);
+    }
+    return *this;
+}
+
+void MappedFile::advise(int advice) const {
+    if (data) {
+        madvise(data, size, advice);
+    }
+}
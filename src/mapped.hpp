@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+// A whole file mapped into memory. Read-only by default; `writable` maps a private copy-on-write
+// view, so writes go to memory and never reach the file.
+class MappedFile {
+public:
+    explicit MappedFile(const std::filesystem::path& path, bool writable = false);
+    ~MappedFile();
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+
+    std::span<const std::byte> bytes() const {
+        return { data, size };
+    }
+
+    // Only for writable mappings
+    std::span<std::byte> writable_bytes() {
+        return { data, size };
+    }
+
+    // madvise() hint for the whole mapping, e.g. MADV_SEQUENTIAL or MADV_RANDOM
+    void advise(int advice) const;
+
+private:
+    std::byte* data = nullptr;
+    size_t size = 0;
+};
@@ -0,0 +1,131 @@
+#include "cpu.hpp"
+#include "idx.hpp"
+#include "kompute.hpp"
+#include "lenet.hpp"
+#include "lenet_gpu.hpp"
+#include "lenet_train.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Epochs of mini-batch SGD on the CPU, in shuffled batches gathered in the background
+void train_net(
+    LeNet& net, float learning_rate, const IdxFile& dataset, const IdxFile& labels, int epochs
+) {
+    ThreadPool pool;
+    LeNetTrainer trainer(net, pool);
+    BatchPrefetcher batches(dataset, labels, 64, 1);
+    printf("Training on %zu threads with %s\n", pool.size(), to_string(trainer.isa));
+    for (int epoch = 0; epoch < epochs; epoch++) {
+        double loss = 0;
+        size_t correct = 0;
+        auto tp = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < batches.batches_per_epoch(); i++) {
+            auto& batch = batches.next();
+            auto images = std::span(batch.images).first(batch.count * LeNet::input_pixels);
+            auto batch_labels = std::span(batch.labels).first(batch.count);
+            loss += trainer.step(images, batch_labels, learning_rate) * batch.count;
+            correct += trainer.correct();
+        }
+        double seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - tp).count();
+        printf(
+            "Epoch %d: loss %.4f, %.2f%% right, %.0f images/s\n", epoch + 1,
+            loss / dataset.count(), 100.0 * correct / dataset.count(), dataset.count() / seconds
+        );
+    }
+}
+
+// Accuracy over `count` images on the GPU, with the first batch checked against the CPU
+void test_net(
+    Kompute& k, LeNet& net, const uint8_t* dataset, const uint8_t* labels, size_t count
+) {
+    const size_t batch = 10000;
+    LeNetInference engine(net);
+    std::vector<float> images;
+    std::vector<float> scores;
+    size_t correct = 0;
+    double seconds = 0;
+    for (size_t first = 0; first < count; first += batch) {
+        size_t n = std::min(batch, count - first);
+        images.resize(n * LeNet::input_pixels);
+        scores.resize(n * LeNet::classes);
+        const uint8_t* pixels = dataset + first * LeNet::input_pixels;
+        std::transform(pixels, pixels + images.size(), images.begin(), [](uint8_t p) {
+            return p / 255.0f;
+        });
+
+        auto tp = std::chrono::steady_clock::now();
+        engine.run(k, images, scores);
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - tp).count();
+        for (size_t i = 0; i < n; i++) {
+            auto image_scores = std::span(scores).subspan(i * LeNet::classes, LeNet::classes);
+            correct += predict(image_scores) == labels[first + i];
+        }
+
+        if (first == 0) {
+            const size_t checked = std::min<size_t>(n, 100);
+            std::vector<float> expected(checked * LeNet::classes);
+            infer(net, std::span(images).first(checked * LeNet::input_pixels), expected);
+            float max_diff = 0;
+            for (size_t i = 0; i < expected.size(); i++) {
+                max_diff = std::max(max_diff, std::abs(expected[i] - scores[i]));
+            }
+            printf("GPU vs CPU on %zu images: max score difference %g\n", checked, max_diff);
+        }
+    }
+    printf(
+        "Accuracy %.2f%% over %zu images, %.0f images/s\n", 100.0 * correct / count, count,
+        count / seconds
+    );
+}
+
+void save_net(LeNet& net, const char* path) {
+    net.save(path);
+}
+
+// Maps the model rather than reading it
+void load_net(LeNet& net, const char* path) {
+    net = LeNet(std::filesystem::path(path));
+}
+
+int main(int argc, char** argv) {
+    // srand(time(NULL));
+    Kompute k(argc > 1 ? argv[1] : "/dev/dri/renderD128");
+
+    IdxFile mnist_data("train-images-idx3-ubyte");
+    IdxFile mnist_labels("train-labels-idx1-ubyte");
+    if (mnist_data.item_size() != LeNet::input_pixels || mnist_labels.item_size() != 1 ||
+        mnist_labels.count() != mnist_data.count()) {
+        throw std::runtime_error("Not MNIST images and labels");
+    }
+    const size_t count = mnist_data.count();
+    const uint8_t* images = mnist_data.data().data();
+    const uint8_t* labels = mnist_labels.data().data();
+    // Done with mnist
+
+    char path[256];
+    sprintf(path, "model%ld.bin", time(NULL));
+
+    LeNet net;
+    if (argc > 2) {
+        load_net(net, argv[2]);
+    } else {
+        net.randomize(1);
+        train_net(net, 0.05f, mnist_data, mnist_labels, 3);
+    }
+    test_net(k, net, images, labels, count);
+    save_net(net, path);
+
+    printf("Done!\n");
+
+    return 0;
+}
@@ -0,0 +1,459 @@
+#include "motion.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+static Defines join(Defines a, const Defines& b) {
+    a.insert(a.end(), b.begin(), b.end());
+    return a;
+}
+
+// Tuning database name of a kernel compiled for `packings`; all-float keeps the plain name
+static std::string tuned_name(const std::string& name, std::initializer_list<Packing> packings) {
+    std::string tuned = name;
+    if (std::ranges::any_of(packings, [](Packing p) { return p != Packing::Float32; })) {
+        for (Packing p : packings) {
+            tuned += std::string("_") + to_string(p);
+        }
+    }
+    return tuned;
+}
+
+MotionDetector::MotionDetector(
+    Kompute& k, int width, int height, PixelFormat input, KernelTuner* tuner, ProgramCache* cache,
+    BufferArena* arena, const std::filesystem::path& kernels, MotionOptions options
+)
+    : width(width), height(height), input(input), options(options), k(k), cache(cache),
+      arena(arena) {
+    if (options.features == Packing::Unorm8) {
+        throw std::runtime_error("Motion features need float32, fp16 or bf16");
+    }
+    if (options.mask != Packing::Float32 && options.mask != Packing::Unorm8) {
+        throw std::runtime_error("Motion masks are float32 or unorm8");
+    }
+    const bool coarse = options.pyramid_level > 0;
+    const bool tiled = options.dirty_tiles || coarse;
+    if (options.pyramid_level < 0 || options.refine_margin < 0) {
+        throw std::runtime_error("Negative pyramid level or refinement margin");
+    }
+    if (options.dirty_tiles && coarse) {
+        throw std::runtime_error("Dirty tiles and coarse-to-fine detection don't combine");
+    }
+    if (tiled && width % 4 != 0) {
+        throw std::runtime_error("Tiled motion detection needs a width that is a multiple of 4");
+    }
+    const size_t pixels = size_t(width) * height;
+    // motion.glsl takes four pixels per invocation
+    const size_t padded = (pixels + 3) & ~size_t(3);
+    if (input == PixelFormat::BGR) {
+        in = std::make_shared<RingBuff<float>>();
+        in->next(pixels * 3);
+        source = in;
+    } else if (input == PixelFormat::BGR8) {
+        in_bgr8 = std::make_shared<RingBuff<uint8_t>>();
+        in_bgr8->next(packed_size(Packing::Unorm8, pixels * 3));
+        source = in_bgr8;
+    } else {
+        yuv = std::make_unique<YuvConverter>(width, height, input, cache);
+        source = make_storage(arena, pixels * 3 * sizeof(float));
+    }
+    for (auto& h : history) {
+        h = make_storage(arena, packed_size(options.features, padded * 4));
+    }
+    out = make_storage(arena, packed_size(options.mask, padded));
+
+    const Packing in_packing = input == PixelFormat::BGR8 ? Packing::Unorm8 : Packing::Float32;
+    const Defines in_defines = packed_accessors("IN", in_packing);
+    const Defines features_defines = join(in_defines, packed_accessors("FEAT", options.features));
+    const Defines motion_defines = join(
+        join(packed_accessors("FEAT", options.features), packed_accessors("MASK", options.mask)),
+        { { "MASK_MAX", options.mask == Packing::Unorm8 ? "1.0" : "255.0" } }
+    );
+
+    const std::array<std::shared_ptr<Buff>, 2> feature_buffers = { source, history[0] };
+    const std::array<std::shared_ptr<Buff>, 3> motion_buffers = { history[0], history[1], out };
+    const uvec3 image = { uint32_t(width), uint32_t(height), 1 };
+    const uvec3 flat = { uint32_t(padded / 4), 1, 1 };
+
+    if (tuner) {
+        features_kernel = &tuner->kernel(
+            tuned_name("features", { in_packing, options.features }), kernels / "features.glsl",
+            image,
+            [&](KomputeKernel& variant) {
+                ParamBlock p(variant);
+                p.set(p.param<ivec3>("dims"), { width, height, 3 });
+                k.dispatch_threads(variant, p, feature_buffers, width, height);
+            },
+            features_defines
+        );
+    } else {
+        own_features = std::make_unique<KomputeKernel>(
+            kernels / "features.glsl",
+            join(Defines{ { "LOCAL_SIZE_X", "16" }, { "LOCAL_SIZE_Y", "16" } }, features_defines),
+            cache
+        );
+        features_kernel = own_features.get();
+    }
+
+    // Tiled modes: a workgroup per tile, so no tuning
+    tiles_x = (width + tile_size - 1) / tile_size;
+    tiles_y = (height + tile_size - 1) / tile_size;
+    const std::string tile = std::to_string(tile_size);
+    const Defines tile_defines = {
+        { "TILE", tile },
+        { "TILES_X", std::to_string(tiles_x) },
+        { "TILES_Y", std::to_string(tiles_y) },
+    };
+    if (tiled) {
+        Defines defines = {
+            { "LOCAL_SIZE_X", std::to_string(tile_size / 4) },
+            { "LOCAL_SIZE_Y", tile },
+            { "WIDTH", std::to_string(width) },
+            { "HEIGHT", std::to_string(height) },
+        };
+        if (coarse) {
+            defines.push_back({ "REFINE", "1" });
+        }
+        own_motion = std::make_unique<KomputeKernel>(
+            kernels / "motion.glsl", join(join(defines, tile_defines), motion_defines), cache
+        );
+        own_motion->name = "tiles_motion";
+        motion_kernel = own_motion.get();
+    } else if (tuner) {
+        motion_kernel = &tuner->kernel(
+            tuned_name("motion", { options.features, options.mask }), kernels / "motion.glsl",
+            flat,
+            [&](KomputeKernel& variant) {
+                ParamBlock p(variant);
+                k.dispatch_threads(variant, p, motion_buffers, int(padded / 4));
+            },
+            motion_defines
+        );
+    } else {
+        own_motion = std::make_unique<KomputeKernel>(
+            kernels / "motion.glsl", join(Defines{ { "LOCAL_SIZE_X", "256" } }, motion_defines),
+            cache
+        );
+        motion_kernel = own_motion.get();
+    }
+
+    features_params = std::make_unique<ParamBlock>(*features_kernel);
+    features_params->set(features_params->param<ivec3>("dims"), { width, height, 3 });
+    motion_params = std::make_unique<ParamBlock>(*motion_kernel);
+    thresh = motion_params->param<float>("thresh");
+
+    if (tiled) {
+        const Defines square = { { "LOCAL_SIZE_X", tile }, { "LOCAL_SIZE_Y", tile } };
+        tile_features = std::make_unique<KomputeKernel>(
+            kernels / "features.glsl", join(join(square, tile_defines), features_defines), cache
+        );
+        tile_features->name = "tiles_features";
+        tile_features_params = std::make_unique<ParamBlock>(*tile_features);
+        tile_features_params->set(
+            tile_features_params->param<ivec3>("dims"), { width, height, 3 }
+        );
+        tile_list = make_storage(arena, (3 + size_t(tiles_x) * tiles_y) * sizeof(uint32_t));
+        tile_reset = std::make_shared<StorageBuff<uint32_t>>();
+        tile_reset->set_data(std::vector<uint32_t>{ 0, 1, 1 });
+    }
+    if (options.dirty_tiles) {
+        record_dirty_tiles(kernels, tile_defines, in_defines);
+        return;
+    }
+    if (coarse) {
+        record_coarse_to_fine(kernels, tile_defines, in_packing);
+        return;
+    }
+
+    for (size_t i = 0; i < lists.size(); i++) {
+        auto& cur = history[i];
+        auto& prev = history[1 - i];
+        const std::array<std::shared_ptr<Buff>, 2> features = { source, cur };
+        const std::array<std::shared_ptr<Buff>, 3> motion = { cur, prev, out };
+        if (yuv) {
+            yuv->record(lists[i], source);
+        }
+        lists[i].dispatch_threads(*features_kernel, *features_params, features, width, height);
+        lists[i].dispatch_threads(*motion_kernel, *motion_params, motion, int(padded / 4));
+    }
+
+    // No history yet on the first frame: only extract its features
+    const std::array<std::shared_ptr<Buff>, 2> features = { source, history[0] };
+    if (yuv) {
+        yuv->record(first_list, source);
+    }
+    first_list.dispatch_threads(*features_kernel, *features_params, features, width, height);
+}
+
+void MotionDetector::record_dirty_tiles(
+    const std::filesystem::path& kernels, const Defines& tile_defines, const Defines& in_defines
+) {
+    signature_kernel = std::make_unique<KomputeKernel>(
+        kernels / "tiles.glsl",
+        join(
+            join(
+                Defines{ { "LOCAL_SIZE_X", std::to_string(tile_size) }, { "PASS", "0" } },
+                tile_defines
+            ),
+            in_defines
+        ),
+        cache
+    );
+    signature_kernel->name = "tiles_signature";
+    list_kernel = std::make_unique<KomputeKernel>(
+        kernels / "tiles.glsl",
+        join(
+            Defines{ { "LOCAL_SIZE_X", "8" }, { "LOCAL_SIZE_Y", "8" }, { "PASS", "1" } },
+            tile_defines
+        ),
+        cache
+    );
+    list_kernel->name = "tiles_list";
+
+    signature_params = std::make_unique<ParamBlock>(*signature_kernel);
+    signature_params->set(signature_params->param<ivec3>("dims"), { width, height, 3 });
+    signature_params->set(signature_params->param<int32_t>("reset"), 0);
+    first_signature_params = std::make_unique<ParamBlock>(*signature_kernel);
+    first_signature_params->set(first_signature_params->param<ivec3>("dims"), { width, height, 3 });
+    first_signature_params->set(first_signature_params->param<int32_t>("reset"), 1);
+    list_params = std::make_unique<ParamBlock>(*list_kernel);
+
+    const size_t tiles = size_t(tiles_x) * tiles_y;
+    signatures = make_storage(arena, tiles * 2 * sizeof(uint32_t));
+    changed = make_storage(arena, tiles * sizeof(uint32_t));
+
+    const std::array<std::shared_ptr<Buff>, 4> tile_buffers = {
+        source, signatures, changed, tile_list,
+    };
+    const std::array<std::shared_ptr<Buff>, 3> features = { source, history[0], tile_list };
+    const std::array<std::shared_ptr<Buff>, 4> motion = { history[0], history[1], out, tile_list };
+    auto& list = lists[0];
+    if (yuv) {
+        yuv->record(list, source);
+    }
+    list.dispatch(*signature_kernel, *signature_params, tile_buffers, tiles_x, tiles_y);
+    list.copy(*tile_reset, *tile_list, 3 * sizeof(uint32_t));
+    list.dispatch_threads(*list_kernel, *list_params, tile_buffers, tiles_x, tiles_y);
+    list.dispatch_indirect(*tile_features, *tile_features_params, features, *tile_list);
+    list.dispatch_indirect(*motion_kernel, *motion_params, motion, *tile_list);
+
+    // Every tile's features go straight to the previous ones, and every tile counts as changed,
+    // so the second frame runs them all and fills the mask
+    const std::array<std::shared_ptr<Buff>, 2> first = { source, history[1] };
+    if (yuv) {
+        yuv->record(first_list, source);
+    }
+    first_list.dispatch(*signature_kernel, *first_signature_params, tile_buffers, tiles_x, tiles_y);
+    first_list.dispatch_threads(*features_kernel, *features_params, first, width, height);
+}
+
+void MotionDetector::record_coarse_to_fine(
+    const std::filesystem::path& kernels, const Defines& tile_defines, Packing in_packing
+) {
+    const int level = options.pyramid_level;
+    pyramid = std::make_unique<Pyramid>(width, height, level, in_packing, cache, arena);
+    const ivec2 size = pyramid->size(level);
+    const size_t padded = (size_t(size[0]) * size[1] + 3) & ~size_t(3);
+
+    // All-float passes over the coarse level
+    coarse_features = std::make_unique<KomputeKernel>(
+        kernels / "features.glsl", Defines{ { "LOCAL_SIZE_X", "16" }, { "LOCAL_SIZE_Y", "16" } },
+        cache
+    );
+    coarse_features->name = "coarse_features";
+    coarse_motion = std::make_unique<KomputeKernel>(
+        kernels / "motion.glsl", Defines{ { "LOCAL_SIZE_X", "256" } }, cache
+    );
+    coarse_motion->name = "coarse_motion";
+    refine_kernel = std::make_unique<KomputeKernel>(
+        kernels / "tiles.glsl",
+        join(
+            Defines{
+                { "LOCAL_SIZE_X", "8" },
+                { "LOCAL_SIZE_Y", "8" },
+                { "PASS", "2" },
+                { "LEVEL", std::to_string(level) },
+            },
+            tile_defines
+        ),
+        cache
+    );
+    refine_kernel->name = "tiles_refine";
+
+    coarse_features_params = std::make_unique<ParamBlock>(*coarse_features);
+    coarse_features_params->set(
+        coarse_features_params->param<ivec3>("dims"), { size[0], size[1], 3 }
+    );
+    coarse_motion_params = std::make_unique<ParamBlock>(*coarse_motion);
+    coarse_thresh = coarse_motion_params->param<float>("thresh");
+    refine_params = std::make_unique<ParamBlock>(*refine_kernel);
+    refine_params->set(refine_params->param<ivec2>("coarse_dims"), size);
+    refine_params->set(refine_params->param<int32_t>("margin"), options.refine_margin);
+
+    for (auto& h : coarse_history) {
+        h = make_storage(arena, padded * 4 * sizeof(float));
+    }
+    coarse_mask = make_storage(arena, padded * sizeof(float));
+    previous = make_storage(arena, source->size);
+
+    const std::shared_ptr<Buff>& small = pyramid->level(level);
+    const std::array<std::shared_ptr<Buff>, 2> refine = { coarse_mask, tile_list };
+    const std::array<std::shared_ptr<Buff>, 3> previous_features = {
+        previous, history[1], tile_list,
+    };
+    const std::array<std::shared_ptr<Buff>, 3> features = { source, history[0], tile_list };
+    const std::array<std::shared_ptr<Buff>, 4> motion = { history[0], history[1], out, tile_list };
+    for (size_t i = 0; i < lists.size(); i++) {
+        auto& list = lists[i];
+        const std::array<std::shared_ptr<Buff>, 2> coarse_in = { small, coarse_history[i] };
+        const std::array<std::shared_ptr<Buff>, 3> coarse_out = {
+            coarse_history[i], coarse_history[1 - i], coarse_mask,
+        };
+        if (yuv) {
+            yuv->record(list, source);
+        }
+        pyramid->record(list, source);
+        list.dispatch_threads(
+            *coarse_features, *coarse_features_params, coarse_in, size[0], size[1]
+        );
+        list.dispatch_threads(*coarse_motion, *coarse_motion_params, coarse_out, int(padded / 4));
+        list.copy(*tile_reset, *tile_list, 3 * sizeof(uint32_t));
+        list.dispatch_threads(*refine_kernel, *refine_params, refine, tiles_x, tiles_y);
+        list.fill(*out);
+        // Both frames' features of the listed tiles, so that none are stale
+        list.dispatch_indirect(
+            *tile_features, *tile_features_params, previous_features, *tile_list
+        );
+        list.dispatch_indirect(*tile_features, *tile_features_params, features, *tile_list);
+        list.dispatch_indirect(*motion_kernel, *motion_params, motion, *tile_list);
+        list.copy(*source, *previous);
+    }
+
+    const std::array<std::shared_ptr<Buff>, 2> coarse_in = { small, coarse_history[0] };
+    if (yuv) {
+        yuv->record(first_list, source);
+    }
+    pyramid->record(first_list, source);
+    first_list.dispatch_threads(
+        *coarse_features, *coarse_features_params, coarse_in, size[0], size[1]
+    );
+    first_list.copy(*source, *previous);
+}
+
+std::span<float> MotionDetector::frame() {
+    if (!in) {
+        throw std::runtime_error("MotionDetector doesn't take float BGR frames");
+    }
+    return in->next(size_t(width) * height * 3);
+}
+
+std::span<uint8_t> MotionDetector::frame_bgr8() {
+    if (!in_bgr8) {
+        throw std::runtime_error("MotionDetector doesn't take 8-bit BGR frames");
+    }
+    const size_t size = size_t(width) * height * 3;
+    return in_bgr8->next(packed_size(Packing::Unorm8, size)).first(size);
+}
+
+void MotionDetector::frame(const uint8_t* const planes[], const int linesize[]) {
+    if (!yuv) {
+        throw std::runtime_error("MotionDetector expects BGR frames");
+    }
+    yuv->upload(planes, linesize);
+}
+
+void MotionDetector::frame(
+    const Buff& buffer, const uint8_t* base, const uint8_t* const planes[], const int linesize[]
+) {
+    if (!yuv) {
+        throw std::runtime_error("MotionDetector expects BGR frames");
+    }
+    yuv->attach(buffer, base, planes, linesize);
+}
+
+size_t MotionDetector::upload_size() const {
+    if (yuv) {
+        return yuv->frame_size();
+    }
+    return size_t(width) * height * 3 * (in_bgr8 ? 1 : sizeof(float));
+}
+
+bool MotionDetector::queue(std::vector<CommandList*>& batch) {
+    motion_params->set(thresh, threshold);
+    if (coarse_motion_params) {
+        coarse_motion_params->set(coarse_thresh, threshold);
+    }
+    if (frames == 0) {
+        batch.push_back(&first_list);
+    } else {
+        batch.push_back(&lists[options.dirty_tiles ? 0 : frames % 2]);
+    }
+    return frames++ > 0;
+}
+
+const Buff& MotionDetector::tiles() const {
+    if (!tile_list) {
+        throw std::runtime_error("MotionDetector is not in a tiled mode");
+    }
+    return *tile_list;
+}
+
+Readback MotionDetector::submit(std::span<float> mask) {
+    if (options.mask != Packing::Float32) {
+        throw std::runtime_error("MotionDetector mask is packed");
+    }
+    if (mask.size() < size_t(width) * height) {
+        throw std::runtime_error("Motion mask is smaller than the frame");
+    }
+    return submit_mask(std::as_writable_bytes(mask.first(size_t(width) * height)));
+}
+
+Readback MotionDetector::submit(std::span<uint8_t> mask) {
+    if (options.mask != Packing::Unorm8) {
+        throw std::runtime_error("MotionDetector mask is not packed as unorm8");
+    }
+    if (mask.size() < size_t(width) * height) {
+        throw std::runtime_error("Motion mask is smaller than the frame");
+    }
+    return submit_mask(std::as_writable_bytes(mask.first(size_t(width) * height)));
+}
+
+Readback MotionDetector::submit_mask(std::span<std::byte> mask) {
+    batch.clear();
+    bool ready = queue(batch);
+    k.submit(batch);
+    if (!ready) {
+        return {};
+    }
+    return readbacks.read(*out, mask);
+}
+
+void MotionDetector::record(std::vector<CommandList*>& batch, const BoxList& boxes) {
+    if (!components) {
+        components = std::make_unique<Components>(
+            width, height, boxes.capacity(), cache, arena, options.mask
+        );
+        components->record(components_list, out);
+    }
+    if (components->capacity != boxes.capacity()) {
+        throw std::runtime_error("BoxList capacity changed between frames");
+    }
+    if (queue(batch)) {
+        batch.push_back(&components_list);
+    }
+}
+
+Readback MotionDetector::read(BoxList& boxes) {
+    if (frames < 2) {
+        return {};
+    }
+    return readbacks.read(components->result(), boxes.bytes());
+}
+
+Readback MotionDetector::submit(BoxList& boxes) {
+    batch.clear();
+    record(batch, boxes);
+    k.submit(batch);
+    return read(boxes);
+}
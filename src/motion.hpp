@@ -0,0 +1,175 @@
+#pragma once
+
+#include "components.hpp"
+#include "kompute.hpp"
+#include "pyramid.hpp"
+#include "tuner.hpp"
+#include "yuv.hpp"
+
+#include <array>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+
+struct MotionOptions {
+    // Element types of the history and the mask (packed.hpp). Packing cuts the memory and
+    // bandwidth of both passes: fp16 or bf16 features at some loss of precision near the
+    // threshold, and an unorm8 mask that holds exactly the values of the float one.
+    //
+    // Blurred colour and edge magnitude: Float32, Half or BFloat16
+    Packing features = Packing::Float32;
+    // Float32 (read back as floats) or Unorm8 (as bytes)
+    Packing mask = Packing::Float32;
+
+    // Runs both passes only over the tiles whose input changed since the last frame, and their
+    // neighbours (tiles.glsl), with indirect dispatches. Changes are found by hashing each tile,
+    // so any difference counts: this pays off on footage whose static parts are bit-identical
+    // between frames, such as decoded skip blocks. Needs a width that is a multiple of 4.
+    bool dirty_tiles = false;
+
+    // Coarse-to-fine mode: finds motion on level `pyramid_level` of an image pyramid
+    // (pyramid.hpp), then runs both passes at full resolution only over the tiles within
+    // `refine_margin` pixels of it. The mask is exact inside those tiles and zero elsewhere, so
+    // motion too small or faint to survive the downsampling is missed. 0 keeps the
+    // full-resolution path. Needs a width that is a multiple of 4; excludes dirty_tiles.
+    int pyramid_level = 0;
+    int refine_margin = 16;
+};
+
+// Two-pass motion detection over a stream of BGR frames, float or 8-bit, or of raw YUV 4:2:0
+// frames that are converted on the GPU first.
+//
+// features.glsl blurs each frame and computes its edge magnitude exactly once, into one of two
+// GPU-resident history buffers; motion.glsl then only diffs the current features against the
+// previous frame's and thresholds. Each frame is uploaded once and nothing is recomputed.
+class MotionDetector {
+public:
+    // `kernels` is the directory holding features.glsl, motion.glsl and tiles.glsl. GPU-side
+    // buffers come from `arena` when given.
+    MotionDetector(
+        Kompute& k, int width, int height, PixelFormat input = PixelFormat::BGR,
+        KernelTuner* tuner = nullptr, ProgramCache* cache = nullptr, BufferArena* arena = nullptr,
+        const std::filesystem::path& kernels = ".", MotionOptions options = {}
+    );
+    MotionDetector(const MotionDetector&) = delete;
+
+    // BGR input: mapped memory for the next frame, width * height * 3 floats in [0, 1].
+    std::span<float> frame();
+    // BGR8 input: the same in bytes, e.g. a continuous CV_8UC3 image.
+    std::span<uint8_t> frame_bgr8();
+    // YUV input: uploads the next frame's planes, laid out as in AVFrame::data / linesize.
+    void frame(const uint8_t* const planes[], const int linesize[]);
+    // YUV input without the copy: the planes already live in `buffer`, mapped at `base`.
+    void frame(
+        const Buff& buffer, const uint8_t* base, const uint8_t* const planes[],
+        const int linesize[]
+    );
+    // Bytes the copying forms of frame() move per frame
+    size_t upload_size() const;
+
+    // Processes the frame written through frame() and queues the readback of its motion mask
+    // (width * height floats, 0 or 255) into `mask`. The first frame has nothing to compare
+    // against and returns an invalid handle.
+    Readback submit(std::span<float> mask);
+    // Same for a mask packed as Unorm8: width * height bytes with the same values.
+    Readback submit(std::span<uint8_t> mask);
+    // Same, but labels the mask on the GPU and only reads back the bounding boxes of its
+    // outermost connected components.
+    Readback submit(BoxList& boxes);
+
+    // Split form of submit(BoxList&), for batching several detectors into one submission:
+    // record() appends this frame's lists to `batch`; once the batch has gone through
+    // Kompute::submit, read() queues the readback of the boxes.
+    void record(std::vector<CommandList*>& batch, const BoxList& boxes);
+    Readback read(BoxList& boxes);
+
+    // Dirty-tile and coarse-to-fine modes: the last frame's indirect dispatch arguments, then
+    // its tile list. The first uint32 is the number of tiles the full-resolution passes ran over.
+    const Buff& tiles() const;
+
+    // Edge of the square tiles of the tiled modes in pixels
+    static constexpr int tile_size = 16;
+
+    float threshold = 0.2f;
+
+    const int width;
+    const int height;
+    const PixelFormat input;
+    const MotionOptions options;
+
+private:
+    // Appends this frame's passes to `batch`; false on the first frame
+    bool queue(std::vector<CommandList*>& batch);
+    Readback submit_mask(std::span<std::byte> mask);
+    void record_dirty_tiles(
+        const std::filesystem::path& kernels, const Defines& tile_defines, const Defines& in_defines
+    );
+    void record_coarse_to_fine(
+        const std::filesystem::path& kernels, const Defines& tile_defines, Packing in_packing
+    );
+
+    Kompute& k;
+    ProgramCache* cache;
+    BufferArena* arena;
+    std::unique_ptr<KomputeKernel> own_features;
+    std::unique_ptr<KomputeKernel> own_motion;
+    KomputeKernel* features_kernel;
+    KomputeKernel* motion_kernel;
+
+    std::shared_ptr<RingBuff<float>> in;
+    std::shared_ptr<RingBuff<uint8_t>> in_bgr8;
+    std::unique_ptr<YuvConverter> yuv;
+    // What the feature pass reads: `in`, or the converter's output
+    std::shared_ptr<Buff> source;
+    std::array<std::shared_ptr<Buff>, 2> history;
+    std::shared_ptr<Buff> out;
+
+    std::unique_ptr<ParamBlock> features_params;
+    std::unique_ptr<ParamBlock> motion_params;
+    Param<float> thresh;
+
+    // Tiled modes: the passes run over the tiles in tile_list, and history[0] only holds the
+    // features of those
+    int tiles_x = 0;
+    int tiles_y = 0;
+    std::unique_ptr<KomputeKernel> tile_features;
+    std::unique_ptr<ParamBlock> tile_features_params;
+    std::shared_ptr<Buff> tile_list;
+    // The arguments before the tiles are listed: (0, 1, 1)
+    std::shared_ptr<StorageBuff<uint32_t>> tile_reset;
+
+    // Dirty-tile mode. history[1] holds the previous features of every pixel.
+    std::unique_ptr<KomputeKernel> signature_kernel;
+    std::unique_ptr<KomputeKernel> list_kernel;
+    std::unique_ptr<ParamBlock> signature_params;
+    std::unique_ptr<ParamBlock> first_signature_params;
+    std::unique_ptr<ParamBlock> list_params;
+    std::shared_ptr<Buff> signatures;
+    std::shared_ptr<Buff> changed;
+
+    // Coarse-to-fine mode. history[1] holds the listed tiles' features of the previous frame,
+    // recomputed from `previous`, its input.
+    std::unique_ptr<Pyramid> pyramid;
+    std::unique_ptr<KomputeKernel> coarse_features;
+    std::unique_ptr<KomputeKernel> coarse_motion;
+    std::unique_ptr<KomputeKernel> refine_kernel;
+    std::unique_ptr<ParamBlock> coarse_features_params;
+    std::unique_ptr<ParamBlock> coarse_motion_params;
+    std::unique_ptr<ParamBlock> refine_params;
+    Param<float> coarse_thresh;
+    std::array<std::shared_ptr<Buff>, 2> coarse_history;
+    std::shared_ptr<Buff> coarse_mask;
+    std::shared_ptr<Buff> previous;
+
+    // One list per history parity (of the coarse history in coarse-to-fine mode), recorded once,
+    // and one for the first frame. Dirty-tile mode only uses lists[0].
+    std::array<CommandList, 2> lists;
+    CommandList first_list;
+    std::vector<CommandList*> batch;
+    // Created on the first box submit
+    std::unique_ptr<Components> components;
+    CommandList components_list;
+    ReadbackPool readbacks;
+    size_t frames = 0;
+};
@@ -0,0 +1,187 @@
+#include "packed.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+const char* to_string(Packing packing) {
+    switch (packing) {
+    case Packing::Float32:
+        return "float32";
+    case Packing::Unorm8:
+        return "unorm8";
+    case Packing::Half:
+        return "fp16";
+    case Packing::BFloat16:
+        return "bf16";
+    }
+    return "unknown";
+}
+
+size_t element_bytes(Packing packing) {
+    switch (packing) {
+    case Packing::Float32:
+        return 4;
+    case Packing::Unorm8:
+        return 1;
+    case Packing::Half:
+    case Packing::BFloat16:
+        return 2;
+    }
+    throw std::runtime_error("Unknown packing");
+}
+
+size_t packed_size(Packing packing, size_t count) {
+    return (count * element_bytes(packing) + 3) & ~size_t(3);
+}
+
+Half to_half(float value) {
+    uint32_t x = std::bit_cast<uint32_t>(value);
+    const uint16_t sign = uint16_t((x >> 16) & 0x8000);
+    x &= 0x7fffffff;
+    if (x > 0x7f800000) {
+        return { uint16_t(sign | 0x7e00) };
+    }
+    // From halfway between 65504 and 65536 on, rounding gives infinity
+    if (x >= 0x477ff000) {
+        return { uint16_t(sign | 0x7c00) };
+    }
+    // Below 2^-14 the result is subnormal: adding 0.5 lines the float's mantissa up with the
+    // half's, and the FPU rounds
+    if (x < 0x38800000) {
+        const float aligned = std::bit_cast<float>(x) + 0.5f;
+        return { uint16_t(sign | (std::bit_cast<uint32_t>(aligned) - 0x3f000000)) };
+    }
+    // Rebias the exponent from 127 to 15 and round the 13 dropped bits to nearest even
+    x += 0xc8000fff + ((x >> 13) & 1);
+    return { uint16_t(sign | (x >> 13)) };
+}
+
+BFloat16 to_bfloat16(float value) {
+    uint32_t x = std::bit_cast<uint32_t>(value);
+    if ((x & 0x7fffffff) > 0x7f800000) {
+        return { uint16_t((x >> 16) | 0x40) };
+    }
+    x += 0x7fff + ((x >> 16) & 1);
+    return { uint16_t(x >> 16) };
+}
+
+uint8_t to_unorm8(float value) {
+    // NaN ends up as 0
+    const float clamped = value > 0.0f ? std::min(value, 1.0f) : 0.0f;
+    return uint8_t(clamped * 255.0f + 0.5f);
+}
+
+float to_float(Half value) {
+    const uint32_t sign = uint32_t(value.bits & 0x8000) << 16;
+    const uint32_t exponent = (value.bits >> 10) & 0x1f;
+    const uint32_t mantissa = value.bits & 0x3ff;
+    if (exponent == 0) {
+        const float magnitude = float(mantissa) * 0x1p-24f;
+        return std::bit_cast<float>(sign | std::bit_cast<uint32_t>(magnitude));
+    }
+    if (exponent == 0x1f) {
+        return std::bit_cast<float>(sign | 0x7f800000 | (mantissa << 13));
+    }
+    return std::bit_cast<float>(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+float to_float(BFloat16 value) {
+    return std::bit_cast<float>(uint32_t(value.bits) << 16);
+}
+
+float unorm8_to_float(uint8_t value) {
+    return float(value) / 255.0f;
+}
+
+template <typename T, typename U, typename F>
+static void convert(std::span<const T> src, std::span<U> dst, F fn) {
+    if (dst.size() < src.size()) {
+        throw std::runtime_error("Conversion destination is too small");
+    }
+    std::transform(src.begin(), src.end(), dst.begin(), fn);
+}
+
+void pack(std::span<const float> src, std::span<uint8_t> dst) {
+    convert(src, dst, to_unorm8);
+}
+
+void pack(std::span<const float> src, std::span<Half> dst) {
+    convert(src, dst, to_half);
+}
+
+void pack(std::span<const float> src, std::span<BFloat16> dst) {
+    convert(src, dst, to_bfloat16);
+}
+
+void unpack(std::span<const uint8_t> src, std::span<float> dst) {
+    convert(src, dst, unorm8_to_float);
+}
+
+void unpack(std::span<const Half> src, std::span<float> dst) {
+    convert(src, dst, [](Half h) { return to_float(h); });
+}
+
+void unpack(std::span<const BFloat16> src, std::span<float> dst) {
+    convert(src, dst, [](BFloat16 b) { return to_float(b); });
+}
+
+std::vector<std::pair<std::string, std::string>> packed_accessors(
+    const std::string& prefix, Packing packing
+) {
+    const std::string p = prefix;
+    // Block-scoped temporaries keep the store macros from evaluating their arguments twice
+    const std::string i = p + "_i";
+    const std::string v = p + "_v";
+    const std::string u = p + "_u";
+    switch (packing) {
+    case Packing::Float32:
+        return {
+            { p + "_ELEM", "float" },
+            { p + "_LOAD(b, i)", "(b)[uint(i)]" },
+            { p + "_LOAD4(b, i)",
+              "vec4((b)[4u * uint(i)], (b)[4u * uint(i) + 1u], (b)[4u * uint(i) + 2u], "
+              "(b)[4u * uint(i) + 3u])" },
+            { p + "_STORE4(b, i, v)",
+              "{ uint " + i + " = 4u * uint(i); vec4 " + v + " = (v); (b)[" + i + "] = " + v +
+                  ".x; (b)[" + i + " + 1u] = " + v + ".y; (b)[" + i + " + 2u] = " + v +
+                  ".z; (b)[" + i + " + 3u] = " + v + ".w; }" },
+        };
+    case Packing::Unorm8:
+        return {
+            { p + "_ELEM", "uint" },
+            { p + "_LOAD(b, i)", "unpackUnorm4x8((b)[uint(i) >> 2])[uint(i) & 3u]" },
+            { p + "_LOAD4(b, i)", "unpackUnorm4x8((b)[uint(i)])" },
+            { p + "_STORE4(b, i, v)", "(b)[uint(i)] = packUnorm4x8(v)" },
+        };
+    case Packing::Half:
+        return {
+            { p + "_ELEM", "uint" },
+            { p + "_LOAD(b, i)", "unpackHalf2x16((b)[uint(i) >> 1])[uint(i) & 1u]" },
+            { p + "_LOAD4(b, i)",
+              "vec4(unpackHalf2x16((b)[2u * uint(i)]), unpackHalf2x16((b)[2u * uint(i) + 1u]))" },
+            { p + "_STORE4(b, i, v)",
+              "{ uint " + i + " = 2u * uint(i); vec4 " + v + " = (v); (b)[" + i +
+                  "] = packHalf2x16(" + v + ".xy); (b)[" + i + " + 1u] = packHalf2x16(" + v +
+                  ".zw); }" },
+        };
+    case Packing::BFloat16:
+        // The high half of each word is the odd element; stores round to nearest even
+        return {
+            { p + "_ELEM", "uint" },
+            { p + "_LOAD(b, i)",
+              "uintBitsToFloat(((b)[uint(i) >> 1] << (16u - 16u * (uint(i) & 1u))) & "
+              "0xffff0000u)" },
+            { p + "_LOAD4(b, i)",
+              "uintBitsToFloat((uvec4((b)[2u * uint(i)], (b)[2u * uint(i)], "
+              "(b)[2u * uint(i) + 1u], (b)[2u * uint(i) + 1u]) << uvec4(16u, 0u, 16u, 0u)) & "
+              "0xffff0000u)" },
+            { p + "_STORE4(b, i, v)",
+              "{ uint " + i + " = 2u * uint(i); uvec4 " + u + " = floatBitsToUint(v); " + u +
+                  " += 0x7fffu + ((" + u + " >> 16) & 1u); (b)[" + i + "] = (" + u +
+                  ".x >> 16) | (" + u + ".y & 0xffff0000u); (b)[" + i + " + 1u] = (" + u +
+                  ".z >> 16) | (" + u + ".w & 0xffff0000u); }" },
+        };
+    }
+    throw std::runtime_error("Unknown packing");
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Packed element types for GPU buffers, and the GLSL that reads and writes them.
+//
+// GLSL has no 8- or 16-bit buffer elements in core 4.3, so a packed buffer is declared as uint[]
+// and shaders go through accessor macros that unpack a word: unpackUnorm4x8 for uint8_t (a value
+// in [0, 1] stored as round(x * 255)), unpackHalf2x16 for Half and a 16-bit shift for BFloat16.
+// Elements sit little-endian in their word, as the host writes them. Buffers are rounded up to
+// whole words.
+
+// IEEE 754 binary16: 11 bits of precision, range +-65504
+struct Half {
+    uint16_t bits;
+};
+
+// The upper half of a float: 8 bits of precision, the full float range
+struct BFloat16 {
+    uint16_t bits;
+};
+
+enum class Packing {
+    Float32,
+    Unorm8,
+    Half,
+    BFloat16,
+};
+
+template <typename T>
+struct PackingOf;
+
+template <>
+struct PackingOf<float> {
+    static constexpr Packing value = Packing::Float32;
+};
+
+template <>
+struct PackingOf<uint8_t> {
+    static constexpr Packing value = Packing::Unorm8;
+};
+
+template <>
+struct PackingOf<Half> {
+    static constexpr Packing value = Packing::Half;
+};
+
+template <>
+struct PackingOf<BFloat16> {
+    static constexpr Packing value = Packing::BFloat16;
+};
+
+const char* to_string(Packing packing);
+
+// Bytes per element
+size_t element_bytes(Packing packing);
+
+// Bytes a buffer of `count` elements takes, rounded up to whole 32-bit words
+size_t packed_size(Packing packing, size_t count);
+
+// Conversions round to nearest even; NaN stays NaN
+Half to_half(float value);
+BFloat16 to_bfloat16(float value);
+// Clamps to [0, 1]
+uint8_t to_unorm8(float value);
+
+float to_float(Half value);
+float to_float(BFloat16 value);
+float unorm8_to_float(uint8_t value);
+
+// Element-wise conversion between floats and a packed type; `dst` holds at least src.size()
+void pack(std::span<const float> src, std::span<uint8_t> dst);
+void pack(std::span<const float> src, std::span<Half> dst);
+void pack(std::span<const float> src, std::span<BFloat16> dst);
+void unpack(std::span<const uint8_t> src, std::span<float> dst);
+void unpack(std::span<const Half> src, std::span<float> dst);
+void unpack(std::span<const BFloat16> src, std::span<float> dst);
+
+// Defines for a shader's buffer of elements packed as `packing`, with every name starting with
+// `prefix`:
+//
+//     PREFIX_ELEM             element type to declare the buffer with: float or uint
+//     PREFIX_LOAD(b, i)       element i of buffer b, as a float
+//     PREFIX_LOAD4(b, i)      elements 4i .. 4i + 3, as a vec4
+//     PREFIX_STORE4(b, i, v)  writes vec4 v to elements 4i .. 4i + 3 (a statement)
+//
+// Stores go four elements at a time: a single 8- or 16-bit element shares its word with others,
+// so writing it alone would race with the invocations writing those.
+std::vector<std::pair<std::string, std::string>> packed_accessors(
+    const std::string& prefix, Packing packing
+);
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Building blocks for running frame processing as a chain of threads: a bounded queue between
+// each pair of stages and counters for each stage.
+
+// Bounded single-producer, single-consumer queue. Push blocks while the queue is full, which is
+// what throttles a fast stage to the pace of the slower ones behind it; pop blocks while it is
+// empty. Neither takes a lock: the two sides only share the head and tail counters, and block
+// with atomic waits on them.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : slots(capacity) {}
+    SpscQueue(const SpscQueue&) = delete;
+
+    // Producer side
+    void push(T value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+        while (t - h == slots.size()) {
+            head.wait(h, std::memory_order_acquire);
+            h = head.load(std::memory_order_acquire);
+        }
+        slots[t % slots.size()] = std::move(value);
+        tail.store(t + 1, std::memory_order_release);
+        tail.notify_one();
+
+        size_t depth = t + 1 - h;
+        pushes.fetch_add(1, std::memory_order_relaxed);
+        depth_sum.fetch_add(depth, std::memory_order_relaxed);
+        if (depth > depth_max.load(std::memory_order_relaxed)) {
+            depth_max.store(depth, std::memory_order_relaxed);
+        }
+    }
+
+    // Producer side: no more pushes. Pending items can still be popped.
+    void close() {
+        tail.fetch_or(closed_bit, std::memory_order_release);
+        tail.notify_one();
+    }
+
+    // Consumer side: the next item, or nothing once the queue is closed and drained
+    std::optional<T> pop() {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        while ((t & ~closed_bit) == h) {
+            if (t & closed_bit) {
+                return std::nullopt;
+            }
+            tail.wait(t, std::memory_order_acquire);
+            t = tail.load(std::memory_order_acquire);
+        }
+        T value = std::move(slots[h % slots.size()]);
+        head.store(h + 1, std::memory_order_release);
+        head.notify_one();
+        return value;
+    }
+
+    // Consumer side: the next item if one is queued, without blocking
+    std::optional<T> try_pop() {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        if ((t & ~closed_bit) == h) {
+            return std::nullopt;
+        }
+        T value = std::move(slots[h % slots.size()]);
+        head.store(h + 1, std::memory_order_release);
+        head.notify_one();
+        return value;
+    }
+
+    // Consumer side: closed, and everything pushed has been popped
+    bool drained() const {
+        size_t t = tail.load(std::memory_order_acquire);
+        return (t & closed_bit) && (t & ~closed_bit) == head.load(std::memory_order_relaxed);
+    }
+
+    size_t capacity() const {
+        return slots.size();
+    }
+
+    // Depth right after each push
+    size_t max_depth() const {
+        return depth_max.load(std::memory_order_relaxed);
+    }
+
+    double mean_depth() const {
+        size_t n = pushes.load(std::memory_order_relaxed);
+        return n ? double(depth_sum.load(std::memory_order_relaxed)) / n : 0.0;
+    }
+
+private:
+    static constexpr size_t closed_bit = size_t(1) << (sizeof(size_t) * 8 - 1);
+
+    std::vector<T> slots;
+    // Items popped and pushed so far; the top bit of tail marks the queue closed
+    alignas(64) std::atomic<size_t> head = 0;
+    alignas(64) std::atomic<size_t> tail = 0;
+    // Only written by the producer
+    alignas(64) std::atomic<size_t> pushes = 0;
+    std::atomic<size_t> depth_sum = 0;
+    std::atomic<size_t> depth_max = 0;
+};
+
+// Lets one consumer sleep until any of several queues has work: producers ring after each push
+// (or close), the consumer notes the count before polling its queues and waits for it to move
+// only if they were all empty, so no ring can be missed.
+class Doorbell {
+public:
+    void ring() {
+        rings.fetch_add(1, std::memory_order_release);
+        rings.notify_one();
+    }
+
+    uint32_t count() const {
+        return rings.load(std::memory_order_acquire);
+    }
+
+    void wait(uint32_t seen) const {
+        rings.wait(seen, std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<uint32_t> rings = 0;
+};
+
+// Per-item latency of one stage. Written by the stage's thread only, readable from any.
+class StageStats {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit StageStats(std::string name) : name(std::move(name)) {}
+
+    void record(Clock::duration d) {
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        items.fetch_add(1, std::memory_order_relaxed);
+        total_ns.fetch_add(ns, std::memory_order_relaxed);
+        if (ns > max_ns.load(std::memory_order_relaxed)) {
+            max_ns.store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    // Records the time since `start`
+    void record_since(Clock::time_point start) {
+        record(Clock::now() - start);
+    }
+
+    uint64_t count() const {
+        return items.load(std::memory_order_relaxed);
+    }
+
+    double mean_ms() const {
+        uint64_t n = count();
+        return n ? total_ns.load(std::memory_order_relaxed) / 1e6 / n : 0.0;
+    }
+
+    double max_ms() const {
+        return max_ns.load(std::memory_order_relaxed) / 1e6;
+    }
+
+    const std::string name;
+
+private:
+    std::atomic<uint64_t> items = 0;
+    std::atomic<uint64_t> total_ns = 0;
+    std::atomic<uint64_t> max_ns = 0;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const StageStats& s) {
+    return os << s.name << ": " << s.count() << " items, " << s.mean_ms() << " ms mean, "
+              << s.max_ms() << " ms max";
+}
+
+template <typename T>
+std::ostream& operator<<(std::ostream& os, const SpscQueue<T>& q) {
+    return os << "depth " << q.mean_depth() << " mean, " << q.max_depth() << " max of "
+              << q.capacity();
+}
@@ -0,0 +1,524 @@
+#include "primitives.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+static constexpr uint32_t local_size = 256;
+static constexpr uint32_t items = 8;
+// Elements per workgroup
+static constexpr size_t tile = size_t(local_size) * items;
+static constexpr size_t max_groups = 65535;
+
+bool has_subgroup_arithmetic() {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    bool found = false;
+    for (GLint i = 0; i < count && !found; i++) {
+        auto name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        found = name && std::strcmp(name, "GL_KHR_shader_subgroup") == 0;
+    }
+    if (!found) {
+        return false;
+    }
+    GLint stages = 0;
+    GLint features = 0;
+    glGetIntegerv(GL_SUBGROUP_SUPPORTED_STAGES_KHR, &stages);
+    glGetIntegerv(GL_SUBGROUP_SUPPORTED_FEATURES_KHR, &features);
+    return (stages & GL_COMPUTE_SHADER_BIT) && (features & GL_SUBGROUP_FEATURE_ARITHMETIC_BIT_KHR);
+}
+
+// Shared by every primitive: the element type and operation, and the workgroup-wide reduce and
+// exclusive scan of one value per invocation.
+static const char* common_src = R"(
+layout (local_size_x = LOCAL_SIZE_X) in;
+
+#define TILE (LOCAL_SIZE_X * ITEMS)
+
+#if OP == 0
+#define combine(a, b) ((a) + (b))
+#define subgroup_reduce subgroupAdd
+#define subgroup_exclusive subgroupExclusiveAdd
+#elif OP == 1
+#define combine(a, b) min(a, b)
+#define subgroup_reduce subgroupMin
+#define subgroup_exclusive subgroupExclusiveMin
+#else
+#define combine(a, b) max(a, b)
+#define subgroup_reduce subgroupMax
+#define subgroup_exclusive subgroupExclusiveMax
+#endif
+
+// One value per subgroup, or per invocation without subgroups, plus the workgroup's total
+shared ELEM partial[LOCAL_SIZE_X + 1];
+
+// The combination of v over the workgroup, valid in invocation 0
+ELEM workgroup_reduce(ELEM v) {
+#if SUBGROUPS
+    v = subgroup_reduce(v);
+    if (subgroupElect()) {
+        partial[gl_SubgroupID] = v;
+    }
+    barrier();
+    if (gl_LocalInvocationIndex == 0u) {
+        for (uint s = 1u; s < gl_NumSubgroups; s++) {
+            v = combine(v, partial[s]);
+        }
+    }
+    return v;
+#else
+    uint i = gl_LocalInvocationIndex;
+    partial[i] = v;
+    barrier();
+    for (uint s = LOCAL_SIZE_X / 2u; s > 0u; s >>= 1) {
+        if (i < s) {
+            partial[i] = combine(partial[i], partial[i + s]);
+        }
+        barrier();
+    }
+    return partial[0];
+#endif
+}
+
+// The combination of v over the invocations before this one; `total` gets all of them
+ELEM workgroup_exclusive_scan(ELEM v, out ELEM total) {
+#if SUBGROUPS
+    ELEM before = subgroup_exclusive(v);
+    if (gl_SubgroupInvocationID == gl_SubgroupSize - 1u) {
+        partial[gl_SubgroupID] = combine(before, v);
+    }
+    barrier();
+    if (gl_LocalInvocationIndex == 0u) {
+        ELEM run = IDENTITY;
+        for (uint s = 0u; s < gl_NumSubgroups; s++) {
+            ELEM t = partial[s];
+            partial[s] = run;
+            run = combine(run, t);
+        }
+        partial[LOCAL_SIZE_X] = run;
+    }
+    barrier();
+    total = partial[LOCAL_SIZE_X];
+    return combine(partial[gl_SubgroupID], before);
+#else
+    // Work-efficient (Blelloch): an up-sweep builds partial sums in place, a down-sweep
+    // distributes them
+    uint i = gl_LocalInvocationIndex;
+    partial[i] = v;
+    barrier();
+    for (uint d = 1u; d < LOCAL_SIZE_X; d <<= 1) {
+        uint j = (i + 1u) * d * 2u - 1u;
+        if (j < LOCAL_SIZE_X) {
+            partial[j] = combine(partial[j - d], partial[j]);
+        }
+        barrier();
+    }
+    if (i == 0u) {
+        partial[LOCAL_SIZE_X] = partial[LOCAL_SIZE_X - 1];
+        partial[LOCAL_SIZE_X - 1] = IDENTITY;
+    }
+    barrier();
+    for (uint d = LOCAL_SIZE_X / 2u; d > 0u; d >>= 1) {
+        uint j = (i + 1u) * d * 2u - 1u;
+        if (j < LOCAL_SIZE_X) {
+            ELEM t = partial[j - d];
+            partial[j - d] = partial[j];
+            partial[j] = combine(partial[j], t);
+        }
+        barrier();
+    }
+    total = partial[LOCAL_SIZE_X];
+    return partial[i];
+#endif
+}
+)";
+
+// Invocations read strided by the workgroup size, so neighbours read neighbouring elements
+static const char* reduce_src = R"(
+layout(binding = 0) readonly buffer In { ELEM src[]; };
+layout(binding = 1) writeonly buffer Out { ELEM dst[]; };
+uniform uint count;
+
+void main() {
+    uint base = gl_WorkGroupID.x * TILE + gl_LocalInvocationIndex;
+    ELEM v = IDENTITY;
+    for (uint k = 0u; k < ITEMS; k++) {
+        uint i = base + k * LOCAL_SIZE_X;
+        if (i < count) {
+            v = combine(v, src[i]);
+        }
+    }
+    v = workgroup_reduce(v);
+    if (gl_LocalInvocationIndex == 0u) {
+        dst[gl_WorkGroupID.x] = v;
+    }
+}
+)";
+
+// The tile goes through shared memory so that loads and stores stay coalesced while each
+// invocation scans ITEMS consecutive elements
+static const char* scan_src = R"(
+layout(binding = 0) readonly buffer In { ELEM src[]; };
+layout(binding = 1) writeonly buffer Out { ELEM dst[]; };
+layout(binding = 2) writeonly buffer Sums { ELEM sums[]; };
+uniform uint count;
+
+shared ELEM tile[TILE];
+
+void main() {
+    uint block = gl_WorkGroupID.x * TILE;
+    uint t = gl_LocalInvocationIndex;
+    for (uint k = 0u; k < ITEMS; k++) {
+        uint i = k * LOCAL_SIZE_X + t;
+        tile[i] = block + i < count ? src[block + i] : IDENTITY;
+    }
+    barrier();
+
+    ELEM run = IDENTITY;
+    for (uint k = 0u; k < ITEMS; k++) {
+        ELEM x = tile[t * ITEMS + k];
+#if INCLUSIVE
+        run = combine(run, x);
+        tile[t * ITEMS + k] = run;
+#else
+        tile[t * ITEMS + k] = run;
+        run = combine(run, x);
+#endif
+    }
+    ELEM total;
+    ELEM offset = workgroup_exclusive_scan(run, total);
+    for (uint k = 0u; k < ITEMS; k++) {
+        tile[t * ITEMS + k] = combine(offset, tile[t * ITEMS + k]);
+    }
+    barrier();
+
+    for (uint k = 0u; k < ITEMS; k++) {
+        uint i = k * LOCAL_SIZE_X + t;
+        if (block + i < count) {
+            dst[block + i] = tile[i];
+        }
+    }
+    if (t == 0u) {
+        sums[gl_WorkGroupID.x] = total;
+    }
+}
+)";
+
+static const char* scan_add_src = R"(
+layout(binding = 0) buffer Data { ELEM data[]; };
+layout(binding = 1) readonly buffer Offsets { ELEM offsets[]; };
+
+void main() {
+    KOMPUTE_GUARD();
+    uint i = gl_GlobalInvocationID.x;
+    data[i] = combine(offsets[i / TILE], data[i]);
+}
+)";
+
+static const char* clear_src = R"(
+layout(binding = 0) writeonly buffer Bins { uint bins[]; };
+
+void main() {
+    KOMPUTE_GUARD();
+    bins[gl_GlobalInvocationID.x] = 0u;
+}
+)";
+
+// Counted in shared memory first, so global atomics are one per workgroup and bin
+static const char* histogram_src = R"(
+layout(binding = 0) readonly buffer In { ELEM src[]; };
+layout(binding = 1) buffer Bins { uint bins[]; };
+uniform uint count;
+uniform float lo;
+uniform float scale;
+
+shared uint local_bins[BINS];
+
+void main() {
+    for (uint b = gl_LocalInvocationIndex; b < BINS; b += LOCAL_SIZE_X) {
+        local_bins[b] = 0u;
+    }
+    barrier();
+    uint base = gl_WorkGroupID.x * TILE + gl_LocalInvocationIndex;
+    for (uint k = 0u; k < ITEMS; k++) {
+        uint i = base + k * LOCAL_SIZE_X;
+        if (i < count) {
+            float x = (float(src[i]) - lo) * scale;
+            if (x >= 0.0 && x < float(BINS)) {
+                atomicAdd(local_bins[uint(x)], 1u);
+            }
+        }
+    }
+    barrier();
+    for (uint b = gl_LocalInvocationIndex; b < BINS; b += LOCAL_SIZE_X) {
+        uint n = local_bins[b];
+        if (n != 0u) {
+            atomicAdd(bins[b], n);
+        }
+    }
+}
+)";
+
+static const char* flag_src = R"(
+layout(binding = 0) readonly buffer In { ELEM src[]; };
+layout(binding = 1) writeonly buffer Flags { uint flags[]; };
+uniform ELEM threshold;
+
+void main() {
+    KOMPUTE_GUARD();
+    uint i = gl_GlobalInvocationID.x;
+    flags[i] = src[i] > threshold ? 1u : 0u;
+}
+)";
+
+// Runs at least one invocation, so the count is written even for empty inputs
+static const char* scatter_src = R"(
+layout(binding = 0) readonly buffer In { ELEM src[]; };
+layout(binding = 1) readonly buffer Flags { uint flags[]; };
+layout(binding = 2) readonly buffer Offsets { uint offsets[]; };
+layout(binding = 3) writeonly buffer Values { ELEM values[]; };
+layout(binding = 4) writeonly buffer Indices { uint indices[]; };
+layout(binding = 5) writeonly buffer Total { uint total[]; };
+uniform uint count;
+
+void main() {
+    KOMPUTE_GUARD();
+    uint i = gl_GlobalInvocationID.x;
+    uint keep = i < count ? flags[i] : 0u;
+    uint at = i < count ? offsets[i] : 0u;
+    if (keep != 0u) {
+        values[at] = src[i];
+        indices[at] = i;
+    }
+    if (i + 1u >= count) {
+        total[0] = at + keep;
+    }
+}
+)";
+
+struct ScalarInfo {
+    const char* glsl;
+    const char* lowest;
+    const char* highest;
+};
+
+static ScalarInfo scalar_info(ScalarType type) {
+    switch (type) {
+    case ScalarType::Float:
+        return { "float", "-3.402823466e+38", "3.402823466e+38" };
+    case ScalarType::Int:
+        return { "int", "(-2147483647 - 1)", "2147483647" };
+    case ScalarType::Uint:
+        return { "uint", "0u", "4294967295u" };
+    }
+    throw std::runtime_error("Unknown scalar type");
+}
+
+static std::unique_ptr<KomputeKernel> make_kernel(
+    const char* name, const char* body, ScalarType type, ReduceOp op, ProgramCache* cache,
+    Defines extra = {}
+) {
+    const bool subgroups = has_subgroup_arithmetic();
+    std::string src = "#version 430 core\n";
+    if (subgroups) {
+        src += "#extension GL_KHR_shader_subgroup_basic : require\n";
+        src += "#extension GL_KHR_shader_subgroup_arithmetic : require\n";
+    }
+    src += common_src;
+    src += body;
+
+    auto info = scalar_info(type);
+    Defines defines = {
+        { "LOCAL_SIZE_X", std::to_string(local_size) },
+        { "ITEMS", std::to_string(items) },
+        { "ELEM", info.glsl },
+        { "IDENTITY", op == ReduceOp::Min   ? info.highest
+                      : op == ReduceOp::Max ? info.lowest
+                                            : "ELEM(0)" },
+        { "OP", std::to_string(int(op)) },
+        { "SUBGROUPS", subgroups ? "1" : "0" },
+    };
+    defines.insert(defines.end(), extra.begin(), extra.end());
+    auto kernel = std::make_unique<KomputeKernel>(src, defines, cache);
+    kernel->name = name;
+    return kernel;
+}
+
+static size_t groups_for(size_t count) {
+    return std::max<size_t>((count + tile - 1) / tile, 1);
+}
+
+static void check_capacity(size_t capacity) {
+    if (capacity > max_groups * tile) {
+        throw std::runtime_error("Too many elements for one dispatch");
+    }
+}
+
+static void check_count(size_t count, size_t capacity) {
+    if (count > capacity) {
+        throw std::runtime_error("More elements than the primitive was created for");
+    }
+}
+
+// Every element type is 32 bits wide
+static constexpr size_t element_size = sizeof(uint32_t);
+
+ReduceBase::ReduceBase(
+    ScalarType type, size_t capacity, ReduceOp op, ProgramCache* cache, BufferArena* arena
+)
+    : capacity(capacity), kernel(make_kernel("reduce", reduce_src, type, op, cache)) {
+    check_capacity(capacity);
+    // One pass per level until a single workgroup is left, which writes the result
+    for (size_t n = capacity;;) {
+        size_t groups = groups_for(n);
+        Level& level = levels.emplace_back();
+        level.params = std::make_unique<ParamBlock>(*kernel);
+        level.count = level.params->param<uint32_t>("count");
+        if (groups == 1) {
+            break;
+        }
+        level.partial = make_storage(arena, groups * element_size);
+        n = groups;
+    }
+    out = make_storage(arena, element_size);
+}
+
+void ReduceBase::record(CommandList& list, const std::shared_ptr<Buff>& in, size_t count) {
+    check_count(count, capacity);
+    std::shared_ptr<Buff> src = in;
+    for (size_t i = 0;; i++) {
+        Level& level = levels[i];
+        size_t groups = groups_for(count);
+        auto& dst = groups == 1 ? out : level.partial;
+        level.params->set(level.count, uint32_t(count));
+        const std::array<std::shared_ptr<Buff>, 2> buffers = { src, dst };
+        list.dispatch(*kernel, *level.params, buffers, int(groups));
+        if (groups == 1) {
+            return;
+        }
+        src = dst;
+        count = groups;
+    }
+}
+
+ScanBase::ScanBase(
+    ScalarType type, size_t capacity, bool inclusive, ReduceOp op, ProgramCache* cache,
+    BufferArena* arena
+)
+    : capacity(capacity) {
+    check_capacity(capacity);
+    const Defines scan_kind = { { "INCLUSIVE", inclusive ? "1" : "0" } };
+    top = make_kernel("scan", scan_src, type, op, cache, scan_kind);
+    add = make_kernel("scan_add", scan_add_src, type, op, cache);
+    if (inclusive && groups_for(capacity) > 1) {
+        exclusive = make_kernel("scan", scan_src, type, op, cache, { { "INCLUSIVE", "0" } });
+    }
+
+    for (size_t n = capacity;;) {
+        size_t groups = groups_for(n);
+        auto& kernel = levels.empty() || !exclusive ? *top : *exclusive;
+        Level& level = levels.emplace_back();
+        level.params = std::make_unique<ParamBlock>(kernel);
+        level.count = level.params->param<uint32_t>("count");
+        level.add_params = std::make_unique<ParamBlock>(*add);
+        level.sums = make_storage(arena, groups * element_size);
+        if (groups == 1) {
+            break;
+        }
+        level.scanned = make_storage(arena, groups * element_size);
+        n = groups;
+    }
+}
+
+void ScanBase::record(
+    CommandList& list, const std::shared_ptr<Buff>& in, const std::shared_ptr<Buff>& out,
+    size_t count
+) {
+    check_count(count, capacity);
+    record_level(list, in, out, count, 0);
+}
+
+// Scans each workgroup's tile, scans the tile totals one level up, then adds those back
+void ScanBase::record_level(
+    CommandList& list, const std::shared_ptr<Buff>& in, const std::shared_ptr<Buff>& out,
+    size_t count, size_t index
+) {
+    Level& level = levels[index];
+    auto& kernel = index == 0 || !exclusive ? *top : *exclusive;
+    size_t groups = groups_for(count);
+    level.params->set(level.count, uint32_t(count));
+    const std::array<std::shared_ptr<Buff>, 3> buffers = { in, out, level.sums };
+    list.dispatch(kernel, *level.params, buffers, int(groups));
+    if (groups == 1) {
+        return;
+    }
+    record_level(list, level.sums, level.scanned, groups, index + 1);
+    const std::array<std::shared_ptr<Buff>, 2> add_buffers = { out, level.scanned };
+    list.dispatch_threads(*add, *level.add_params, add_buffers, int(count));
+}
+
+HistogramBase::HistogramBase(
+    ScalarType type, uint32_t bins, float lo, float hi, ProgramCache* cache, BufferArena* arena
+)
+    : bins(bins) {
+    if (bins == 0 || bins > max_bins) {
+        throw std::runtime_error("Histogram needs 1 to 4096 bins");
+    }
+    if (!(lo < hi)) {
+        throw std::runtime_error("Histogram range is empty");
+    }
+    clear = make_kernel("histogram_clear", clear_src, type, ReduceOp::Sum, cache);
+    clear_params = std::make_unique<ParamBlock>(*clear);
+    kernel = make_kernel(
+        "histogram", histogram_src, type, ReduceOp::Sum, cache,
+        { { "BINS", std::to_string(bins) + "u" } }
+    );
+    params = std::make_unique<ParamBlock>(*kernel);
+    count_param = params->param<uint32_t>("count");
+    params->set(params->param<float>("lo"), lo);
+    params->set(params->param<float>("scale"), float(bins) / (hi - lo));
+    out = make_storage(arena, bins * sizeof(uint32_t));
+}
+
+void HistogramBase::record(CommandList& list, const std::shared_ptr<Buff>& in, size_t count) {
+    check_capacity(count);
+    params->set(count_param, uint32_t(count));
+    const std::array<std::shared_ptr<Buff>, 1> cleared = { out };
+    list.dispatch_threads(*clear, *clear_params, cleared, int(bins));
+    const std::array<std::shared_ptr<Buff>, 2> buffers = { in, out };
+    list.dispatch(*kernel, *params, buffers, int(groups_for(count)));
+}
+
+CompactBase::CompactBase(
+    ScalarType type, size_t capacity, ProgramCache* cache, BufferArena* arena
+)
+    : capacity(capacity), scan(ScalarType::Uint, capacity, false, ReduceOp::Sum, cache, arena) {
+    flag = make_kernel("compact_flags", flag_src, type, ReduceOp::Sum, cache);
+    flag_params = std::make_unique<ParamBlock>(*flag);
+    scatter = make_kernel("compact_scatter", scatter_src, type, ReduceOp::Sum, cache);
+    scatter_params = std::make_unique<ParamBlock>(*scatter);
+    count_param = scatter_params->param<uint32_t>("count");
+
+    const size_t bytes = std::max<size_t>(capacity, 1) * element_size;
+    flags = make_storage(arena, bytes);
+    offsets = make_storage(arena, bytes);
+    kept = make_storage(arena, bytes);
+    kept_indices = make_storage(arena, bytes);
+    total = make_storage(arena, sizeof(uint32_t));
+}
+
+void CompactBase::record(CommandList& list, const std::shared_ptr<Buff>& in, size_t count) {
+    check_count(count, capacity);
+    if (count > 0) {
+        const std::array<std::shared_ptr<Buff>, 2> flagged = { in, flags };
+        list.dispatch_threads(*flag, *flag_params, flagged, int(count));
+    }
+    scan.record(list, flags, offsets, count);
+    scatter_params->set(count_param, uint32_t(count));
+    const std::array<std::shared_ptr<Buff>, 6> buffers = {
+        in, flags, offsets, kept, kept_indices, total
+    };
+    list.dispatch_threads(*scatter, *scatter_params, buffers, int(std::max<size_t>(count, 1)));
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+#include "arena.hpp"
+#include "kompute.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+// Data-parallel building blocks over StorageBuff<float>, <int32_t> or <uint32_t>: reduction,
+// prefix scan, histogram and stream compaction. Every primitive records into a CommandList like
+// Stencil and Components do, so it can run in the same submission as the kernels producing its
+// input, and has a run() that submits and reads the result back.
+//
+//     Reduce<float> moved(width * height);
+//     float pixels = moved.run(k, mask, width * height);
+//
+// Each workgroup of 256 invocations covers 2048 elements, 8 per invocation, and combines them in
+// shared memory, or with subgroup operations where GL_KHR_shader_subgroup supports arithmetic in
+// compute shaders. Inputs larger than one workgroup take further passes over per-workgroup
+// partials, up to 65535 * 2048 elements. Intermediate buffers come from `arena` when given.
+
+enum class ReduceOp { Sum, Min, Max };
+
+enum class ScalarType { Float, Int, Uint };
+
+template <typename T>
+struct ScalarTypeOf;
+
+template <>
+struct ScalarTypeOf<float> {
+    static constexpr ScalarType value = ScalarType::Float;
+};
+
+template <>
+struct ScalarTypeOf<int32_t> {
+    static constexpr ScalarType value = ScalarType::Int;
+};
+
+template <>
+struct ScalarTypeOf<uint32_t> {
+    static constexpr ScalarType value = ScalarType::Uint;
+};
+
+// Whether the primitives compile with subgroup operations on the current context
+bool has_subgroup_arithmetic();
+
+// The untyped implementations; use the templates below.
+class ReduceBase {
+public:
+    ReduceBase(
+        ScalarType type, size_t capacity, ReduceOp op, ProgramCache* cache, BufferArena* arena
+    );
+    ReduceBase(const ReduceBase&) = delete;
+
+    // Records the reduction of the first `count` elements of `in` into result()
+    void record(CommandList& list, const std::shared_ptr<Buff>& in, size_t count);
+
+    // One element; the identity of the operation when count is 0
+    const Buff& result() const {
+        return *out;
+    }
+
+    const size_t capacity;
+
+protected:
+    CommandList list;
+    ReadbackPool readbacks;
+
+private:
+    struct Level {
+        std::unique_ptr<ParamBlock> params;
+        Param<uint32_t> count;
+        std::shared_ptr<Buff> partial;
+    };
+
+    std::unique_ptr<KomputeKernel> kernel;
+    std::vector<Level> levels;
+    std::shared_ptr<Buff> out;
+};
+
+class ScanBase {
+public:
+    ScanBase(
+        ScalarType type, size_t capacity, bool inclusive, ReduceOp op, ProgramCache* cache,
+        BufferArena* arena
+    );
+    ScanBase(const ScanBase&) = delete;
+
+    // Records the scan of the first `count` elements of `in` into `out`
+    void record(
+        CommandList& list, const std::shared_ptr<Buff>& in, const std::shared_ptr<Buff>& out,
+        size_t count
+    );
+
+    const size_t capacity;
+
+protected:
+    CommandList list;
+
+private:
+    struct Level {
+        std::unique_ptr<ParamBlock> params;
+        Param<uint32_t> count;
+        std::unique_ptr<ParamBlock> add_params;
+        // Total of each workgroup, and their exclusive scan once the level below ran
+        std::shared_ptr<Buff> sums;
+        std::shared_ptr<Buff> scanned;
+    };
+
+    // Level 0 scans as asked, the workgroup totals above it always exclusively
+    std::unique_ptr<KomputeKernel> top;
+    std::unique_ptr<KomputeKernel> exclusive;
+    std::unique_ptr<KomputeKernel> add;
+    std::vector<Level> levels;
+
+    void record_level(
+        CommandList& list, const std::shared_ptr<Buff>& in, const std::shared_ptr<Buff>& out,
+        size_t count, size_t level
+    );
+};
+
+class HistogramBase {
+public:
+    static constexpr uint32_t max_bins = 4096;
+
+    HistogramBase(
+        ScalarType type, uint32_t bins, float lo, float hi, ProgramCache* cache,
+        BufferArena* arena
+    );
+    HistogramBase(const HistogramBase&) = delete;
+
+    // Records the counts of the first `count` elements of `in` into result()
+    void record(CommandList& list, const std::shared_ptr<Buff>& in, size_t count);
+
+    // `bins` uint32 counts
+    const Buff& result() const {
+        return *out;
+    }
+
+    const uint32_t bins;
+
+protected:
+    CommandList list;
+    ReadbackPool readbacks;
+
+private:
+    std::unique_ptr<KomputeKernel> clear;
+    std::unique_ptr<ParamBlock> clear_params;
+    std::unique_ptr<KomputeKernel> kernel;
+    std::unique_ptr<ParamBlock> params;
+    Param<uint32_t> count_param;
+    std::shared_ptr<Buff> out;
+};
+
+class CompactBase {
+public:
+    CompactBase(ScalarType type, size_t capacity, ProgramCache* cache, BufferArena* arena);
+    CompactBase(const CompactBase&) = delete;
+
+    // Records the compaction of the first `count` elements of `in`
+    void record(CommandList& list, const std::shared_ptr<Buff>& in, size_t count);
+
+    // The kept elements and their indices into the input, in input order, and how many there are
+    // as a single uint32
+    const Buff& values() const {
+        return *kept;
+    }
+
+    const Buff& indices() const {
+        return *kept_indices;
+    }
+
+    const Buff& selected() const {
+        return *total;
+    }
+
+    const size_t capacity;
+
+protected:
+    CommandList list;
+    ReadbackPool readbacks;
+    std::unique_ptr<KomputeKernel> flag;
+    std::unique_ptr<ParamBlock> flag_params;
+
+private:
+    std::unique_ptr<KomputeKernel> scatter;
+    std::unique_ptr<ParamBlock> scatter_params;
+    Param<uint32_t> count_param;
+    ScanBase scan;
+    std::shared_ptr<Buff> flags;
+    std::shared_ptr<Buff> offsets;
+    std::shared_ptr<Buff> kept;
+    std::shared_ptr<Buff> kept_indices;
+    std::shared_ptr<Buff> total;
+};
+
+// Sum, minimum or maximum of up to `capacity` elements
+template <typename T>
+class Reduce : public ReduceBase {
+public:
+    explicit Reduce(
+        size_t capacity, ReduceOp op = ReduceOp::Sum, ProgramCache* cache = nullptr,
+        BufferArena* arena = nullptr
+    )
+        : ReduceBase(ScalarTypeOf<T>::value, capacity, op, cache, arena) {}
+
+    T run(Kompute& k, const std::shared_ptr<Buff>& in, size_t count) {
+        list.clear();
+        record(list, in, count);
+        k.submit(list);
+        T value;
+        readbacks.read(result(), std::as_writable_bytes(std::span(&value, 1))).wait();
+        return value;
+    }
+};
+
+// Prefix sums, minima or maxima of up to `capacity` elements. Exclusive scans start from the
+// identity of the operation: 0, the type's largest value or its lowest.
+template <typename T>
+class Scan : public ScanBase {
+public:
+    explicit Scan(
+        size_t capacity, bool inclusive = false, ReduceOp op = ReduceOp::Sum,
+        ProgramCache* cache = nullptr, BufferArena* arena = nullptr
+    )
+        : ScanBase(ScalarTypeOf<T>::value, capacity, inclusive, op, cache, arena) {}
+
+    void run(
+        Kompute& k, const std::shared_ptr<Buff>& in, const std::shared_ptr<Buff>& out,
+        size_t count
+    ) {
+        list.clear();
+        record(list, in, out, count);
+        k.submit(list);
+    }
+};
+
+// Counts of elements in `bins` equal bins over [lo, hi); elements outside are not counted
+template <typename T>
+class Histogram : public HistogramBase {
+public:
+    Histogram(
+        uint32_t bins, float lo, float hi, ProgramCache* cache = nullptr,
+        BufferArena* arena = nullptr
+    )
+        : HistogramBase(ScalarTypeOf<T>::value, bins, lo, hi, cache, arena) {}
+
+    std::vector<uint32_t> run(Kompute& k, const std::shared_ptr<Buff>& in, size_t count) {
+        list.clear();
+        record(list, in, count);
+        k.submit(list);
+        std::vector<uint32_t> counts(bins);
+        readbacks.read(result(), std::as_writable_bytes(std::span(counts))).wait();
+        return counts;
+    }
+};
+
+// Keeps the elements greater than a threshold, e.g. the moving pixels of a motion mask
+template <typename T>
+class Compact : public CompactBase {
+public:
+    struct Compacted {
+        std::vector<T> values;
+        std::vector<uint32_t> indices;
+    };
+
+    explicit Compact(
+        size_t capacity, ProgramCache* cache = nullptr, BufferArena* arena = nullptr
+    )
+        : CompactBase(ScalarTypeOf<T>::value, capacity, cache, arena),
+          threshold(flag_params->param<T>("threshold")) {}
+
+    void record(CommandList& list, const std::shared_ptr<Buff>& in, size_t count, T above) {
+        flag_params->set(threshold, above);
+        CompactBase::record(list, in, count);
+    }
+
+    Compacted run(Kompute& k, const std::shared_ptr<Buff>& in, size_t count, T above) {
+        list.clear();
+        record(list, in, count, above);
+        k.submit(list);
+        uint32_t n = 0;
+        readbacks.read(selected(), std::as_writable_bytes(std::span(&n, 1))).wait();
+        Compacted result{ std::vector<T>(n), std::vector<uint32_t>(n) };
+        if (n > 0) {
+            auto a = readbacks.read(values(), std::as_writable_bytes(std::span(result.values)));
+            auto b = readbacks.read(indices(), std::as_writable_bytes(std::span(result.indices)));
+            a.wait();
+            b.wait();
+        }
+        return result;
+    }
+
+private:
+    Param<T> threshold;
+};
@@ -0,0 +1,224 @@
+#include "profile.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+const char* to_string(TraceKind kind) {
+    switch (kind) {
+        case TraceKind::Dispatch:
+            return "dispatch";
+        case TraceKind::Copy:
+            return "copy";
+        case TraceKind::Upload:
+            return "upload";
+        case TraceKind::Readback:
+            return "readback";
+        case TraceKind::Submit:
+            return "submit";
+        case TraceKind::Wait:
+            return "wait";
+    }
+    return "unknown";
+}
+
+Profiler::Profiler(size_t capacity) : ring(std::max<size_t>(capacity, 1)) {}
+
+Profiler::~Profiler() {
+    Profiler* self = this;
+    current.compare_exchange_strong(self, nullptr);
+    for (auto& p : pending) {
+        free_queries.push_back(p.begin);
+        free_queries.push_back(p.end);
+    }
+    if (!free_queries.empty()) {
+        glDeleteQueries(GLsizei(free_queries.size()), free_queries.data());
+    }
+}
+
+void Profiler::start() {
+    // GL_TIMESTAMP and steady_clock tick at the same rate but from different origins
+    GLint64 gpu = 0;
+    int64_t before = now_ns();
+    glGetInteger64v(GL_TIMESTAMP, &gpu);
+    int64_t after = now_ns();
+    gpu_offset_ns = (before + after) / 2 - gpu;
+
+    Profiler* expected = nullptr;
+    if (!current.compare_exchange_strong(expected, this) && expected != this) {
+        throw std::runtime_error("Another profiler is already running");
+    }
+}
+
+void Profiler::stop() {
+    Profiler* self = this;
+    current.compare_exchange_strong(self, nullptr);
+    collect(true);
+}
+
+GLuint Profiler::query() {
+    if (free_queries.empty()) {
+        free_queries.resize(64);
+        glGenQueries(GLsizei(free_queries.size()), free_queries.data());
+    }
+    GLuint q = free_queries.back();
+    free_queries.pop_back();
+    return q;
+}
+
+void Profiler::collect(bool wait) {
+    // Queries finish in the order they were issued
+    size_t done = 0;
+    for (; done < pending.size(); done++) {
+        auto& p = pending[done];
+        if (!wait) {
+            GLuint available = 0;
+            glGetQueryObjectuiv(p.end, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                break;
+            }
+        }
+        GLuint64 begin = 0;
+        GLuint64 end = 0;
+        glGetQueryObjectui64v(p.begin, GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(p.end, GL_QUERY_RESULT, &end);
+        p.event.start_ns = int64_t(begin) + gpu_offset_ns;
+        p.event.duration_ns = int64_t(end - begin);
+        record(p.event);
+        free_queries.push_back(p.begin);
+        free_queries.push_back(p.end);
+    }
+    pending.erase(pending.begin(), pending.begin() + done);
+}
+
+void Profiler::record(const TraceEvent& event) {
+    uint64_t index = head.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = ring[index % ring.size()];
+    slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.event = event;
+    slot.seq.store(2 * (index + 1), std::memory_order_release);
+}
+
+uint32_t Profiler::thread_id() {
+    static std::atomic<uint32_t> next = 1;
+    thread_local uint32_t id = next.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+// Writes `s` as a JSON string body
+static void write_escaped(std::ostream& os, const char* s) {
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            os << '\\' << *s;
+        } else if (uint8_t(*s) >= 0x20) {
+            os << *s;
+        }
+    }
+}
+
+void Profiler::write_chrome_trace(std::ostream& os) const {
+    // The last `capacity` events, oldest first. A slot that is being overwritten while we read
+    // it is skipped.
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t begin = end > ring.size() ? end - ring.size() : 0;
+    std::vector<TraceEvent> events;
+    events.reserve(end - begin);
+    for (uint64_t i = begin; i < end; i++) {
+        const Slot& slot = ring[i % ring.size()];
+        if (slot.seq.load(std::memory_order_acquire) != 2 * (i + 1)) {
+            continue;
+        }
+        TraceEvent event = slot.event;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == 2 * (i + 1)) {
+            events.push_back(event);
+        }
+    }
+    std::sort(events.begin(), events.end(), [](const TraceEvent& a, const TraceEvent& b) {
+        return a.start_ns < b.start_ns;
+    });
+
+    // Timestamps are microseconds relative to the first event, to the nanosecond; CPU and GPU get
+    // a process each
+    int64_t origin = events.empty() ? 0 : events.front().start_ns;
+    const std::ios::fmtflags flags = os.flags();
+    const std::streamsize precision = os.precision();
+    os << std::fixed << std::setprecision(3);
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    os << "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"CPU\"}},\n";
+    os << "{\"ph\":\"M\",\"pid\":2,\"name\":\"process_name\",\"args\":{\"name\":\"GPU\"}}";
+    for (const TraceEvent& e : events) {
+        os << ",\n{\"ph\":\"X\",\"cat\":\"" << to_string(e.kind) << "\",\"name\":\"";
+        write_escaped(os, e.name);
+        os << "\",\"pid\":" << (e.gpu ? 2 : 1) << ",\"tid\":" << e.thread
+           << ",\"ts\":" << (e.start_ns - origin) / 1e3 << ",\"dur\":" << e.duration_ns / 1e3
+           << ",\"args\":{\"bytes\":" << e.bytes;
+        if (e.kind == TraceKind::Dispatch) {
+            os << ",\"groups\":[" << e.groups[0] << "," << e.groups[1] << "," << e.groups[2]
+               << "]";
+        }
+        os << "}}";
+    }
+    os << "\n]}\n";
+    os.flags(flags);
+    os.precision(precision);
+}
+
+void Profiler::save(const std::filesystem::path& path) const {
+    std::ofstream file(path);
+    if (!file) {
+        throw std::runtime_error("Cannot open " + path.string());
+    }
+    write_chrome_trace(file);
+}
+
+static void fill(
+    TraceEvent& event, TraceKind kind, std::string_view name, uint64_t bytes,
+    std::array<uint32_t, 3> groups
+) {
+    event.kind = kind;
+    event.bytes = bytes;
+    event.groups = groups;
+    size_t n = std::min(name.size(), sizeof(event.name) - 1);
+    std::memcpy(event.name, name.data(), n);
+    event.name[n] = '\0';
+}
+
+void TraceScope::begin(
+    TraceKind kind, std::string_view name, uint64_t bytes, std::array<uint32_t, 3> groups
+) {
+    fill(event, kind, name, bytes, groups);
+    event.gpu = false;
+    event.thread = Profiler::thread_id();
+    event.start_ns = Profiler::now_ns();
+}
+
+void TraceScope::end() {
+    event.duration_ns = Profiler::now_ns() - event.start_ns;
+    profiler->record(event);
+}
+
+void GpuSpan::begin(
+    TraceKind kind, std::string_view name, uint64_t bytes, std::array<uint32_t, 3> groups
+) {
+    fill(event, kind, name, bytes, groups);
+    event.gpu = true;
+    // One GPU track per GL thread
+    event.thread = Profiler::thread_id();
+    query = profiler->query();
+    glQueryCounter(query, GL_TIMESTAMP);
+}
+
+void GpuSpan::end() {
+    GLuint end = profiler->query();
+    glQueryCounter(end, GL_TIMESTAMP);
+    profiler->pending.push_back({ query, end, event });
+    // Callers that never submit still get their spans resolved. Polling has a cost of its own,
+    // so only every so often.
+    if (profiler->pending.size() % 256 == 0) {
+        profiler->collect();
+    }
+}
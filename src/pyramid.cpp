@@ -0,0 +1,107 @@
+#include "pyramid.hpp"
+
+#include <array>
+#include <stdexcept>
+#include <string>
+
+static const char* pyramid_src = R"(#version 430 core
+
+layout (local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y, local_size_z = 1) in;
+
+#ifndef IN_ELEM
+#define IN_ELEM float
+#define IN_LOAD(b, i) (b)[i]
+#endif
+
+layout(binding = 0) readonly buffer In {
+    IN_ELEM InData[];
+};
+
+layout(binding = 1) writeonly buffer Out {
+    float OutData[];
+};
+
+// Of the input; the output is half of it, rounded up
+uniform ivec2 dims;
+
+vec3 pixel(ivec2 c) {
+    c = min(c, dims - 1);
+    int i = (c.y * dims.x + c.x) * 3;
+    return vec3(IN_LOAD(InData, i), IN_LOAD(InData, i + 1), IN_LOAD(InData, i + 2));
+}
+
+void main() {
+    KOMPUTE_GUARD();
+    const ivec2 Coord = ivec2(gl_GlobalInvocationID.xy);
+
+    const ivec2 c = Coord * 2;
+    vec3 mean = (pixel(c) + pixel(c + ivec2(1, 0)) + pixel(c + ivec2(0, 1)) +
+                 pixel(c + ivec2(1, 1))) * 0.25;
+
+    int o = (Coord.y * ((dims.x + 1) / 2) + Coord.x) * 3;
+    OutData[o] = mean.x;
+    OutData[o + 1] = mean.y;
+    OutData[o + 2] = mean.z;
+}
+)";
+
+Pyramid::Pyramid(
+    int width, int height, int levels, Packing input, ProgramCache* cache, BufferArena* arena
+)
+    : width(width), height(height), levels(levels) {
+    if (levels < 1) {
+        throw std::runtime_error("Pyramid needs at least one level");
+    }
+    if (input != Packing::Float32 && input != Packing::Unorm8) {
+        throw std::runtime_error("Pyramid input is float32 or unorm8");
+    }
+    sizes.push_back({ width, height });
+    for (int i = 1; i <= levels; i++) {
+        const ivec2 prev = sizes.back();
+        sizes.push_back({ (prev[0] + 1) / 2, (prev[1] + 1) / 2 });
+        const size_t pixels = size_t(sizes[i][0]) * sizes[i][1];
+        buffers.push_back(make_storage(arena, pixels * 3 * sizeof(float)));
+    }
+
+    const Defines local = { { "LOCAL_SIZE_X", "16" }, { "LOCAL_SIZE_Y", "16" } };
+    floats = std::make_unique<KomputeKernel>(std::string(pyramid_src), local, cache);
+    floats->name = "pyramid";
+    if (input == Packing::Unorm8) {
+        Defines defines = local;
+        const auto accessors = packed_accessors("IN", input);
+        defines.insert(defines.end(), accessors.begin(), accessors.end());
+        bytes = std::make_unique<KomputeKernel>(std::string(pyramid_src), defines, cache);
+        bytes->name = "pyramid_bgr8";
+    }
+    for (int i = 1; i <= levels; i++) {
+        params.push_back(std::make_unique<ParamBlock>(kernel(i)));
+        params.back()->set(params.back()->param<ivec2>("dims"), sizes[i - 1]);
+    }
+}
+
+KomputeKernel& Pyramid::kernel(int level) {
+    return level == 1 && bytes ? *bytes : *floats;
+}
+
+void Pyramid::record(CommandList& list, const std::shared_ptr<Buff>& frame) {
+    for (int i = 1; i <= levels; i++) {
+        const std::array<std::shared_ptr<Buff>, 2> buffers = {
+            i == 1 ? frame : this->buffers[i - 2], this->buffers[i - 1],
+        };
+        list.dispatch_threads(kernel(i), *params[i - 1], buffers, sizes[i][0], sizes[i][1]);
+    }
+}
+
+const std::shared_ptr<Buff>& Pyramid::level(int i) const {
+    if (i < 1 || i > levels) {
+        throw std::runtime_error("Pyramid level out of range");
+    }
+    return buffers[i - 1];
+}
+
+ivec2 Pyramid::size(int i) const {
+    if (i < 0 || i > levels) {
+        throw std::runtime_error("Pyramid level out of range");
+    }
+    return sizes[i];
+}
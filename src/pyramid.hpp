@@ -0,0 +1,45 @@
+#pragma once
+
+#include "arena.hpp"
+#include "kompute.hpp"
+#include "packed.hpp"
+
+#include <memory>
+#include <vector>
+
+// Image pyramid of a BGR frame, built on the GPU by repeated 2x downsampling. Level 0 is the
+// frame itself; level i is ceil(width / 2^i) x ceil(height / 2^i) BGR floats, each pixel the mean
+// of the 2x2 pixels of level i - 1 it covers (edge pixels of odd sizes are repeated).
+class Pyramid {
+public:
+    // `input` is the element type of the frames given to record(): Float32 or Unorm8 (BGR8).
+    // Levels come from `arena` when given.
+    Pyramid(
+        int width, int height, int levels, Packing input = Packing::Float32,
+        ProgramCache* cache = nullptr, BufferArena* arena = nullptr
+    );
+    Pyramid(const Pyramid&) = delete;
+
+    // Records the downsampling of `frame` (width * height * 3 elements) into levels 1 .. levels
+    void record(CommandList& list, const std::shared_ptr<Buff>& frame);
+
+    // Level 1 .. levels
+    const std::shared_ptr<Buff>& level(int i) const;
+    // Width and height of level 0 .. levels
+    ivec2 size(int i) const;
+
+    const int width;
+    const int height;
+    const int levels;
+
+private:
+    KomputeKernel& kernel(int level);
+
+    std::vector<ivec2> sizes;
+    // levels[i - 1]
+    std::vector<std::shared_ptr<Buff>> buffers;
+    // Every level reads floats but the first one of BGR8 frames
+    std::unique_ptr<KomputeKernel> floats;
+    std::unique_ptr<KomputeKernel> bytes;
+    std::vector<std::unique_ptr<ParamBlock>> params;
+};
@@ -0,0 +1,213 @@
+#include "stencil.hpp"
+
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+// Shared by every pass: tile loading with a RX x RY halo, clamped to the image.
+static const char* tile_src = R"(#version 430 core
+
+layout (local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y, local_size_z = 1) in;
+
+layout(binding = 0) readonly buffer In {
+    float InData[];
+};
+
+layout(binding = 1) writeonly buffer Out {
+    float OutData[];
+};
+
+uniform ivec2 dims;
+
+#define CW (LOCAL_SIZE_X + 2 * RX)
+#define CH (LOCAL_SIZE_Y + 2 * RY)
+
+shared vec4 tile[CW * CH];
+
+vec4 load(ivec2 p) {
+    p = clamp(p, ivec2(0), dims - 1);
+    int base = (p.y * dims.x + p.x) * CHANNELS;
+    vec4 v = vec4(0.0);
+    for (int c = 0; c < CHANNELS; c++) {
+        v[c] = InData[base + c];
+    }
+    return v;
+}
+
+void load_tile() {
+    ivec2 origin = ivec2(gl_WorkGroupID.xy * gl_WorkGroupSize.xy) - ivec2(RX, RY);
+    for (int i = int(gl_LocalInvocationIndex); i < CW * CH; i += LOCAL_SIZE_X * LOCAL_SIZE_Y) {
+        tile[i] = load(origin + ivec2(i % CW, i / CW));
+    }
+    barrier();
+}
+
+vec4 at(int dx, int dy) {
+    ivec2 l = ivec2(gl_LocalInvocationID.xy) + ivec2(RX + dx, RY + dy);
+    return tile[l.y * CW + l.x];
+}
+
+void store(vec4 v, int channels) {
+    ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+    int base = (p.y * dims.x + p.x) * channels;
+    for (int c = 0; c < channels; c++) {
+        OutData[base + c] = v[c];
+    }
+}
+)";
+
+static const char* convolution_src = R"(
+uniform float weights[(2 * RX + 1) * (2 * RY + 1)];
+
+void main() {
+    // Every invocation helps load the tile, so the guard has to come after the barrier
+    load_tile();
+    KOMPUTE_GUARD();
+
+    vec4 acc = vec4(0.0);
+    for (int dy = -RY; dy <= RY; dy++) {
+        for (int dx = -RX; dx <= RX; dx++) {
+            acc += at(dx, dy) * weights[(dy + RY) * (2 * RX + 1) + dx + RX];
+        }
+    }
+    store(acc, CHANNELS);
+}
+)";
+
+static const char* sobel_src = R"(
+float intensity(vec4 c) {
+    return CHANNELS >= 3 ? dot(c.xyz, vec3(0.299, 0.587, 0.114)) : c.x;
+}
+
+void main() {
+    load_tile();
+    KOMPUTE_GUARD();
+
+    float tl = intensity(at(-1, -1)), t = intensity(at(0, -1)), tr = intensity(at(1, -1));
+    float l = intensity(at(-1, 0)), r = intensity(at(1, 0));
+    float bl = intensity(at(-1, 1)), b = intensity(at(0, 1)), br = intensity(at(1, 1));
+
+    float gx = (tr + 2.0 * r + br) - (tl + 2.0 * l + bl);
+    float gy = (bl + 2.0 * b + br) - (tl + 2.0 * t + tr);
+    store(vec4(length(vec2(gx, gy))), 1);
+}
+)";
+
+static void check_channels(int channels) {
+    if (channels < 1 || channels > 4) {
+        throw std::runtime_error("Stencils support 1 to 4 channels");
+    }
+}
+
+static std::vector<float> gaussian_weights(int radius, float sigma) {
+    if (sigma <= 0) {
+        sigma = 0.3f * (radius - 1) + 0.8f;
+    }
+    std::vector<float> w(2 * radius + 1);
+    float sum = 0;
+    for (int i = -radius; i <= radius; i++) {
+        w[i + radius] = std::exp(-(i * i) / (2 * sigma * sigma));
+        sum += w[i + radius];
+    }
+    for (auto& v : w) {
+        v /= sum;
+    }
+    return w;
+}
+
+void Stencil::add_pass(const char* body, int rx, int ry, const std::vector<float>& weights) {
+    Defines defines = {
+        { "LOCAL_SIZE_X", "16" },
+        { "LOCAL_SIZE_Y", "16" },
+        { "RX", std::to_string(rx) },
+        { "RY", std::to_string(ry) },
+        { "CHANNELS", std::to_string(in_channels) },
+    };
+    Pass pass;
+    pass.kernel = std::make_unique<KomputeKernel>(std::string(tile_src) + body, defines);
+    pass.kernel->name = "stencil_" + std::to_string(passes.size());
+    pass.params = std::make_unique<ParamBlock>(*pass.kernel);
+    pass.dims = pass.params->param<ivec2>("dims");
+    if (!weights.empty()) {
+        auto w = pass.params->param<float>("weights");
+        pass.params->set(w, std::span<const float>(weights));
+    }
+    passes.push_back(std::move(pass));
+}
+
+Stencil Stencil::gaussian(int radius, float sigma, int channels) {
+    auto w = gaussian_weights(radius, sigma);
+    return separable(w, w, channels);
+}
+
+Stencil Stencil::box(int radius, int channels) {
+    std::vector<float> w(2 * radius + 1, 1.0f / (2 * radius + 1));
+    return separable(w, w, channels);
+}
+
+Stencil Stencil::separable(std::vector<float> row, std::vector<float> col, int channels) {
+    check_channels(channels);
+    if (row.size() % 2 == 0 || col.size() % 2 == 0) {
+        throw std::runtime_error("Separable kernels need odd lengths");
+    }
+    int rx = int(row.size() / 2);
+    int ry = int(col.size() / 2);
+    if (rx > max_separable_radius || ry > max_separable_radius) {
+        throw std::runtime_error("Stencil radius too large");
+    }
+    Stencil s(channels, channels);
+    s.add_pass(convolution_src, rx, 0, row);
+    s.add_pass(convolution_src, 0, ry, col);
+    s.scratch = std::make_shared<StorageBuff<float>>();
+    return s;
+}
+
+Stencil Stencil::convolution(int size, std::vector<float> weights, int channels) {
+    check_channels(channels);
+    if (size % 2 == 0 || weights.size() != size_t(size) * size) {
+        throw std::runtime_error("Convolution needs an odd size and size * size weights");
+    }
+    if (size / 2 > max_radius) {
+        throw std::runtime_error("Stencil radius too large");
+    }
+    Stencil s(channels, channels);
+    s.add_pass(convolution_src, size / 2, size / 2, weights);
+    return s;
+}
+
+Stencil Stencil::sobel(int channels) {
+    check_channels(channels);
+    Stencil s(channels, 1);
+    s.add_pass(sobel_src, 1, 1, {});
+    return s;
+}
+
+void Stencil::record(
+    CommandList& list, const std::shared_ptr<Buff>& src, const std::shared_ptr<Buff>& dst,
+    int width, int height
+) {
+    for (auto& pass : passes) {
+        pass.params->set(pass.dims, { width, height });
+    }
+    if (passes.size() == 1) {
+        const std::array<std::shared_ptr<Buff>, 2> buffers = { src, dst };
+        list.dispatch_threads(*passes[0].kernel, *passes[0].params, buffers, width, height);
+        return;
+    }
+
+    scratch->set_size(size_t(width) * height * in_channels * sizeof(float));
+    const std::array<std::shared_ptr<Buff>, 2> first = { src, scratch };
+    const std::array<std::shared_ptr<Buff>, 2> second = { scratch, dst };
+    list.dispatch_threads(*passes[0].kernel, *passes[0].params, first, width, height);
+    list.dispatch_threads(*passes[1].kernel, *passes[1].params, second, width, height);
+}
+
+void Stencil::run(
+    Kompute& k, const std::shared_ptr<Buff>& src, const std::shared_ptr<Buff>& dst, int width,
+    int height
+) {
+    list.clear();
+    record(list, src, dst, width, height);
+    k.submit(list);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "kompute.hpp"
+
+#include <memory>
+#include <vector>
+
+// Tiled stencil filters over float images with 1-4 interleaved channels. Each workgroup loads
+// its tile plus the filter's halo into shared memory once; separable filters run as a
+// horizontal and a vertical pass through an internal scratch buffer. Borders are replicated,
+// like OpenCV's BORDER_REPLICATE.
+//
+//     auto blur = Stencil::gaussian(2, 1.0f, 3);
+//     blur.run(k, in, out, width, height);
+class Stencil {
+public:
+    // Largest supported radius: 8 for full 2D kernels, 16 per pass for separable ones.
+    static constexpr int max_radius = 8;
+    static constexpr int max_separable_radius = 16;
+
+    // sigma <= 0 picks OpenCV's default for the kernel size: 0.3 * (radius - 1) + 0.8
+    static Stencil gaussian(int radius, float sigma = 0, int channels = 1);
+    static Stencil box(int radius, int channels = 1);
+    // Row and column kernels must have odd lengths
+    static Stencil separable(std::vector<float> row, std::vector<float> col, int channels = 1);
+    // Generic size x size kernel in row-major order; size must be odd
+    static Stencil convolution(int size, std::vector<float> weights, int channels = 1);
+    // Sobel gradient magnitude; the output has one channel. Multi-channel inputs are reduced to
+    // intensity with the same weights as features.glsl.
+    static Stencil sobel(int channels = 1);
+
+    Stencil(Stencil&&) = default;
+
+    int channels() const {
+        return in_channels;
+    }
+
+    int out_channels() const {
+        return result_channels;
+    }
+
+    // Records the filter's passes. src and dst hold width * height pixels.
+    void record(
+        CommandList& list, const std::shared_ptr<Buff>& src, const std::shared_ptr<Buff>& dst,
+        int width, int height
+    );
+    void run(
+        Kompute& k, const std::shared_ptr<Buff>& src, const std::shared_ptr<Buff>& dst, int width,
+        int height
+    );
+
+private:
+    struct Pass {
+        std::unique_ptr<KomputeKernel> kernel;
+        std::unique_ptr<ParamBlock> params;
+        Param<ivec2> dims;
+    };
+
+    Stencil(int channels, int result_channels)
+        : in_channels(channels), result_channels(result_channels) {}
+
+    void add_pass(const char* body, int rx, int ry, const std::vector<float>& weights);
+
+    int in_channels;
+    int result_channels;
+    std::vector<Pass> passes;
+    std::shared_ptr<StorageBuff<float>> scratch;
+    CommandList list;
+};
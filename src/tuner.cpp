@@ -0,0 +1,163 @@
+#include "tuner.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+
+static std::string key(const std::string& name, uvec3 v) {
+    return name + " " + std::to_string(v[0]) + " " + std::to_string(v[1]) + " " +
+           std::to_string(v[2]);
+}
+
+KernelTuner::KernelTuner(std::filesystem::path db, ProgramCache* cache)
+    : db(std::move(db)), cache(cache) {
+    if (this->db.empty()) {
+        return;
+    }
+    // One choice per line: name w h d lx ly lz
+    std::ifstream file(this->db);
+    std::string name;
+    uvec3 threads, local;
+    while (file >> name >> threads[0] >> threads[1] >> threads[2] >> local[0] >> local[1] >>
+           local[2])
+    {
+        choices[key(name, threads)] = local;
+    }
+}
+
+std::vector<uvec3> KernelTuner::candidates(uvec3 threads) const {
+    GLint max_invocations = 0;
+    GLint max_size[3];
+    glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &max_invocations);
+    for (GLuint i = 0; i < 3; i++) {
+        glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, i, &max_size[i]);
+    }
+
+    std::vector<uvec3> all;
+    if (threads[1] == 1 && threads[2] == 1) {
+        for (uint32_t x : { 32, 64, 128, 256, 512, 1024 }) {
+            all.push_back({ x, 1, 1 });
+        }
+    } else {
+        for (uvec2 xy : std::initializer_list<uvec2>{
+                 { 8, 4 }, { 8, 8 }, { 16, 4 }, { 16, 8 }, { 16, 16 }, { 32, 4 }, { 32, 8 },
+                 { 32, 16 }, { 64, 2 }, { 64, 4 }, { 128, 1 }, { 256, 1 } })
+        {
+            all.push_back({ xy[0], xy[1], 1 });
+        }
+    }
+
+    std::vector<uvec3> out;
+    for (auto& c : all) {
+        if (c[0] * c[1] * c[2] <= uint32_t(max_invocations) && c[0] <= uint32_t(max_size[0]) &&
+            c[1] <= uint32_t(max_size[1]) && c[2] <= uint32_t(max_size[2]))
+        {
+            out.push_back(c);
+        }
+    }
+    return out;
+}
+
+KomputeKernel& KernelTuner::variant(
+    const std::string& name, const std::string& src, const Defines& defines, uvec3 local
+) {
+    auto& kernel = variants[key(name, local)];
+    if (!kernel) {
+        Defines all = defines;
+        all.push_back({ "LOCAL_SIZE_X", std::to_string(local[0]) });
+        all.push_back({ "LOCAL_SIZE_Y", std::to_string(local[1]) });
+        all.push_back({ "LOCAL_SIZE_Z", std::to_string(local[2]) });
+        kernel = std::make_unique<KomputeKernel>(src, all, cache);
+        kernel->name = name;
+    }
+    return *kernel;
+}
+
+double KernelTuner::time(KomputeKernel& kernel, const Run& run) {
+    // Warm-up, so first-use costs in the driver don't count
+    run(kernel);
+    glFinish();
+
+    // Wall clock around glFinish rather than timer queries: software rasterizers such as
+    // llvmpipe don't report compute work in GL_TIME_ELAPSED.
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < repeats; i++) {
+        auto tp = std::chrono::steady_clock::now();
+        run(kernel);
+        glFinish();
+        auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - tp);
+        best = std::min(best, ns.count());
+    }
+    GL_CHECK_ERROR();
+    return best;
+}
+
+KomputeKernel& KernelTuner::kernel(
+    const std::string& name, const std::string& src, uvec3 threads, const Run& run,
+    const Defines& defines
+) {
+    auto it = choices.find(key(name, threads));
+    if (it != choices.end()) {
+        return variant(name, src, defines, it->second);
+    }
+
+    uvec3 best_local = { 1, 1, 1 };
+    double best = std::numeric_limits<double>::max();
+    for (auto& local : candidates(threads)) {
+        double ns = time(variant(name, src, defines, local), run);
+        if (ns < best) {
+            best = ns;
+            best_local = local;
+        }
+    }
+    std::cout << "Tuned " << name << " for " << threads[0] << "x" << threads[1] << "x"
+              << threads[2] << ": " << best_local[0] << "x" << best_local[1] << "x"
+              << best_local[2] << " (" << best / 1e6 << " ms)" << std::endl;
+
+    choices[key(name, threads)] = best_local;
+    save();
+    // Drop the losers, but keep variants chosen for other sizes: callers hold references to them
+    auto chosen = [&](const std::string& variant) {
+        for (auto& [k, local] : choices) {
+            if (k.starts_with(name + " ") && key(name, local) == variant) {
+                return true;
+            }
+        }
+        return false;
+    };
+    for (auto v = variants.begin(); v != variants.end();) {
+        if (v->first.starts_with(name + " ") && !chosen(v->first)) {
+            v = variants.erase(v);
+        } else {
+            ++v;
+        }
+    }
+    return variant(name, src, defines, best_local);
+}
+
+KomputeKernel& KernelTuner::kernel(
+    const std::string& name, const std::filesystem::path& path, uvec3 threads, const Run& run,
+    const Defines& defines
+) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Cannot open " + path.string());
+    }
+    std::stringstream ss;
+    ss << file.rdbuf();
+    return kernel(name, ss.str(), threads, run, defines);
+}
+
+void KernelTuner::save() const {
+    if (db.empty()) {
+        return;
+    }
+    std::ofstream file(db, std::ios::trunc);
+    for (auto& [k, local] : choices) {
+        file << k << " " << local[0] << " " << local[1] << " " << local[2] << "\n";
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "kompute.hpp"
+
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Picks the workgroup size of a kernel per problem size by timing candidate variants, compiled
+// from the same source with LOCAL_SIZE_X/Y/Z defines. Choices are remembered in memory and, if a
+// path is given, in a small text file so later runs skip the tuning.
+class KernelTuner {
+public:
+    // Dispatches the given variant once with real inputs; the tuner times it.
+    using Run = std::function<void(KomputeKernel&)>;
+
+    explicit KernelTuner(std::filesystem::path db = {}, ProgramCache* cache = nullptr);
+    KernelTuner(const KernelTuner&) = delete;
+
+    // Returns the fastest variant of `src` for `threads` invocations, tuning on first use.
+    // `name` identifies the kernel in the database and must not contain spaces.
+    KomputeKernel& kernel(
+        const std::string& name, const std::string& src, uvec3 threads, const Run& run,
+        const Defines& defines = {}
+    );
+    KomputeKernel& kernel(
+        const std::string& name, const std::filesystem::path& path, uvec3 threads, const Run& run,
+        const Defines& defines = {}
+    );
+
+    // Candidate local sizes for a problem shape, limited by the device.
+    std::vector<uvec3> candidates(uvec3 threads) const;
+
+    int repeats = 5;
+
+private:
+    std::filesystem::path db;
+    ProgramCache* cache;
+    std::map<std::string, uvec3> choices;
+    std::map<std::string, std::unique_ptr<KomputeKernel>> variants;
+
+    KomputeKernel& variant(
+        const std::string& name, const std::string& src, const Defines& defines, uvec3 local
+    );
+    double time(KomputeKernel& kernel, const Run& run);
+    void save() const;
+};
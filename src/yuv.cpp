@@ -0,0 +1,155 @@
+#include "yuv.hpp"
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+static const char* yuv_src = R"(#version 430 core
+
+layout (local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y, local_size_z = 1) in;
+
+// Y, then U and V (or interleaved UV for NV12), wherever offsets and strides say
+layout(binding = 0) readonly buffer Planes {
+    uint PlaneData[];
+};
+
+layout(binding = 1) writeonly buffer Out {
+    float OutData[];
+};
+
+uniform ivec2 dims;
+uniform ivec2 chroma_dims;
+// Byte offset and row stride of each plane
+uniform ivec3 offsets;
+uniform ivec3 strides;
+
+uint byte_at(int offset) {
+    return (PlaneData[offset >> 2] >> ((offset & 3) << 3)) & 0xffu;
+}
+
+vec2 chroma(ivec2 c) {
+    c = clamp(c, ivec2(0), chroma_dims - 1);
+#if NV12
+    int o = offsets.y + c.y * strides.y + c.x * 2;
+    return vec2(byte_at(o), byte_at(o + 1));
+#else
+    return vec2(byte_at(offsets.y + c.y * strides.y + c.x),
+                byte_at(offsets.z + c.y * strides.z + c.x));
+#endif
+}
+
+void main() {
+    KOMPUTE_GUARD();
+    const ivec2 Coord = ivec2(gl_GlobalInvocationID.xy);
+
+    float y = float(byte_at(offsets.x + Coord.y * strides.x + Coord.x));
+
+    // MPEG-2 siting: chroma is co-sited horizontally and centred between rows vertically
+    vec2 c = vec2(Coord) * 0.5 - vec2(0.0, 0.25);
+    ivec2 c0 = ivec2(floor(c));
+    vec2 f = c - vec2(c0);
+    vec2 uv = mix(mix(chroma(c0), chroma(c0 + ivec2(1, 0)), f.x),
+                  mix(chroma(c0 + ivec2(0, 1)), chroma(c0 + ivec2(1, 1)), f.x), f.y);
+    uv -= 128.0;
+
+#if FULL_RANGE
+    vec3 bgr = vec3(y + 1.772 * uv.x,
+                    y - 0.344136 * uv.x - 0.714136 * uv.y,
+                    y + 1.402 * uv.y);
+#else
+    y = (y - 16.0) * 1.164383;
+    vec3 bgr = vec3(y + 2.017232 * uv.x,
+                    y - 0.391762 * uv.x - 0.812968 * uv.y,
+                    y + 1.596027 * uv.y);
+#endif
+    bgr = clamp(bgr / 255.0, 0.0, 1.0);
+
+    int o = (Coord.y * dims.x + Coord.x) * 3;
+    OutData[o] = bgr.x;
+    OutData[o + 1] = bgr.y;
+    OutData[o + 2] = bgr.z;
+}
+)";
+
+YuvConverter::YuvConverter(int width, int height, PixelFormat format, ProgramCache* cache)
+    : width(width), height(height), format(format) {
+    if (format == PixelFormat::BGR || format == PixelFormat::BGR8) {
+        throw std::runtime_error("YuvConverter needs a YUV format");
+    }
+    chroma_width = (width + 1) / 2;
+    chroma_height = (height + 1) / 2;
+    size = size_t(width) * height + size_t(chroma_width) * chroma_height * 2;
+
+    planes = std::make_shared<RingBuff<uint8_t>>();
+    input = std::make_shared<Buff>();
+    kernel = std::make_unique<KomputeKernel>(
+        std::string(yuv_src),
+        Defines{
+            { "LOCAL_SIZE_X", "16" },
+            { "LOCAL_SIZE_Y", "16" },
+            { "NV12", format == PixelFormat::NV12 ? "1" : "0" },
+            { "FULL_RANGE", format == PixelFormat::YUVJ420P ? "1" : "0" },
+        },
+        cache
+    );
+    kernel->name = "yuv";
+    params = std::make_unique<ParamBlock>(*kernel);
+    params->set(params->param<ivec2>("dims"), { width, height });
+    params->set(params->param<ivec2>("chroma_dims"), { chroma_width, chroma_height });
+    offsets = params->param<ivec3>("offsets");
+    strides = params->param<ivec3>("strides");
+}
+
+static void copy_plane(uint8_t* dst, const uint8_t* src, int linesize, int row, int rows) {
+    if (linesize == row) {
+        std::memcpy(dst, src, size_t(row) * rows);
+        return;
+    }
+    for (int y = 0; y < rows; y++) {
+        std::memcpy(dst + size_t(y) * row, src + size_t(y) * linesize, row);
+    }
+}
+
+void YuvConverter::upload(const uint8_t* const src[], const int linesize[]) {
+    // The shader reads whole uints
+    auto dst = planes->next((size + 3) & ~size_t(3)).data();
+    *input = *planes;
+    const int luma = width * height;
+    if (format == PixelFormat::NV12) {
+        params->set(offsets, { 0, luma, 0 });
+        params->set(strides, { width, chroma_width * 2, 0 });
+    } else {
+        params->set(offsets, { 0, luma, luma + chroma_width * chroma_height });
+        params->set(strides, { width, chroma_width, chroma_width });
+    }
+
+    copy_plane(dst, src[0], linesize[0], width, height);
+    dst += size_t(width) * height;
+    if (format == PixelFormat::NV12) {
+        copy_plane(dst, src[1], linesize[1], chroma_width * 2, chroma_height);
+    } else {
+        copy_plane(dst, src[1], linesize[1], chroma_width, chroma_height);
+        dst += size_t(chroma_width) * chroma_height;
+        copy_plane(dst, src[2], linesize[2], chroma_width, chroma_height);
+    }
+}
+
+void YuvConverter::attach(
+    const Buff& buffer, const uint8_t* base, const uint8_t* const src[], const int linesize[]
+) {
+    *input = buffer;
+    const int planes = format == PixelFormat::NV12 ? 2 : 3;
+    ivec3 offset = { 0, 0, 0 };
+    ivec3 stride = { 0, 0, 0 };
+    for (int i = 0; i < planes; i++) {
+        offset[i] = int(src[i] - base);
+        stride[i] = linesize[i];
+    }
+    params->set(offsets, offset);
+    params->set(strides, stride);
+}
+
+void YuvConverter::record(CommandList& list, const std::shared_ptr<Buff>& dst) {
+    const std::array<std::shared_ptr<Buff>, 2> buffers = { input, dst };
+    list.dispatch_threads(*kernel, *params, buffers, width, height);
+}
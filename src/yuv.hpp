@@ -0,0 +1,62 @@
+#pragma once
+
+#include "kompute.hpp"
+
+#include <cstdint>
+#include <memory>
+
+enum class PixelFormat {
+    // width * height * 3 floats in [0, 1], BGR order
+    BGR,
+    // width * height * 3 bytes, BGR order (CV_8UC3), unpacked on the GPU
+    BGR8,
+    // 8-bit planar 4:2:0, limited range (AV_PIX_FMT_YUV420P)
+    YUV420P,
+    // 8-bit planar 4:2:0, full range (AV_PIX_FMT_YUVJ420P)
+    YUVJ420P,
+    // 8-bit Y plane plus interleaved UV plane, limited range (AV_PIX_FMT_NV12)
+    NV12,
+};
+
+// Uploads the raw planes of a decoded 4:2:0 frame (1.5 bytes per pixel) and converts them on
+// the GPU to the BGR float layout the rest of the pipeline uses (12 bytes per pixel). Colours
+// follow BT.601, like swscale's default; chroma is sampled bilinearly at MPEG-2 siting.
+class YuvConverter {
+public:
+    YuvConverter(int width, int height, PixelFormat format, ProgramCache* cache = nullptr);
+    YuvConverter(const YuvConverter&) = delete;
+
+    // Copies the planes, given as in AVFrame::data / AVFrame::linesize, into the next upload slot.
+    void upload(const uint8_t* const planes[], const int linesize[]);
+    // Reads the next frame in place instead: the planes already live in `buffer`, whose mapping
+    // starts at `base` (e.g. a StagingPool block). Positive linesizes only.
+    void attach(
+        const Buff& buffer, const uint8_t* base, const uint8_t* const planes[],
+        const int linesize[]
+    );
+
+    // Records the conversion of the last uploaded or attached frame into dst (width * height * 3
+    // floats).
+    void record(CommandList& list, const std::shared_ptr<Buff>& dst);
+
+    // Bytes uploaded per frame
+    size_t frame_size() const {
+        return size;
+    }
+
+    const int width;
+    const int height;
+    const PixelFormat format;
+
+private:
+    int chroma_width;
+    int chroma_height;
+    size_t size;
+    std::shared_ptr<RingBuff<uint8_t>> planes;
+    // What the recorded dispatch reads: the current ring slot or an attached buffer
+    std::shared_ptr<Buff> input;
+    std::unique_ptr<KomputeKernel> kernel;
+    std::unique_ptr<ParamBlock> params;
+    Param<ivec3> offsets;
+    Param<ivec3> strides;
+};
@@ -0,0 +1,144 @@
+#version 430 core
+
+// Dirty tiles of a frame, for MotionDetector to run features.glsl and motion.glsl only where the
+// input changed. TILE x TILE pixels per tile, TILES_X x TILES_Y tiles.
+//   PASS 0, a workgroup per tile and an invocation per row: hash the tile's pixels and compare
+//           with the previous frame's
+//   PASS 1, an invocation per tile: list the tiles next to a change in this or the last frame
+//   PASS 2, an invocation per tile: list the tiles within `margin` pixels of motion found at
+//           pyramid level LEVEL, for coarse-to-fine detection
+
+layout (local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y, local_size_z = 1) in;
+
+#ifndef IN_ELEM
+#define IN_ELEM float
+#define IN_LOAD(b, i) (b)[i]
+#endif
+
+#if PASS == 2
+// The coarse motion mask, as floats
+layout(binding = 0) readonly buffer Coarse {
+    float CoarseMask[];
+};
+
+#define TILES_BINDING 1
+#else
+layout(binding = 0) readonly buffer In {
+    IN_ELEM InData[];
+};
+
+// Two words per tile: the sum of its pixels' hashes, two ways
+layout(binding = 1) buffer Signatures {
+    uint Signature[];
+};
+
+// Per tile, bit 0: changed in this frame, bit 1: changed in the last one
+layout(binding = 2) buffer Changes {
+    uint Changed[];
+};
+
+#define TILES_BINDING 3
+#endif
+
+// Indirect dispatch arguments (tile count, 1, 1), then the tile indices
+layout(binding = TILES_BINDING) buffer Tiles {
+    uint Args[3];
+    uint Tile[];
+};
+
+uniform ivec3 dims;
+// Nonzero on the first frame: every tile counts as changed
+uniform int reset;
+// Size of the coarse level, and how far from its motion tiles are listed, in full-size pixels
+uniform ivec2 coarse_dims;
+uniform int margin;
+
+#if PASS == 0
+
+// One row of the tile per invocation
+shared uvec2 rows[TILE];
+
+uint mix(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+void main() {
+    const uint tile = gl_WorkGroupID.y * TILES_X + gl_WorkGroupID.x;
+    const uint row = gl_LocalInvocationID.x;
+    const ivec2 start = ivec2(gl_WorkGroupID.xy) * TILE + ivec2(0, row);
+
+    // Salted with the position, so that pixels trading places change the sum
+    uvec2 sum = uvec2(0u);
+    if (start.y < dims.y) {
+        for (int x = start.x; x < min(start.x + TILE, dims.x); x++) {
+            const int p = (start.y * dims.x + x) * dims.z;
+            uint h = mix(uint(p));
+            for (int c = 0; c < dims.z; c++) {
+                h = mix(h ^ floatBitsToUint(IN_LOAD(InData, p + c)));
+            }
+            sum += uvec2(h, mix(h ^ 0x9e3779b9u));
+        }
+    }
+    rows[row] = sum;
+    barrier();
+
+    if (row == 0u) {
+        for (uint r = 1u; r < TILE; r++) {
+            sum += rows[r];
+        }
+        const uvec2 last = uvec2(Signature[2u * tile], Signature[2u * tile + 1u]);
+        const bool changed = reset != 0 || sum != last;
+        Signature[2u * tile] = sum.x;
+        Signature[2u * tile + 1u] = sum.y;
+        Changed[tile] = reset != 0 ? 3u : ((Changed[tile] << 1) & 2u) | uint(changed);
+    }
+}
+
+#elif PASS == 1
+
+// features.glsl reads a pixel's neighbours, so a change reaches one pixel into the next tile.
+// Tiles stay listed for a frame after their last change, which rewrites their mask to zero.
+void main() {
+    KOMPUTE_GUARD();
+    const ivec2 Coord = ivec2(gl_GlobalInvocationID.xy);
+
+    bool dirty = false;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            const ivec2 n = Coord + ivec2(dx, dy);
+            if (all(greaterThanEqual(n, ivec2(0))) && all(lessThan(n, ivec2(TILES_X, TILES_Y)))) {
+                dirty = dirty || Changed[n.y * TILES_X + n.x] != 0u;
+            }
+        }
+    }
+    if (dirty) {
+        Tile[atomicAdd(Args[0], 1u)] = uint(Coord.y * TILES_X + Coord.x);
+    }
+}
+
+#elif PASS == 2
+
+void main() {
+    KOMPUTE_GUARD();
+    const ivec2 Coord = ivec2(gl_GlobalInvocationID.xy);
+
+    // The coarse pixels covering the tile and its margin
+    const ivec2 lo = max((Coord * TILE - margin) >> LEVEL, ivec2(0));
+    const ivec2 hi = min(((Coord + 1) * TILE - 1 + margin) >> LEVEL, coarse_dims - 1);
+    bool moving = false;
+    for (int y = lo.y; y <= hi.y && !moving; y++) {
+        for (int x = lo.x; x <= hi.x && !moving; x++) {
+            moving = CoarseMask[y * coarse_dims.x + x] > 0.0;
+        }
+    }
+    if (moving) {
+        Tile[atomicAdd(Args[0], 1u)] = uint(Coord.y * TILES_X + Coord.x);
+    }
+}
+
+#endif